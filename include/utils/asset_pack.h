@@ -0,0 +1,499 @@
+/*
+Asset pack
+- a single archive file containing the assets of the application (models, textures, baked data, ...)
+- the archive is memory-mapped: reading an asset does not require to open a file, and uncompressed assets
+  are read directly from the mapped memory, without copies
+
+File format:
+- header (padded to 4 KB)
+- data of the entries: each entry starts at a multiple of 4 KB (the page size), and it is stored uncompressed,
+  or compressed with a LZ4-style compressor (only if the compression saves at least 10% of the size:
+  images like JPG and PNG are already compressed, while e.g. OBJ models are text files, which compress very well)
+- table of contents: fixed-size entries, sorted by name, so an entry is found with a binary search directly in the mapped memory
+- names of the entries (paths relative to the root folder of the assets, e.g. "models/saturn.obj")
+
+N.B. 1)
+The compressed format follows the LZ4 block format: a sequence of literals and matches with 16 bit offsets.
+The compressor uses a simple greedy strategy (hash table of 4-byte sequences): it is not as fast as the original LZ4,
+but decompression is equally simple and fast, and packs are built offline.
+
+N.B. 2)
+For each entry, we store also the last modification time of the source file: in this way, the caches
+validated using size and modification time of the sources (see mesh_cache.h and texture_baker.h) remain valid
+when the assets are read from the pack.
+
+N.B. 3) the file format is not portable between architectures with different endianness
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// messages on the console (see logger.h)
+#include <utils/logger.h>
+
+// memory mapping of files: Win32 API on Windows, POSIX mmap on the other platforms
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+// identifier and version of the pack file format
+const char ASSET_PACK_MAGIC[8] = { 'R', 'T', 'G', 'P', 'P', 'A', 'C', 'K' };
+const uint32_t ASSET_PACK_VERSION = 1;
+// alignment of the entries (and size of the header)
+const uint64_t ASSET_PACK_ALIGNMENT = 4096;
+// flags of the entries
+const uint32_t ASSET_PACK_COMPRESSED = 1;
+
+// header of the pack file
+struct AssetPackHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numEntries;
+    // offset of the table of contents, and of the names of the entries
+    uint64_t tocOffset;
+    uint64_t namesOffset;
+};
+
+// an entry of the table of contents
+struct AssetPackEntry
+{
+    // offset of the data, size of the asset, and size of the stored (compressed) data
+    uint64_t offset;
+    uint64_t size;
+    uint64_t storedSize;
+    // last modification time of the source file
+    int64_t sourceTime;
+    // name (offset from namesOffset, and length)
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t flags;
+    uint32_t padding;
+};
+
+// the content of an asset in memory
+// data points to the mapped memory of a pack (for uncompressed entries), or to the storage vector
+struct AssetData
+{
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    vector<unsigned char> storage;
+
+    // we copy the content of a buffer in the storage
+    void Assign(vector<unsigned char>&& buffer)
+    {
+        this->storage = std::move(buffer);
+        this->data = this->storage.data();
+        this->size = this->storage.size();
+    }
+};
+
+//////////////////////////////////////////
+// LZ4-style compression of a memory block (see N.B. 1)
+inline void CompressLZ(const unsigned char* src, size_t size, vector<unsigned char>& dst)
+{
+    dst.clear();
+    dst.reserve(size + size / 255 + 16);
+
+    // we write a length in the "token + 255 255 ... n" encoding
+    auto writeLength = [&dst](size_t length)
+    {
+        for (; length >= 255; length -= 255)
+            dst.push_back(255);
+        dst.push_back((unsigned char)length);
+    };
+    auto read32 = [src](size_t i) { uint32_t v; memcpy(&v, src + i, 4); return v; };
+
+    const int HASH_BITS = 16;
+    vector<int64_t> table((size_t)1 << HASH_BITS, -1);
+    size_t anchor = 0, i = 0;
+    // the last match must start at least 12 bytes before the end, and the last 5 bytes are always literals
+    const size_t matchStartLimit = (size > 12) ? size - 12 : 0;
+    const size_t matchEndLimit = (size > 5) ? size - 5 : 0;
+    while (i < matchStartLimit)
+    {
+        uint32_t sequence = read32(i);
+        size_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+        int64_t candidate = table[hash];
+        table[hash] = (int64_t)i;
+        if (candidate < 0 || i - (size_t)candidate > 65535 || read32((size_t)candidate) != sequence)
+        {
+            i++;
+            continue;
+        }
+
+        size_t length = 4;
+        while (i + length < matchEndLimit && src[candidate + length] == src[i + length])
+            length++;
+
+        // sequence: token (literals length, match length - 4), literals, offset, match length
+        size_t literals = i - anchor;
+        dst.push_back((unsigned char)((min(literals, (size_t)15) << 4) | min(length - 4, (size_t)15)));
+        if (literals >= 15)
+            writeLength(literals - 15);
+        dst.insert(dst.end(), src + anchor, src + i);
+        uint16_t offset = (uint16_t)(i - (size_t)candidate);
+        dst.push_back((unsigned char)(offset & 0xFF));
+        dst.push_back((unsigned char)(offset >> 8));
+        if (length - 4 >= 15)
+            writeLength(length - 4 - 15);
+
+        i += length;
+        anchor = i;
+    }
+
+    // last literals
+    size_t literals = size - anchor;
+    dst.push_back((unsigned char)(min(literals, (size_t)15) << 4));
+    if (literals >= 15)
+        writeLength(literals - 15);
+    dst.insert(dst.end(), src + anchor, src + size);
+}
+
+//////////////////////////////////////////
+// decompression of a block compressed with CompressLZ. It returns false if the data are corrupted
+inline bool DecompressLZ(const unsigned char* src, size_t srcSize, unsigned char* dst, size_t dstSize)
+{
+    size_t in = 0, out = 0;
+    auto readLength = [&](size_t length) -> size_t
+    {
+        if (length == 15)
+        {
+            unsigned char b;
+            do
+            {
+                if (in >= srcSize)
+                    return SIZE_MAX;
+                b = src[in++];
+                length += b;
+            } while (b == 255);
+        }
+        return length;
+    };
+
+    while (in < srcSize)
+    {
+        unsigned char token = src[in++];
+        size_t literals = readLength(token >> 4);
+        if (literals == SIZE_MAX || in + literals > srcSize || out + literals > dstSize)
+            return false;
+        memcpy(dst + out, src + in, literals);
+        in += literals;
+        out += literals;
+        // the last sequence has only literals
+        if (in == srcSize)
+            break;
+
+        if (in + 2 > srcSize)
+            return false;
+        size_t offset = src[in] | (src[in + 1] << 8);
+        in += 2;
+        size_t length = readLength(token & 15);
+        if (length == SIZE_MAX || offset == 0 || offset > out || out + length + 4 > dstSize)
+            return false;
+        length += 4;
+        // the match can overlap the output (e.g., repeated patterns): we copy byte by byte
+        for (size_t k = 0; k < length; k++, out++)
+            dst[out] = dst[out - offset];
+    }
+    return out == dstSize;
+}
+
+/////////////////// MAPPEDFILE class ///////////////////////
+// read-only memory mapping of a file. It is a "move-only" class, responsible of the mapping
+class MappedFile
+{
+public:
+
+    MappedFile() = default;
+    MappedFile(const MappedFile& copy) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& move) noexcept
+    {
+        *this = std::move(move);
+    }
+
+    MappedFile& operator=(MappedFile&& move) noexcept
+    {
+        this->Close();
+        swap(this->data, move.data);
+        swap(this->size, move.size);
+#ifdef _WIN32
+        swap(this->file, move.file);
+        swap(this->mapping, move.mapping);
+#endif
+        return *this;
+    }
+
+    ~MappedFile()
+    {
+        this->Close();
+    }
+
+    //////////////////////////////////////////
+
+    // we map the whole file in memory. It returns false in case of errors
+    bool Open(const string& path)
+    {
+        this->Close();
+#ifdef _WIN32
+        this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (this->file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(this->file, &fileSize);
+        this->size = (size_t)fileSize.QuadPart;
+        this->mapping = CreateFileMappingA(this->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (this->mapping)
+            this->data = (const unsigned char*)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            this->size = (size_t)info.st_size;
+            void* mapped = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            this->data = (mapped == MAP_FAILED) ? nullptr : (const unsigned char*)mapped;
+        }
+        // the mapping remains valid after closing the file descriptor
+        close(fd);
+#endif
+        if (!this->data)
+        {
+            this->Close();
+            return false;
+        }
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (this->data)
+            UnmapViewOfFile(this->data);
+        if (this->mapping)
+            CloseHandle(this->mapping);
+        if (this->file != INVALID_HANDLE_VALUE)
+            CloseHandle(this->file);
+        this->mapping = nullptr;
+        this->file = INVALID_HANDLE_VALUE;
+#else
+        if (this->data)
+            munmap((void*)this->data, this->size);
+#endif
+        this->data = nullptr;
+        this->size = 0;
+    }
+
+    //////////////////////////////////////////
+
+    const unsigned char* Data() const { return this->data; }
+    size_t Size() const { return this->size; }
+
+private:
+
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+/////////////////// ASSETPACK class ///////////////////////
+// read access to a pack file. After Open, all the methods can be called by more threads at the same time
+class AssetPack
+{
+public:
+
+    // we map the pack file, and we check header and table of contents. It returns false if the pack is not valid
+    bool Open(const string& path)
+    {
+        if (!this->file.Open(path))
+            return false;
+        const unsigned char* base = this->file.Data();
+        if (this->file.Size() < sizeof(AssetPackHeader))
+            return false;
+        memcpy(&this->header, base, sizeof(this->header));
+        if (memcmp(this->header.magic, ASSET_PACK_MAGIC, sizeof(ASSET_PACK_MAGIC)) != 0 || this->header.version != ASSET_PACK_VERSION ||
+            this->header.tocOffset + (uint64_t)this->header.numEntries * sizeof(AssetPackEntry) > this->header.namesOffset ||
+            this->header.namesOffset > this->file.Size())
+        {
+            LOG_ERROR("ASSET_PACK", "invalid pack file " << path);
+            this->file.Close();
+            return false;
+        }
+        // the entries are aligned to 8 bytes in the file, and the mapping is aligned to the page size: we can use them in place
+        this->entries = (const AssetPackEntry*)(base + this->header.tocOffset);
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+    // we search an entry, using a binary search on the sorted table of contents
+    const AssetPackEntry* Find(const string& name) const
+    {
+        if (!this->entries)
+            return nullptr;
+        const AssetPackEntry* end = this->entries + this->header.numEntries;
+        const AssetPackEntry* entry = lower_bound(this->entries, end, name, [this](const AssetPackEntry& e, const string& n) { return this->Name(e).compare(n) < 0; });
+        return (entry != end && this->Name(*entry) == name) ? entry : nullptr;
+    }
+
+    // name of an entry (it points to the mapped memory)
+    string_view Name(const AssetPackEntry& entry) const
+    {
+        return string_view((const char*)this->file.Data() + this->header.namesOffset + entry.nameOffset, entry.nameLength);
+    }
+
+    //////////////////////////////////////////
+
+    // we read an entry: uncompressed entries point directly to the mapped memory, compressed entries are decompressed in the storage
+    bool Read(const AssetPackEntry& entry, AssetData& asset) const
+    {
+        if (entry.offset + entry.storedSize > this->file.Size())
+            return false;
+        const unsigned char* stored = this->file.Data() + entry.offset;
+        if (!(entry.flags & ASSET_PACK_COMPRESSED))
+        {
+            asset.storage.clear();
+            asset.data = stored;
+            asset.size = (size_t)entry.size;
+            return true;
+        }
+        vector<unsigned char> buffer((size_t)entry.size);
+        if (!DecompressLZ(stored, (size_t)entry.storedSize, buffer.data(), buffer.size()))
+        {
+            LOG_ERROR("ASSET_PACK", "corrupted entry " << this->Name(entry));
+            return false;
+        }
+        asset.Assign(std::move(buffer));
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+    // true if the pack has been opened
+    bool IsOpen() const { return this->entries != nullptr; }
+
+private:
+
+    MappedFile file;
+    AssetPackHeader header = {};
+    const AssetPackEntry* entries = nullptr;
+};
+
+//////////////////////////////////////////
+// we build a pack file: the names of the entries are the paths of the files relative to the root folder
+// It returns false in case of errors (missing files are skipped, with a warning)
+inline bool BuildAssetPack(const string& packPath, const string& root, vector<string> names)
+{
+    sort(names.begin(), names.end());
+    names.erase(unique(names.begin(), names.end()), names.end());
+
+    ofstream pack(packPath, ios::binary | ios::trunc);
+    if (!pack)
+    {
+        LOG_ERROR("ASSET_PACK", "impossible to write " << packPath);
+        return false;
+    }
+    auto padTo = [&pack](uint64_t alignment)
+    {
+        uint64_t position = (uint64_t)pack.tellp();
+        uint64_t padding = (alignment - position % alignment) % alignment;
+        static const char zeros[ASSET_PACK_ALIGNMENT] = {};
+        pack.write(zeros, (streamsize)padding);
+    };
+
+    // the header is written at the end, when the offsets are known
+    pack.write(string(ASSET_PACK_ALIGNMENT, '\0').data(), ASSET_PACK_ALIGNMENT);
+
+    vector<AssetPackEntry> entries;
+    string namesTable;
+    uint64_t totalSize = 0, totalStored = 0;
+    for (const string& name : names)
+    {
+        ifstream source(root + name, ios::binary | ios::ate);
+        if (!source)
+        {
+            LOG_WARNING("ASSET_PACK", "missing file " << root + name);
+            continue;
+        }
+        vector<unsigned char> content((size_t)source.tellg());
+        source.seekg(0);
+        source.read((char*)content.data(), content.size());
+
+        AssetPackEntry entry = {};
+        error_code ec;
+        entry.sourceTime = (int64_t)filesystem::last_write_time(root + name, ec).time_since_epoch().count();
+        entry.size = content.size();
+        entry.nameOffset = (uint32_t)namesTable.size();
+        entry.nameLength = (uint32_t)name.size();
+        namesTable += name;
+
+        // we keep the compressed data only if they save at least 10% of the size
+        vector<unsigned char> compressed;
+        CompressLZ(content.data(), content.size(), compressed);
+        const vector<unsigned char>* stored = &content;
+        if (compressed.size() < content.size() - content.size() / 10)
+        {
+            entry.flags |= ASSET_PACK_COMPRESSED;
+            stored = &compressed;
+        }
+        entry.storedSize = stored->size();
+
+        padTo(ASSET_PACK_ALIGNMENT);
+        entry.offset = (uint64_t)pack.tellp();
+        pack.write((const char*)stored->data(), stored->size());
+        entries.push_back(entry);
+        totalSize += entry.size;
+        totalStored += entry.storedSize;
+    }
+
+    AssetPackHeader header = {};
+    memcpy(header.magic, ASSET_PACK_MAGIC, sizeof(ASSET_PACK_MAGIC));
+    header.version = ASSET_PACK_VERSION;
+    header.numEntries = (uint32_t)entries.size();
+    padTo(sizeof(AssetPackEntry));
+    header.tocOffset = (uint64_t)pack.tellp();
+    pack.write((const char*)entries.data(), entries.size() * sizeof(AssetPackEntry));
+    header.namesOffset = (uint64_t)pack.tellp();
+    pack.write(namesTable.data(), namesTable.size());
+    pack.seekp(0);
+    pack.write((const char*)&header, sizeof(header));
+
+    cout << "Asset pack " << packPath << ": " << entries.size() << " entries, " << totalSize / 1024 << " KB -> " << totalStored / 1024 << " KB" << endl;
+    return (bool)pack;
+}
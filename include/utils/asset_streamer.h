@@ -0,0 +1,521 @@
+/*
+AssetStreamer class
+- asynchronous loading of models and textures using C++20 coroutines: the loading code is written sequentially
+  (e.g., "unique_ptr<Model> model = co_await streamer.LoadModel(path);"), and each co_await moves the coroutine
+  to the thread where the next step must be executed:
+  - co_await ToLoader(): the coroutine continues in the loader thread of the streamer, where files are read and
+    CPU-heavy work is executed (which in turn uses the worker threads, see thread_pool.h)
+  - co_await ToMain(): the coroutine continues in the main thread, inside Update(), where the OpenGL context is current
+  - co_await LoadTexture(...): the coroutine continues when the texture has been uploaded by the TextureLoader (see texture_loader.h)
+- StreamedModel and StreamedTexture are handles used by the rendering code: until the asset is resident,
+  they return a placeholder (e.g., a low-resolution sphere, or a 1x1 texture), so the application can draw
+  the first frame without waiting for the loading of the assets
+
+The main thread must call Update() once per frame: it resumes the coroutines waiting for the main thread,
+within a time budget, so the creation of the GPU resources is spread over more frames.
+
+N.B. 1)
+AssetTask is a "lazy" coroutine: it starts when it is awaited by another coroutine, or when it is passed to Spawn().
+Spawn() starts a "root" coroutine, owned by the streamer: it is destroyed when it is completed, or at Shutdown().
+The assets are assigned to the handles in the main thread, so the rendering code does not need synchronization.
+
+N.B. 2)
+Shutdown() must be called before the destruction of the handles and of the TextureLoader: the loader thread is stopped,
+and the coroutines not yet completed are destroyed (their assets are discarded).
+
+N.B. 3) coroutines require C++20 (see the /std:c++20 flag in MakefileWin)
+
+N.B. 4) the class is "non-copyable" and "non-movable": the loader thread and the suspended coroutines keep pointers to the instance
+
+N.B. 5)
+The "main thread" is the thread where the OpenGL context is current: by default, the thread creating the streamer. If the context
+is moved to another thread (e.g., the render thread of the application), that thread must call SetMainThread() before its first Update().
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <coroutine>
+#include <optional>
+#include <exception>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iostream>
+
+#include <utils/model.h>
+#include <utils/texture_loader.h>
+#include <utils/logger.h>
+
+template<class T> class AssetTask;
+
+//////////////////////////////////////////
+// promise of the AssetTask coroutines: when the coroutine is completed, the awaiting coroutine (if any) is resumed
+struct AssetTaskPromiseBase
+{
+    coroutine_handle<> continuation;
+    exception_ptr exception;
+
+    // the coroutine does not start until it is awaited
+    suspend_always initial_suspend() noexcept { return {}; }
+
+    // at the end, we transfer the execution to the awaiting coroutine (symmetric transfer, so no stack is consumed)
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        template<class P>
+        coroutine_handle<> await_suspend(coroutine_handle<P> handle) noexcept
+        {
+            coroutine_handle<> continuation = handle.promise().continuation;
+            return continuation ? continuation : noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { this->exception = current_exception(); }
+};
+
+template<class T>
+struct AssetTaskPromise : AssetTaskPromiseBase
+{
+    optional<T> value;
+    AssetTask<T> get_return_object();
+    void return_value(T result) { this->value = std::move(result); }
+};
+
+template<>
+struct AssetTaskPromise<void> : AssetTaskPromiseBase
+{
+    AssetTask<void> get_return_object();
+    void return_void() {}
+};
+
+/////////////////// ASSETTASK class ///////////////////////
+// a coroutine returning a value of type T. The coroutine frame is owned by the AssetTask (move-only)
+template<class T = void>
+class AssetTask
+{
+public:
+    using promise_type = AssetTaskPromise<T>;
+
+    AssetTask() = default;
+    explicit AssetTask(coroutine_handle<promise_type> handle) : handle(handle) {}
+    AssetTask(const AssetTask& copy) = delete;
+    AssetTask& operator=(const AssetTask&) = delete;
+    AssetTask(AssetTask&& move) noexcept : handle(move.handle) { move.handle = nullptr; }
+    AssetTask& operator=(AssetTask&& move) noexcept
+    {
+        if (this != &move)
+        {
+            if (this->handle)
+                this->handle.destroy();
+            this->handle = move.handle;
+            move.handle = nullptr;
+        }
+        return *this;
+    }
+    ~AssetTask()
+    {
+        if (this->handle)
+            this->handle.destroy();
+    }
+
+    // awaiting an AssetTask starts it, and the awaiting coroutine is resumed when it is completed
+    bool await_ready() const noexcept { return false; }
+    coroutine_handle<> await_suspend(coroutine_handle<> awaiting) noexcept
+    {
+        this->handle.promise().continuation = awaiting;
+        return this->handle;
+    }
+    T await_resume()
+    {
+        if (this->handle.promise().exception)
+            rethrow_exception(this->handle.promise().exception);
+        if constexpr (!is_void_v<T>)
+            return std::move(*this->handle.promise().value);
+    }
+
+    // we start a task which is not awaited (see AssetStreamer::Spawn)
+    void Start() { this->handle.resume(); }
+
+private:
+    coroutine_handle<promise_type> handle = nullptr;
+};
+
+template<class T>
+AssetTask<T> AssetTaskPromise<T>::get_return_object() { return AssetTask<T>(coroutine_handle<AssetTaskPromise<T>>::from_promise(*this)); }
+inline AssetTask<void> AssetTaskPromise<void>::get_return_object() { return AssetTask<void>(coroutine_handle<AssetTaskPromise<void>>::from_promise(*this)); }
+
+//////////////////////////////////////////
+// handle of a streamed model: until the model is resident, the placeholder is used
+struct StreamedModel
+{
+    Model* placeholder = nullptr;
+    unique_ptr<Model> model;
+
+    Model& Get() { return this->model ? *this->model : *this->placeholder; }
+    const Model& Get() const { return this->model ? *this->model : *this->placeholder; }
+    bool Resident() const { return (bool)this->model; }
+};
+
+// handle of a streamed texture: until the texture is resident, the placeholder is used
+struct StreamedTexture
+{
+    GLuint placeholder = 0;
+    GLuint texture = 0;
+
+    GLuint Get() const { return this->texture ? this->texture : this->placeholder; }
+    bool Resident() const { return this->texture != 0; }
+};
+
+/////////////////// ASSETSTREAMER class ///////////////////////
+class AssetStreamer
+{
+public:
+
+    // We want AssetStreamer to be neither copied nor moved
+    AssetStreamer(const AssetStreamer& copy) = delete;
+    AssetStreamer& operator=(const AssetStreamer&) = delete;
+
+    //////////////////////////////////////////
+
+    // constructor: it must be called by the main thread (the thread where the OpenGL context is current)
+    // the textures are loaded using the TextureLoader passed as parameter
+    AssetStreamer(TextureLoader& textureLoader) : textureLoader(textureLoader), mainThread(this_thread::get_id())
+    {
+        this->loaderThread = thread([this] { this->loaderLoop(); });
+    }
+
+    ~AssetStreamer()
+    {
+        this->Shutdown();
+    }
+
+    //////////////////////////////////////////
+
+    // we stop the loader thread, and we destroy the coroutines not yet completed (see N.B. 2)
+    void Shutdown()
+    {
+        if (!this->loaderThread.joinable())
+            return;
+        {
+            lock_guard<mutex> lock(this->queueMutex);
+            this->stop = true;
+        }
+        this->loaderCondition.notify_all();
+        this->loaderThread.join();
+        this->roots.clear();
+        this->mainQueue.clear();
+        this->textureWaits.clear();
+        if (this->placeholderTexture2D)
+        {
+            ResourceRegistry::Instance().Release(RESOURCE_TEXTURE, this->placeholderTexture2D);
+            glDeleteTextures(1, &this->placeholderTexture2D);
+        }
+        if (this->placeholderCubeMap)
+        {
+            ResourceRegistry::Instance().Release(RESOURCE_TEXTURE, this->placeholderCubeMap);
+            glDeleteTextures(1, &this->placeholderCubeMap);
+        }
+    }
+
+    // the calling thread becomes the main thread: the coroutines are resumed by its Update() (see N.B. 5)
+    void SetMainThread()
+    {
+        this->mainThread.store(this_thread::get_id(), memory_order_release);
+    }
+
+    //////////////////////////////////////////
+
+    // awaitable moving the coroutine to the loader thread
+    auto ToLoader()
+    {
+        struct Awaiter
+        {
+            AssetStreamer* streamer;
+            bool await_ready() const { return this_thread::get_id() == streamer->loaderThread.get_id(); }
+            void await_suspend(coroutine_handle<> handle)
+            {
+                // the awaiter is in the coroutine frame: after the push, the coroutine can be resumed (and completed) by the loader thread,
+                // so we must not access the awaiter anymore
+                AssetStreamer* target = streamer;
+                {
+                    lock_guard<mutex> lock(target->queueMutex);
+                    target->loaderQueue.push_back(handle);
+                }
+                target->loaderCondition.notify_one();
+            }
+            void await_resume() {}
+        };
+        return Awaiter{ this };
+    }
+
+    // awaitable moving the coroutine to the main thread (it is resumed by Update())
+    auto ToMain()
+    {
+        struct Awaiter
+        {
+            AssetStreamer* streamer;
+            bool await_ready() const { return this_thread::get_id() == streamer->mainThread.load(memory_order_acquire); }
+            void await_suspend(coroutine_handle<> handle)
+            {
+                lock_guard<mutex> lock(streamer->queueMutex);
+                streamer->mainQueue.push_back(handle);
+            }
+            void await_resume() {}
+        };
+        return Awaiter{ this };
+    }
+
+    //////////////////////////////////////////
+
+    // we load a model: the meshes data are read (and processed) in the loader thread, and the GPU buffers are created in the main thread
+    AssetTask<unique_ptr<Model>> LoadModel(string path, SimplifySettings simplifySettings = SimplifySettings(), MeshRetention retention = MESH_RETAIN_NONE)
+    {
+        co_await this->ToLoader();
+        vector<MeshData> meshesData;
+        const bool loaded = Model::LoadMeshesData(path, simplifySettings, meshesData);
+        co_await this->ToMain();
+        // if the loading fails, the handle keeps using the placeholder
+        if (!loaded)
+        {
+            LOG_ERROR("ASSET_STREAMER", "impossible to load " << path);
+            co_return nullptr;
+        }
+        // the buffers of the meshes are recorded with the path of the model as owner (see resource_registry.h)
+        ResourceOwner owner(path);
+        co_return make_unique<Model>(std::move(meshesData), retention);
+    }
+
+    // we load a 2D texture, or a cube map (if faces is not empty), using the TextureLoader. The coroutine is resumed when the texture is ready
+    AssetTask<GLuint> LoadTexture(string path, vector<string> faces = vector<string>())
+    {
+        // the requests are sent to the TextureLoader by the main thread
+        co_await this->ToMain();
+        GLuint request = faces.empty() ? this->textureLoader.Load2D(path) : this->textureLoader.LoadCube(path, faces);
+        co_return co_await TextureAwaiter{ this, request };
+    }
+
+    // we load a cube-sphere texture from an equirectangular image (see cube_reprojection.h) using the TextureLoader
+    AssetTask<GLuint> LoadCubeSphere(string path)
+    {
+        co_await this->ToMain();
+        GLuint request = this->textureLoader.LoadCubeSphere(path);
+        co_return co_await TextureAwaiter{ this, request };
+    }
+
+    //////////////////////////////////////////
+
+    // we start the loading of a model, assigned to the handle when it is resident
+    void Stream(StreamedModel& target, const string& path, const SimplifySettings& simplifySettings = SimplifySettings(), MeshRetention retention = MESH_RETAIN_NONE)
+    {
+        this->Spawn(this->streamModel(target, path, simplifySettings, retention));
+    }
+
+    // we start the loading of a texture (a cube map if faces is not empty), assigned to the handle when it is resident
+    void Stream(StreamedTexture& target, const string& path, const vector<string>& faces = vector<string>())
+    {
+        this->Spawn(this->streamTexture(target, path, faces));
+    }
+
+    // we start the loading of a cube-sphere texture, assigned to the handle when it is resident
+    void StreamCubeSphere(StreamedTexture& target, const string& path)
+    {
+        this->Spawn(this->streamCubeSphere(target, path));
+    }
+
+    // we start a "root" coroutine (see N.B. 1)
+    void Spawn(AssetTask<void>&& task)
+    {
+        unique_ptr<Root> root = make_unique<Root>();
+        Root* started = root.get();
+        root->task = this->runRoot(std::move(task), root->completed);
+        this->roots.push_back(std::move(root));
+        started->task.Start();
+    }
+
+    //////////////////////////////////////////
+
+    // called by the main thread at each frame: we resume the coroutines waiting for the main thread (within the time budget, in milliseconds),
+    // and the coroutines waiting for textures already uploaded
+    void Update(double budgetMs = 4.0)
+    {
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        this->textureLoader.Poll();
+
+        for (size_t i = 0; i < this->textureWaits.size();)
+        {
+            if (this->textureLoader.Texture(this->textureWaits[i].first) != 0)
+            {
+                coroutine_handle<> handle = this->textureWaits[i].second;
+                this->textureWaits.erase(this->textureWaits.begin() + i);
+                handle.resume();
+            }
+            else
+                i++;
+        }
+
+        // at least a coroutine is resumed at each frame, so the streaming always progresses
+        do
+        {
+            coroutine_handle<> handle;
+            {
+                lock_guard<mutex> lock(this->queueMutex);
+                if (this->mainQueue.empty())
+                    break;
+                handle = this->mainQueue.front();
+                this->mainQueue.pop_front();
+            }
+            handle.resume();
+        } while (chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() < budgetMs);
+
+        // the completed root coroutines are destroyed
+        this->roots.erase(remove_if(this->roots.begin(), this->roots.end(), [](const unique_ptr<Root>& root) { return root->completed; }), this->roots.end());
+    }
+
+    // number of root coroutines not yet completed
+    size_t Pending() const
+    {
+        return this->roots.size();
+    }
+
+    //////////////////////////////////////////
+
+    // placeholder textures (1x1, created by the main thread at the first call)
+    GLuint PlaceholderTexture2D()
+    {
+        if (!this->placeholderTexture2D)
+            this->placeholderTexture2D = createPlaceholder(GL_TEXTURE_2D);
+        return this->placeholderTexture2D;
+    }
+
+    GLuint PlaceholderCubeMap()
+    {
+        if (!this->placeholderCubeMap)
+            this->placeholderCubeMap = createPlaceholder(GL_TEXTURE_CUBE_MAP);
+        return this->placeholderCubeMap;
+    }
+
+private:
+
+    // a root coroutine: the flag is set by the coroutine itself (in the main thread) as its last operation
+    struct Root
+    {
+        AssetTask<void> task;
+        bool completed = false;
+    };
+
+    // awaitable resuming the coroutine when a texture request is ready (it is used only by the main thread)
+    struct TextureAwaiter
+    {
+        AssetStreamer* streamer;
+        GLuint request;
+        bool await_ready() const { return streamer->textureLoader.Texture(request) != 0; }
+        void await_suspend(coroutine_handle<> handle) { streamer->textureWaits.push_back({ request, handle }); }
+        GLuint await_resume() const { return streamer->textureLoader.Texture(request); }
+    };
+
+    TextureLoader& textureLoader;
+    // the thread of the OpenGL context (it is read also by the loader thread, see N.B. 5)
+    atomic<thread::id> mainThread;
+    thread loaderThread;
+
+    // coroutines waiting for the loader thread, and for the main thread
+    deque<coroutine_handle<>> loaderQueue;
+    deque<coroutine_handle<>> mainQueue;
+    mutex queueMutex;
+    condition_variable loaderCondition;
+    bool stop = false;
+
+    // coroutines waiting for textures (main thread only)
+    vector<pair<GLuint, coroutine_handle<>>> textureWaits;
+    vector<unique_ptr<Root>> roots;
+
+    GLuint placeholderTexture2D = 0;
+    GLuint placeholderCubeMap = 0;
+
+    //////////////////////////////////////////
+    // the loader thread resumes the coroutines in its queue, in FIFO order
+    void loaderLoop()
+    {
+        while (true)
+        {
+            coroutine_handle<> handle;
+            {
+                unique_lock<mutex> lock(this->queueMutex);
+                this->loaderCondition.wait(lock, [this] { return this->stop || !this->loaderQueue.empty(); });
+                if (this->stop)
+                    return;
+                handle = this->loaderQueue.front();
+                this->loaderQueue.pop_front();
+            }
+            handle.resume();
+        }
+    }
+
+    //////////////////////////////////////////
+    // wrapper of the root coroutines: errors are printed, and the completion is flagged in the main thread
+    AssetTask<void> runRoot(AssetTask<void> task, bool& completed)
+    {
+        try
+        {
+            co_await task;
+        }
+        catch (const exception& e)
+        {
+            LOG_ERROR("ASSET_STREAMER", e.what());
+        }
+        co_await this->ToMain();
+        completed = true;
+    }
+
+    AssetTask<void> streamModel(StreamedModel& target, string path, SimplifySettings simplifySettings, MeshRetention retention)
+    {
+        target.model = co_await this->LoadModel(path, simplifySettings, retention);
+    }
+
+    AssetTask<void> streamTexture(StreamedTexture& target, string path, vector<string> faces)
+    {
+        target.texture = co_await this->LoadTexture(path, faces);
+    }
+
+    AssetTask<void> streamCubeSphere(StreamedTexture& target, string path)
+    {
+        target.texture = co_await this->LoadCubeSphere(path);
+    }
+
+    //////////////////////////////////////////
+    // 1x1 grey texture (all the faces, for a cube map)
+    static GLuint createPlaceholder(GLenum target)
+    {
+        const unsigned char grey[4] = { 64, 64, 64, 255 };
+        GLuint texture;
+        glGenTextures(1, &texture);
+        ResourceRegistry::Instance().Register(RESOURCE_TEXTURE, texture, (target == GL_TEXTURE_CUBE_MAP) ? 6 * 4 : 4, GL_RGBA8, "AssetStreamer placeholder");
+        glBindTexture(target, texture);
+        if (target == GL_TEXTURE_CUBE_MAP)
+        {
+            for (GLuint face = 0; face < 6; face++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        }
+        else
+            glTexImage2D(target, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(target, 0);
+        return texture;
+    }
+};
@@ -0,0 +1,319 @@
+/*
+AssetSystem class
+- a virtual file system for the assets of the application: the loaders (models, textures, ...) ask for a path
+  (e.g., "../../models/saturn.obj"), and the asset is searched in the mounted archives, then on disk
+- supported archives:
+  - asset packs (see asset_pack.h): memory-mapped, with uncompressed assets read without copies
+  - zip archives (e.g., models/models.zip): read through the ZipArchiveIOSystem class of Assimp (which uses minizip)
+- AssetIOSystem is an adapter of the AssetSystem for Assimp: models (and the files they reference, e.g. materials)
+  are read from memory, without Assimp opening files on disk
+
+Each archive is mounted on a "mount point": the paths starting with the mount point are searched in the archive,
+using the rest of the path as name (e.g., with a pack mounted on "../../", "../../models/saturn.obj" is searched as "models/saturn.obj").
+Archives are searched in the order they have been mounted.
+
+N.B. 1)
+Archives must be mounted at startup, before the loading of the assets: after that, Read, Exists and GetFileInfo can be called
+by more threads at the same time (e.g., by the texture decoding jobs). Reads from zip archives are serialized, because
+the zip reader keeps the state of the current file.
+
+N.B. 2)
+For the assets in a zip archive, size and modification time (used to validate caches and baked textures) are
+the size of the asset and the modification time of the archive.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <assimp/IOSystem.hpp>
+#include <assimp/IOStream.hpp>
+#include <assimp/DefaultIOSystem.h>
+#include <assimp/ZipArchiveIOSystem.h>
+
+#include <utils/asset_pack.h>
+#include <utils/logger.h>
+
+/////////////////// ASSETSYSTEM class ///////////////////////
+class AssetSystem
+{
+public:
+
+    // We want AssetSystem to be neither copied nor moved
+    AssetSystem() = default;
+    AssetSystem(const AssetSystem& copy) = delete;
+    AssetSystem& operator=(const AssetSystem&) = delete;
+
+    //////////////////////////////////////////
+
+    // we mount an asset pack. It returns false if the pack does not exist or it is not valid
+    bool MountPack(const string& packPath, const string& mountPoint)
+    {
+        unique_ptr<Mount> mount = make_unique<Mount>();
+        mount->mountPoint = NormalizePath(mountPoint);
+        if (!mount->pack.Open(packPath))
+            return false;
+        mount->archiveTime = fileTime(packPath);
+        this->mounts.push_back(std::move(mount));
+        return true;
+    }
+
+    // we mount a zip archive. It returns false if the archive does not exist or it is not valid
+    bool MountZip(const string& zipPath, const string& mountPoint)
+    {
+        if (!filesystem::exists(zipPath))
+            return false;
+        unique_ptr<Mount> mount = make_unique<Mount>();
+        mount->mountPoint = NormalizePath(mountPoint);
+        mount->zip = make_unique<Assimp::ZipArchiveIOSystem>(&this->defaultIO, zipPath);
+        if (!mount->zip->isOpen())
+        {
+            LOG_ERROR("ASSET_SYSTEM", "invalid zip archive " << zipPath);
+            return false;
+        }
+        mount->archiveTime = fileTime(zipPath);
+        this->mounts.push_back(std::move(mount));
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+    // we read an asset (from the archives, or from disk). It returns false if the asset does not exist
+    bool Read(const string& path, AssetData& asset)
+    {
+        const string normalized = NormalizePath(path);
+        for (unique_ptr<Mount>& mount : this->mounts)
+        {
+            string name;
+            if (!mount->Resolve(normalized, name))
+                continue;
+            if (mount->zip)
+            {
+                lock_guard<mutex> lock(mount->zipMutex);
+                if (!mount->zip->Exists(name.c_str()))
+                    continue;
+                Assimp::IOStream* stream = mount->zip->Open(name.c_str());
+                if (!stream)
+                    continue;
+                vector<unsigned char> buffer(stream->FileSize());
+                stream->Read(buffer.data(), 1, buffer.size());
+                mount->zip->Close(stream);
+                asset.Assign(std::move(buffer));
+                return true;
+            }
+            const AssetPackEntry* entry = mount->pack.Find(name);
+            if (entry)
+                return mount->pack.Read(*entry, asset);
+        }
+
+        // the asset is not in the archives: we read it from disk
+        ifstream file(path, ios::binary | ios::ate);
+        if (!file)
+            return false;
+        vector<unsigned char> buffer((size_t)file.tellg());
+        file.seekg(0);
+        if (!file.read((char*)buffer.data(), buffer.size()))
+            return false;
+        asset.Assign(std::move(buffer));
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+    // true if the asset exists (in the archives, or on disk)
+    bool Exists(const string& path)
+    {
+        uint64_t size;
+        int64_t time;
+        return this->GetFileInfo(path, size, time);
+    }
+
+    //////////////////////////////////////////
+
+    // size and last modification time of an asset (see N.B. 2). It returns false if the asset does not exist
+    bool GetFileInfo(const string& path, uint64_t& size, int64_t& time)
+    {
+        const string normalized = NormalizePath(path);
+        for (unique_ptr<Mount>& mount : this->mounts)
+        {
+            string name;
+            if (!mount->Resolve(normalized, name))
+                continue;
+            if (mount->zip)
+            {
+                lock_guard<mutex> lock(mount->zipMutex);
+                if (!mount->zip->Exists(name.c_str()))
+                    continue;
+                Assimp::IOStream* stream = mount->zip->Open(name.c_str());
+                if (!stream)
+                    continue;
+                size = stream->FileSize();
+                time = mount->archiveTime;
+                mount->zip->Close(stream);
+                return true;
+            }
+            const AssetPackEntry* entry = mount->pack.Find(name);
+            if (entry)
+            {
+                size = entry->size;
+                time = entry->sourceTime;
+                return true;
+            }
+        }
+
+        error_code ec;
+        size = (uint64_t)filesystem::file_size(path, ec);
+        if (ec)
+            return false;
+        time = (int64_t)filesystem::last_write_time(path, ec).time_since_epoch().count();
+        return !ec;
+    }
+
+    //////////////////////////////////////////
+
+    // we normalize a path: "/" as separator, and no "." components
+    static string NormalizePath(const string& path)
+    {
+        string result = path;
+        replace(result.begin(), result.end(), '\\', '/');
+        size_t position;
+        while ((position = result.find("/./")) != string::npos)
+            result.erase(position, 2);
+        while (result.compare(0, 2, "./") == 0)
+            result.erase(0, 2);
+        return result;
+    }
+
+    //////////////////////////////////////////
+
+    // asset system shared by the whole application
+    static AssetSystem& Instance()
+    {
+        static AssetSystem assets;
+        return assets;
+    }
+
+private:
+
+    // a mounted archive (a pack, or a zip archive)
+    struct Mount
+    {
+        string mountPoint;
+        AssetPack pack;
+        unique_ptr<Assimp::ZipArchiveIOSystem> zip;
+        mutex zipMutex;
+        int64_t archiveTime = 0;
+
+        // name in the archive of a path (false if the path is not under the mount point)
+        bool Resolve(const string& path, string& name) const
+        {
+            if (path.compare(0, this->mountPoint.size(), this->mountPoint) != 0)
+                return false;
+            name = path.substr(this->mountPoint.size());
+            return true;
+        }
+    };
+
+    // IOSystem used by the zip reader to open the archives (declared before the mounts, so it is destroyed after them)
+    Assimp::DefaultIOSystem defaultIO;
+    vector<unique_ptr<Mount>> mounts;
+
+    //////////////////////////////////////////
+    // last modification time of a file on disk
+    static int64_t fileTime(const string& path)
+    {
+        error_code ec;
+        return (int64_t)filesystem::last_write_time(path, ec).time_since_epoch().count();
+    }
+};
+
+/////////////////// ASSETIOSTREAM class ///////////////////////
+// Assimp stream reading an asset from memory
+class AssetIOStream : public Assimp::IOStream
+{
+public:
+
+    AssetIOStream(AssetData&& asset) : asset(std::move(asset)) {}
+
+    size_t Read(void* buffer, size_t size, size_t count) override
+    {
+        if (size == 0)
+            return 0;
+        count = min(count, (this->asset.size - this->position) / size);
+        memcpy(buffer, this->asset.data + this->position, size * count);
+        this->position += size * count;
+        return count;
+    }
+
+    // assets are read-only
+    size_t Write(const void*, size_t, size_t) override
+    {
+        return 0;
+    }
+
+    aiReturn Seek(size_t offset, aiOrigin origin) override
+    {
+        size_t target = (origin == aiOrigin_SET) ? offset : (origin == aiOrigin_CUR) ? this->position + offset : this->asset.size + offset;
+        if (target > this->asset.size)
+            return aiReturn_FAILURE;
+        this->position = target;
+        return aiReturn_SUCCESS;
+    }
+
+    size_t Tell() const override { return this->position; }
+    size_t FileSize() const override { return this->asset.size; }
+    void Flush() override {}
+
+private:
+
+    AssetData asset;
+    size_t position = 0;
+};
+
+/////////////////// ASSETIOSYSTEM class ///////////////////////
+// Assimp IOSystem using the AssetSystem: it is passed to Assimp::Importer::SetIOHandler (the Importer takes its ownership)
+class AssetIOSystem : public Assimp::IOSystem
+{
+public:
+
+    bool Exists(const char* file) const override
+    {
+        return AssetSystem::Instance().Exists(file);
+    }
+
+    char getOsSeparator() const override
+    {
+        return '/';
+    }
+
+    Assimp::IOStream* Open(const char* file, const char* mode = "rb") override
+    {
+        // assets can be only read
+        if (strchr(mode, 'w') || strchr(mode, 'a'))
+            return nullptr;
+        AssetData asset;
+        if (!AssetSystem::Instance().Read(file, asset))
+            return nullptr;
+        return new AssetIOStream(std::move(asset));
+    }
+
+    void Close(Assimp::IOStream* stream) override
+    {
+        delete stream;
+    }
+};
@@ -0,0 +1,431 @@
+/*
+ClusteredLights class
+- clustered forward shading of many point lights: the view frustum is divided in a grid of clusters ("froxels"), CLUSTER_X x CLUSTER_Y
+  tiles of the window and CLUSTER_Z slices of depth, and at each frame we build the list of the lights intersecting each cluster.
+  In the fragment shader, each fragment finds its cluster (from its window coordinates and its depth), and it shades only the lights
+  of the cluster: the cost of a fragment depends on the number of lights near to it, and not on the total number of lights
+- the lists are built on the CPU (Build): the clusters covered by each light are computed from its bounding sphere, and the depth
+  slices are filled in parallel by the job system (see job_system.h). Upload() copies them in three shader storage buffers:
+  the lights (in view coordinates), the grid (offset and number of lights of each cluster), and the indices of the lights of all
+  the clusters, concatenated
+- fallback: without the shader storage buffers (OpenGL 4.3, e.g. with the OpenGL 4.1 context), the CLUSTER_FALLBACK_LIGHTS visible
+  lights nearest to the camera are passed as uniform arrays, and each fragment shades all of them
+
+N.B. 1)
+The depth slices are exponential: the slice of a depth z (positive, in view coordinates) is log(z / near) / log(far / near) * CLUSTER_Z,
+so the clusters far from the camera are deeper, like their tiles are larger. The near and far planes are taken from the projection matrix.
+
+N.B. 2)
+The clusters of a light are the tiles covered by the projection of its bounding box, in the slices covered by its depth: the lists are
+conservative (a light can be in a cluster without intersecting its volume), but a light is never missing from a cluster where it contributes.
+The attenuation of the lights reaches zero at their radius (see illumination_models_ML.frag), so the lights are not cut at the borders
+of the clusters.
+
+N.B. 3)
+The illumination shaders are GLSL 4.10: the buffers are declared only if CLUSTERED_LIGHTING is 1 (see ShaderDefines), with the extension
+GL_ARB_shader_storage_buffer_object (checked by Supported). The explicit bindings of the blocks require GLSL 4.20, so the blocks are
+bound to the binding points CLUSTER_*_BINDING by SetupProgram, after the creation of each program.
+
+N.B. 4)
+The buffers are re-allocated at each upload, with their new size ("orphaning", like the PBOs of the texture loader): the driver does not
+wait for the frames still using the previous content. Build and Upload must be called by the thread where the context is current.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+
+#include <glm/glm.hpp>
+
+#include <utils/job_system.h>
+#include <utils/resource_registry.h>
+
+// size of the grid of the clusters: tiles of the window, and slices of depth (see N.B. 1)
+const GLuint CLUSTER_X = 16;
+const GLuint CLUSTER_Y = 9;
+const GLuint CLUSTER_Z = 24;
+// number of lights passed as uniforms, without the shader storage buffers
+const GLuint CLUSTER_FALLBACK_LIGHTS = 16;
+// binding points of the shader storage buffers (see N.B. 3)
+const GLuint CLUSTER_LIGHTS_BINDING = 0;
+const GLuint CLUSTER_GRID_BINDING = 1;
+const GLuint CLUSTER_INDICES_BINDING = 2;
+const GLuint CLUSTER_BUFFERS = 3;
+
+// point light: position in world coordinates, radius of influence, color and intensity
+struct PointLight
+{
+    glm::vec3 position = glm::vec3(0.0f);
+    GLfloat radius = 1.0f;
+    glm::vec3 color = glm::vec3(1.0f);
+    GLfloat intensity = 1.0f;
+};
+
+/////////////////// CLUSTEREDLIGHTS class ///////////////////////
+class ClusteredLights
+{
+public:
+    // We want ClusteredLights to be non-copyable (it owns the buffers)
+    ClusteredLights(const ClusteredLights&) = delete;
+    ClusteredLights& operator=(const ClusteredLights&) = delete;
+
+    //////////////////////////////////////////
+
+    // constructor: storage is true if the lists are passed in shader storage buffers (see Supported), false for the fallback.
+    // The buffers are created at the first upload
+    explicit ClusteredLights(bool storage) : storage(storage), grid(CLUSTER_X * CLUSTER_Y * CLUSTER_Z), slices(CLUSTER_Z) {}
+
+    // true if the current context supports the shader storage buffers, also in the shaders with #version 410 (see N.B. 3)
+    static bool Supported()
+    {
+        if (!GLAD_GL_VERSION_4_3)
+            return false;
+        GLint extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+        for (GLint i = 0; i < extensions; i++)
+            if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_ARB_shader_storage_buffer_object") == 0)
+                return true;
+        return false;
+    }
+
+    bool Storage() const { return this->storage; }
+
+    // the #define directives of the illumination shaders (see lights.glsl)
+    string ShaderDefines() const
+    {
+        return "#define CLUSTERED_LIGHTING " + to_string(this->storage ? 1 : 0) + "\n#define CLUSTER_X " + to_string(CLUSTER_X) +
+               "\n#define CLUSTER_Y " + to_string(CLUSTER_Y) + "\n#define CLUSTER_Z " + to_string(CLUSTER_Z) +
+               "\n#define CLUSTER_FALLBACK_LIGHTS " + to_string(CLUSTER_FALLBACK_LIGHTS) + "\n";
+    }
+
+    // we bind the blocks of the buffers of a Shader Program to their binding points (called once after the creation of the program)
+    void SetupProgram(GLuint program) const
+    {
+        if (!this->storage)
+            return;
+        const char* blocks[CLUSTER_BUFFERS] = { "PointLights", "LightClusters", "LightIndices" };
+        for (GLuint binding = 0; binding < CLUSTER_BUFFERS; binding++)
+        {
+            const GLuint index = glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, blocks[binding]);
+            if (index != GL_INVALID_INDEX)
+                glShaderStorageBlockBinding(program, index, binding);
+        }
+    }
+
+    //////////////////////////////////////////
+
+    // we build the lists of the lights of the clusters, for the given camera (without the shader storage buffers, we select the
+    // lights nearest to the camera)
+    void Build(const vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection)
+    {
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        this->projection = projection;
+        // near and far planes of the perspective projection, and scale and bias of the slices of depth (see N.B. 1)
+        this->nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+        this->farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+        this->depthScale = CLUSTER_Z / log(this->farPlane / this->nearPlane);
+        this->depthBias = -log(this->nearPlane) * this->depthScale;
+        this->numLights = (GLuint)lights.size();
+
+        // the lights in view coordinates, and the ranges of clusters covered by them
+        this->viewLights.resize(lights.size() * 2);
+        this->ranges.resize(lights.size());
+        JobSystem::Instance().ParallelFor(lights.size(), [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const glm::vec3 center = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+                this->viewLights[i * 2] = glm::vec4(center, lights[i].radius);
+                this->viewLights[i * 2 + 1] = glm::vec4(lights[i].color * lights[i].intensity, 0.0f);
+                this->ranges[i] = this->clusterRange(center, lights[i].radius);
+            }
+        }, 64);
+        this->visibleLights = (GLuint)count_if(this->ranges.begin(), this->ranges.end(), [](const Range& range) { return range.visible; });
+
+        if (this->storage)
+            this->buildClusters();
+        else
+            this->selectNearest();
+        this->buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    // we copy the lists in the shader storage buffers (see N.B. 4)
+    void Upload()
+    {
+        if (!this->storage)
+            return;
+        if (!this->buffers[0])
+            glGenBuffers(CLUSTER_BUFFERS, this->buffers);
+        this->upload(CLUSTER_LIGHTS_BINDING, this->viewLights.data(), this->viewLights.size() * sizeof(glm::vec4));
+        this->upload(CLUSTER_GRID_BINDING, this->grid.data(), this->grid.size() * sizeof(glm::uvec2));
+        this->upload(CLUSTER_INDICES_BINDING, this->indices.data(), this->indices.size() * sizeof(GLuint));
+    }
+
+    // we bind the buffers, and we set the uniforms of the clusters in a Shader Program (it must be active). width and height are the
+    // size of the viewport
+    void Bind(GLuint program, GLuint width, GLuint height) const
+    {
+        if (this->storage)
+        {
+            for (GLuint binding = 0; binding < CLUSTER_BUFFERS; binding++)
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, this->buffers[binding]);
+            glUniform2f(glGetUniformLocation(program, "clusterScale"), (GLfloat)CLUSTER_X / width, (GLfloat)CLUSTER_Y / height);
+            glUniform2f(glGetUniformLocation(program, "clusterDepth"), this->depthScale, this->depthBias);
+        }
+        else
+        {
+            const GLsizei count = (GLsizei)this->fallback.size() / 2;
+            vector<glm::vec4> positions(count), colors(count);
+            for (GLsizei i = 0; i < count; i++)
+            {
+                positions[i] = this->fallback[i * 2];
+                colors[i] = this->fallback[i * 2 + 1];
+            }
+            glUniform1i(glGetUniformLocation(program, "numPointLights"), count);
+            if (count > 0)
+            {
+                glUniform4fv(glGetUniformLocation(program, "pointLightPositions"), count, &positions[0][0]);
+                glUniform4fv(glGetUniformLocation(program, "pointLightColors"), count, &colors[0][0]);
+            }
+        }
+    }
+
+    // the buffer bound to a binding point (0 if the buffers are not used)
+    GLuint Buffer(GLuint binding) const { return this->buffers[binding]; }
+
+    //////////////////////////////////////////
+
+    // the lights of the cluster containing a point (in view coordinates), as they are found by the fragment shader
+    vector<GLuint> LightsAt(const glm::vec3& position) const
+    {
+        vector<GLuint> result;
+        if (!this->storage || -position.z < this->nearPlane || -position.z > this->farPlane)
+            return result;
+        const glm::vec4 clip = this->projection * glm::vec4(position, 1.0f);
+        const GLuint x = tile(clip.x / clip.w, CLUSTER_X), y = tile(clip.y / clip.w, CLUSTER_Y), z = this->slice(-position.z);
+        const glm::uvec2& cluster = this->grid[(z * CLUSTER_Y + y) * CLUSTER_X + x];
+        result.assign(this->indices.begin() + cluster.x, this->indices.begin() + cluster.x + cluster.y);
+        return result;
+    }
+
+    // statistics of the last build
+    GLuint Lights() const { return this->numLights; }
+    GLuint VisibleLights() const { return this->visibleLights; }
+    size_t References() const { return this->indices.size(); }
+    GLuint MaxLightsPerCluster() const { return this->maxPerCluster; }
+    GLuint LitClusters() const { return this->litClusters; }
+    double BuildMs() const { return this->buildMs; }
+
+    // we print on console the statistics of the last build
+    void PrintStats() const
+    {
+        if (this->storage)
+            std::cout << "Clustered lights (" << CLUSTER_X << "x" << CLUSTER_Y << "x" << CLUSTER_Z << " clusters): " << this->numLights
+                      << " lights, " << this->visibleLights << " visible, " << this->indices.size() << " references in " << this->litClusters
+                      << " clusters (" << std::fixed << std::setprecision(2) << (this->litClusters ? (double)this->indices.size() / this->litClusters : 0.0)
+                      << " lights per cluster, max " << this->maxPerCluster << "), build " << this->buildMs << " ms, "
+                      << (this->bytes[0] + this->bytes[1] + this->bytes[2]) / 1024 << " KB" << std::endl;
+        else
+            std::cout << "Clustered lights (fallback, no shader storage buffers): " << this->numLights << " lights, " << this->visibleLights
+                      << " visible, the " << this->fallback.size() / 2 << " nearest shaded by all the fragments, build " << std::fixed
+                      << std::setprecision(2) << this->buildMs << " ms" << std::endl;
+    }
+
+    // we delete the buffers (the context must be current)
+    void Release()
+    {
+        if (!this->buffers[0])
+            return;
+        for (GLuint binding = 0; binding < CLUSTER_BUFFERS; binding++)
+        {
+            ResourceRegistry::Instance().Release(RESOURCE_BUFFER, this->buffers[binding]);
+            this->bytes[binding] = 0;
+        }
+        glDeleteBuffers(CLUSTER_BUFFERS, this->buffers);
+        memset(this->buffers, 0, sizeof(this->buffers));
+    }
+
+private:
+    // clusters covered by a light (inclusive ranges)
+    struct Range
+    {
+        bool visible = false;
+        GLuint x0 = 0, x1 = 0, y0 = 0, y1 = 0, z0 = 0, z1 = 0;
+    };
+
+    // lists of the clusters of a slice of depth (filled in parallel, and then concatenated)
+    struct Slice
+    {
+        vector<GLuint> lights;
+        vector<GLuint> counts;
+        vector<GLuint> offsets;
+        vector<GLuint> indices;
+    };
+
+    bool storage;
+    // camera of the last build (see N.B. 1)
+    glm::mat4 projection = glm::mat4(1.0f);
+    GLfloat nearPlane = 0.1f, farPlane = 100.0f, depthScale = 1.0f, depthBias = 0.0f;
+    // lights in view coordinates (position and radius, color multiplied by the intensity), and their clusters
+    vector<glm::vec4> viewLights;
+    vector<Range> ranges;
+    // offset and number of lights of each cluster, and indices of the lights of the clusters
+    vector<glm::uvec2> grid;
+    vector<GLuint> indices;
+    vector<Slice> slices;
+    // lights shaded without the clusters (position and color, like the lights)
+    vector<glm::vec4> fallback;
+    GLuint buffers[CLUSTER_BUFFERS] = { 0, 0, 0 };
+    size_t bytes[CLUSTER_BUFFERS] = { 0, 0, 0 };
+    // statistics
+    GLuint numLights = 0, visibleLights = 0, maxPerCluster = 0, litClusters = 0;
+    double buildMs = 0.0;
+
+    // tile of a coordinate in normalized device coordinates
+    static GLuint tile(GLfloat ndc, GLuint tiles)
+    {
+        return (GLuint)glm::clamp((GLint)floor((ndc * 0.5f + 0.5f) * tiles), 0, (GLint)tiles - 1);
+    }
+
+    // slice of a depth (positive, in view coordinates)
+    GLuint slice(GLfloat depth) const
+    {
+        return (GLuint)glm::clamp((GLint)floor(log(depth) * this->depthScale + this->depthBias), 0, (GLint)CLUSTER_Z - 1);
+    }
+
+    // clusters covered by the bounding box of a light, clipped by the near and far planes (see N.B. 2)
+    Range clusterRange(const glm::vec3& center, GLfloat radius) const
+    {
+        Range range;
+        const GLfloat nearDepth = max(-center.z - radius, this->nearPlane), farDepth = min(-center.z + radius, this->farPlane);
+        if (nearDepth > farDepth)
+            return range;
+        // the projection of a box in front of the camera is contained in the rectangle of the projections of its corners
+        glm::vec2 minimum(1.0f), maximum(-1.0f);
+        for (GLuint corner = 0; corner < 8; corner++)
+        {
+            const glm::vec4 point((corner & 1) ? center.x + radius : center.x - radius, (corner & 2) ? center.y + radius : center.y - radius,
+                                  (corner & 4) ? -farDepth : -nearDepth, 1.0f);
+            const glm::vec4 clip = this->projection * point;
+            minimum = glm::min(minimum, glm::vec2(clip) / clip.w);
+            maximum = glm::max(maximum, glm::vec2(clip) / clip.w);
+        }
+        if (maximum.x < -1.0f || maximum.y < -1.0f || minimum.x > 1.0f || minimum.y > 1.0f)
+            return range;
+        range.visible = true;
+        range.x0 = tile(minimum.x, CLUSTER_X);
+        range.x1 = tile(maximum.x, CLUSTER_X);
+        range.y0 = tile(minimum.y, CLUSTER_Y);
+        range.y1 = tile(maximum.y, CLUSTER_Y);
+        range.z0 = this->slice(nearDepth);
+        range.z1 = this->slice(farDepth);
+        return range;
+    }
+
+    // we fill the lists of the slices in parallel, and we concatenate them
+    void buildClusters()
+    {
+        const GLuint tiles = CLUSTER_X * CLUSTER_Y;
+        JobSystem::Instance().ParallelFor(CLUSTER_Z, [&](size_t begin, size_t end)
+        {
+            for (size_t z = begin; z < end; z++)
+            {
+                Slice& slice = this->slices[z];
+                slice.lights.clear();
+                for (GLuint i = 0; i < this->ranges.size(); i++)
+                    if (this->ranges[i].visible && this->ranges[i].z0 <= z && z <= this->ranges[i].z1)
+                        slice.lights.push_back(i);
+                // we count the lights of each cluster, and then we write their indices
+                slice.counts.assign(tiles, 0);
+                for (GLuint light : slice.lights)
+                {
+                    const Range& range = this->ranges[light];
+                    for (GLuint y = range.y0; y <= range.y1; y++)
+                        for (GLuint x = range.x0; x <= range.x1; x++)
+                            slice.counts[y * CLUSTER_X + x]++;
+                }
+                slice.offsets.resize(tiles);
+                GLuint total = 0;
+                for (GLuint c = 0; c < tiles; c++)
+                {
+                    slice.offsets[c] = total;
+                    total += slice.counts[c];
+                }
+                slice.indices.resize(total);
+                vector<GLuint> cursors(slice.offsets);
+                for (GLuint light : slice.lights)
+                {
+                    const Range& range = this->ranges[light];
+                    for (GLuint y = range.y0; y <= range.y1; y++)
+                        for (GLuint x = range.x0; x <= range.x1; x++)
+                            slice.indices[cursors[y * CLUSTER_X + x]++] = light;
+                }
+            }
+        });
+
+        this->indices.clear();
+        this->maxPerCluster = this->litClusters = 0;
+        for (GLuint z = 0; z < CLUSTER_Z; z++)
+        {
+            const Slice& slice = this->slices[z];
+            const GLuint base = (GLuint)this->indices.size();
+            for (GLuint c = 0; c < tiles; c++)
+            {
+                this->grid[z * tiles + c] = glm::uvec2(base + slice.offsets[c], slice.counts[c]);
+                this->maxPerCluster = max(this->maxPerCluster, slice.counts[c]);
+                this->litClusters += (slice.counts[c] > 0) ? 1 : 0;
+            }
+            this->indices.insert(this->indices.end(), slice.indices.begin(), slice.indices.end());
+        }
+    }
+
+    // without the clusters, we select the visible lights nearest to the camera (the distance from their sphere)
+    void selectNearest()
+    {
+        vector<GLuint> visible;
+        for (GLuint i = 0; i < this->ranges.size(); i++)
+            if (this->ranges[i].visible)
+                visible.push_back(i);
+        const size_t count = min(visible.size(), (size_t)CLUSTER_FALLBACK_LIGHTS);
+        partial_sort(visible.begin(), visible.begin() + count, visible.end(), [this](GLuint a, GLuint b)
+        {
+            return glm::length(glm::vec3(this->viewLights[a * 2])) - this->viewLights[a * 2].w < glm::length(glm::vec3(this->viewLights[b * 2])) - this->viewLights[b * 2].w;
+        });
+        this->fallback.clear();
+        for (size_t i = 0; i < count; i++)
+        {
+            this->fallback.push_back(this->viewLights[visible[i] * 2]);
+            this->fallback.push_back(this->viewLights[visible[i] * 2 + 1]);
+        }
+    }
+
+    // we re-allocate a buffer with its new content (see N.B. 4). The buffers are never empty
+    void upload(GLuint binding, const void* data, size_t size)
+    {
+        const size_t allocated = max(size, sizeof(glm::uvec4));
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->buffers[binding]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, allocated, nullptr, GL_STREAM_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        if (allocated != this->bytes[binding])
+        {
+            ResourceRegistry::Instance().Register(RESOURCE_BUFFER, this->buffers[binding], allocated, 0, "ClusteredLights");
+            this->bytes[binding] = allocated;
+        }
+    }
+};
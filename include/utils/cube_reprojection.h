@@ -0,0 +1,232 @@
+/*
+Cube-sphere reprojection of equirectangular textures
+- an equirectangular (latitude/longitude) image has the same number of texels in each row: near the poles a row covers
+  a very small circle of the sphere, so the texture is heavily oversampled there (and the mipmaps, selected by the
+  derivatives along the longitude, cause aliasing and the "pinching" of the poles)
+- a cube-sphere texture is a cube map whose faces are the projection of the sphere on the 6 faces of a cube:
+  the density of the texels varies at most of a factor ~5 on the whole sphere, and there are no poles and no seam
+- ReprojectEquirectangular resamples an equirectangular RGBA image in the 6 faces of a cube map (in the order +X, -X, +Y, -Y, +Z, -Z)
+- BakeCubeSphereTexture executes the reprojection offline, and it saves the faces as a baked (block-compressed, with mipmaps) KTX cube map
+  next to the source image (e.g., "earth.jpg" -> "earth.jpg.cubesphere.ktx"), see texture_baker.h.
+  Without the baked file, the reprojection is executed at load time by the TextureLoader (see LoadCubeSphere in texture_loader.h)
+
+In the shader, the cube map is sampled with the direction of the fragment in object space (the position on the unit sphere),
+instead of the UV coordinates (see illumination_models_ML.frag in the main application).
+
+N.B. 1)
+The faces are squares with the power of two nearest to 1/4 of the width of the source image (e.g., 512x512 for a 2048x1024 image):
+the 6 faces have 3/4 of the texels of the source image (and of its mipmaps), and their density at the center of a face
+is ~80% of the density of the source image at the equator. For each texel of a face, the source image is sampled
+on a 4x4 grid, with bilinear filtering (the image is repeated along the longitude, and clamped at the poles):
+near the poles a texel of a face covers many texels of the source image, so the supersampling avoids the aliasing.
+
+N.B. 2)
+The mapping between faces and directions follows the cube map convention of OpenGL, and the mapping between directions and
+the source image follows the UVs of the procedural spheres (see FinalizeSphere in procedural_mesh.h):
+u = atan2(-z, x) / 2PI + 0.5, v = acos(y) / PI, with the first row of the image at the north pole (v = 0).
+
+N.B. 3)
+The bilinear sampling works on a RGBA texel at a time using SSE2 (the 4 channels in a single register), if available.
+ReprojectEquirectangular divides the rows of the faces among the threads of the job system (see job_system.h): the calling
+thread works on the rows too while it waits, so it can be called also inside a job of the thread pool. ReprojectFace works
+on a range of rows of a face.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include <stb_image/stb_image.h>
+
+#include <utils/job_system.h>
+#include <utils/asset_system.h>
+#include <utils/texture_baker.h>
+#include <utils/logger.h>
+
+// texture unit of the cube-sphere textures (unit 0 is used by the usual textures, units 1 and 2 by the virtual textures)
+const GLuint CUBE_SPHERE_TEXTURE_UNIT = 3;
+
+// side of the grid of samples taken from the source image for each texel of a face
+const GLuint CUBE_SPHERE_SUPERSAMPLING = 4;
+
+//////////////////////////////////////////
+// path of the baked cube-sphere texture of a source image
+inline string CubeSphereTexturePath(const string& source)
+{
+    return source + ".cubesphere.ktx";
+}
+
+//////////////////////////////////////////
+// size of the faces for a source image with the given width (see N.B. 1)
+inline GLuint CubeFaceSize(int width)
+{
+    return 1u << (GLuint)max((int)round(log2(max(width, 4) / 4.0)), 0);
+}
+
+//////////////////////////////////////////
+// direction (not normalized) of the point of a face with coordinates (s, t) in [0, 1] (see N.B. 2)
+inline void CubeFaceDirection(GLuint face, float s, float t, float direction[3])
+{
+    const float a = 2.0f * s - 1.0f, b = 2.0f * t - 1.0f;
+    switch (face)
+    {
+        case 0: direction[0] = 1.0f; direction[1] = -b; direction[2] = -a; break;
+        case 1: direction[0] = -1.0f; direction[1] = -b; direction[2] = a; break;
+        case 2: direction[0] = a; direction[1] = 1.0f; direction[2] = b; break;
+        case 3: direction[0] = a; direction[1] = -1.0f; direction[2] = -b; break;
+        case 4: direction[0] = a; direction[1] = -b; direction[2] = 1.0f; break;
+        default: direction[0] = -a; direction[1] = -b; direction[2] = -1.0f; break;
+    }
+}
+
+//////////////////////////////////////////
+// we resample the rows [firstRow, lastRow) of a face from the equirectangular RGBA image (see N.B. 1)
+// faceImage is a faceSize x faceSize RGBA image
+inline void ReprojectFace(const unsigned char* rgba, int width, int height, GLuint face, GLuint faceSize, GLuint firstRow, GLuint lastRow, unsigned char* faceImage)
+{
+    const float PI = 3.14159265359f;
+    const GLuint grid = CUBE_SPHERE_SUPERSAMPLING;
+    const float weight = 1.0f / (grid * grid);
+
+    // coordinates of the 4 texels around the sample, and the bilinear weights
+    auto texels = [&](float u, float v, const unsigned char* p[4], float& fx, float& fy)
+    {
+        // texel centers are at (i + 0.5) / size
+        float x = u * width - 0.5f, y = v * height - 0.5f;
+        float x0 = floor(x), y0 = floor(y);
+        fx = x - x0;
+        fy = y - y0;
+        int ix0 = (int)x0 % width;
+        if (ix0 < 0)
+            ix0 += width;
+        int ix1 = (ix0 + 1) % width;
+        int iy0 = clamp((int)y0, 0, height - 1), iy1 = clamp((int)y0 + 1, 0, height - 1);
+        p[0] = rgba + 4 * ((size_t)iy0 * width + ix0);
+        p[1] = rgba + 4 * ((size_t)iy0 * width + ix1);
+        p[2] = rgba + 4 * ((size_t)iy1 * width + ix0);
+        p[3] = rgba + 4 * ((size_t)iy1 * width + ix1);
+    };
+
+    for (GLuint y = firstRow; y < lastRow; y++)
+        for (GLuint x = 0; x < faceSize; x++)
+        {
+#ifdef TEXTURE_BAKER_SSE2
+            const __m128i zero = _mm_setzero_si128();
+            // a RGBA8 texel, converted to 4 floats
+            auto load = [&zero](const unsigned char* p)
+            {
+                int texel;
+                memcpy(&texel, p, sizeof(texel));
+                return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(texel), zero), zero));
+            };
+            __m128 sum = _mm_setzero_ps();
+#else
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+#endif
+            for (GLuint j = 0; j < grid; j++)
+                for (GLuint i = 0; i < grid; i++)
+                {
+                    float d[3];
+                    CubeFaceDirection(face, (x + (i + 0.5f) / grid) / faceSize, (y + (j + 0.5f) / grid) / faceSize, d);
+                    const float length = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+                    const float u = atan2(-d[2], d[0]) / (2.0f * PI) + 0.5f;
+                    const float v = acos(clamp(d[1] / length, -1.0f, 1.0f)) / PI;
+
+                    const unsigned char* p[4];
+                    float fx, fy;
+                    texels(u, v, p, fx, fy);
+#ifdef TEXTURE_BAKER_SSE2
+                    const __m128 wx = _mm_set1_ps(fx), wy = _mm_set1_ps(fy);
+                    const __m128 t0 = load(p[0]), t2 = load(p[2]);
+                    __m128 top = _mm_add_ps(t0, _mm_mul_ps(wx, _mm_sub_ps(load(p[1]), t0)));
+                    __m128 bottom = _mm_add_ps(t2, _mm_mul_ps(wx, _mm_sub_ps(load(p[3]), t2)));
+                    sum = _mm_add_ps(sum, _mm_add_ps(top, _mm_mul_ps(wy, _mm_sub_ps(bottom, top))));
+#else
+                    for (int c = 0; c < 4; c++)
+                    {
+                        float top = p[0][c] + fx * (p[1][c] - p[0][c]);
+                        float bottom = p[2][c] + fx * (p[3][c] - p[2][c]);
+                        sum[c] += top + fy * (bottom - top);
+                    }
+#endif
+                }
+
+            unsigned char* out = faceImage + 4 * ((size_t)y * faceSize + x);
+#ifdef TEXTURE_BAKER_SSE2
+            // average of the samples, rounded and packed back to 8 bits (with saturation)
+            __m128i result = _mm_cvtps_epi32(_mm_mul_ps(sum, _mm_set1_ps(weight)));
+            result = _mm_packus_epi16(_mm_packs_epi32(result, zero), zero);
+            int packed = _mm_cvtsi128_si32(result);
+            memcpy(out, &packed, sizeof(packed));
+#else
+            for (int c = 0; c < 4; c++)
+                out[c] = (unsigned char)clamp((int)(sum[c] * weight + 0.5f), 0, 255);
+#endif
+        }
+}
+
+//////////////////////////////////////////
+// we reproject an equirectangular RGBA image in the 6 faces of a cube map (see N.B. 3)
+inline vector<vector<unsigned char>> ReprojectEquirectangular(const unsigned char* rgba, int width, int height, GLuint faceSize)
+{
+    vector<vector<unsigned char>> faces(6, vector<unsigned char>((size_t)faceSize * faceSize * 4));
+
+    // the rows of all the faces are divided among the threads of the job system
+    JobSystem::Instance().ParallelFor(6 * (size_t)faceSize, [&](size_t first, size_t last)
+    {
+        for (GLuint row = (GLuint)first; row < (GLuint)last; )
+        {
+            const GLuint face = row / faceSize, end = min((GLuint)last, (face + 1) * faceSize);
+            ReprojectFace(rgba, width, height, face, faceSize, row - face * faceSize, end - face * faceSize, faces[face].data());
+            row = end;
+        }
+    });
+    return faces;
+}
+
+//////////////////////////////////////////
+// we bake the cube-sphere texture of an equirectangular source image, with the full chain of mipmaps.
+// It returns false in case of errors
+inline bool BakeCubeSphereTexture(const string& source, BakeFormat format)
+{
+    vector<int64_t> sourceInfo;
+    AssetData file;
+    int width, height, channels;
+    unsigned char* pixels = nullptr;
+    if (GetBakeSourcesInfo({ source }, sourceInfo) && AssetSystem::Instance().Read(source, file))
+        pixels = stbi_load_from_memory(file.data, (int)file.size, &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels)
+    {
+        LOG_ERROR("CUBE_REPROJECTION", "impossible to load " << source);
+        return false;
+    }
+
+    const GLuint faceSize = CubeFaceSize(width);
+    vector<vector<unsigned char>> faces = ReprojectEquirectangular(pixels, width, height, faceSize);
+    stbi_image_free(pixels);
+    return WriteBakedTexture(CubeSphereTexturePath(source), faces, faceSize, faceSize, format, true, sourceInfo);
+}
+
+//////////////////////////////////////////
+// we read the baked cube-sphere texture of a source image. It returns false if the baked texture does not exist,
+// or if it is not valid (e.g., the source image has been modified after the baking)
+inline bool LoadCubeSphereTexture(const string& source, KTXTexture& texture)
+{
+    vector<int64_t> sourceInfo;
+    if (!GetBakeSourcesInfo({ source }, sourceInfo))
+        return false;
+    return ReadBakedTexture(CubeSphereTexturePath(source), sourceInfo, 6, texture);
+}
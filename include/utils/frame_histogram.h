@@ -0,0 +1,110 @@
+/*
+FrameHistogram class
+- histogram of the frame times: the average frame rate hides the spikes (a single frame of 100 ms in a second of frames of 10 ms
+  is a visible stutter), so we count the frames in buckets of the frame time, and we compute the percentiles
+- with the frame time stable, the frames are in a few adjacent buckets around the median, and the 99th percentile is close to the median:
+  e.g., this is the expected result while a heavy work is executed in small steps by the FrameScheduler (see frame_scheduler.h)
+
+N.B. 1)
+The percentiles are computed from the buckets (the result is the upper limit of the bucket), so their precision is the width of a bucket.
+The frames longer than the last bucket are counted in the last bucket; the maximum frame time is stored separately.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+// number of buckets of the histogram
+const size_t FRAME_HISTOGRAM_BUCKETS = 100;
+// length of the longest bar printed on console
+const size_t FRAME_HISTOGRAM_BAR = 50;
+
+/////////////////// FRAMEHISTOGRAM class ///////////////////////
+class FrameHistogram
+{
+public:
+    // constructor: width of the buckets, in milliseconds
+    explicit FrameHistogram(double bucketMs = 0.5) : bucketMs(bucketMs), buckets(FRAME_HISTOGRAM_BUCKETS, 0) {}
+
+    //////////////////////////////////////////
+
+    // we add the time of a frame, in milliseconds
+    void Add(double ms)
+    {
+        const size_t bucket = min((size_t)max(ms / this->bucketMs, 0.0), FRAME_HISTOGRAM_BUCKETS - 1);
+        this->buckets[bucket]++;
+        this->count++;
+        this->totalMs += ms;
+        this->maxMs = max(this->maxMs, ms);
+    }
+
+    // we remove all the frames
+    void Reset()
+    {
+        fill(this->buckets.begin(), this->buckets.end(), 0);
+        this->count = 0;
+        this->totalMs = 0.0;
+        this->maxMs = 0.0;
+    }
+
+    //////////////////////////////////////////
+
+    size_t Count() const { return this->count; }
+    double Mean() const { return this->count ? this->totalMs / this->count : 0.0; }
+    double Max() const { return this->maxMs; }
+
+    // frame time below which there are the given fraction of the frames (e.g., 0.99 for the 99th percentile, see N.B. 1)
+    double Percentile(double fraction) const
+    {
+        if (this->count == 0)
+            return 0.0;
+        const size_t target = max((size_t)(fraction * this->count + 0.5), (size_t)1);
+        size_t seen = 0;
+        for (size_t i = 0; i < FRAME_HISTOGRAM_BUCKETS; i++)
+        {
+            seen += this->buckets[i];
+            if (seen >= target)
+                return min((i + 1) * this->bucketMs, this->maxMs);
+        }
+        return this->maxMs;
+    }
+
+    //////////////////////////////////////////
+
+    // we print on console the percentiles, and the non-empty buckets with a bar proportional to their number of frames
+    void Print(const string& title) const
+    {
+        std::cout << title << " (" << this->count << " frames): mean " << std::fixed << std::setprecision(2) << this->Mean()
+                  << " ms, median " << this->Percentile(0.5) << " ms, 95% " << this->Percentile(0.95) << " ms, 99% "
+                  << this->Percentile(0.99) << " ms, max " << this->maxMs << " ms" << std::endl;
+        if (this->count == 0)
+            return;
+        const size_t highest = *max_element(this->buckets.begin(), this->buckets.end());
+        for (size_t i = 0; i < FRAME_HISTOGRAM_BUCKETS; i++)
+        {
+            if (this->buckets[i] == 0)
+                continue;
+            const size_t bar = max(this->buckets[i] * FRAME_HISTOGRAM_BAR / highest, (size_t)1);
+            std::cout << "  " << std::setw(6) << i * this->bucketMs << ((i == FRAME_HISTOGRAM_BUCKETS - 1) ? "+" : " ") << " ms "
+                      << string(bar, '#') << " " << this->buckets[i] << std::endl;
+        }
+    }
+
+private:
+    double bucketMs;
+    vector<size_t> buckets;
+    size_t count = 0;
+    double totalMs = 0.0;
+    double maxMs = 0.0;
+};
@@ -0,0 +1,113 @@
+/*
+FrameQueue class
+- bounded single-producer / single-consumer queue of frame packets, between the thread preparing the frames (input, camera,
+  animation, matrices) and the render thread (the thread of the OpenGL context, which submits the draw calls)
+- with a queue of N packets, the producer can prepare up to N frames ahead of the frame being rendered: the two threads work
+  in parallel, and the CPU frame time approaches max(prepare, submit), instead of prepare + submit
+- the queue is lock-free: the slots are a ring buffer, and each thread writes only its own index (the producer the tail,
+  the consumer the head). A thread blocks only when the queue is full (producer) or empty (consumer), sleeping on the index
+  of the other thread (std::atomic::wait, C++20, like the writer of the Logger, see logger.h)
+
+N.B. 1)
+Push and Pop must be called always by the same two threads (one producer, one consumer). The packets are exchanged with the slots
+(swap): Push leaves in the packet of the producer the packet released by the consumer some frames before, and Pop leaves in the slot
+the previous packet of the consumer. So the memory of the packets (e.g., a vector) circulates between the two threads and it is
+reused: if the producer keeps its packet between the frames and overwrites its contents, there are no allocations at each frame.
+A packet should contain only values (matrices, options of the frame, copies of lists), so the producer can prepare the next frame
+while the consumer reads the previous one, without sharing data. After Push, the contents of the packet are old, and they must be
+overwritten.
+
+N.B. 2)
+The queue has no "close" operation: the producer sends a last packet telling the consumer to exit (see FramePacket in the application).
+
+N.B. 3)
+The head and the tail are in different cache lines, so the two threads do not invalidate each other's cache line at each operation.
+The indices increase without wrapping (a 64 bit counter never overflows), and the slot is the index modulo N.
+
+N.B. 4)
+The queue is checked by frame_queue_test (in lectures_final/tests), which sends many packets between two threads.
+The test does not use OpenGL, so it can be run with a data race detector: MSVC has no ThreadSanitizer, so "make tsan"
+builds and runs the test with clang or gcc (e.g., on Linux), with -fsanitize=thread.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <chrono>
+
+/////////////////// FRAME QUEUE class ///////////////////////
+template <typename T, size_t N>
+class FrameQueue
+{
+public:
+    static_assert(N > 0, "the queue must have at least one slot");
+
+    FrameQueue() {}
+
+    // FrameQueue is not copyable (the threads use its slots)
+    FrameQueue(const FrameQueue&) = delete;
+    FrameQueue& operator=(const FrameQueue&) = delete;
+
+    //////////////////////////////////////////
+
+    // the producer adds a packet: if the queue is full, it waits until the consumer removes one. The packet receives an old packet
+    // released by the consumer (see N.B. 1). It returns the time waited, in milliseconds
+    double Push(T& packet)
+    {
+        uint64_t tail = this->tail.load(memory_order_relaxed);
+        double waited = this->waitFor(this->head, [tail](uint64_t head) { return tail - head < N; });
+        swap(this->slots[tail % N], packet);
+        this->tail.store(tail + 1, memory_order_release);
+        this->tail.notify_one();
+        return waited;
+    }
+
+    // the consumer removes the oldest packet: if the queue is empty, it waits until the producer adds one. The previous contents
+    // of the packet are left in the slot, to be reused by the producer (see N.B. 1). It returns the time waited, in milliseconds
+    double Pop(T& packet)
+    {
+        uint64_t head = this->head.load(memory_order_relaxed);
+        double waited = this->waitFor(this->tail, [head](uint64_t tail) { return tail != head; });
+        swap(this->slots[head % N], packet);
+        this->head.store(head + 1, memory_order_release);
+        this->head.notify_one();
+        return waited;
+    }
+
+    // number of packets in the queue (approximate, if called while the other thread is working)
+    size_t Size() const
+    {
+        return (size_t)(this->tail.load(memory_order_acquire) - this->head.load(memory_order_acquire));
+    }
+
+private:
+    T slots[N];
+    // next slot to read (written only by the consumer), and next slot to write (written only by the producer) (see N.B. 3)
+    alignas(64) atomic<uint64_t> head{ 0 };
+    alignas(64) atomic<uint64_t> tail{ 0 };
+
+    // we wait until the index of the other thread satisfies the condition
+    template <typename Condition>
+    static double waitFor(const atomic<uint64_t>& index, Condition condition)
+    {
+        uint64_t value = index.load(memory_order_acquire);
+        if (condition(value))
+            return 0.0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        while (!condition(value))
+        {
+            index.wait(value, memory_order_acquire);
+            value = index.load(memory_order_acquire);
+        }
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+};
@@ -0,0 +1,240 @@
+/*
+FrameScheduler class
+- time-sliced execution of expensive but non-urgent work (e.g., the compaction of a cache, the rebuilding of an acceleration structure):
+  the work is divided in short steps, and at each frame the scheduler executes steps only until a time budget (in milliseconds) is spent.
+  A heavy task is spread over many frames, instead of causing a spike in the frame time
+- a task is a "resumable" function: it is called once for each step, it keeps its state between the calls (e.g., in the captures of a
+  lambda), and it returns true when the work is completed
+- each task has a priority, and optionally a deadline (milliseconds from its submission): the tasks past their deadline are executed
+  first, and the missed deadlines are counted in the statistics
+- starvation: a task waiting for many frames gains a priority level every SCHEDULER_AGING_FRAMES frames, so the low priority tasks
+  progress also when the high priority tasks use all the budget
+
+N.B. 1)
+The steps must be short compared to the budget: before each step, the scheduler estimates its duration (average of the previous
+steps of the task), and it does not start a step which would exceed the budget (another task with shorter steps can be executed).
+At least a step is executed at each frame, so the work always progresses (like the Update of the AssetStreamer, see asset_streamer.h):
+a step longer than the budget causes a spike in the frame time.
+
+N.B. 2)
+Update() must be called once per frame, by the thread executing the tasks (the render thread of the application, where the OpenGL
+context is current, so the steps can use the OpenGL API). The tasks must be submitted and cancelled by the same thread.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+#include <utils/logger.h>
+
+// priority of the tasks
+enum TaskPriority { TASK_PRIORITY_LOW = 0, TASK_PRIORITY_NORMAL = 1, TASK_PRIORITY_HIGH = 2 };
+
+// frames of waiting to gain a priority level (see starvation above)
+const GLuint SCHEDULER_AGING_FRAMES = 30;
+// weight of the last step in the estimated duration of the steps of a task
+const double SCHEDULER_STEP_WEIGHT = 0.25;
+
+/////////////////// FRAMESCHEDULER class ///////////////////////
+class FrameScheduler
+{
+public:
+    // We want FrameScheduler to be non-copyable (the tasks are owned by the scheduler)
+    FrameScheduler(const FrameScheduler&) = delete;
+    FrameScheduler& operator=(const FrameScheduler&) = delete;
+
+    //////////////////////////////////////////
+
+    // constructor: time budget of each frame, in milliseconds
+    explicit FrameScheduler(double budgetMs = 2.0) : budget(budgetMs) {}
+
+    //////////////////////////////////////////
+
+    // we add a task: step is called at each step, until it returns true. deadlineMs is the time (from now) before which the task
+    // should be completed (0 = no deadline). It returns the identifier of the task
+    GLuint Submit(const string& name, function<bool()> step, TaskPriority priority = TASK_PRIORITY_NORMAL, double deadlineMs = 0.0)
+    {
+        Task task;
+        task.id = ++this->lastId;
+        task.name = name;
+        task.step = std::move(step);
+        task.priority = priority;
+        task.submitted = chrono::steady_clock::now();
+        task.hasDeadline = deadlineMs > 0.0;
+        if (task.hasDeadline)
+            task.deadline = task.submitted + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(deadlineMs));
+        this->tasks.push_back(std::move(task));
+        return this->lastId;
+    }
+
+    // we remove a task not yet completed (its steps are not executed anymore)
+    void Cancel(GLuint id)
+    {
+        this->tasks.erase(remove_if(this->tasks.begin(), this->tasks.end(), [id](const Task& task) { return task.id == id; }), this->tasks.end());
+    }
+
+    // true if the task is not yet completed
+    bool Pending(GLuint id) const
+    {
+        return any_of(this->tasks.begin(), this->tasks.end(), [id](const Task& task) { return task.id == id; });
+    }
+
+    // number of tasks not yet completed
+    size_t Size() const
+    {
+        return this->tasks.size();
+    }
+
+    // time budget of each frame, in milliseconds
+    void SetBudget(double budgetMs) { this->budget = budgetMs; }
+    double Budget() const { return this->budget; }
+
+    //////////////////////////////////////////
+
+    // called once per frame: we execute the steps of the tasks, in order of urgency, until the budget is spent (see N.B. 1)
+    void Update()
+    {
+        this->lastFrameMs = 0.0;
+        if (this->tasks.empty())
+            return;
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        // order of execution: the tasks past their deadline (the earliest deadline first), then the tasks with the highest priority
+        // (increased by the waiting, see SCHEDULER_AGING_FRAMES), then the earliest deadline, then the order of submission
+        for (Task& task : this->tasks)
+            task.ranThisFrame = false;
+        sort(this->tasks.begin(), this->tasks.end(), [start](const Task& a, const Task& b)
+        {
+            const bool lateA = a.hasDeadline && a.deadline <= start, lateB = b.hasDeadline && b.deadline <= start;
+            if (lateA != lateB)
+                return lateA;
+            if (lateA)
+                return a.deadline < b.deadline;
+            const GLuint priorityA = a.EffectivePriority(), priorityB = b.EffectivePriority();
+            if (priorityA != priorityB)
+                return priorityA > priorityB;
+            if (a.hasDeadline != b.hasDeadline)
+                return a.hasDeadline;
+            if (a.hasDeadline && a.deadline != b.deadline)
+                return a.deadline < b.deadline;
+            return a.id < b.id;
+        });
+
+        GLboolean executed = GL_FALSE;
+        for (size_t i = 0; i < this->tasks.size();)
+        {
+            Task& task = this->tasks[i];
+            GLboolean completed = GL_FALSE;
+            // the steps of the task are executed while their estimated duration fits in the rest of the budget
+            while (!executed || elapsed(start) + task.stepMs <= this->budget)
+            {
+                const chrono::steady_clock::time_point stepStart = chrono::steady_clock::now();
+                completed = task.step();
+                const double stepMs = elapsed(stepStart);
+                task.stepMs = (task.steps == 0) ? stepMs : task.stepMs + SCHEDULER_STEP_WEIGHT * (stepMs - task.stepMs);
+                task.totalMs += stepMs;
+                task.steps++;
+                task.ranThisFrame = true;
+                executed = GL_TRUE;
+                if (completed)
+                    break;
+            }
+
+            if (completed)
+            {
+                this->complete(task);
+                this->tasks.erase(this->tasks.begin() + i);
+            }
+            else
+                i++;
+            if (elapsed(start) >= this->budget)
+                break;
+        }
+
+        // the tasks not executed in this frame wait one more frame
+        for (Task& task : this->tasks)
+            task.framesWaiting = task.ranThisFrame ? 0 : task.framesWaiting + 1;
+        this->lastFrameMs = elapsed(start);
+        this->maxFrameMs = max(this->maxFrameMs, this->lastFrameMs);
+        this->overBudgetFrames += (this->lastFrameMs > this->budget) ? 1 : 0;
+        this->busyFrames++;
+    }
+
+    //////////////////////////////////////////
+
+    // time spent by the tasks in the last frame, in milliseconds
+    double LastFrameMs() const { return this->lastFrameMs; }
+
+    // we print on console the statistics of the scheduler, and the pending tasks
+    void PrintStats() const
+    {
+        std::cout << "Frame scheduler (budget " << std::fixed << std::setprecision(2) << this->budget << " ms): " << this->completedTasks
+                  << " tasks completed, " << this->missedDeadlines << " deadlines missed, " << this->busyFrames << " frames with tasks, "
+                  << this->overBudgetFrames << " over budget, max " << this->maxFrameMs << " ms/frame" << std::endl;
+        for (const Task& task : this->tasks)
+            std::cout << "  " << task.name << ": priority " << task.priority << " (effective " << task.EffectivePriority() << "), "
+                      << task.steps << " steps, " << task.totalMs << " ms, " << task.stepMs << " ms/step"
+                      << (task.hasDeadline && task.deadline <= chrono::steady_clock::now() ? ", late" : "") << std::endl;
+    }
+
+private:
+    struct Task
+    {
+        GLuint id = 0;
+        string name;
+        function<bool()> step;
+        TaskPriority priority = TASK_PRIORITY_NORMAL;
+        chrono::steady_clock::time_point submitted;
+        bool hasDeadline = false;
+        chrono::steady_clock::time_point deadline;
+        // frames since the last step executed
+        GLuint framesWaiting = 0;
+        bool ranThisFrame = false;
+        // number of steps, total time, and estimated duration of a step (see N.B. 1)
+        GLuint steps = 0;
+        double totalMs = 0.0;
+        double stepMs = 0.0;
+
+        GLuint EffectivePriority() const
+        {
+            return (GLuint)this->priority + this->framesWaiting / SCHEDULER_AGING_FRAMES;
+        }
+    };
+
+    vector<Task> tasks;
+    GLuint lastId = 0;
+    double budget;
+    // statistics
+    double lastFrameMs = 0.0, maxFrameMs = 0.0;
+    GLuint completedTasks = 0, missedDeadlines = 0, busyFrames = 0, overBudgetFrames = 0;
+
+    static double elapsed(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    // we count the completed tasks, and the missed deadlines
+    void complete(const Task& task)
+    {
+        this->completedTasks++;
+        if (task.hasDeadline && chrono::steady_clock::now() > task.deadline)
+        {
+            this->missedDeadlines++;
+            const double lateMs = elapsed(task.deadline);
+            LOG_WARNING("SCHEDULER", "task " << task.name << " completed " << lateMs << " ms after its deadline");
+        }
+    }
+};
@@ -0,0 +1,81 @@
+/*
+GLBackend class
+- selection of the OpenGL path used to create the buffers of the meshes (see mesh.h) and the textures of the TextureLoader
+  (see texture_loader.h):
+  - Direct State Access (OpenGL 4.5): the objects are created and edited by name (glCreateBuffers, glNamedBufferStorage,
+    glCreateTextures, glTextureStorage2D, glVertexArrayVertexBuffer, ...), without binding them, and with immutable storage
+  - "bind-to-edit" (OpenGL 4.1): the objects are bound to a target to edit them (glBindBuffer + glBufferData,
+    glBindTexture + glTexImage2D), with mutable storage
+- the application requests a 4.5 context, and it falls back to the 4.1 context if the 4.5 one cannot be created
+  (or if the DSA backend is disabled, see the "--gl41" argument of the application)
+
+N.B. 1)
+With DSA, the creation of a resource does not depend on (and does not change) the objects bound to the context: e.g.,
+the creation of a mesh does not unbind the VAO in use, and the creation of a texture does not change the bound texture unit.
+With immutable storage, the size and the format of all the levels are fixed at the creation: the driver can allocate
+the resource once, in the optimal location, and it does not need to check the consistency of the levels at each use.
+
+N.B. 2)
+The textures with partial residency (see mip_streamer.h) and the placeholders (see asset_streamer.h) keep the mutable storage:
+their levels are allocated and released independently. The PBOs are re-allocated at each upload ("orphaning"),
+so they keep the mutable storage too.
+
+N.B. 3)
+The backend is chosen once, after the loading of the OpenGL functions (Init): the contexts shared with the main one
+(e.g., the context of the texture loader) are created with the same version, so the same backend is valid for them.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <algorithm>
+
+/////////////////// GL BACKEND class ///////////////////////
+class GLBackend
+{
+public:
+    // the backend is shared by the whole application
+    static GLBackend& Instance()
+    {
+        static GLBackend backend;
+        return backend;
+    }
+
+    GLBackend(const GLBackend&) = delete;
+    GLBackend& operator=(const GLBackend&) = delete;
+
+    // we choose the backend, after the loading of the OpenGL functions (see N.B. 3).
+    // DSA is used if it is allowed, and if the context supports OpenGL 4.5
+    void Init(bool allowDSA)
+    {
+        this->dsa = allowDSA && GLAD_GL_VERSION_4_5;
+    }
+
+    // true if the resources are created with Direct State Access and immutable storage
+    bool DSA() const { return this->dsa; }
+
+    // name of the backend (for the messages on the console)
+    string Name() const { return this->dsa ? "OpenGL 4.5 DSA" : "OpenGL 4.1"; }
+
+private:
+    GLBackend() {}
+
+    bool dsa = false;
+};
+
+//////////////////////////////////////////
+// number of levels of the complete mipmap chain of a texture
+inline GLsizei MipmapLevels(GLuint width, GLuint height)
+{
+    GLsizei levels = 1;
+    for (GLuint size = max(width, height); size > 1; size >>= 1)
+        levels++;
+    return levels;
+}
@@ -0,0 +1,40 @@
+/*
+Hash functions
+- FNV-1a hash of memory blocks, used to identify the content of the cache files
+  (see mesh_cache.h and program_cache.h)
+
+N.B.) the hash is not a cryptographic hash: it is used only to detect if the data used to create a cache file have changed
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+//////////////////////////////////////////
+// FNV-1a hash of a memory block. The hash of a previous block can be passed as seed, to chain more blocks
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t h = seed;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= bytes[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// hash of a string (chained as HashBytes)
+inline uint64_t HashString(const string& text, uint64_t seed = 14695981039346656037ull)
+{
+    return HashBytes(text.data(), text.size(), seed);
+}
@@ -0,0 +1,174 @@
+/*
+ImportArena class
+- monotonic arena for the temporary data structures of the loading of a model (see LoadMeshesData in model.h):
+  the arena requests a single block (of the size estimated for the load) to the heap, and all the temporaries are allocated
+  moving a pointer in the block. Nothing is released until the destruction of the arena, when the block is freed all at once
+- the arena is a std::pmr::memory_resource, so it can be used by the pmr containers (pmr::vector, pmr::unordered_map, ...):
+  the simplification of the meshes (see mesh_simplify.h) allocates all its temporaries in the arena of the mesh
+- the arena counts the allocations it serves, and the blocks requested to the heap
+- ImportLog collects the statistics of each model load (meshes, arena allocations and heap allocations), printed by PrintReport()
+
+N.B. 1)
+If the estimated size is not enough, the arena requests other blocks to the heap (with geometric growth, see std::pmr::monotonic_buffer_resource):
+the number of heap blocks in the report shows if the estimate must be increased.
+
+N.B. 2)
+An arena must be used by a single thread (std::pmr::monotonic_buffer_resource is not thread-safe):
+the meshes of a model are processed in parallel by the worker threads (see thread_pool.h), each one with its own arena.
+ImportLog can be used by all the threads.
+
+N.B. 3)
+The data of the loaded meshes (MeshData, see mesh.h) are not allocated in the arena, because they must survive the loading:
+they are allocated in the heap with their exact size (one allocation for each vector), and they are transferred to the GPU buffers
+with a single glBufferData call for each buffer (see Mesh::setupMesh in mesh.h). In the report, they are counted as "output buffers".
+The allocations made internally by Assimp are not counted.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <memory_resource>
+#include <mutex>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+// minimum size of the block of an arena (in bytes)
+const size_t IMPORT_ARENA_MIN_BLOCK = 64 * 1024;
+
+/////////////////// IMPORT ARENA class ///////////////////////
+class ImportArena : public pmr::memory_resource
+{
+public:
+    // the first block is allocated (with the estimated size) at the first allocation
+    explicit ImportArena(size_t estimatedBytes) : arena(max(estimatedBytes, IMPORT_ARENA_MIN_BLOCK), &this->heap) {}
+
+    // ImportArena is not copyable and not movable (the containers keep a pointer to it)
+    ImportArena(const ImportArena&) = delete;
+    ImportArena& operator=(const ImportArena&) = delete;
+
+    // number and total size of the allocations served by the arena
+    size_t Allocations() const { return this->allocations; }
+    size_t Bytes() const { return this->bytes; }
+    // number and total size of the blocks requested to the heap
+    size_t HeapBlocks() const { return this->heap.blocks; }
+    size_t HeapBytes() const { return this->heap.bytes; }
+
+private:
+    // the upstream resource of the arena: the blocks are allocated in the heap, and counted
+    struct CountingHeap : public pmr::memory_resource
+    {
+        size_t blocks = 0;
+        size_t bytes = 0;
+
+        void* do_allocate(size_t size, size_t alignment) override
+        {
+            this->blocks++;
+            this->bytes += size;
+            return pmr::new_delete_resource()->allocate(size, alignment);
+        }
+        void do_deallocate(void* p, size_t size, size_t alignment) override
+        {
+            pmr::new_delete_resource()->deallocate(p, size, alignment);
+        }
+        bool do_is_equal(const pmr::memory_resource& other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    // N.B.) the heap must be declared before the arena, which uses it
+    CountingHeap heap;
+    pmr::monotonic_buffer_resource arena;
+    size_t allocations = 0;
+    size_t bytes = 0;
+
+    void* do_allocate(size_t size, size_t alignment) override
+    {
+        this->allocations++;
+        this->bytes += size;
+        return this->arena.allocate(size, alignment);
+    }
+
+    // the memory is released only at the destruction of the arena
+    void do_deallocate(void*, size_t, size_t) override {}
+
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+//////////////////////////////////////////
+// statistics of the loading of a model
+struct ImportStats
+{
+    string path;
+    // "baked", "cache", "assimp" or "compressed" (see LoadMeshesData in model.h)
+    string source;
+    size_t meshes = 0;
+    // allocations served by the arenas, and blocks requested by the arenas to the heap
+    size_t arenaAllocations = 0;
+    size_t arenaBytes = 0;
+    size_t heapBlocks = 0;
+    size_t heapBytes = 0;
+    // heap allocations of the loaded data (see N.B. 3)
+    size_t outputBuffers = 0;
+    double milliseconds = 0.0;
+
+    // we add the counters of an arena
+    void Add(const ImportArena& arena)
+    {
+        this->arenaAllocations += arena.Allocations();
+        this->arenaBytes += arena.Bytes();
+        this->heapBlocks += arena.HeapBlocks();
+        this->heapBytes += arena.HeapBytes();
+    }
+};
+
+/////////////////// IMPORT LOG class ///////////////////////
+class ImportLog
+{
+public:
+    // the log is shared by the whole application
+    static ImportLog& Instance()
+    {
+        static ImportLog log;
+        return log;
+    }
+
+    ImportLog(const ImportLog&) = delete;
+    ImportLog& operator=(const ImportLog&) = delete;
+
+    void Add(const ImportStats& stats)
+    {
+        lock_guard<mutex> lock(this->logMutex);
+        this->loads.push_back(stats);
+    }
+
+    // we print the statistics of all the model loads
+    void PrintReport() const
+    {
+        lock_guard<mutex> lock(this->logMutex);
+        std::cout << "Model loads: " << this->loads.size() << std::endl;
+        for (const ImportStats& stats : this->loads)
+            std::cout << "  " << left << setw(28) << stats.path << setw(11) << stats.source << right
+                      << setw(4) << stats.meshes << " meshes, " << setw(6) << stats.arenaAllocations << " arena allocations ("
+                      << stats.arenaBytes / 1024 << " KB), " << stats.heapBlocks << " heap blocks (" << stats.heapBytes / 1024 << " KB), "
+                      << stats.outputBuffers << " output buffers, " << fixed << setprecision(2) << stats.milliseconds << " ms" << std::endl;
+    }
+
+private:
+    ImportLog() {}
+
+    vector<ImportStats> loads;
+    mutable mutex logMutex;
+};
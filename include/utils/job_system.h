@@ -0,0 +1,519 @@
+/*
+JobSystem class
+- work-stealing scheduler of small jobs: each thread has its own queue of jobs (a Chase-Lev deque). A thread adds and removes
+  the jobs at the bottom of its own queue (LIFO, the data of the last job is still in the cache), and the idle threads steal
+  the jobs from the top of the queues of the other threads (FIFO, the oldest jobs, which are usually the biggest ones)
+- JobCounter: the number of pending jobs of a group. Wait(counter) returns when all the jobs of the group are completed, and the
+  waiting thread executes jobs in the meantime (also the main thread participates to the work, and the jobs can wait for other
+  jobs without blocking a worker). RunAfter starts a job when the jobs of another counter are completed (dependencies)
+- ParallelFor(count, body): the range [0, count) is divided adaptively (see N.B. 2), and body(begin, end) is called on the chunks
+- compared to the ThreadPool (see thread_pool.h), the jobs are not stored in std::function objects in a shared queue protected by a mutex,
+  and the calling thread does not wait for a future: the ThreadPool is still used for the long jobs (e.g., the decoding of an image),
+  the JobSystem for the parallel loops inside them (e.g., the reprojection of the image in a cube map)
+
+N.B. 1)
+The deque is the version of Chase and Lev with the memory orderings of N. M. Le et al., "Correct and Efficient Work-Stealing for
+Weak Memory Models" (PPoPP 2013), with a fixed size (JOB_QUEUE_SIZE): if the queue of a thread is full, the job is executed immediately
+by the thread. The workers have a queue each; the other threads (e.g., the main thread, the render thread, the workers of the ThreadPool)
+receive a queue at their first use of the JobSystem.
+
+N.B. 2)
+ParallelFor uses the "lazy binary splitting": the thread executing a range processes it in chunks, and before each chunk, if its own
+queue is empty (= the other threads have stolen all its jobs, so they are looking for work), it splits the rest of the range in two
+halves, and it pushes the second half in its queue. So the range is divided only when there are idle threads, and the number of jobs
+adapts to the load: without idle threads, a single job processes the whole range, with N idle threads, the range is divided in about
+N parts (and then again, when a thread finishes its part earlier). The size of the chunks is the minimum size passed by the caller,
+increased so there are at most JOB_CHUNKS_PER_THREAD chunks for each thread (the check of the queue is done once for each chunk).
+
+N.B. 3)
+The idle threads spin for a short time (JOB_SPIN_COUNT attempts to find a job), then they sleep on an atomic counter (std::atomic::wait,
+C++20), which is incremented when a job is added or a JobCounter is completed (and notified only if there are sleeping threads).
+
+N.B. 4)
+The jobs must not throw exceptions. A JobCounter must be alive until Wait returns (the thread executing the last job of the group
+sets the counter to 0 while it holds the lock of the continuations, and Wait acquires the lock before returning), and all the jobs
+must be completed before the destruction of the JobSystem. The JobSystem used by the application is Instance(); other instances can be created to measure
+the scaling with a different number of threads (see the "--bench-jobs" argument of the application).
+
+N.B. 5)
+The stealing, the dependencies and the parallel loops are checked by job_system_test (in lectures_final/tests). The test does
+not use OpenGL, so it can be run with a data race detector: MSVC has no ThreadSanitizer, so "make tsan" builds and runs the test
+with clang or gcc (e.g., on Linux), with -fsanitize=thread.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+
+// number of jobs in the queue of a thread (must be a power of two)
+const int64_t JOB_QUEUE_SIZE = 4096;
+// maximum number of chunks of a ParallelFor for each thread (see N.B. 2)
+const size_t JOB_CHUNKS_PER_THREAD = 16;
+// attempts to find a job before sleeping (see N.B. 3)
+const unsigned int JOB_SPIN_COUNT = 64;
+
+class JobSystem;
+class JobCounter;
+
+// a job: a function, with its data and its range of indices (for ParallelFor), and the counter decremented at the end
+struct Job
+{
+    void (*execute)(Job& job) = nullptr;
+    void* data = nullptr;
+    size_t begin = 0;
+    size_t end = 0;
+    JobCounter* counter = nullptr;
+};
+
+/////////////////// JOB COUNTER class ///////////////////////
+class JobCounter
+{
+public:
+    JobCounter() {}
+
+    // JobCounter is not copyable (the jobs keep a pointer to it)
+    JobCounter(const JobCounter&) = delete;
+    JobCounter& operator=(const JobCounter&) = delete;
+
+    // true if all the jobs of the counter are completed
+    bool Done() const { return this->pending.load(memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+
+    atomic<uint32_t> pending{ 0 };
+    // the jobs started when the counter reaches 0 (see RunAfter)
+    mutex continuationsMutex;
+    vector<Job*> continuations;
+};
+
+/////////////////// JOB QUEUE class ///////////////////////
+// Chase-Lev deque (see N.B. 1): Push and Pop are called only by the owner thread, Steal by any thread
+class JobQueue
+{
+public:
+    JobQueue() {}
+
+    JobQueue(const JobQueue&) = delete;
+    JobQueue& operator=(const JobQueue&) = delete;
+
+    // it returns false if the queue is full
+    bool Push(Job* job)
+    {
+        int64_t bottom = this->bottom.load(memory_order_relaxed);
+        int64_t top = this->top.load(memory_order_acquire);
+        if (bottom - top >= JOB_QUEUE_SIZE)
+            return false;
+        this->slots[bottom & (JOB_QUEUE_SIZE - 1)].store(job, memory_order_release);
+        this->bottom.store(bottom + 1, memory_order_release);
+        return true;
+    }
+
+    // the last job pushed (or nullptr if the queue is empty)
+    Job* Pop()
+    {
+        int64_t bottom = this->bottom.load(memory_order_relaxed) - 1;
+        this->bottom.store(bottom, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        int64_t top = this->top.load(memory_order_relaxed);
+        if (top > bottom)
+        {
+            // the queue is empty
+            this->bottom.store(bottom + 1, memory_order_relaxed);
+            return nullptr;
+        }
+        Job* job = this->slots[bottom & (JOB_QUEUE_SIZE - 1)].load(memory_order_acquire);
+        if (top == bottom)
+        {
+            // the last job: the owner and the thieves compete for it
+            if (!this->top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+                job = nullptr;
+            this->bottom.store(bottom + 1, memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // the oldest job (or nullptr if the queue is empty, or another thread has taken it)
+    Job* Steal()
+    {
+        int64_t top = this->top.load(memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        int64_t bottom = this->bottom.load(memory_order_acquire);
+        if (top >= bottom)
+            return nullptr;
+        Job* job = this->slots[top & (JOB_QUEUE_SIZE - 1)].load(memory_order_acquire);
+        if (!this->top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+            return nullptr;
+        return job;
+    }
+
+    // approximate, if called by a thread different from the owner
+    bool Empty() const
+    {
+        return this->bottom.load(memory_order_relaxed) <= this->top.load(memory_order_relaxed);
+    }
+
+private:
+    // the top is written by the thieves, the bottom by the owner: they are in different cache lines
+    alignas(64) atomic<int64_t> top{ 0 };
+    alignas(64) atomic<int64_t> bottom{ 0 };
+    atomic<Job*> slots[JOB_QUEUE_SIZE];
+};
+
+/////////////////// JOB SYSTEM class ///////////////////////
+class JobSystem
+{
+public:
+    // We want JobSystem to be neither copied nor moved (the threads keep a pointer to the instance)
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    //////////////////////////////////////////
+
+    // constructor
+    // if numThreads is 0, we use all the available hardware threads except one (the thread waiting for the jobs executes them too)
+    explicit JobSystem(unsigned int numThreads = 0) : id(NextId().fetch_add(1))
+    {
+        unsigned int hw = max(thread::hardware_concurrency(), 1u);
+        if (numThreads == 0)
+            numThreads = (hw > 1) ? hw - 1 : 1;
+        // a queue for each worker, and for the other threads using the system (see N.B. 1)
+        this->capacity = numThreads + max(2 * hw, 64u);
+        this->queues = make_unique<atomic<JobQueue*>[]>(this->capacity);
+        for (size_t i = 0; i < this->capacity; i++)
+            this->queues[i].store(nullptr, memory_order_relaxed);
+        for (unsigned int i = 0; i < numThreads; i++)
+            this->queues[i].store(new JobQueue(), memory_order_relaxed);
+        this->numQueues.store(numThreads, memory_order_release);
+        for (unsigned int i = 0; i < numThreads; i++)
+            this->workers.emplace_back([this, i] { this->workerLoop(i); });
+    }
+
+    // destructor: the workers are stopped (all the jobs must be completed, see N.B. 4)
+    ~JobSystem()
+    {
+        this->stopping.store(true, memory_order_release);
+        this->wake();
+        for (thread& worker : this->workers)
+            worker.join();
+        for (size_t i = 0; i < this->capacity; i++)
+            delete this->queues[i].load(memory_order_relaxed);
+    }
+
+    //////////////////////////////////////////
+
+    // number of worker threads
+    unsigned int Size() const { return (unsigned int)this->workers.size(); }
+
+    // system shared by the whole application, created at the first use
+    static JobSystem& Instance()
+    {
+        static JobSystem system;
+        return system;
+    }
+
+    //////////////////////////////////////////
+
+    // we start a job of the group of the counter
+    template<class F>
+    void Run(JobCounter& counter, F&& function)
+    {
+        counter.pending.fetch_add(1, memory_order_relaxed);
+        this->schedule(this->functionJob(counter, std::forward<F>(function)));
+    }
+
+    // we start a job of the group of the counter, when all the jobs of the dependency are completed
+    template<class F>
+    void RunAfter(JobCounter& dependency, JobCounter& counter, F&& function)
+    {
+        counter.pending.fetch_add(1, memory_order_relaxed);
+        Job* job = this->functionJob(counter, std::forward<F>(function));
+        {
+            lock_guard<mutex> lock(dependency.continuationsMutex);
+            if (!dependency.Done())
+            {
+                dependency.continuations.push_back(job);
+                return;
+            }
+        }
+        this->schedule(job);
+    }
+
+    // we wait for the jobs of the counter, executing jobs in the meantime
+    void Wait(JobCounter& counter)
+    {
+        JobQueue* queue = this->localQueue();
+        unsigned int spins = 0;
+        while (!counter.Done())
+        {
+            uint32_t seen = this->signal.load(memory_order_acquire);
+            if (Job* job = this->find(queue))
+            {
+                this->execute(*job);
+                spins = 0;
+                continue;
+            }
+            if (counter.Done())
+                break;
+            if (++spins < JOB_SPIN_COUNT)
+                this_thread::yield();
+            else
+                this->sleep(seen);
+        }
+        // the thread completing the last job may still hold the lock: after Wait, the counter can be destroyed
+        lock_guard<mutex> lock(counter.continuationsMutex);
+    }
+
+    // we call body(begin, end) on chunks of [0, count), in parallel (see N.B. 2). The calling thread executes a part of the range
+    template<class F>
+    void ParallelFor(size_t count, F&& body, size_t minChunk = 1)
+    {
+        if (count == 0)
+            return;
+        const size_t threads = this->Size() + 1;
+        const size_t maxChunks = threads * JOB_CHUNKS_PER_THREAD;
+        const size_t chunk = max(max(minChunk, (size_t)1), (count + maxChunks - 1) / maxChunks);
+        if (count <= chunk || this->workers.empty())
+        {
+            body((size_t)0, count);
+            return;
+        }
+
+        // each job starts at a different chunk, so the jobs are at most the chunks
+        using Body = typename remove_reference<F>::type;
+        RangeData<Body> data;
+        data.system = this;
+        data.body = &body;
+        data.chunk = chunk;
+        data.jobs.resize((count + chunk - 1) / chunk);
+        JobCounter counter;
+        counter.pending.store(1, memory_order_relaxed);
+        Job& root = data.jobs[data.allocated++];
+        root.execute = &JobSystem::executeRange<Body>;
+        root.data = &data;
+        root.begin = 0;
+        root.end = count;
+        root.counter = &counter;
+        this->execute(root);
+        this->Wait(counter);
+    }
+
+private:
+    // data of a ParallelFor, shared by its jobs
+    template<class Body>
+    struct RangeData
+    {
+        JobSystem* system;
+        Body* body;
+        size_t chunk;
+        vector<Job> jobs;
+        atomic<size_t> allocated{ 0 };
+    };
+
+    // a job of Run and RunAfter, with its function (it is deleted after the execution)
+    struct FunctionJob
+    {
+        Job job;
+        function<void()> body;
+    };
+
+    // identifier of the instance, for the queues of the threads (see localQueue)
+    const uint64_t id;
+    vector<thread> workers;
+    // queues of the workers (the first ones) and of the other threads (see N.B. 1)
+    unique_ptr<atomic<JobQueue*>[]> queues;
+    size_t capacity = 0;
+    atomic<size_t> numQueues{ 0 };
+    // it is incremented when a job is added, or a counter is completed (see N.B. 3)
+    atomic<uint32_t> signal{ 0 };
+    atomic<uint32_t> sleeping{ 0 };
+    atomic<bool> stopping{ false };
+
+    static atomic<uint64_t>& NextId()
+    {
+        static atomic<uint64_t> next{ 0 };
+        return next;
+    }
+
+    //////////////////////////////////////////
+
+    // queue of the calling thread in this system: a thread which is not a worker receives a queue at its first call.
+    // It returns nullptr if there are no more queues (the jobs of the thread are executed immediately)
+    JobQueue* localQueue(size_t workerIndex = SIZE_MAX)
+    {
+        thread_local vector<pair<uint64_t, JobQueue*>> registered;
+        for (const pair<uint64_t, JobQueue*>& entry : registered)
+            if (entry.first == this->id)
+                return entry.second;
+        JobQueue* queue = nullptr;
+        if (workerIndex != SIZE_MAX)
+            queue = this->queues[workerIndex].load(memory_order_acquire);
+        else
+        {
+            size_t index = this->numQueues.fetch_add(1, memory_order_acq_rel);
+            if (index < this->capacity)
+            {
+                queue = new JobQueue();
+                this->queues[index].store(queue, memory_order_release);
+            }
+        }
+        registered.push_back({ this->id, queue });
+        return queue;
+    }
+
+    template<class F>
+    Job* functionJob(JobCounter& counter, F&& function)
+    {
+        FunctionJob* functionJob = new FunctionJob{ Job(), std::forward<F>(function) };
+        functionJob->job.execute = [](Job& job)
+        {
+            FunctionJob* functionJob = (FunctionJob*)job.data;
+            functionJob->body();
+            delete functionJob;
+        };
+        functionJob->job.data = functionJob;
+        functionJob->job.counter = &counter;
+        return &functionJob->job;
+    }
+
+    // we add a job to the queue of the calling thread (if the queue is full, the job is executed immediately)
+    void schedule(Job* job)
+    {
+        JobQueue* queue = this->localQueue();
+        if (queue && queue->Push(job))
+            this->wake();
+        else
+            this->execute(*job);
+    }
+
+    void execute(Job& job)
+    {
+        // the job can be deleted by its execution
+        JobCounter* counter = job.counter;
+        job.execute(job);
+        if (!counter)
+            return;
+        // we decrement the counter, unless this is the last job of the group
+        uint32_t pending = counter->pending.load(memory_order_acquire);
+        while (pending > 1 && !counter->pending.compare_exchange_weak(pending, pending - 1, memory_order_acq_rel))
+            ;
+        if (pending == 1)
+        {
+            // the last job: the counter reaches 0 under the lock (see N.B. 4), the jobs depending on it are started,
+            // and the threads waiting for it are woken up
+            vector<Job*> continuations;
+            {
+                lock_guard<mutex> lock(counter->continuationsMutex);
+                continuations.swap(counter->continuations);
+                counter->pending.store(0, memory_order_release);
+            }
+            for (Job* continuation : continuations)
+                this->schedule(continuation);
+            this->wake();
+        }
+    }
+
+    // a job of the queue of the calling thread, or stolen from another thread
+    Job* find(JobQueue* queue)
+    {
+        if (queue)
+            if (Job* job = queue->Pop())
+                return job;
+        size_t numQueues = min(this->numQueues.load(memory_order_acquire), this->capacity);
+        if (numQueues == 0)
+            return nullptr;
+        // the thieves start from different queues
+        thread_local size_t start = 0;
+        start++;
+        for (size_t i = 0; i < numQueues; i++)
+        {
+            JobQueue* victim = this->queues[(start + i) % numQueues].load(memory_order_acquire);
+            if (victim && victim != queue)
+                if (Job* job = victim->Steal())
+                    return job;
+        }
+        return nullptr;
+    }
+
+    // we sleep until the signal changes (see N.B. 3)
+    void sleep(uint32_t seen)
+    {
+        this->sleeping.fetch_add(1, memory_order_seq_cst);
+        this->signal.wait(seen, memory_order_seq_cst);
+        this->sleeping.fetch_sub(1, memory_order_relaxed);
+    }
+
+    void wake()
+    {
+        this->signal.fetch_add(1, memory_order_seq_cst);
+        if (this->sleeping.load(memory_order_seq_cst) > 0)
+            this->signal.notify_all();
+    }
+
+    // a range of a ParallelFor: before each chunk, the rest of the range is split if the queue is empty (see N.B. 2)
+    template<class Body>
+    static void executeRange(Job& job)
+    {
+        RangeData<Body>& data = *(RangeData<Body>*)job.data;
+        JobSystem& system = *data.system;
+        JobQueue* queue = system.localQueue();
+        size_t begin = job.begin, end = job.end;
+        while (begin < end)
+        {
+            const size_t chunks = (end - begin + data.chunk - 1) / data.chunk;
+            if (chunks > 1 && queue && queue->Empty())
+            {
+                const size_t middle = begin + (chunks / 2) * data.chunk;
+                Job& half = data.jobs[data.allocated.fetch_add(1, memory_order_relaxed)];
+                half = job;
+                half.begin = middle;
+                half.end = end;
+                job.counter->pending.fetch_add(1, memory_order_relaxed);
+                system.schedule(&half);
+                end = middle;
+                continue;
+            }
+            const size_t last = min(begin + data.chunk, end);
+            (*data.body)(begin, last);
+            begin = last;
+        }
+    }
+
+    //////////////////////////////////////////
+
+    // each worker executes the jobs of its queue, or steals them, and it sleeps when there are no jobs (see N.B. 3)
+    void workerLoop(size_t index)
+    {
+        JobQueue* queue = this->localQueue(index);
+        unsigned int spins = 0;
+        while (!this->stopping.load(memory_order_acquire))
+        {
+            uint32_t seen = this->signal.load(memory_order_acquire);
+            if (Job* job = this->find(queue))
+            {
+                this->execute(*job);
+                spins = 0;
+                continue;
+            }
+            if (++spins < JOB_SPIN_COUNT)
+                this_thread::yield();
+            else if (!this->stopping.load(memory_order_acquire))
+                this->sleep(seen);
+        }
+    }
+};
@@ -0,0 +1,172 @@
+/*
+Level of Detail selection
+- at each frame, we compute the size on screen of each object, using its bounding sphere and the current projection matrix
+- the LOD is chosen as the coarsest one whose geometric error, projected on screen, is below a threshold (in pixels)
+- objects smaller than a pixel are not drawn at all
+
+N.B. 1)
+To avoid "flickering" between two LODs (or between visible and not visible) when the projected error is close to the threshold,
+we use hysteresis: a coarser LOD is chosen only when its error is well below the threshold (threshold * (1 - hysteresis)),
+while a finer LOD is chosen as soon as the current one exceeds the threshold.
+
+N.B. 2)
+The transition between two LODs is not instantaneous: for a short time both LODs are drawn, using complementary
+"screen-door" (ordered dithering) patterns in the fragment shader. The fragments of the new LOD gradually replace the ones of the old LOD.
+The shaders must declare the "lodFade" uniform (see DrawModelLOD for its meaning).
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include <utils/model.h>
+
+// parameters of the LOD selection
+struct LODSettings
+{
+    // if false, the full resolution mesh is always used
+    GLboolean enabled = GL_TRUE;
+    // maximum geometric error on screen (in pixels)
+    GLfloat pixelError = 1.0f;
+    // hysteresis, as a fraction of the threshold
+    GLfloat hysteresis = 0.25f;
+    // objects with a projected diameter (in pixels) smaller than this value are not drawn
+    GLfloat cullPixelSize = 1.0f;
+    // duration of the dithered transition between two LODs (in seconds)
+    GLfloat fadeDuration = 0.3f;
+};
+
+// LOD state of an object: it must be kept between frames
+struct LODState
+{
+    // LOD currently used
+    GLuint current = 0;
+    // LOD used before the last change (-1 if no transition is in progress)
+    GLint previous = -1;
+    // progress of the transition (1 = completed)
+    GLfloat fade = 1.0f;
+    // false if the object is too small to be drawn
+    GLboolean visible = GL_TRUE;
+    // projected diameter of the object, in pixels (last computed value)
+    GLfloat pixelSize = 0.0f;
+};
+
+//////////////////////////////////////////
+// uniform scale applied by a model matrix (= length of the longest transformed axis)
+inline GLfloat MaxScale(const glm::mat4& modelMatrix)
+{
+    return max(glm::length(glm::vec3(modelMatrix[0])), max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+}
+
+//////////////////////////////////////////
+// number of pixels corresponding to 1 unit in view coordinates, at the given distance from the camera
+// (projection[1][1] = cot(fovY/2): the projected size of an object with height h at distance d is h * projection[1][1] / d in NDC, and NDC [-1,1] spans the viewport height)
+inline GLfloat PixelsPerUnit(const glm::mat4& projection, GLfloat viewportHeight, GLfloat distance)
+{
+    return projection[1][1] * viewportHeight * 0.5f / max(distance, 1e-4f);
+}
+
+//////////////////////////////////////////
+// we select the LOD of a model, given its transformation, and we update the transition state
+inline void UpdateLOD(LODState& state, const Model& model, const glm::mat4& modelMatrix, const glm::mat4& view, const glm::mat4& projection,
+                      GLfloat viewportHeight, GLfloat deltaTime, const LODSettings& settings)
+{
+    // bounding sphere in view coordinates
+    glm::vec3 center;
+    GLfloat radius;
+    model.BoundingSphere(center, radius);
+    GLfloat scale = MaxScale(modelMatrix);
+    glm::vec3 viewCenter = glm::vec3(view * modelMatrix * glm::vec4(center, 1.0f));
+    GLfloat worldRadius = radius * scale;
+
+    // distance of the nearest point of the sphere. If the camera is inside the sphere (or LOD selection is disabled), we use the full resolution mesh
+    GLfloat distance = glm::length(viewCenter) - worldRadius;
+    GLuint target = state.current;
+    if (!settings.enabled || distance <= 0.0f)
+    {
+        target = 0;
+        state.visible = GL_TRUE;
+        state.pixelSize = viewportHeight;
+    }
+    else
+    {
+        GLfloat pixelsPerUnit = PixelsPerUnit(projection, viewportHeight, distance);
+        state.pixelSize = 2.0f * worldRadius * pixelsPerUnit;
+
+        // sub-pixel objects are skipped (with hysteresis, to avoid popping)
+        if (state.visible)
+            state.visible = state.pixelSize >= settings.cullPixelSize;
+        else
+            state.visible = state.pixelSize >= settings.cullPixelSize * (1.0f + settings.hysteresis);
+
+        // projected error of a LOD, in pixels
+        auto projectedError = [&](GLuint lod) { return model.LODError(lod) * scale * pixelsPerUnit; };
+        const GLuint numLODs = model.NumLODs();
+        target = min(target, numLODs - 1);
+        // we move to coarser LODs only if the error is below the threshold reduced by the hysteresis
+        while (target + 1 < numLODs && projectedError(target + 1) <= settings.pixelError * (1.0f - settings.hysteresis))
+            target++;
+        // we move to finer LODs as soon as the current one exceeds the threshold
+        while (target > 0 && projectedError(target) > settings.pixelError)
+            target--;
+    }
+
+    // a new transition starts when the LOD changes
+    if (target != state.current)
+    {
+        state.previous = (GLint)state.current;
+        state.current = target;
+        state.fade = 0.0f;
+    }
+
+    // transition update
+    if (state.previous >= 0)
+    {
+        state.fade += (settings.fadeDuration > 0.0f) ? deltaTime / settings.fadeDuration : 1.0f;
+        if (state.fade >= 1.0f)
+        {
+            state.fade = 1.0f;
+            state.previous = -1;
+        }
+    }
+}
+
+//////////////////////////////////////////
+// we draw the model using the LOD selected by UpdateLOD. During a transition, both LODs are drawn with complementary dithering patterns.
+// lodFadeLocation is the location of the "lodFade" uniform in the current Shader Program:
+// - lodFade = 0: all the fragments are drawn (it is the default value of the uniform, so shaders work also if it is never set)
+// - lodFade in (0,1]: only the fragments with dithering threshold < lodFade are drawn
+// - lodFade in [-1,0): only the fragments with dithering threshold >= -lodFade are drawn
+// It returns the number of triangles submitted to the GPU
+inline GLuint DrawModelLOD(Model& model, const LODState& state, GLint lodFadeLocation)
+{
+    if (!state.visible)
+        return 0;
+
+    GLuint triangles = 0;
+    if (state.previous >= 0)
+    {
+        // we avoid 0, which disables the dithering
+        GLfloat fade = max(state.fade, 1e-3f);
+        // the old LOD "fades out"
+        glUniform1f(lodFadeLocation, -fade);
+        triangles += model.Draw((GLuint)state.previous);
+        // the new LOD "fades in"
+        glUniform1f(lodFadeLocation, fade);
+    }
+
+    triangles += model.Draw(state.current);
+    // we restore the default value for the next draw calls
+    glUniform1f(lodFadeLocation, 0.0f);
+    return triangles;
+}
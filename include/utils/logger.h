@@ -0,0 +1,372 @@
+/*
+Logger class
+- asynchronous logging: the messages are formatted by the calling thread, and added to a lock-free queue.
+  A background thread (the "writer") extracts the messages from the queue, and writes them on the console, flushing once for each batch
+- the messages are sent using the macros LOG_DEBUG, LOG_INFO, LOG_WARNING and LOG_ERROR, with a category and a stream expression:
+  e.g., LOG_ERROR("ASSET_PACK", "invalid pack file " << path); prints "ERROR::ASSET_PACK:: invalid pack file ..."
+  (the messages with level INFO or DEBUG, and an empty category, are printed without prefix)
+- the levels lower than LOG_MIN_LEVEL are removed at compile time (the default is LOG_LEVEL_INFO:
+  e.g., compile with /DLOG_MIN_LEVEL=LOG_LEVEL_DEBUG to enable the debug messages)
+- each call site of the macros has a static LogSite, which limits the number of messages of the site (LOG_SITE_RATE each second),
+  and removes the repeated messages (the same text is printed at most once each LOG_DEDUP_INTERVAL ms): the number of suppressed
+  messages is added to the next message of the site, and the sites with suppressed messages are listed when the application is closed
+
+N.B. 1)
+The queue is a bounded multiple-producers / single-consumer ring buffer (based on the bounded queue of D. Vyukov:
+https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue): a thread sending a message never waits for
+a lock or for the writer. If the queue is full, the message is discarded (and the number of discarded messages is printed by the writer).
+The rate limit of a site is checked before the formatting of the message, so a suppressed message costs only a few atomic operations.
+
+N.B. 2)
+The writer sleeps on an atomic counter (std::atomic::wait, C++20), incremented and notified by the threads sending the messages.
+Flush() waits until all the messages sent before the call have been written: it is used before the synchronous reports on the console
+(e.g., the memory report), so the order of the output is preserved.
+
+N.B. 3)
+The logger is shared by the whole application (Instance()), like the ThreadPool and the AssetSystem. When it is destroyed (at the end
+of the application), the messages in the queue are written, and the messages sent after the destruction (e.g., by the destructors
+of other static objects) are written directly on the console.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <iostream>
+#include <functional>
+#include <cstdint>
+
+// levels of the messages
+enum LogLevel {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR
+};
+
+// messages with a lower level are removed at compile time
+#ifndef LOG_MIN_LEVEL
+    #define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+// number of messages in the queue (must be a power of two)
+const size_t LOG_QUEUE_SIZE = 4096;
+// maximum number of messages of a call site in a second
+const uint32_t LOG_SITE_RATE = 20;
+// minimum interval (in ms) between two messages of a call site with the same text
+const int64_t LOG_DEDUP_INTERVAL = 1000;
+
+// the logger has been destroyed: the messages are written directly (see N.B. 3)
+inline atomic<bool> LoggerClosed{ false };
+
+//////////////////////////////////////////
+inline const char* LogLevelName(LogLevel level)
+{
+    switch (level)
+    {
+        case LOG_LEVEL_DEBUG: return "DEBUG";
+        case LOG_LEVEL_INFO: return "INFO";
+        case LOG_LEVEL_WARNING: return "WARNING";
+        default: return "ERROR";
+    }
+}
+
+// milliseconds from the start of the application
+inline int64_t LogTime()
+{
+    static const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+}
+
+/////////////////// LOG SITE class ///////////////////////
+// a call site of the log macros: a static instance is created for each call site
+class LogSite
+{
+public:
+    const LogLevel level;
+    const char* const category;
+    const char* const file;
+    const int line;
+    // messages not written, because of the rate limit or of the deduplication
+    atomic<size_t> suppressed{ 0 };
+    // next site in the list of all the sites
+    LogSite* next = nullptr;
+
+    LogSite(LogLevel level, const char* category, const char* file, int line) : level(level), category(category), file(file), line(line)
+    {
+        // the site is added to the list (lock-free), to print the suppressed messages at the end
+        this->next = Sites().load(memory_order_relaxed);
+        while (!Sites().compare_exchange_weak(this->next, this, memory_order_release, memory_order_relaxed)) {}
+    }
+
+    LogSite(const LogSite&) = delete;
+    LogSite& operator=(const LogSite&) = delete;
+
+    // head of the list of all the sites
+    static atomic<LogSite*>& Sites()
+    {
+        static atomic<LogSite*> head{ nullptr };
+        return head;
+    }
+
+    // rate limit: it returns false if the site has already sent LOG_SITE_RATE messages in the current second
+    bool Allow()
+    {
+        const int64_t now = LogTime();
+        int64_t start = this->windowStart.load(memory_order_relaxed);
+        if (now - start >= 1000 && this->windowStart.compare_exchange_strong(start, now, memory_order_relaxed))
+            this->windowCount.store(0, memory_order_relaxed);
+        if (this->windowCount.fetch_add(1, memory_order_relaxed) < LOG_SITE_RATE)
+            return true;
+        this->suppressed.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    // deduplication: it returns false if the same text has been sent by the site less than LOG_DEDUP_INTERVAL ms ago
+    bool Unique(const string& message)
+    {
+        const size_t hash = std::hash<string>()(message);
+        const int64_t now = LogTime();
+        if (hash == this->lastHash.load(memory_order_relaxed) && now - this->lastTime.load(memory_order_relaxed) < LOG_DEDUP_INTERVAL)
+        {
+            this->suppressed.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        this->lastHash.store(hash, memory_order_relaxed);
+        this->lastTime.store(now, memory_order_relaxed);
+        return true;
+    }
+
+private:
+    atomic<int64_t> windowStart{ INT64_MIN / 2 };
+    atomic<uint32_t> windowCount{ 0 };
+    atomic<size_t> lastHash{ 0 };
+    atomic<int64_t> lastTime{ INT64_MIN / 2 };
+};
+
+// a message in the queue
+struct LogRecord
+{
+    const LogSite* site = nullptr;
+    string message;
+    // messages of the site suppressed before this one
+    size_t suppressed = 0;
+};
+
+/////////////////// LOGGER class ///////////////////////
+class Logger
+{
+public:
+    // the logger is shared by the whole application (see N.B. 3)
+    static Logger& Instance()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    // We want Logger to be neither copied nor moved
+    Logger(const Logger& copy) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    //////////////////////////////////////////
+
+    // we send a message of a call site (used by the LOG_ macros). It never waits (see N.B. 1)
+    static void Write(LogSite& site, string&& message)
+    {
+        if (!site.Unique(message))
+            return;
+        LogRecord record;
+        record.site = &site;
+        record.message = std::move(message);
+        record.suppressed = site.suppressed.exchange(0, memory_order_relaxed);
+        if (LoggerClosed.load(memory_order_acquire))
+        {
+            cout << Format(record);
+            return;
+        }
+        Instance().push(std::move(record));
+    }
+
+    // we wait until all the messages sent before the call have been written (see N.B. 2)
+    void Flush()
+    {
+        const size_t ticket = this->enqueuePos.load(memory_order_acquire);
+        size_t written = this->written.load(memory_order_acquire);
+        while (written < ticket)
+        {
+            this->written.wait(written, memory_order_acquire);
+            written = this->written.load(memory_order_acquire);
+        }
+    }
+
+    // text of a message, as written on the console
+    static string Format(const LogRecord& record)
+    {
+        const LogSite& site = *record.site;
+        string text;
+        if (site.level >= LOG_LEVEL_WARNING || site.category[0] != '\0')
+            text = string(LogLevelName(site.level)) + "::" + site.category + ":: ";
+        text += record.message;
+        if (record.suppressed > 0)
+            text += " (" + to_string(record.suppressed) + " similar messages suppressed)";
+        return text + "\n";
+    }
+
+    //////////////////////////////////////////
+
+    // destructor: the messages in the queue are written, and the sites with suppressed messages are listed
+    ~Logger()
+    {
+        LoggerClosed.store(true, memory_order_release);
+        this->stopping.store(true, memory_order_release);
+        this->pending.fetch_add(1, memory_order_release);
+        this->pending.notify_one();
+        this->writer.join();
+
+        for (LogSite* site = LogSite::Sites().load(memory_order_acquire); site; site = site->next)
+        {
+            const size_t suppressed = site->suppressed.load(memory_order_relaxed);
+            if (suppressed > 0)
+                cout << "WARNING::LOGGER:: " << suppressed << " messages suppressed at " << site->file << ":" << site->line << "\n";
+        }
+        cout.flush();
+    }
+
+private:
+    // a slot of the ring buffer: the sequence number says if the slot is free or full (see N.B. 1)
+    struct Slot
+    {
+        atomic<size_t> sequence{ 0 };
+        LogRecord record;
+    };
+
+    vector<Slot> slots;
+    // next position for the producers, and for the writer
+    atomic<size_t> enqueuePos{ 0 };
+    size_t dequeuePos = 0;
+    // number of messages written (it is notified to the threads waiting in Flush)
+    atomic<size_t> written{ 0 };
+    // messages discarded because the queue was full
+    atomic<size_t> dropped{ 0 };
+    // incremented and notified for each new message (see N.B. 2)
+    atomic<uint32_t> pending{ 0 };
+    atomic<bool> stopping{ false };
+    thread writer;
+
+    //////////////////////////////////////////
+
+    // constructor: the writer thread is started
+    Logger() : slots(LOG_QUEUE_SIZE)
+    {
+        for (size_t i = 0; i < LOG_QUEUE_SIZE; i++)
+            this->slots[i].sequence.store(i, memory_order_relaxed);
+        this->writer = thread([this] { this->writerLoop(); });
+    }
+
+    //////////////////////////////////////////
+
+    // we add a message to the queue (any thread). If the queue is full, the message is discarded
+    void push(LogRecord&& record)
+    {
+        size_t pos = this->enqueuePos.load(memory_order_relaxed);
+        Slot* slot;
+        for (;;)
+        {
+            slot = &this->slots[pos & (LOG_QUEUE_SIZE - 1)];
+            const size_t sequence = slot->sequence.load(memory_order_acquire);
+            const intptr_t difference = (intptr_t)sequence - (intptr_t)pos;
+            if (difference == 0)
+            {
+                if (this->enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+            {
+                this->dropped.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+            else
+                pos = this->enqueuePos.load(memory_order_relaxed);
+        }
+        slot->record = std::move(record);
+        slot->sequence.store(pos + 1, memory_order_release);
+
+        this->pending.fetch_add(1, memory_order_release);
+        this->pending.notify_one();
+    }
+
+    // we extract all the messages in the queue (writer thread), and we write them. It returns false if the queue was empty
+    bool drain()
+    {
+        string batch;
+        for (;;)
+        {
+            Slot& slot = this->slots[this->dequeuePos & (LOG_QUEUE_SIZE - 1)];
+            if (slot.sequence.load(memory_order_acquire) != this->dequeuePos + 1)
+                break;
+            batch += Format(slot.record);
+            slot.record.message.clear();
+            slot.sequence.store(this->dequeuePos + LOG_QUEUE_SIZE, memory_order_release);
+            this->dequeuePos++;
+        }
+
+        const size_t dropped = this->dropped.exchange(0, memory_order_relaxed);
+        if (dropped > 0)
+            batch += "WARNING::LOGGER:: " + to_string(dropped) + " messages discarded (queue full)\n";
+        if (batch.empty())
+            return false;
+
+        // a single write and flush for the batch
+        cout << batch;
+        cout.flush();
+        this->written.store(this->dequeuePos, memory_order_release);
+        this->written.notify_all();
+        return true;
+    }
+
+    // writer thread: it sleeps until new messages are sent
+    void writerLoop()
+    {
+        for (;;)
+        {
+            const uint32_t seen = this->pending.load(memory_order_acquire);
+            if (this->drain())
+                continue;
+            if (this->stopping.load(memory_order_acquire))
+                break;
+            this->pending.wait(seen, memory_order_acquire);
+        }
+    }
+};
+
+//////////////////////////////////////////
+// log macros: the message is formatted (and the site is checked) only if the level is enabled (see LOG_MIN_LEVEL)
+#define LOG_MESSAGE(level, category, message) \
+    do { \
+        if constexpr ((level) >= LOG_MIN_LEVEL) \
+        { \
+            static LogSite logSite_((level), (category), __FILE__, __LINE__); \
+            if (logSite_.Allow()) \
+            { \
+                ostringstream logStream_; \
+                logStream_ << message; \
+                Logger::Write(logSite_, logStream_.str()); \
+            } \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(category, message) LOG_MESSAGE(LOG_LEVEL_DEBUG, category, message)
+#define LOG_INFO(category, message) LOG_MESSAGE(LOG_LEVEL_INFO, category, message)
+#define LOG_WARNING(category, message) LOG_MESSAGE(LOG_LEVEL_WARNING, category, message)
+#define LOG_ERROR(category, message) LOG_MESSAGE(LOG_LEVEL_ERROR, category, message)
@@ -15,7 +15,20 @@ Moreover, we want to have, CPU-side, a Mesh instance, with associated GPU resour
 
 N.B. 2) no texturing in this version of the class
 
-N.B. 3) based on https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/mesh.h
+N.B. 3)
+After the creation of the GPU buffers, the CPU-side copies of vertices and indices are not needed for rendering:
+by default they are released, to avoid keeping the same data both in RAM and in VRAM.
+The MeshRetention parameter of the constructors allows to keep all the data, or only the positions (e.g., for picking or collisions).
+
+N.B. 4)
+VBO and EBO are recorded in the ResourceRegistry (see resource_registry.h), with the owner active when the mesh is created
+(e.g., the path of the model). The CPU-side data kept by the retention policy are recorded too, identified by the name of the VBO.
+
+N.B. 5)
+With the DSA backend (see gl_backend.h), VBO and EBO have immutable storage, and VAO, VBO and EBO are created and set up
+without binding them (the format of the vertex attributes is separated from the buffer they are read from).
+
+N.B. 6) based on https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/mesh.h
 
 author: Davide Gadia, Michael Marchesan
 
@@ -30,6 +43,10 @@ using namespace std;
 
 // Std. Includes
 #include <vector>
+#include <algorithm>
+
+#include <utils/resource_registry.h>
+#include <utils/gl_backend.h>
 
 // data structure for vertices
 struct Vertex {
@@ -45,12 +62,57 @@ struct Vertex {
     glm::vec3 Bitangent;
 };
 
+// a Level of Detail (LOD) of a mesh: all the LODs share the same vertices, and each LOD is a range of indices in the EBO
+struct MeshLOD {
+    // offset (in number of indices) of the first index of the LOD in the EBO
+    GLuint indexOffset;
+    // number of indices of the LOD
+    GLuint indexCount;
+    // maximum geometric error with respect to the full resolution mesh (in model coordinates)
+    GLfloat error;
+};
+
+// CPU-side data kept by a Mesh after the creation of the GPU buffers
+enum MeshRetention {
+    // only LODs ranges and bounds are kept (the data are needed only to create the buffers)
+    MESH_RETAIN_NONE,
+    // positions, and indices of the full resolution LOD, are kept (e.g., for picking or collisions)
+    MESH_RETAIN_POSITIONS,
+    // vertices and indices are kept
+    MESH_RETAIN_FULL
+};
+
+// CPU-side data of a mesh, before the creation of the GPU buffers
+// (it is used to pass data between the loading/simplification steps, executed also in worker threads, and the Mesh class)
+struct MeshData {
+    vector<Vertex> vertices;
+    // indices of all the LODs, concatenated
+    vector<GLuint> indices;
+    // LODs ranges (if empty, the mesh has a single LOD using all the indices)
+    vector<MeshLOD> lods;
+};
+
 /////////////////// MESH class ///////////////////////
 class Mesh {
 public:
     // data structures for vertices, and indices of vertices (for faces)
+    // N.B.) after the creation of the GPU buffers, they are released if the retention policy is MESH_RETAIN_NONE,
+    // and with MESH_RETAIN_POSITIONS the indices are only the ones of the full resolution LOD
     vector<Vertex> vertices;
     vector<GLuint> indices;
+    // vertex positions (kept only if the retention policy is MESH_RETAIN_POSITIONS)
+    vector<glm::vec3> positions;
+    // retention policy of the CPU-side data
+    MeshRetention retention = MESH_RETAIN_NONE;
+    // number of vertices and indices in the GPU buffers (valid also after the release of the CPU-side data)
+    GLuint numVertices = 0;
+    GLuint numIndices = 0;
+    // Levels of Detail: LOD 0 is the full resolution mesh
+    vector<MeshLOD> lods;
+    // bounding box and bounding sphere (in model coordinates), used e.g. to select the LOD at draw time
+    glm::vec3 boundsMin = glm::vec3(0.0f), boundsMax = glm::vec3(0.0f);
+    glm::vec3 boundingCenter = glm::vec3(0.0f);
+    GLfloat boundingRadius = 0.0f;
     // VAO
     GLuint VAO;
 
@@ -67,10 +129,28 @@ public:
     // Constructor
     // We use initializer list and std::move in order to avoid a copy of the arguments
     // This constructor empties the source vectors (vertices and indices)
-    Mesh(vector<Vertex>& vertices, vector<GLuint>& indices) noexcept
-        : vertices(std::move(vertices)), indices(std::move(indices))
+    Mesh(vector<Vertex>& vertices, vector<GLuint>& indices, MeshRetention retention = MESH_RETAIN_NONE) noexcept
+        : vertices(std::move(vertices)), indices(std::move(indices)), retention(retention)
+    {
+        this->lods.push_back({ 0, (GLuint)this->indices.size(), 0.0f });
+        this->computeBounds();
+        this->setupMesh();
+        this->releaseCPUData();
+        this->registerResources();
+    }
+
+    // Constructor with Levels of Detail
+    // the indices of all the LODs are placed in the same EBO, and each LOD is drawn using its range of indices
+    // This constructor empties the source MeshData
+    Mesh(MeshData& data, MeshRetention retention = MESH_RETAIN_NONE) noexcept
+        : vertices(std::move(data.vertices)), indices(std::move(data.indices)), retention(retention), lods(std::move(data.lods))
     {
+        if (this->lods.empty())
+            this->lods.push_back({ 0, (GLuint)this->indices.size(), 0.0f });
+        this->computeBounds();
         this->setupMesh();
+        this->releaseCPUData();
+        this->registerResources();
     }
 
     // We implement a user-defined move constructor and move assignment
@@ -86,7 +166,9 @@ public:
     // In our case it will no longer imply ownership of the GPU resources and its vectors will be empty.
     Mesh(Mesh&& move) noexcept
         // Calls move for both vectors, which internally consists of a simple pointer swap between the new instance and the source one.
-        : vertices(std::move(move.vertices)), indices(std::move(move.indices)),
+        : vertices(std::move(move.vertices)), indices(std::move(move.indices)), positions(std::move(move.positions)),
+        retention(move.retention), numVertices(move.numVertices), numIndices(move.numIndices), lods(std::move(move.lods)),
+        boundsMin(move.boundsMin), boundsMax(move.boundsMax), boundingCenter(move.boundingCenter), boundingRadius(move.boundingRadius),
         VAO(move.VAO), VBO(move.VBO), EBO(move.EBO)
     {
         move.VAO = 0; // We *could* set VBO and EBO to 0 too,
@@ -103,6 +185,15 @@ public:
         {
             vertices = std::move(move.vertices);
             indices = std::move(move.indices);
+            positions = std::move(move.positions);
+            retention = move.retention;
+            numVertices = move.numVertices;
+            numIndices = move.numIndices;
+            lods = std::move(move.lods);
+            boundsMin = move.boundsMin;
+            boundsMax = move.boundsMax;
+            boundingCenter = move.boundingCenter;
+            boundingRadius = move.boundingRadius;
             VAO = move.VAO;
             VBO = move.VBO;
             EBO = move.EBO;
@@ -126,14 +217,34 @@ public:
     //////////////////////////////////////////
 
     // rendering of mesh
-    void Draw()
+    // the LOD parameter selects the Level of Detail to render (0 = full resolution). If the LOD is not available, we use the coarsest one
+    // it returns the number of triangles submitted to the GPU
+    GLuint Draw(GLuint lod = 0)
     {
+        const MeshLOD& range = this->lods[min(lod, (GLuint)this->lods.size() - 1)];
         // VAO is made "active"
         glBindVertexArray(this->VAO);
         // rendering of data in the VAO
-        glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
+        // the last parameter is the offset (in bytes) of the first index of the LOD in the EBO
+        glDrawElements(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, (GLvoid*)(range.indexOffset * sizeof(GLuint)));
         // VAO is "detached"
         glBindVertexArray(0);
+        return range.indexCount / 3;
+    }
+
+    //////////////////////////////////////////
+
+    // CPU memory used by the mesh data (in bytes)
+    size_t CPUMemoryBytes() const
+    {
+        return this->vertices.capacity() * sizeof(Vertex) + this->indices.capacity() * sizeof(GLuint) +
+               this->positions.capacity() * sizeof(glm::vec3) + this->lods.capacity() * sizeof(MeshLOD);
+    }
+
+    // GPU memory used by VBO and EBO (in bytes)
+    size_t GPUMemoryBytes() const
+    {
+        return (size_t)this->numVertices * sizeof(Vertex) + (size_t)this->numIndices * sizeof(GLuint);
     }
 
 private:
@@ -149,6 +260,14 @@ private:
     // http://www.informit.com/articles/article.aspx?p=1377833&seqNum=8
     void setupMesh()
     {
+        this->numVertices = (GLuint)this->vertices.size();
+        this->numIndices = (GLuint)this->indices.size();
+        if (GLBackend::Instance().DSA())
+        {
+            this->setupMeshDSA();
+            return;
+        }
+
         // we create the buffers
         glGenVertexArrays(1, &this->VAO);
         glGenBuffers(1, &this->VBO);
@@ -186,6 +305,84 @@ private:
         // Unbind VAO (it's always a good thing to unbind any buffer/array to prevent strange bugs), remember: do NOT unbind the EBO, keep it bound to this VAO
         glBindVertexArray(0);    }
 
+    //////////////////////////////////////////
+    // the same setup with Direct State Access (see N.B. 5): nothing is bound to the context
+    void setupMeshDSA()
+    {
+        // we create the buffers, with immutable storage initialized with the data (0 = the data are never changed)
+        glCreateBuffers(1, &this->VBO);
+        glNamedBufferStorage(this->VBO, this->vertices.size() * sizeof(Vertex), &this->vertices[0], 0);
+        glCreateBuffers(1, &this->EBO);
+        glNamedBufferStorage(this->EBO, this->indices.size() * sizeof(GLuint), &this->indices[0], 0);
+
+        // the VAO reads the vertices from the binding point 0 (VBO), and the indices from the EBO
+        glCreateVertexArrays(1, &this->VAO);
+        glVertexArrayVertexBuffer(this->VAO, 0, this->VBO, 0, sizeof(Vertex));
+        glVertexArrayElementBuffer(this->VAO, this->EBO);
+
+        // format of the vertex attributes (with the relative offsets inside the data structure), all read from the binding point 0
+        // these will be the positions to use in the layout qualifiers in the shaders ("layout (location = ...)"")
+        const GLint sizes[] = { 3, 3, 2, 3, 3 };
+        const GLuint offsets[] = { offsetof(Vertex, Position), offsetof(Vertex, Normal), offsetof(Vertex, TexCoords),
+                                   offsetof(Vertex, Tangent), offsetof(Vertex, Bitangent) };
+        for (GLuint attribute = 0; attribute < 5; attribute++)
+        {
+            glEnableVertexArrayAttrib(this->VAO, attribute);
+            glVertexArrayAttribFormat(this->VAO, attribute, sizes[attribute], GL_FLOAT, GL_FALSE, offsets[attribute]);
+            glVertexArrayAttribBinding(this->VAO, attribute, 0);
+        }
+    }
+
+    //////////////////////////////////////////
+    // after the creation of the GPU buffers, we release the CPU-side data not required by the retention policy
+    // N.B.) clear() does not free the memory of a vector: we swap it with an empty (or a trimmed) one
+    void releaseCPUData()
+    {
+        if (this->retention == MESH_RETAIN_FULL)
+            return;
+        if (this->retention == MESH_RETAIN_POSITIONS)
+        {
+            this->positions.reserve(this->vertices.size());
+            for (const Vertex& v : this->vertices)
+                this->positions.push_back(v.Position);
+            const MeshLOD& full = this->lods[0];
+            vector<GLuint>(this->indices.begin() + full.indexOffset, this->indices.begin() + full.indexOffset + full.indexCount).swap(this->indices);
+        }
+        else
+            vector<GLuint>().swap(this->indices);
+        vector<Vertex>().swap(this->vertices);
+    }
+
+    //////////////////////////////////////////
+    // we record VBO, EBO and the CPU-side data kept (if any) in the ResourceRegistry
+    void registerResources()
+    {
+        ResourceRegistry& registry = ResourceRegistry::Instance();
+        registry.Register(RESOURCE_BUFFER, this->VBO, (size_t)this->numVertices * sizeof(Vertex), GL_ARRAY_BUFFER);
+        registry.Register(RESOURCE_BUFFER, this->EBO, (size_t)this->numIndices * sizeof(GLuint), GL_ELEMENT_ARRAY_BUFFER);
+        if (this->retention != MESH_RETAIN_NONE)
+            registry.Register(RESOURCE_CPU, this->VBO, this->CPUMemoryBytes());
+    }
+
+    //////////////////////////////////////////
+    // we compute bounding box and bounding sphere of the vertices
+    // (the sphere is centered in the center of the box: it is not the minimal one, but it is fast to compute and good enough for LOD selection and culling)
+    void computeBounds()
+    {
+        if (this->vertices.empty())
+            return;
+        this->boundsMin = this->boundsMax = this->vertices[0].Position;
+        for (const Vertex& v : this->vertices)
+        {
+            this->boundsMin = glm::min(this->boundsMin, v.Position);
+            this->boundsMax = glm::max(this->boundsMax, v.Position);
+        }
+        this->boundingCenter = (this->boundsMin + this->boundsMax) * 0.5f;
+        this->boundingRadius = 0.0f;
+        for (const Vertex& v : this->vertices)
+            this->boundingRadius = max(this->boundingRadius, glm::length(v.Position - this->boundingCenter));
+    }
+
     //////////////////////////////////////////
 
     void freeGPUresources()
@@ -194,6 +391,9 @@ private:
         // so there's no need for deleting.
         if (VAO)
         {
+            ResourceRegistry::Instance().Release(RESOURCE_BUFFER, this->VBO);
+            ResourceRegistry::Instance().Release(RESOURCE_BUFFER, this->EBO);
+            ResourceRegistry::Instance().Release(RESOURCE_CPU, this->VBO);
             glDeleteVertexArrays(1, &this->VAO);
             glDeleteBuffers(1, &this->VBO);
             glDeleteBuffers(1, &this->EBO);
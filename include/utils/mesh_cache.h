@@ -0,0 +1,160 @@
+/*
+Mesh cache
+- binary cache of the processed meshes of a model (vertices, indices of all the LODs, LODs ranges)
+- the cache file is saved next to the model file (e.g., "earth.obj" -> "earth.obj.meshcache")
+
+When a model is loaded, if a valid cache file exists, the meshes are read directly from it, skipping Assimp loading and LODs generation.
+The cache is valid if:
+- it has been created with the same version of the file format
+- the size and the last modification time of the model file are the same stored in the cache
+- the simplification settings used to generate the LODs are the same (we store a hash of the settings)
+Otherwise, the model is processed again and the cache is overwritten.
+
+N.B. 1) the file format is not portable between architectures with different endianness, it is meant as a local cache only
+
+N.B. 2) model and cache files are accessed through the AssetSystem (see asset_system.h): they can be read also from an asset pack
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <cstdint>
+
+#include <utils/mesh.h>
+#include <utils/mesh_simplify.h>
+#include <utils/asset_system.h>
+#include <utils/logger.h>
+#include <utils/hash.h>
+
+// identifier and version of the cache file format
+const uint32_t MESH_CACHE_MAGIC = 0x4353484D; // "MHSC"
+const uint32_t MESH_CACHE_VERSION = 1;
+
+// header of the cache file
+struct MeshCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    // identification of the source model file
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    // hash of the simplification settings
+    uint64_t settingsHash;
+    uint32_t numMeshes;
+    uint32_t padding;
+};
+
+//////////////////////////////////////////
+// hash of the simplification settings: if they change, the LODs must be generated again
+inline uint64_t HashSimplifySettings(const SimplifySettings& settings)
+{
+    uint64_t h = HashBytes(settings.lodRatios.data(), settings.lodRatios.size() * sizeof(GLfloat));
+    h = HashBytes(&settings.maxError, sizeof(GLfloat), h);
+    h = HashBytes(&settings.normalWeight, sizeof(GLfloat), h);
+    h = HashBytes(&settings.uvWeight, sizeof(GLfloat), h);
+    return h;
+}
+
+//////////////////////////////////////////
+// path of the cache file of a model
+inline string MeshCachePath(const string& modelPath)
+{
+    return modelPath + ".meshcache";
+}
+
+//////////////////////////////////////////
+// size and last modification time of the source model. It returns false if the file does not exist
+inline bool GetSourceFileInfo(const string& path, uint64_t& size, int64_t& time)
+{
+    return AssetSystem::Instance().GetFileInfo(path, size, time);
+}
+
+//////////////////////////////////////////
+// we read the meshes from the cache file. It returns false if the cache does not exist or it is not valid
+inline bool LoadMeshCache(const string& modelPath, const SimplifySettings& settings, vector<MeshData>& meshes)
+{
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!GetSourceFileInfo(modelPath, sourceSize, sourceTime))
+        return false;
+
+    AssetData file;
+    if (!AssetSystem::Instance().Read(MeshCachePath(modelPath), file))
+        return false;
+    // we read the data sequentially from memory
+    size_t position = 0;
+    auto read = [&file, &position](void* dst, size_t size)
+    {
+        if (position + size > file.size)
+            return false;
+        memcpy(dst, file.data + position, size);
+        position += size;
+        return true;
+    };
+
+    MeshCacheHeader header;
+    if (!read(&header, sizeof(header)))
+        return false;
+    if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION ||
+        header.sourceSize != sourceSize || header.sourceTime != sourceTime ||
+        header.settingsHash != HashSimplifySettings(settings))
+        return false;
+
+    vector<MeshData> result(header.numMeshes);
+    for (MeshData& mesh : result)
+    {
+        uint32_t counts[3];
+        if (!read(counts, sizeof(counts)))
+            return false;
+        mesh.vertices.resize(counts[0]);
+        mesh.indices.resize(counts[1]);
+        mesh.lods.resize(counts[2]);
+        if (!read(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex)) ||
+            !read(mesh.indices.data(), mesh.indices.size() * sizeof(GLuint)) ||
+            !read(mesh.lods.data(), mesh.lods.size() * sizeof(MeshLOD)))
+            return false;
+    }
+
+    meshes = std::move(result);
+    return true;
+}
+
+//////////////////////////////////////////
+// we write the processed meshes in the cache file
+inline void SaveMeshCache(const string& modelPath, const SimplifySettings& settings, const vector<MeshData>& meshes)
+{
+    MeshCacheHeader header = {};
+    if (!GetSourceFileInfo(modelPath, header.sourceSize, header.sourceTime))
+        return;
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.settingsHash = HashSimplifySettings(settings);
+    header.numMeshes = (uint32_t)meshes.size();
+
+    ofstream file(MeshCachePath(modelPath), ios::binary | ios::trunc);
+    if (!file)
+    {
+        LOG_WARNING("MESH_CACHE", "impossible to write the cache file for " << modelPath);
+        return;
+    }
+    file.write((const char*)&header, sizeof(header));
+    for (const MeshData& mesh : meshes)
+    {
+        uint32_t counts[3] = { (uint32_t)mesh.vertices.size(), (uint32_t)mesh.indices.size(), (uint32_t)mesh.lods.size() };
+        file.write((const char*)counts, sizeof(counts));
+        file.write((const char*)mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+        file.write((const char*)mesh.indices.data(), mesh.indices.size() * sizeof(GLuint));
+        file.write((const char*)mesh.lods.data(), mesh.lods.size() * sizeof(MeshLOD));
+    }
+}
@@ -0,0 +1,503 @@
+/*
+Compressed meshes
+- compact on-disk representation of the processed meshes of a model, with lossy quantization of the vertex attributes
+- ".cmesh" files: a custom format of the application (it is not Draco-compatible, it only borrows some ideas of Draco,
+  https://google.github.io/draco/):
+  - positions quantized on a grid inside the bounding box of the mesh (positionBits per component)
+  - normals and tangents encoded with the octahedral mapping (2 components of normalBits / tangentBits),
+    bitangents reconstructed from normal, tangent and the handedness sign
+  - texture coordinates quantized inside their range (texCoordBits per component)
+  - each attribute is stored as deltas between consecutive vertices (zigzag + varint), and indices as deltas
+    between consecutive indices, so that the LZ compression (see asset_pack.h) finds many repeated small values
+  The file stores also the LODs: a model loaded from a .cmesh file does not need simplification or a mesh cache
+- the .cmesh files of the models of the application are baked with the "--bake" argument, next to the models (e.g., "saturn.obj" ->
+  "saturn.obj.cmesh"). When a model is loaded (see LoadMeshesData in model.h), its .cmesh file is used instead of the model file,
+  if it has been baked from the current version of the model, with the same simplification settings (like the mesh cache, see mesh_cache.h)
+
+Each mesh of a .cmesh file is an independent chunk: the meshes are decoded in parallel by the worker threads (see thread_pool.h),
+directly in the Vertex layout used by the Mesh class.
+
+N.B. 1)
+Quantization is lossy: with the default settings the position error is below 1/16384 of the size of the bounding box.
+The quantization settings are stored in the file, so the decoder does not need them.
+
+N.B. 2) like the mesh cache, the format is not portable between architectures with different endianness
+
+N.B. 3) a .cmesh file can be loaded also directly (a path ending with ".cmesh"): in this case, the source model is not checked
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <future>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+#include <utils/mesh.h>
+#include <utils/mesh_cache.h>
+#include <utils/thread_pool.h>
+#include <utils/asset_system.h>
+#include <utils/logger.h>
+
+// identifier and version of the compressed mesh format
+const uint32_t COMPRESSED_MESH_MAGIC = 0x48534D43; // "CMSH"
+const uint32_t COMPRESSED_MESH_VERSION = 2;
+
+// quantization of the vertex attributes (number of bits per component)
+struct MeshQuantization
+{
+    GLuint positionBits = 14;
+    GLuint normalBits = 10;
+    GLuint texCoordBits = 12;
+    GLuint tangentBits = 8;
+};
+
+// header of a .cmesh file
+struct CompressedMeshHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numMeshes;
+    uint32_t bits[4];
+    uint32_t padding;
+    // identification of the source model file, and hash of the simplification settings used for the LODs (see N.B. 3)
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint64_t settingsHash;
+};
+
+// model a .cmesh file is baked from (all zeros for a file which is not baked from a model)
+struct CompressedMeshSource
+{
+    uint64_t size = 0;
+    int64_t time = 0;
+    uint64_t settingsHash = 0;
+};
+
+// header of a mesh chunk: it is followed by the LODs, and by the LZ-compressed attribute streams
+struct CompressedMeshChunk
+{
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t numLODs;
+    uint32_t hasTangents;
+    float positionMin[3];
+    float positionMax[3];
+    float texCoordMin[2];
+    float texCoordMax[2];
+    uint64_t streamSize;
+    uint64_t compressedSize;
+};
+
+//////////////////////////////////////////
+// zigzag + varint (LEB128) coding of signed values: small values use a single byte
+inline void WriteVarint(vector<unsigned char>& stream, int32_t value)
+{
+    uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    while (v >= 0x80)
+    {
+        stream.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    stream.push_back((unsigned char)v);
+}
+
+inline bool ReadVarint(const unsigned char*& src, const unsigned char* end, int32_t& value)
+{
+    uint32_t v = 0;
+    for (GLuint shift = 0; shift < 35; shift += 7)
+    {
+        if (src == end)
+            return false;
+        unsigned char byte = *src++;
+        v |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            value = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+//////////////////////////////////////////
+// uniform quantization of a value in [minV, maxV] on 2^bits levels, and its inverse
+inline int32_t QuantizeValue(GLfloat value, GLfloat minV, GLfloat maxV, GLuint bits)
+{
+    const GLfloat levels = (GLfloat)((1u << bits) - 1);
+    const GLfloat t = (maxV > minV) ? (value - minV) / (maxV - minV) : 0.0f;
+    return (int32_t)glm::clamp(t * levels + 0.5f, 0.0f, levels);
+}
+
+inline GLfloat DequantizeValue(int32_t q, GLfloat minV, GLfloat maxV, GLuint bits)
+{
+    return minV + (maxV - minV) * (GLfloat)q / (GLfloat)((1u << bits) - 1);
+}
+
+//////////////////////////////////////////
+// octahedral mapping of a unit vector in [-1, 1]^2 (https://jcgt.org/published/0003/02/01/), and its inverse
+inline glm::vec2 OctahedralEncode(glm::vec3 n)
+{
+    n /= (fabs(n.x) + fabs(n.y) + fabs(n.z));
+    glm::vec2 p(n.x, n.y);
+    if (n.z < 0.0f)
+        p = glm::vec2((1.0f - fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    return p;
+}
+
+inline glm::vec3 OctahedralDecode(glm::vec2 p)
+{
+    glm::vec3 n(p.x, p.y, 1.0f - fabs(p.x) - fabs(p.y));
+    if (n.z < 0.0f)
+        n = glm::vec3((1.0f - fabs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f), (1.0f - fabs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f), n.z);
+    return glm::normalize(n);
+}
+
+//////////////////////////////////////////
+// we encode a mesh in a chunk: the chunk header, the LODs, and the compressed streams are appended to the output
+inline void EncodeMeshChunk(const MeshData& mesh, const MeshQuantization& q, vector<unsigned char>& output)
+{
+    CompressedMeshChunk chunk = {};
+    chunk.numVertices = (uint32_t)mesh.vertices.size();
+    chunk.numIndices = (uint32_t)mesh.indices.size();
+    chunk.numLODs = (uint32_t)mesh.lods.size();
+
+    glm::vec3 minP(0.0f), maxP(0.0f);
+    glm::vec2 minT(0.0f), maxT(0.0f);
+    if (!mesh.vertices.empty())
+    {
+        minP = maxP = mesh.vertices[0].Position;
+        minT = maxT = mesh.vertices[0].TexCoords;
+    }
+    for (const Vertex& v : mesh.vertices)
+    {
+        minP = glm::min(minP, v.Position);
+        maxP = glm::max(maxP, v.Position);
+        minT = glm::min(minT, v.TexCoords);
+        maxT = glm::max(maxT, v.TexCoords);
+        if (glm::dot(v.Tangent, v.Tangent) > 0.0f)
+            chunk.hasTangents = 1;
+    }
+    memcpy(chunk.positionMin, &minP[0], sizeof(chunk.positionMin));
+    memcpy(chunk.positionMax, &maxP[0], sizeof(chunk.positionMax));
+    memcpy(chunk.texCoordMin, &minT[0], sizeof(chunk.texCoordMin));
+    memcpy(chunk.texCoordMax, &maxT[0], sizeof(chunk.texCoordMax));
+
+    // the attributes are written as separate streams (all the positions, then all the normals, ...),
+    // so each stream has homogeneous values, and each value is the delta from the same value of the previous vertex
+    vector<unsigned char> stream;
+    stream.reserve(mesh.vertices.size() * 12 + mesh.indices.size() * 2);
+    auto writeDeltas = [&stream, &mesh](GLuint components, auto quantize)
+    {
+        int32_t previous[3] = { 0, 0, 0 };
+        for (const Vertex& v : mesh.vertices)
+        {
+            int32_t values[3];
+            quantize(v, values);
+            for (GLuint c = 0; c < components; c++)
+            {
+                WriteVarint(stream, values[c] - previous[c]);
+                previous[c] = values[c];
+            }
+        }
+    };
+    writeDeltas(3, [&](const Vertex& v, int32_t* values)
+    {
+        for (GLuint c = 0; c < 3; c++)
+            values[c] = QuantizeValue(v.Position[c], minP[c], maxP[c], q.positionBits);
+    });
+    writeDeltas(2, [&](const Vertex& v, int32_t* values)
+    {
+        glm::vec2 p = OctahedralEncode(glm::dot(v.Normal, v.Normal) > 0.0f ? v.Normal : glm::vec3(0.0f, 0.0f, 1.0f));
+        values[0] = QuantizeValue(p.x, -1.0f, 1.0f, q.normalBits);
+        values[1] = QuantizeValue(p.y, -1.0f, 1.0f, q.normalBits);
+    });
+    writeDeltas(2, [&](const Vertex& v, int32_t* values)
+    {
+        values[0] = QuantizeValue(v.TexCoords.x, minT.x, maxT.x, q.texCoordBits);
+        values[1] = QuantizeValue(v.TexCoords.y, minT.y, maxT.y, q.texCoordBits);
+    });
+    if (chunk.hasTangents)
+    {
+        // the third component is the handedness of the tangent space (sign of the bitangent with respect to cross(N, T))
+        writeDeltas(3, [&](const Vertex& v, int32_t* values)
+        {
+            glm::vec2 p = OctahedralEncode(glm::dot(v.Tangent, v.Tangent) > 0.0f ? v.Tangent : glm::vec3(1.0f, 0.0f, 0.0f));
+            values[0] = QuantizeValue(p.x, -1.0f, 1.0f, q.tangentBits);
+            values[1] = QuantizeValue(p.y, -1.0f, 1.0f, q.tangentBits);
+            values[2] = (glm::dot(glm::cross(v.Normal, v.Tangent), v.Bitangent) < 0.0f) ? 1 : 0;
+        });
+    }
+    int32_t previous = 0;
+    for (GLuint index : mesh.indices)
+    {
+        WriteVarint(stream, (int32_t)index - previous);
+        previous = (int32_t)index;
+    }
+
+    vector<unsigned char> compressed;
+    CompressLZ(stream.data(), stream.size(), compressed);
+    chunk.streamSize = stream.size();
+    chunk.compressedSize = compressed.size();
+
+    const size_t start = output.size();
+    output.resize(start + sizeof(chunk) + mesh.lods.size() * sizeof(MeshLOD));
+    memcpy(&output[start], &chunk, sizeof(chunk));
+    if (!mesh.lods.empty())
+        memcpy(&output[start + sizeof(chunk)], mesh.lods.data(), mesh.lods.size() * sizeof(MeshLOD));
+    output.insert(output.end(), compressed.begin(), compressed.end());
+}
+
+//////////////////////////////////////////
+// we decode a mesh chunk (the chunk header has already been read and validated)
+inline bool DecodeMeshChunk(const CompressedMeshChunk& chunk, const MeshQuantization& q, const unsigned char* lods, const unsigned char* compressed, MeshData& mesh)
+{
+    vector<unsigned char> stream(chunk.streamSize);
+    if (!DecompressLZ(compressed, chunk.compressedSize, stream.data(), stream.size()))
+        return false;
+    const unsigned char* src = stream.data();
+    const unsigned char* end = src + stream.size();
+
+    mesh.vertices.resize(chunk.numVertices);
+    mesh.indices.resize(chunk.numIndices);
+    mesh.lods.resize(chunk.numLODs);
+    if (chunk.numLODs > 0)
+        memcpy(mesh.lods.data(), lods, chunk.numLODs * sizeof(MeshLOD));
+
+    auto readDeltas = [&src, end, &mesh](GLuint components, auto dequantize)
+    {
+        int32_t values[3] = { 0, 0, 0 };
+        for (Vertex& v : mesh.vertices)
+        {
+            for (GLuint c = 0; c < components; c++)
+            {
+                int32_t delta;
+                if (!ReadVarint(src, end, delta))
+                    return false;
+                values[c] += delta;
+            }
+            dequantize(v, values);
+        }
+        return true;
+    };
+    if (!readDeltas(3, [&](Vertex& v, const int32_t* values)
+        {
+            for (GLuint c = 0; c < 3; c++)
+                v.Position[c] = DequantizeValue(values[c], chunk.positionMin[c], chunk.positionMax[c], q.positionBits);
+        }))
+        return false;
+    if (!readDeltas(2, [&](Vertex& v, const int32_t* values)
+        {
+            v.Normal = OctahedralDecode(glm::vec2(DequantizeValue(values[0], -1.0f, 1.0f, q.normalBits), DequantizeValue(values[1], -1.0f, 1.0f, q.normalBits)));
+        }))
+        return false;
+    if (!readDeltas(2, [&](Vertex& v, const int32_t* values)
+        {
+            v.TexCoords.x = DequantizeValue(values[0], chunk.texCoordMin[0], chunk.texCoordMax[0], q.texCoordBits);
+            v.TexCoords.y = DequantizeValue(values[1], chunk.texCoordMin[1], chunk.texCoordMax[1], q.texCoordBits);
+        }))
+        return false;
+    if (chunk.hasTangents)
+    {
+        if (!readDeltas(3, [&](Vertex& v, const int32_t* values)
+            {
+                glm::vec3 t = OctahedralDecode(glm::vec2(DequantizeValue(values[0], -1.0f, 1.0f, q.tangentBits), DequantizeValue(values[1], -1.0f, 1.0f, q.tangentBits)));
+                // we orthogonalize the tangent with respect to the decoded normal (Gram-Schmidt)
+                t = t - v.Normal * glm::dot(v.Normal, t);
+                v.Tangent = (glm::dot(t, t) > 1e-12f) ? glm::normalize(t) : t;
+                v.Bitangent = glm::cross(v.Normal, v.Tangent) * (values[2] ? -1.0f : 1.0f);
+            }))
+            return false;
+    }
+    else
+    {
+        for (Vertex& v : mesh.vertices)
+            v.Tangent = v.Bitangent = glm::vec3(0.0f);
+    }
+
+    int32_t index = 0;
+    for (GLuint& i : mesh.indices)
+    {
+        int32_t delta;
+        if (!ReadVarint(src, end, delta))
+            return false;
+        index += delta;
+        if (index < 0 || (uint32_t)index >= chunk.numVertices)
+            return false;
+        i = (GLuint)index;
+    }
+    return src == end;
+}
+
+//////////////////////////////////////////
+// we write the meshes (with their LODs) in a .cmesh file. It returns false if the file cannot be written
+inline bool SaveCompressedMeshes(const string& path, const vector<MeshData>& meshes, const MeshQuantization& quantization = MeshQuantization(),
+                                 const CompressedMeshSource& source = CompressedMeshSource())
+{
+    CompressedMeshHeader header = {};
+    header.magic = COMPRESSED_MESH_MAGIC;
+    header.version = COMPRESSED_MESH_VERSION;
+    header.numMeshes = (uint32_t)meshes.size();
+    header.sourceSize = source.size;
+    header.sourceTime = source.time;
+    header.settingsHash = source.settingsHash;
+    header.bits[0] = quantization.positionBits;
+    header.bits[1] = quantization.normalBits;
+    header.bits[2] = quantization.texCoordBits;
+    header.bits[3] = quantization.tangentBits;
+
+    // the chunks are encoded in parallel, and written in order
+    vector<vector<unsigned char>> chunks(meshes.size());
+    vector<future<void>> jobs;
+    for (size_t m = 0; m < meshes.size(); m++)
+        jobs.push_back(ThreadPool::Instance().Submit([&meshes, &chunks, &quantization, m] { EncodeMeshChunk(meshes[m], quantization, chunks[m]); }));
+    for (future<void>& job : jobs)
+        job.get();
+
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file)
+    {
+        LOG_ERROR("MESH_COMPRESSION", "impossible to write " << path);
+        return false;
+    }
+    file.write((const char*)&header, sizeof(header));
+    for (const vector<unsigned char>& chunk : chunks)
+        file.write((const char*)chunk.data(), chunk.size());
+    return (bool)file;
+}
+
+//////////////////////////////////////////
+// we decode the meshes of a .cmesh file in memory: each mesh is decoded by a worker thread.
+// If a source is passed, the file must have been baked from it
+inline bool DecodeCompressedMeshes(const AssetData& file, vector<MeshData>& meshes, const CompressedMeshSource* source = nullptr)
+{
+    CompressedMeshHeader header;
+    if (file.size < sizeof(header))
+        return false;
+    memcpy(&header, file.data, sizeof(header));
+    if (header.magic != COMPRESSED_MESH_MAGIC || header.version != COMPRESSED_MESH_VERSION)
+        return false;
+    if (source && (header.sourceSize != source->size || header.sourceTime != source->time || header.settingsHash != source->settingsHash))
+        return false;
+    MeshQuantization quantization;
+    quantization.positionBits = header.bits[0];
+    quantization.normalBits = header.bits[1];
+    quantization.texCoordBits = header.bits[2];
+    quantization.tangentBits = header.bits[3];
+    for (uint32_t bits : header.bits)
+        if (bits == 0 || bits > 24)
+            return false;
+
+    // the chunks are located sequentially (only the headers are read here), then decoded in parallel
+    vector<MeshData> result(header.numMeshes);
+    vector<CompressedMeshChunk> chunks(header.numMeshes);
+    vector<future<bool>> jobs;
+    size_t offset = sizeof(header);
+    for (uint32_t m = 0; m < header.numMeshes; m++)
+    {
+        if (offset + sizeof(CompressedMeshChunk) > file.size)
+            break;
+        memcpy(&chunks[m], file.data + offset, sizeof(CompressedMeshChunk));
+        const unsigned char* lods = file.data + offset + sizeof(CompressedMeshChunk);
+        const unsigned char* compressed = lods + (size_t)chunks[m].numLODs * sizeof(MeshLOD);
+        offset += sizeof(CompressedMeshChunk) + (size_t)chunks[m].numLODs * sizeof(MeshLOD) + chunks[m].compressedSize;
+        if (offset > file.size)
+            break;
+        jobs.push_back(ThreadPool::Instance().Submit([&chunks, &result, quantization, lods, compressed, m]
+            { return DecodeMeshChunk(chunks[m], quantization, lods, compressed, result[m]); }));
+    }
+    GLboolean success = (jobs.size() == header.numMeshes);
+    for (future<bool>& job : jobs)
+        success &= job.get();
+    if (!success)
+        return false;
+    meshes = std::move(result);
+    return true;
+}
+
+//////////////////////////////////////////
+// true if the path is a compressed mesh file (.cmesh)
+inline bool IsCompressedMeshPath(const string& path)
+{
+    auto endsWith = [&path](const string& extension)
+    {
+        return path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+    };
+    return endsWith(".cmesh");
+}
+
+//////////////////////////////////////////
+// we load the meshes of a compressed mesh file (read through the AssetSystem). It returns false if the file is not valid
+inline bool LoadCompressedMeshes(const string& path, vector<MeshData>& meshes)
+{
+    AssetData file;
+    if (!AssetSystem::Instance().Read(path, file))
+    {
+        LOG_ERROR("MESH_COMPRESSION", "impossible to read " << path);
+        return false;
+    }
+    if (!DecodeCompressedMeshes(file, meshes))
+    {
+        LOG_ERROR("MESH_COMPRESSION", "invalid compressed mesh file " << path);
+        return false;
+    }
+    return true;
+}
+
+//////////////////////////////////////////
+// path of the .cmesh file baked from a model
+inline string CompressedMeshPath(const string& modelPath)
+{
+    return modelPath + ".cmesh";
+}
+
+//////////////////////////////////////////
+// identification of a model and of the simplification settings, stored in the .cmesh file baked from it.
+// It returns false if the model does not exist
+inline bool GetCompressedMeshSource(const string& modelPath, const SimplifySettings& settings, CompressedMeshSource& source)
+{
+    if (!GetSourceFileInfo(modelPath, source.size, source.time))
+        return false;
+    source.settingsHash = HashSimplifySettings(settings);
+    return true;
+}
+
+//////////////////////////////////////////
+// we load the meshes of the .cmesh file baked from a model. It returns false if the file does not exist, or it has been baked
+// from a different version of the model, or with different simplification settings: in this case, the model file must be loaded
+inline bool LoadBakedCompressedMeshes(const string& modelPath, const SimplifySettings& settings, vector<MeshData>& meshes)
+{
+    CompressedMeshSource source;
+    if (!GetCompressedMeshSource(modelPath, settings, source))
+        return false;
+    AssetData file;
+    if (!AssetSystem::Instance().Read(CompressedMeshPath(modelPath), file))
+        return false;
+    return DecodeCompressedMeshes(file, meshes, &source);
+}
+
+//////////////////////////////////////////
+// we bake the meshes (with their LODs) of a model in its .cmesh file. It returns false if the file cannot be written
+inline bool BakeCompressedMeshes(const string& modelPath, const SimplifySettings& settings, const vector<MeshData>& meshes,
+                                 const MeshQuantization& quantization = MeshQuantization())
+{
+    CompressedMeshSource source;
+    if (!GetCompressedMeshSource(modelPath, settings, source))
+        return false;
+    return SaveCompressedMeshes(CompressedMeshPath(modelPath), meshes, quantization, source);
+}
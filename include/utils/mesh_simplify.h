@@ -0,0 +1,474 @@
+/*
+Mesh simplification
+- Quadric Error Metrics (QEM) edge-collapse simplification, used to build a chain of Levels of Detail (LODs) for each mesh at loading time
+
+The algorithm is based on:
+M. Garland, P. Heckbert, "Surface Simplification Using Quadric Error Metrics", SIGGRAPH 1997
+https://www.cs.cmu.edu/~garland/Papers/quadrics.pdf
+
+- for each vertex, we accumulate a quadric (= sum of the squared distances from the planes of the adjacent triangles)
+- an edge (a,b) is collapsed moving vertex a onto vertex b ("half-edge collapse"): the cost is the quadric error of the merged quadrics, evaluated at the position of b
+- collapses are performed in order of increasing cost, until the target number of triangles is reached, or the error budget is exhausted
+
+N.B. 1)
+We use half-edge collapses (the surviving vertex is one of the original ones): no new vertices are created,
+so all the LODs of a mesh can share the same vertex buffer, and each LOD is just a different range of indices in the EBO.
+
+N.B. 2)
+The cost used to order the collapses is "attribute-aware": a penalty is added when the two vertices have different normals or UVs.
+The error budget (and the error stored in each LOD, used at draw time to select the LOD) considers only the geometric error.
+
+N.B. 3)
+Vertices sharing the same position but with different attributes (e.g., UV seams, hard edges) and vertices on open borders are "locked":
+they are never removed, so seams and borders are preserved in every LOD.
+
+N.B. 4) the functions work only on CPU-side data, so they can be executed in a worker thread (see thread_pool.h)
+
+N.B. 5)
+All the temporary data structures are allocated in the memory resource passed to the functions (by default, the heap):
+the model loader passes a monotonic arena for each mesh (see import_arena.h), with the size estimated by LODChainArenaBytes,
+so the generation of the LOD chain of a mesh requests a single block to the heap.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <unordered_map>
+#include <memory_resource>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+// the simplification works on the Vertex data structure used by the Mesh class
+#include <utils/mesh.h>
+
+// parameters of the LOD chain generation
+struct SimplifySettings
+{
+    // number of triangles of each LOD, as a fraction of the original mesh (the first one must be the full resolution mesh)
+    vector<GLfloat> lodRatios = { 1.0f, 0.5f, 0.25f, 0.1f };
+    // maximum geometric error allowed, as a fraction of the diagonal of the mesh bounding box.
+    // When the next collapse would exceed this value, the LOD is stopped even if the target number of triangles has not been reached
+    GLfloat maxError = 0.02f;
+    // weights of the attributes penalties in the collapse cost
+    GLfloat normalWeight = 0.5f;
+    GLfloat uvWeight = 1.0f;
+};
+
+/////////////////// QUADRIC ///////////////////////
+// symmetric 4x4 matrix (10 coefficients) representing the sum of the squared distances from a set of planes.
+// We use double precision, because the coefficients are accumulated on many triangles
+struct Quadric
+{
+    double a2 = 0.0, ab = 0.0, ac = 0.0, ad = 0.0;
+    double b2 = 0.0, bc = 0.0, bd = 0.0;
+    double c2 = 0.0, cd = 0.0;
+    double d2 = 0.0;
+    // sum of the weights of the planes: the error is normalized with this value, in order to obtain a squared distance
+    double weight = 0.0;
+
+    // quadric of the plane ax + by + cz + d = 0 (with normalized (a,b,c)), multiplied by the weight w
+    static Quadric FromPlane(double a, double b, double c, double d, double w)
+    {
+        Quadric q;
+        q.a2 = w*a*a; q.ab = w*a*b; q.ac = w*a*c; q.ad = w*a*d;
+        q.b2 = w*b*b; q.bc = w*b*c; q.bd = w*b*d;
+        q.c2 = w*c*c; q.cd = w*c*d;
+        q.d2 = w*d*d;
+        q.weight = w;
+        return q;
+    }
+
+    Quadric& operator+=(const Quadric& q)
+    {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+        weight += q.weight;
+        return *this;
+    }
+
+    // (weighted mean) squared distance of the point p from the planes
+    double Evaluate(const glm::vec3& p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a2*x*x + 2.0*ab*x*y + 2.0*ac*x*z + 2.0*ad*x
+                 + b2*y*y + 2.0*bc*y*z + 2.0*bd*y
+                 + c2*z*z + 2.0*cd*z
+                 + d2;
+        return (weight > 0.0) ? fabs(e) / weight : 0.0;
+    }
+};
+
+//////////////////////////////////////////
+// for each vertex, we compute the index of the first vertex with the same position.
+// Different vertices with the same position are created by the loader when the attributes are different (e.g., UV seams)
+// (positionId can be a vector or a pmr::vector, the hash table is allocated in the memory resource)
+template <typename IdVector>
+inline void ComputePositionRemap(const vector<Vertex>& vertices, IdVector& positionId, pmr::memory_resource* memory = pmr::get_default_resource())
+{
+    // hash of the bit pattern of the 3 coordinates
+    struct PositionHash
+    {
+        size_t operator()(const glm::vec3& p) const
+        {
+            GLuint h[3];
+            memcpy(h, &p, sizeof(h));
+            return (size_t)((h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u));
+        }
+    };
+
+    pmr::unordered_map<glm::vec3, GLuint, PositionHash> firstVertex(memory);
+    firstVertex.reserve(vertices.size());
+    positionId.resize(vertices.size());
+    for (GLuint i = 0; i < vertices.size(); i++)
+        positionId[i] = firstVertex.emplace(vertices[i].Position, i).first->second;
+}
+
+//////////////////////////////////////////
+// estimate of the memory used by the temporary data structures of SimplifyMesh (in bytes), see N.B. 5
+inline size_t SimplifyArenaBytes(size_t numVertices, size_t numIndices)
+{
+    // per vertex: position remap (id + node and bucket of the hash table), wedge count, quadric, adjacency offset,
+    // best collapse (target, cost, error), candidate, collapse target, fill position, plus the bit vectors
+    const size_t perVertex = sizeof(GLuint) + 48 + sizeof(GLuint) + sizeof(Quadric) + sizeof(GLuint)
+                           + sizeof(GLuint) + 2 * sizeof(double) + 3 * sizeof(GLuint) + 1;
+    // per index: current indices, edge keys, adjacency
+    const size_t perIndex = sizeof(GLuint) + sizeof(unsigned long long) + sizeof(GLuint);
+    // a small margin for the alignment of the allocations
+    return numVertices * perVertex + numIndices * perIndex + 4096;
+}
+
+//////////////////////////////////////////
+// Simplification of a list of triangles (the indices refer to the vertices vector), until the number of indices is <= targetIndexCount
+// or the next collapse would exceed maxError (absolute error, in model coordinates).
+// The returned indices still refer to the original vertices vector. If resultError is not null, the geometric error of the result is returned.
+// The result and all the temporaries are allocated in the memory resource (see N.B. 5)
+inline pmr::vector<GLuint> SimplifyMesh(const vector<Vertex>& vertices, const GLuint* indices, size_t numIndices, size_t targetIndexCount,
+                                        GLfloat maxError, const SimplifySettings& settings, GLfloat* resultError = nullptr,
+                                        pmr::memory_resource* memory = pmr::get_default_resource())
+{
+    const GLuint numVertices = (GLuint)vertices.size();
+    pmr::vector<GLuint> current(indices, indices + numIndices, memory);
+    GLfloat error = 0.0f;
+
+    if (current.size() <= targetIndexCount || numVertices == 0)
+    {
+        if (resultError)
+            *resultError = 0.0f;
+        return current;
+    }
+
+    // size of the mesh: the diagonal of the bounding box is used to make the attributes penalties independent from the scale of the model
+    glm::vec3 minP = vertices[0].Position, maxP = vertices[0].Position;
+    for (const Vertex& v : vertices)
+    {
+        minP = glm::min(minP, v.Position);
+        maxP = glm::max(maxP, v.Position);
+    }
+    double diagonal = glm::length(maxP - minP);
+    if (diagonal <= 0.0)
+        diagonal = 1.0;
+    const double maxErrorSq = (double)maxError * (double)maxError;
+
+    // vertices with the same position share topology and quadric
+    pmr::vector<GLuint> positionId(memory);
+    ComputePositionRemap(vertices, positionId, memory);
+
+    // vertices with more than one "wedge" (= same position, different attributes) are locked, to preserve seams
+    pmr::vector<GLuint> wedgeCount(numVertices, 0, memory);
+    for (GLuint i = 0; i < numVertices; i++)
+        wedgeCount[positionId[i]]++;
+    pmr::vector<bool> locked(numVertices, false, memory);
+    for (GLuint i = 0; i < numVertices; i++)
+        locked[i] = wedgeCount[positionId[i]] > 1;
+
+    // vertices on open borders (= edges used by only one triangle) are locked too.
+    // The edges are sorted, so each edge used only once is a key not repeated in the sorted array
+    {
+        pmr::vector<unsigned long long> edges(current.size(), memory);
+        for (size_t t = 0; t < current.size(); t += 3)
+            for (int e = 0; e < 3; e++)
+            {
+                GLuint a = positionId[current[t + e]], b = positionId[current[t + (e + 1) % 3]];
+                edges[t + e] = ((unsigned long long)min(a, b) << 32) | max(a, b);
+            }
+        sort(edges.begin(), edges.end());
+        for (size_t i = 0; i < edges.size(); )
+        {
+            size_t j = i + 1;
+            while (j < edges.size() && edges[j] == edges[i])
+                j++;
+            if (j - i == 1)
+            {
+                locked[(GLuint)(edges[i] >> 32)] = true;
+                locked[(GLuint)(edges[i] & 0xffffffffu)] = true;
+            }
+            i = j;
+        }
+        // the lock is propagated from the "first" vertex of a position to all its wedges
+        for (GLuint i = 0; i < numVertices; i++)
+            if (locked[positionId[i]])
+                locked[i] = true;
+    }
+
+    // quadrics (one for each position), weighted by the area of the triangles
+    pmr::vector<Quadric> quadrics(numVertices, memory);
+    for (size_t t = 0; t < current.size(); t += 3)
+    {
+        const glm::vec3& p0 = vertices[current[t]].Position;
+        const glm::vec3& p1 = vertices[current[t + 1]].Position;
+        const glm::vec3& p2 = vertices[current[t + 2]].Position;
+        glm::dvec3 n = glm::cross(glm::dvec3(p1 - p0), glm::dvec3(p2 - p0));
+        double len = glm::length(n);
+        if (len <= 0.0)
+            continue;
+        n /= len;
+        Quadric q = Quadric::FromPlane(n.x, n.y, n.z, -glm::dot(n, glm::dvec3(p0)), len * 0.5);
+        for (int k = 0; k < 3; k++)
+            quadrics[positionId[current[t + k]]] += q;
+    }
+
+    // data structures reused at each pass (allocated with their maximum size, so they are never reallocated)
+    pmr::vector<GLuint> adjacencyOffsets(numVertices + 1, memory);
+    pmr::vector<GLuint> fillPosition(numVertices, memory);
+    pmr::vector<GLuint> adjacency(memory);
+    adjacency.reserve(current.size());
+    pmr::vector<GLuint> bestTarget(numVertices, memory);
+    pmr::vector<double> bestCost(numVertices, memory), bestGeometricError(numVertices, memory);
+    pmr::vector<GLuint> candidates(memory);
+    candidates.reserve(numVertices);
+    pmr::vector<GLuint> collapseTo(numVertices, memory);
+    pmr::vector<bool> touched(numVertices, memory);
+
+    // each pass collects the cheapest collapse for each vertex, and performs the non-overlapping ones in order of increasing cost
+    while (current.size() > targetIndexCount)
+    {
+        const size_t numTriangles = current.size() / 3;
+
+        // vertex -> triangles adjacency (compressed in a single array)
+        fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+        for (GLuint idx : current)
+            adjacencyOffsets[idx + 1]++;
+        for (GLuint i = 0; i < numVertices; i++)
+            adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+        adjacency.resize(current.size());
+        copy(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1, fillPosition.begin());
+        for (size_t i = 0; i < current.size(); i++)
+            adjacency[fillPosition[current[i]]++] = (GLuint)(i / 3);
+
+        // cheapest collapse for each vertex
+        fill(bestTarget.begin(), bestTarget.end(), numVertices);
+        for (size_t t = 0; t < current.size(); t += 3)
+            for (int e = 0; e < 6; e++)
+            {
+                // the 3 edges of the triangle, in both directions
+                GLuint a = current[t + (e % 3)];
+                GLuint b = current[t + ((e % 3) + (e < 3 ? 1 : 2)) % 3];
+                if (locked[a] || positionId[a] == positionId[b])
+                    continue;
+
+                Quadric q = quadrics[positionId[a]];
+                q += quadrics[positionId[b]];
+                double geometric = q.Evaluate(vertices[b].Position);
+
+                // attributes penalty, proportional to the (squared) length of the collapsed edge
+                double edgeLength = glm::length(vertices[a].Position - vertices[b].Position) / diagonal;
+                double normalDelta = glm::length(vertices[a].Normal - vertices[b].Normal);
+                double uvDelta = glm::length(vertices[a].TexCoords - vertices[b].TexCoords);
+                double attributes = (settings.normalWeight * normalDelta * normalDelta + settings.uvWeight * uvDelta * uvDelta) * edgeLength * edgeLength;
+
+                double cost = geometric / (diagonal * diagonal) + attributes;
+                if (bestTarget[a] == numVertices || cost < bestCost[a])
+                {
+                    bestTarget[a] = b;
+                    bestCost[a] = cost;
+                    bestGeometricError[a] = geometric;
+                }
+            }
+
+        candidates.clear();
+        for (GLuint i = 0; i < numVertices; i++)
+            if (bestTarget[i] != numVertices && bestGeometricError[i] <= maxErrorSq)
+                candidates.push_back(i);
+        if (candidates.empty())
+            break;
+        sort(candidates.begin(), candidates.end(), [&](GLuint a, GLuint b) { return bestCost[a] < bestCost[b]; });
+
+        // number of triangles still to remove
+        const size_t trianglesToRemove = numTriangles - targetIndexCount / 3;
+        size_t removed = 0;
+        GLuint collapses = 0;
+        for (GLuint i = 0; i < numVertices; i++)
+            collapseTo[i] = i;
+        fill(touched.begin(), touched.end(), false);
+
+        for (GLuint a : candidates)
+        {
+            GLuint b = bestTarget[a];
+            // the neighbourhood of a vertex can be modified only once in each pass
+            if (touched[positionId[a]] || touched[positionId[b]])
+                continue;
+
+            // we check that no triangle flips (or becomes degenerate) when a is moved onto b
+            const glm::vec3& target = vertices[b].Position;
+            bool valid = true;
+            size_t removedByCollapse = 0;
+            for (GLuint k = adjacencyOffsets[a]; k < adjacencyOffsets[a + 1] && valid; k++)
+            {
+                const GLuint* tri = &current[adjacency[k] * 3];
+                if (positionId[tri[0]] == positionId[b] || positionId[tri[1]] == positionId[b] || positionId[tri[2]] == positionId[b])
+                {
+                    removedByCollapse++;
+                    continue;
+                }
+                glm::vec3 p[3], q[3];
+                for (int j = 0; j < 3; j++)
+                {
+                    p[j] = vertices[tri[j]].Position;
+                    q[j] = (tri[j] == a) ? target : p[j];
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                float lb = glm::length(before), la = glm::length(after);
+                if (la <= 0.0f || lb <= 0.0f || glm::dot(before, after) < 0.2f * lb * la)
+                    valid = false;
+            }
+            if (!valid)
+                continue;
+
+            // collapse: a is replaced by b, and the quadric of b includes now the planes of a
+            collapseTo[a] = b;
+            quadrics[positionId[b]] += quadrics[positionId[a]];
+            error = max(error, (GLfloat)sqrt(bestGeometricError[a]));
+            collapses++;
+            removed += removedByCollapse;
+
+            // all the vertices of the triangles around a are "touched"
+            for (GLuint k = adjacencyOffsets[a]; k < adjacencyOffsets[a + 1]; k++)
+            {
+                const GLuint* tri = &current[adjacency[k] * 3];
+                for (int j = 0; j < 3; j++)
+                    touched[positionId[tri[j]]] = true;
+            }
+
+            if (removed >= trianglesToRemove)
+                break;
+        }
+
+        if (collapses == 0)
+            break;
+
+        // we apply the collapses, and we remove the degenerate triangles
+        size_t write = 0;
+        for (size_t t = 0; t < current.size(); t += 3)
+        {
+            GLuint i0 = collapseTo[current[t]], i1 = collapseTo[current[t + 1]], i2 = collapseTo[current[t + 2]];
+            if (positionId[i0] == positionId[i1] || positionId[i1] == positionId[i2] || positionId[i0] == positionId[i2])
+                continue;
+            current[write++] = i0;
+            current[write++] = i1;
+            current[write++] = i2;
+        }
+        current.resize(write);
+    }
+
+    if (resultError)
+        *resultError = error;
+    return current;
+}
+
+//////////////////////////////////////////
+// estimate of the memory used by BuildLODChain (in bytes), see N.B. 5:
+// each LOD is simplified from the previous one, and the arena keeps the temporaries of all the simplifications
+inline size_t LODChainArenaBytes(const MeshData& data, const SimplifySettings& settings)
+{
+    const size_t numLODs = settings.lodRatios.size();
+    if (numLODs < 2)
+        return 0;
+    size_t bytes = 0;
+    for (size_t l = 1; l < numLODs; l++)
+    {
+        // the input of the simplification of LOD l has the size of LOD l-1, and its result is kept until the end of the chain
+        const size_t input = (size_t)(data.indices.size() * settings.lodRatios[l - 1]);
+        bytes += SimplifyArenaBytes(data.vertices.size(), input) + (size_t)(data.indices.size() * settings.lodRatios[l]) * sizeof(GLuint);
+    }
+    // the chain of the LODs, and their errors
+    return bytes + numLODs * (sizeof(pmr::vector<GLuint>) + sizeof(GLfloat));
+}
+
+//////////////////////////////////////////
+// Generation of the LOD chain of a mesh: the indices of all the LODs are concatenated in the indices vector of the MeshData,
+// and the lods vector contains the range of each LOD.
+// Each LOD is obtained simplifying the previous one. The chain stops when the error budget does not allow further simplification.
+// The simplified LODs are kept in the memory resource until the end, and then they are copied in the indices vector,
+// allocated once with the exact size (see N.B. 5)
+inline void BuildLODChain(MeshData& data, const SimplifySettings& settings, pmr::memory_resource* memory = pmr::get_default_resource())
+{
+    data.lods.clear();
+
+    // error budget in model coordinates
+    GLfloat maxError = 0.0f;
+    if (!data.vertices.empty())
+    {
+        glm::vec3 minP = data.vertices[0].Position, maxP = data.vertices[0].Position;
+        for (const Vertex& v : data.vertices)
+        {
+            minP = glm::min(minP, v.Position);
+            maxP = glm::max(maxP, v.Position);
+        }
+        maxError = settings.maxError * glm::length(maxP - minP);
+    }
+
+    // LOD 0 is always the full resolution mesh (= the current indices)
+    const size_t fullIndexCount = data.indices.size();
+    pmr::vector<pmr::vector<GLuint>> chain(memory);
+    chain.reserve(settings.lodRatios.size());
+    pmr::vector<GLfloat> errors(1, 0.0f, memory);
+    errors.reserve(settings.lodRatios.size());
+
+    const GLuint* previous = data.indices.data();
+    size_t previousCount = fullIndexCount;
+    GLfloat previousError = 0.0f;
+    for (size_t l = 1; l < settings.lodRatios.size(); l++)
+    {
+        size_t target = (size_t)(fullIndexCount / 3 * settings.lodRatios[l]) * 3;
+        GLfloat error = 0.0f;
+        pmr::vector<GLuint> lod = SimplifyMesh(data.vertices, previous, previousCount, target, maxError, settings, &error, memory);
+        // if the error budget did not allow to remove at least 10% of the triangles of the previous LOD, we stop the chain
+        if (lod.size() * 10 > previousCount * 9)
+            break;
+
+        // the error of the LOD is measured with respect to the previous one: we accumulate it to have a (conservative) error with respect to the full resolution mesh
+        GLfloat lodError = previousError + error;
+        chain.push_back(std::move(lod));
+        errors.push_back(lodError);
+        previous = chain.back().data();
+        previousCount = chain.back().size();
+        previousError = lodError;
+    }
+
+    // we concatenate the LODs
+    size_t totalIndexCount = fullIndexCount;
+    for (const pmr::vector<GLuint>& lod : chain)
+        totalIndexCount += lod.size();
+    vector<GLuint> indices;
+    indices.reserve(totalIndexCount);
+    indices.insert(indices.end(), data.indices.begin(), data.indices.end());
+    data.lods.reserve(chain.size() + 1);
+    data.lods.push_back({ 0, (GLuint)fullIndexCount, 0.0f });
+    for (size_t l = 0; l < chain.size(); l++)
+    {
+        data.lods.push_back({ (GLuint)indices.size(), (GLuint)chain[l].size(), errors[l + 1] });
+        indices.insert(indices.end(), chain[l].begin(), chain[l].end());
+    }
+    data.indices = std::move(indices);
+}
@@ -0,0 +1,456 @@
+/*
+MipStreamer class
+- streaming of the mipmap levels of 2D textures, driven by the projected size of the objects using them
+- at each frame, the application tells the size in pixels of each textured object (Request), and the streamer
+  estimates the finest mipmap level actually needed: the texture has `width` texels along its U direction, and if
+  the object covers only a fraction (coverage) of them on a diameter of `pixelSize` pixels, the needed level is
+  log2(width * coverage / pixelSize). The coverage of a sphere with equirectangular texture is 0.5 (we see half of it)
+- the levels are uploaded (a level per step, from coarse to fine) and evicted to keep the resident levels of all the textures
+  inside a VRAM budget:
+  - the levels finer than needed are kept as long as there is space, and they are evicted first, starting from the
+    Least Recently Used textures (= the textures whose objects were not requested for longer time)
+  - then, the levels of the textures not requested in the current frame are evicted, in LRU order
+  - the "tail" of each texture (the levels smaller than MIP_STREAMING_TAIL_SIZE) is always resident, so a texture can always be used
+- the uploads are executed by the main thread in Update(), only for the textures requested in the frame, with a limit of bytes per frame
+
+The source of each texture is its baked KTX file (see texture_baker.h), if it exists and its format is supported: the levels are
+uploaded directly from the KTX file (memory-mapped, if the file is in an asset pack, see asset_pack.h).
+Otherwise, the image is decoded, and its chain of mipmaps (RGBA8) is generated and kept in CPU memory.
+The sources are read by the worker threads (see thread_pool.h).
+
+N.B. 1)
+Partial residency: the texture is "mutable" (glTexImage2D / glCompressedTexImage2D for each level), and only the resident levels are allocated.
+GL_TEXTURE_BASE_LEVEL is the finest resident level, so the texture is complete using only the levels in [base, max].
+An evicted level is re-specified with size 0, which releases its memory.
+
+N.B. 2)
+Update(), Request() and Texture() must be called by the main thread (where the OpenGL context is current).
+
+N.B. 3)
+The textures are recorded in the ResourceRegistry (see resource_registry.h) with the bytes of their resident levels,
+and the decoded chains of mipmaps (kept in CPU memory when the baked texture is not available) as CPU-side data.
+
+N.B. 4) the class is "non-copyable" and "non-movable": the loading jobs keep pointers to the instance
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+
+#include <utils/thread_pool.h>
+#include <utils/texture_baker.h>
+#include <utils/texture_loader.h>
+#include <utils/asset_system.h>
+#include <utils/resource_registry.h>
+#include <utils/logger.h>
+
+// the levels with both sizes not larger than this value are always resident
+const GLuint MIP_STREAMING_TAIL_SIZE = 128;
+
+/////////////////// MIPSTREAMER class ///////////////////////
+class MipStreamer
+{
+public:
+
+    // We want MipStreamer to be neither copied nor moved
+    MipStreamer(const MipStreamer& copy) = delete;
+    MipStreamer& operator=(const MipStreamer&) = delete;
+
+    //////////////////////////////////////////
+
+    // constructor: budget of VRAM used by the streamed textures, and maximum number of bytes uploaded per frame
+    // It must be called by the main thread (we query the compressed formats supported by the OpenGL implementation)
+    MipStreamer(size_t budgetBytes, size_t uploadBytesPerFrame = 8 * 1024 * 1024)
+        : budget(budgetBytes), uploadBytesPerFrame(uploadBytesPerFrame)
+    {
+        this->compressedFormats = QueryCompressedFormats();
+    }
+
+    ~MipStreamer()
+    {
+        this->waitLoading();
+    }
+
+    //////////////////////////////////////////
+
+    // we add a texture to the streamer: the source is read by a worker thread. It returns the id of the texture
+    // coverage is the fraction of the width of the texture visible on the diameter of the object (see the header comment)
+    GLuint Add(const string& path, GLfloat coverage = 0.5f)
+    {
+        unique_ptr<StreamedMips> texture = make_unique<StreamedMips>();
+        texture->path = path;
+        texture->coverage = coverage;
+        StreamedMips* source = texture.get();
+        texture->loading = ThreadPool::Instance().Submit([this, source] { return this->loadSource(*source); });
+        this->textures.push_back(std::move(texture));
+        return (GLuint)this->textures.size() - 1;
+    }
+
+    //////////////////////////////////////////
+
+    // the object using the texture is drawn in the current frame, with the given projected diameter (in pixels)
+    void Request(GLuint id, GLfloat pixelSize)
+    {
+        StreamedMips& texture = *this->textures[id];
+        texture.lastUsed = this->frame;
+        // the levels are known only after the creation of the texture (the source is loaded by a worker thread)
+        if (!texture.texture)
+            return;
+        GLfloat texels = (GLfloat)texture.levels[0].width * texture.coverage;
+        GLint level = (GLint)floor(log2(texels / max(pixelSize, 1.0f)));
+        GLuint needed = (GLuint)min(max(level, 0), (GLint)texture.tailLevel);
+        // more objects can use the same texture: we keep the finest level requested in the frame
+        if (texture.requestFrame != this->frame || needed < texture.neededLevel)
+            texture.neededLevel = needed;
+        texture.requestFrame = this->frame;
+    }
+
+    //////////////////////////////////////////
+
+    // called by the main thread at each frame, after the requests: we create the textures whose source has been loaded,
+    // and we upload and evict the levels, inside the budget
+    void Update()
+    {
+        size_t uploaded = 0;
+
+        // textures whose source has been loaded: we upload the tail, so they can be used
+        for (unique_ptr<StreamedMips>& texture : this->textures)
+        {
+            if (!texture->loading.valid() || texture->loading.wait_for(chrono::seconds(0)) != future_status::ready)
+                continue;
+            if (texture->loading.get())
+                uploaded += this->createTexture(*texture);
+            else
+            {
+                texture->failed = GL_TRUE;
+                LOG_ERROR("MIP_STREAMER", "impossible to load " << texture->path);
+            }
+        }
+
+        // if the budget has been reduced, we evict levels until the resident levels fit in it (also the levels needed in this frame)
+        if (this->residentBytes > this->budget)
+            this->evict(this->residentBytes - this->budget, nullptr, GL_TRUE);
+
+        // textures requested in this frame and needing finer levels: the ones with the largest difference from the needed level first
+        vector<StreamedMips*> candidates;
+        for (unique_ptr<StreamedMips>& texture : this->textures)
+            if (texture->texture && texture->lastUsed == this->frame && texture->neededLevel < texture->residentLevel)
+                candidates.push_back(texture.get());
+        sort(candidates.begin(), candidates.end(), [](const StreamedMips* a, const StreamedMips* b)
+        {
+            return a->residentLevel - a->neededLevel > b->residentLevel - b->neededLevel;
+        });
+
+        for (StreamedMips* texture : candidates)
+        {
+            while (texture->neededLevel < texture->residentLevel && uploaded < this->uploadBytesPerFrame)
+            {
+                const GLuint level = texture->residentLevel - 1;
+                const size_t size = texture->levels[level].size;
+                if (this->residentBytes + size > this->budget && !this->evict(this->residentBytes + size - this->budget, texture, GL_FALSE))
+                    break;
+                this->uploadLevel(*texture, level);
+                uploaded += size;
+            }
+        }
+
+        // the requests of the next frame
+        this->frame++;
+    }
+
+    //////////////////////////////////////////
+
+    // OpenGL texture (0 until the tail of the texture has been uploaded)
+    GLuint Texture(GLuint id) const
+    {
+        return this->textures[id]->texture;
+    }
+
+    // we change the budget (the levels are evicted at the next Update, if needed)
+    void SetBudget(size_t budgetBytes)
+    {
+        this->budget = budgetBytes;
+    }
+
+    size_t ResidentBytes() const
+    {
+        return this->residentBytes;
+    }
+
+    //////////////////////////////////////////
+
+    // we print on console the resident and the needed level of each texture, and the memory used
+    void PrintStats() const
+    {
+        std::cout << "Mip streaming (budget " << this->budget / 1024 << " KB, resident " << this->residentBytes / 1024 << " KB):" << std::endl;
+        for (const unique_ptr<StreamedMips>& texture : this->textures)
+        {
+            std::cout << "  " << texture->path;
+            if (!texture->texture)
+            {
+                std::cout << (texture->failed ? ": not available" : ": loading") << std::endl;
+                continue;
+            }
+            const MipLevel& resident = texture->levels[texture->residentLevel];
+            const MipLevel& needed = texture->levels[texture->neededLevel];
+            std::cout << ": resident " << resident.width << "x" << resident.height << " (level " << texture->residentLevel
+                      << "), needed " << needed.width << "x" << needed.height << " (level " << texture->neededLevel << "), "
+                      << texture->bytes / 1024 << " KB" << (texture->compressed ? " compressed" : "") << std::endl;
+        }
+    }
+
+    //////////////////////////////////////////
+
+    // we wait for the loading jobs, and we delete the textures (the OpenGL context must still be current)
+    void Shutdown()
+    {
+        this->waitLoading();
+        for (unique_ptr<StreamedMips>& texture : this->textures)
+        {
+            ResourceRegistry::Instance().Release(RESOURCE_CPU, (uintptr_t)texture.get());
+            if (texture->texture)
+            {
+                ResourceRegistry::Instance().Release(RESOURCE_TEXTURE, texture->texture);
+                glDeleteTextures(1, &texture->texture);
+            }
+        }
+        this->textures.clear();
+        this->residentBytes = 0;
+    }
+
+private:
+
+    // a level of the source of a texture
+    struct MipLevel
+    {
+        GLuint width, height;
+        // offset in the KTX file (for compressed textures), and size
+        size_t offset;
+        size_t size;
+    };
+
+    // a streamed texture
+    struct StreamedMips
+    {
+        string path;
+        GLfloat coverage = 0.5f;
+        future<bool> loading;
+        GLboolean failed = GL_FALSE;
+
+        // source: the baked texture (compressed), or the chain of RGBA8 images
+        GLboolean compressed = GL_FALSE;
+        KTXTexture baked;
+        vector<vector<unsigned char>> images;
+        vector<MipLevel> levels;
+        // first level of the tail (always resident)
+        GLuint tailLevel = 0;
+
+        GLuint texture = 0;
+        // finest resident level, and finest level needed
+        GLuint residentLevel = 0;
+        GLuint neededLevel = 0;
+        // bytes of the resident levels
+        size_t bytes = 0;
+        // last frame when the texture has been requested, and frame of the last request
+        uint64_t lastUsed = 0;
+        uint64_t requestFrame = 0;
+    };
+
+    vector<unique_ptr<StreamedMips>> textures;
+    vector<GLenum> compressedFormats;
+    size_t budget;
+    size_t uploadBytesPerFrame;
+    size_t residentBytes = 0;
+    // current frame (the textures never requested have lastUsed = 0)
+    uint64_t frame = 1;
+
+    //////////////////////////////////////////
+    // job executed by a worker thread: we read the baked texture, or we decode the image and we generate its mipmaps
+    bool loadSource(StreamedMips& texture)
+    {
+        KTXTexture baked;
+        if (LoadBakedTexture({ texture.path }, baked) && baked.numFaces == 1 &&
+            find(this->compressedFormats.begin(), this->compressedFormats.end(), baked.internalFormat) != this->compressedFormats.end())
+        {
+            for (GLuint level = 0; level < baked.numLevels; level++)
+                texture.levels.push_back({ max(baked.width >> level, 1u), max(baked.height >> level, 1u), baked.imageOffsets[level], (size_t)baked.imageSizes[level] });
+            texture.baked = std::move(baked);
+            texture.compressed = GL_TRUE;
+            // the file is in CPU memory only if it has been read from disk (the files in an asset pack are memory-mapped)
+            if (!texture.baked.file.storage.empty())
+                ResourceRegistry::Instance().Register(RESOURCE_CPU, (uintptr_t)&texture, texture.baked.file.storage.size(),
+                                                      texture.baked.internalFormat, texture.path + " (baked file)");
+        }
+        else
+        {
+            AssetData file;
+            int width, height, channels;
+            unsigned char* pixels = nullptr;
+            if (AssetSystem::Instance().Read(texture.path, file))
+                pixels = stbi_load_from_memory(file.data, (int)file.size, &width, &height, &channels, STBI_rgb_alpha);
+            if (!pixels)
+                return false;
+            vector<unsigned char> image(pixels, pixels + (size_t)width * height * 4);
+            stbi_image_free(pixels);
+            GLuint w = (GLuint)width, h = (GLuint)height;
+            while (true)
+            {
+                texture.levels.push_back({ w, h, 0, image.size() });
+                if (w == 1 && h == 1)
+                    break;
+                vector<unsigned char> next = DownsampleImage(image, w, h, w, h);
+                texture.images.push_back(std::move(image));
+                image = std::move(next);
+            }
+            texture.images.push_back(std::move(image));
+            size_t imagesBytes = 0;
+            for (const vector<unsigned char>& level : texture.images)
+                imagesBytes += level.capacity();
+            ResourceRegistry::Instance().Register(RESOURCE_CPU, (uintptr_t)&texture, imagesBytes, GL_RGBA8, texture.path + " (decoded mipmaps)");
+        }
+
+        // the tail starts from the first level not larger than MIP_STREAMING_TAIL_SIZE (or from the last level)
+        texture.tailLevel = (GLuint)texture.levels.size() - 1;
+        for (GLuint level = 0; level < texture.levels.size(); level++)
+            if (texture.levels[level].width <= MIP_STREAMING_TAIL_SIZE && texture.levels[level].height <= MIP_STREAMING_TAIL_SIZE)
+            {
+                texture.tailLevel = level;
+                break;
+            }
+        return true;
+    }
+
+    //////////////////////////////////////////
+    // we create the OpenGL texture, with only the tail resident. It returns the uploaded bytes
+    size_t createTexture(StreamedMips& texture)
+    {
+        const GLuint numLevels = (GLuint)texture.levels.size();
+        glGenTextures(1, &texture.texture);
+        glBindTexture(GL_TEXTURE_2D, texture.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+        // the tail is uploaded from the coarsest level, so the texture is always complete
+        texture.residentLevel = numLevels;
+        texture.neededLevel = texture.tailLevel;
+        size_t uploaded = 0;
+        for (GLint level = (GLint)numLevels - 1; level >= (GLint)texture.tailLevel; level--)
+        {
+            uploaded += texture.levels[level].size;
+            this->uploadLevel(texture, (GLuint)level);
+        }
+        return uploaded;
+    }
+
+    //////////////////////////////////////////
+    // we upload a level (the next finer level of the resident ones), and we make it the base level
+    void uploadLevel(StreamedMips& texture, GLuint level)
+    {
+        const MipLevel& mip = texture.levels[level];
+        glBindTexture(GL_TEXTURE_2D, texture.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (texture.compressed)
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, texture.baked.internalFormat, mip.width, mip.height, 0, (GLsizei)mip.size, texture.baked.file.data + mip.offset);
+        else
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, mip.width, mip.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture.images[level].data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        texture.residentLevel = level;
+        texture.bytes += mip.size;
+        this->residentBytes += mip.size;
+        this->registerTexture(texture);
+    }
+
+    //////////////////////////////////////////
+    // we evict the finest resident level of a texture
+    void evictLevel(StreamedMips& texture)
+    {
+        const GLuint level = texture.residentLevel;
+        glBindTexture(GL_TEXTURE_2D, texture.texture);
+        // first the base level is moved, then the level is re-specified with size 0, to release its memory
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        texture.residentLevel = level + 1;
+        texture.bytes -= texture.levels[level].size;
+        this->residentBytes -= texture.levels[level].size;
+        this->registerTexture(texture);
+    }
+
+    //////////////////////////////////////////
+    // we update the record of a texture in the ResourceRegistry, with the bytes of the resident levels
+    void registerTexture(const StreamedMips& texture)
+    {
+        ResourceRegistry::Instance().Register(RESOURCE_TEXTURE, texture.texture, texture.bytes,
+                                              texture.compressed ? texture.baked.internalFormat : GL_RGBA8, texture.path);
+    }
+
+    //////////////////////////////////////////
+    // we evict levels to free at least the given number of bytes (the levels of the excluded texture are not evicted).
+    // First the levels finer than needed, then the levels of the textures not requested in this frame, both in LRU order.
+    // If force is true, in the second pass all the textures can be evicted down to their tail.
+    // It returns false if it is not possible to free enough memory (and, if force is false, nothing is evicted)
+    bool evict(size_t bytes, const StreamedMips* excluded, GLboolean force)
+    {
+        vector<StreamedMips*> lru;
+        for (unique_ptr<StreamedMips>& texture : this->textures)
+            if (texture->texture && texture.get() != excluded && texture->residentLevel < texture->tailLevel)
+                lru.push_back(texture.get());
+        sort(lru.begin(), lru.end(), [](const StreamedMips* a, const StreamedMips* b) { return a->lastUsed < b->lastUsed; });
+
+        // we check that enough memory can be freed, so we do not evict levels without being able to upload the new one
+        auto keepLevel = [this, force](const StreamedMips* texture, GLuint pass)
+        {
+            // in the second pass, the needed levels of the textures not used in the current frame can be evicted
+            return min((pass == 0 || (texture->lastUsed == this->frame && !force)) ? texture->neededLevel : texture->tailLevel, texture->tailLevel);
+        };
+        size_t available = 0;
+        for (const StreamedMips* texture : lru)
+            for (GLuint level = texture->residentLevel; level < keepLevel(texture, 1); level++)
+                available += texture->levels[level].size;
+        if (available < bytes && !force)
+            return false;
+
+        size_t freed = 0;
+        for (GLuint pass = 0; pass < 2 && freed < bytes; pass++)
+            for (StreamedMips* texture : lru)
+            {
+                while (freed < bytes && texture->residentLevel < keepLevel(texture, pass))
+                {
+                    freed += texture->levels[texture->residentLevel].size;
+                    this->evictLevel(*texture);
+                }
+                if (freed >= bytes)
+                    break;
+            }
+        return freed >= bytes;
+    }
+
+    //////////////////////////////////////////
+    // we wait for the loading jobs still running (they access the textures)
+    void waitLoading()
+    {
+        for (unique_ptr<StreamedMips>& texture : this->textures)
+            if (texture->loading.valid())
+                texture->loading.wait();
+    }
+};
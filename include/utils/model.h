@@ -11,6 +11,23 @@ N.B. 2) no texturing in this version of the class
 
 N.B. 3) based on https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/model.h
 
+N.B. 4) for each mesh, a chain of Levels of Detail is generated at loading time (see mesh_simplify.h).
+The LODs of the different meshes are generated in parallel using worker threads (see thread_pool.h),
+and the processed meshes are saved in a cache file, used to skip Assimp loading in the next executions (see mesh_cache.h)
+
+N.B. 5) after the creation of the GPU buffers, the CPU-side data of the meshes are released, unless a different
+retention policy is passed to the constructor (see MeshRetention in mesh.h)
+
+N.B. 6) models are read through the AssetSystem (see asset_system.h): they can be loaded also from asset packs and zip archives
+
+N.B. 7) compressed mesh files (.cmesh, see mesh_compression.h) are decoded without Assimp. They store also the LODs,
+so they are used directly, without simplification and mesh cache. If a model has a .cmesh file baked from its current version,
+the .cmesh file is loaded instead of the model
+
+N.B. 8) the loading path is "allocation-light": the vectors of the meshes data are allocated once with their exact size,
+and the temporaries of the LODs generation are allocated in a monotonic arena for each mesh (see import_arena.h).
+The number of allocations of each load is recorded in the ImportLog
+
 authors: Davide Gadia, Michael Marchesan
 
 Real-Time Graphics Programming - a.a. 2023/2024
@@ -31,8 +48,20 @@ using namespace std;
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+// Std. Includes
+#include <chrono>
+#include <memory>
+
 // we include the Mesh class, which manages the "OpenGL side" (= creation and allocation of VBO, VAO, EBO buffers) of the loading of models
 #include <utils/mesh.h>
+// LODs generation, cache of the processed meshes, and worker threads used to process the meshes in parallel
+#include <utils/mesh_simplify.h>
+#include <utils/mesh_cache.h>
+#include <utils/thread_pool.h>
+#include <utils/asset_system.h>
+#include <utils/mesh_compression.h>
+#include <utils/import_arena.h>
+#include <utils/logger.h>
 
 /////////////////// MODEL class ///////////////////////
 class Model
@@ -67,52 +96,235 @@ public:
     // to notice that Model class is not strictly following the Rules of 5
     // https://en.cppreference.com/w/cpp/language/rule_of_three
     // because we are not writing a user-defined destructor.
-    Model(const string& path)
+    // the simplification settings define the LODs generated for each mesh of the model,
+    // the retention policy defines the CPU-side data kept by the meshes after the creation of the GPU buffers
+    Model(const string& path, const SimplifySettings& simplifySettings = SimplifySettings(), MeshRetention retention = MESH_RETAIN_NONE)
+    {
+        this->loadModel(path, simplifySettings, retention);
+    }
+
+    // constructor from CPU-side mesh data (e.g., a procedural mesh, see procedural_mesh.h): the model has a single mesh
+    // This constructor empties the source MeshData
+    Model(MeshData&& data, MeshRetention retention = MESH_RETAIN_NONE)
+    {
+        this->meshes.emplace_back(data, retention);
+    }
+
+    // constructor from the CPU-side data of more meshes (e.g., read by LoadMeshesData in a different thread)
+    // This constructor empties the source MeshData vector
+    Model(vector<MeshData>&& meshesData, MeshRetention retention = MESH_RETAIN_NONE)
     {
-        this->loadModel(path);
+        this->createMeshes(meshesData, retention);
     }
 
     //////////////////////////////////////////
 
     // model rendering: calls rendering methods of each instance of Mesh class in the vector
-    void Draw()
+    // the LOD parameter selects the Level of Detail of the meshes (0 = full resolution)
+    // it returns the number of triangles submitted to the GPU
+    GLuint Draw(GLuint lod = 0)
     {
+        GLuint triangles = 0;
         for(GLuint i = 0; i < this->meshes.size(); i++)
-            this->meshes[i].Draw();
+            triangles += this->meshes[i].Draw(lod);
+        return triangles;
     }
 
     //////////////////////////////////////////
 
+    // number of LODs of the model (= the maximum number of LODs of its meshes)
+    GLuint NumLODs() const
+    {
+        GLuint num = 1;
+        for (const Mesh& mesh : this->meshes)
+            num = max(num, (GLuint)mesh.lods.size());
+        return num;
+    }
 
-private:
+    // geometric error of a LOD of the model (= the maximum error of its meshes), in model coordinates
+    GLfloat LODError(GLuint lod) const
+    {
+        GLfloat error = 0.0f;
+        for (const Mesh& mesh : this->meshes)
+            if (!mesh.lods.empty())
+                error = max(error, mesh.lods[min(lod, (GLuint)mesh.lods.size() - 1)].error);
+        return error;
+    }
+
+    // bounding sphere of the model (in model coordinates), obtained merging the bounding spheres of the meshes
+    void BoundingSphere(glm::vec3& center, GLfloat& radius) const
+    {
+        center = glm::vec3(0.0f);
+        radius = 0.0f;
+        if (this->meshes.empty())
+            return;
+        glm::vec3 minP = this->meshes[0].boundsMin, maxP = this->meshes[0].boundsMax;
+        for (const Mesh& mesh : this->meshes)
+        {
+            minP = glm::min(minP, mesh.boundsMin);
+            maxP = glm::max(maxP, mesh.boundsMax);
+        }
+        center = (minP + maxP) * 0.5f;
+        for (const Mesh& mesh : this->meshes)
+            radius = max(radius, glm::length(mesh.boundingCenter - center) + mesh.boundingRadius);
+    }
+
+    //////////////////////////////////////////
+
+    // CPU memory used by the meshes data (in bytes)
+    size_t CPUMemoryBytes() const
+    {
+        size_t bytes = this->meshes.capacity() * sizeof(Mesh);
+        for (const Mesh& mesh : this->meshes)
+            bytes += mesh.CPUMemoryBytes();
+        return bytes;
+    }
+
+    // GPU memory used by the meshes buffers (in bytes)
+    size_t GPUMemoryBytes() const
+    {
+        size_t bytes = 0;
+        for (const Mesh& mesh : this->meshes)
+            bytes += mesh.GPUMemoryBytes();
+        return bytes;
+    }
 
     //////////////////////////////////////////
-    // loading of the model using Assimp library. Nodes are processed to build a vector of Mesh class instances
-    void loadModel(string path)
+
+    // we read the CPU-side data of the meshes of a model file, without LODs generation and mesh cache:
+    // compressed mesh files are decoded by the worker threads, the other formats are loaded using Assimp library.
+    // It returns false if the file cannot be loaded
+    static bool ImportMeshes(const string& path, vector<MeshData>& meshesData)
     {
+        if (IsCompressedMeshPath(path))
+            return LoadCompressedMeshes(path, meshesData);
+
         // loading using Assimp
         // N.B.: it is possible to set, if needed, some operations to be performed by Assimp after the loading.
         // Details on the different flags to use are available at: http://assimp.sourceforge.net/lib_html/postprocess_8h.html#a64795260b95f5a4b3f3dc1be4f52e410
         // VERY IMPORTANT: calculation of Tangents and Bitangents is possible only if the model has Texture Coordinates
         // If they are not present, the calculation is skipped (but no error is provided in the following checks!)
         Assimp::Importer importer;
+        // Assimp reads the model (and the files it references) through the AssetSystem, from the asset archives or from disk
+        // (the Importer takes the ownership of the IOSystem)
+        importer.SetIOHandler(new AssetIOSystem());
         const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_FlipUVs | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
 
         // check for errors (see comment above)
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
         {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
+            LOG_ERROR("ASSIMP", importer.GetErrorString());
+            return false;
         }
 
         // we start the recursive processing of nodes in the Assimp data structure
-        this->processNode(scene->mRootNode, scene);
+        // (the vector is allocated once, with the number of meshes referenced by the nodes)
+        meshesData.reserve(meshesData.size() + countMeshes(scene->mRootNode));
+        processNode(scene->mRootNode, scene, meshesData);
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+    // we read the CPU-side data of the meshes of a model file, with their LODs. No OpenGL calls are executed: it can be called by any thread.
+    // If a valid .cmesh file baked from the model exists (see N.B. 7), or a valid cache file of the model, meshes and LODs are read
+    // from it, and the model file is not loaded.
+    // It returns false if the file cannot be loaded
+    // The statistics of the load are added to the ImportLog (see N.B. 8)
+    static bool LoadMeshesData(const string& path, const SimplifySettings& simplifySettings, vector<MeshData>& meshesData)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        ImportStats stats;
+        stats.path = path;
+        stats.source = "cache";
+        if (LoadBakedCompressedMeshes(path, simplifySettings, meshesData))
+            stats.source = "baked";
+        else if (!LoadMeshCache(path, simplifySettings, meshesData))
+        {
+            stats.source = IsCompressedMeshPath(path) ? "compressed" : "assimp";
+            if (!ImportMeshes(path, meshesData))
+                return false;
+
+            // we generate the LODs of the meshes in parallel, using the worker threads (.cmesh files already contain them).
+            // Each job works on a different MeshData, with its own arena, so no synchronization is needed
+            vector<unique_ptr<ImportArena>> arenas;
+            arenas.reserve(meshesData.size());
+            vector<future<void>> jobs;
+            jobs.reserve(meshesData.size());
+            for (MeshData& data : meshesData)
+                if (data.lods.empty())
+                {
+                    arenas.push_back(make_unique<ImportArena>(LODChainArenaBytes(data, simplifySettings)));
+                    ImportArena* arena = arenas.back().get();
+                    jobs.push_back(ThreadPool::Instance().Submit([&data, &simplifySettings, arena] { BuildLODChain(data, simplifySettings, arena); }));
+                }
+            for (future<void>& job : jobs)
+                job.get();
+            for (const unique_ptr<ImportArena>& arena : arenas)
+                stats.Add(*arena);
+
+            // we save the processed meshes for the next executions (only if we had to generate some LODs)
+            if (!jobs.empty())
+                SaveMeshCache(path, simplifySettings, meshesData);
+        }
+
+        stats.meshes = meshesData.size();
+        stats.outputBuffers = meshesData.empty() ? 0 : 1;
+        for (const MeshData& data : meshesData)
+            stats.outputBuffers += !data.vertices.empty() + !data.indices.empty() + !data.lods.empty();
+        stats.milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        ImportLog::Instance().Add(stats);
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+
+private:
+
+    //////////////////////////////////////////
+    // loading of the model: we read the meshes data, and we create the meshes
+    void loadModel(string path, const SimplifySettings& simplifySettings, MeshRetention retention)
+    {
+        // CPU-side data of the meshes
+        vector<MeshData> meshesData;
+        if (LoadMeshesData(path, simplifySettings, meshesData))
+        {
+            // the buffers of the meshes are recorded with the path of the model as owner (see resource_registry.h)
+            ResourceOwner owner(path);
+            this->createMeshes(meshesData, retention);
+        }
+    }
+
+    //////////////////////////////////////////
+    // creation of the meshes from their CPU-side data
+    void createMeshes(vector<MeshData>& meshesData, MeshRetention retention)
+    {
+        // we create the GPU buffers (in the main thread, where the OpenGL context is current)
+        // we use emplace_back instead as push_back, so to have the instance created directly in the
+        // vector memory, without the creation of a temp copy.
+        // https://en.cppreference.com/w/cpp/container/vector/emplace_back
+        // N.B.) each MeshData is emptied by the Mesh constructor, so the data are not duplicated in CPU memory while loading the next meshes
+        this->meshes.reserve(meshesData.size());
+        for (MeshData& data : meshesData)
+            this->meshes.emplace_back(data, retention);
+    }
+
+    //////////////////////////////////////////
+
+    // number of meshes referenced by a node and by its children (a mesh referenced by more nodes is processed more times)
+    static GLuint countMeshes(const aiNode* node)
+    {
+        GLuint count = node->mNumMeshes;
+        for (GLuint i = 0; i < node->mNumChildren; i++)
+            count += countMeshes(node->mChildren[i]);
+        return count;
     }
 
     //////////////////////////////////////////
 
     // Recursive processing of nodes of Assimp data structure
-    void processNode(aiNode* node, const aiScene* scene)
+    static void processNode(aiNode* node, const aiScene* scene, vector<MeshData>& meshesData)
     {
         // we process each mesh inside the current node
         for(GLuint i = 0; i < node->mNumMeshes; i++)
@@ -121,33 +333,40 @@ private:
             // "Scene" contains all the data. Class node is used only to point to one or more mesh inside the scene and to maintain informations on relations between nodes
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
             // we start processing of the Assimp mesh using processMesh method.
-            // the result (an istance of the Mesh class) is added to the vector
-            // we use emplace_back instead as push_back, so to have the instance created directly in the
-            // vector memory, without the creation of a temp copy.
-            // https://en.cppreference.com/w/cpp/container/vector/emplace_back
-            this->meshes.emplace_back(processMesh(mesh));
+            // the result (the CPU-side data of the mesh) is added to the vector
+            meshesData.emplace_back(processMesh(mesh));
         }
         // we then recursively process each of the children nodes
         for(GLuint i = 0; i < node->mNumChildren; i++)
         {
-            this->processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, meshesData);
         }
 
     }
 
     //////////////////////////////////////////
 
-    // Processing of the Assimp mesh in order to obtain an "OpenGL mesh"
-    // = we create and allocate the buffers used to send mesh data to the GPU
-    Mesh processMesh(aiMesh* mesh)
+    // Processing of the Assimp mesh in order to obtain the data of an "OpenGL mesh"
+    // = we convert the data in the format used to create and allocate the buffers used to send mesh data to the GPU
+    static MeshData processMesh(aiMesh* mesh)
     {
+        MeshData data;
         // data structures for vertices and indices of vertices (for faces)
-        vector<Vertex> vertices;
-        vector<GLuint> indices;
+        // they are allocated once, with their exact size, and then filled (see N.B. 8)
+        vector<Vertex>& vertices = data.vertices;
+        vector<GLuint>& indices = data.indices;
+        size_t numIndices = 0;
+        for(GLuint i = 0; i < mesh->mNumFaces; i++)
+            numIndices += mesh->mFaces[i].mNumIndices;
+        vertices.resize(mesh->mNumVertices);
+        indices.reserve(numIndices);
+
+        if(!mesh->mTextureCoords[0])
+            LOG_WARNING("ASSIMP", "MODEL WITHOUT UV COORDINATES -> TANGENT AND BITANGENT ARE = 0");
 
         for(GLuint i = 0; i < mesh->mNumVertices; i++)
         {
-            Vertex vertex;
+            Vertex& vertex = vertices[i];
             // the vector data type used by Assimp is different than the GLM vector needed to allocate the OpenGL buffers
             // I need to convert the data structures (from Assimp to GLM, which are fully compatible to the OpenGL)
             glm::vec3 vector;
@@ -185,22 +404,19 @@ private:
             }
             else{
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-                cout << "WARNING::ASSIMP:: MODEL WITHOUT UV COORDINATES -> TANGENT AND BITANGENT ARE = 0" << endl;
             }
-            // we add the vertex to the list
-            vertices.emplace_back(vertex);
         }
 
         // for each face of the mesh, we retrieve the indices of its vertices , and we store them in a vector data structure
         for(GLuint i = 0; i < mesh->mNumFaces; i++)
         {
             aiFace* face = &mesh->mFaces[i];
-             for(GLuint j = 0; j < face->mNumIndices; j++)
-                 indices.emplace_back(face->mIndices[j]);
+            indices.insert(indices.end(), face->mIndices, face->mIndices + face->mNumIndices);
 
         }
 
-        // we return an instance of the Mesh class created using the vertices and faces data structures we have created above.
-        return Mesh(vertices, indices);
+        // we return the vertices and faces data structures we have created above.
+        // The instance of the Mesh class is created after the generation of the LODs
+        return data;
     }
 };
@@ -0,0 +1,386 @@
+/*
+Procedural meshes
+- generation of spheres and rings directly in the Vertex format used by the Mesh class, without loading files from disk
+- icosphere: icosahedron whose faces are subdivided in a triangular grid, and projected on the unit sphere
+- cube-sphere: cube whose faces are subdivided in a square grid, and projected on the unit sphere
+- annulus: flat ring on the XZ plane (e.g., planetary rings), with UVs going from the inner (u = 0) to the outer (u = 1) border
+
+N.B. 1)
+Spheres have equirectangular UV coordinates (u = longitude, v = latitude, with v = 0 at the north pole), consistent with the planet textures.
+Differently from the "UV sphere" topology, the triangles have almost uniform size (no pinched triangles at the poles), which is better for LOD generation.
+Vertices are duplicated along the UV seam (u = 0 / u = 1) and at the poles, where the longitude is not defined.
+
+N.B. 2)
+For the cube-sphere, we do not simply normalize the points of the cube, but we use the mapping described in
+http://mathproofs.blogspot.com/2005/07/mapping-cube-to-sphere.html
+which distributes the vertices on the sphere more uniformly.
+
+N.B. 3)
+For high subdivision levels, the faces of the base solid are generated in parallel using the job system (see job_system.h).
+The generated meshes (including their LODs) are cached using the generation parameters as key: creating many planets with the same sphere is done only once.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include <utils/mesh.h>
+#include <utils/mesh_simplify.h>
+#include <utils/mesh_cache.h>
+#include <utils/job_system.h>
+
+// shapes available
+enum ProceduralShape {
+    PROCEDURAL_ICOSPHERE,
+    PROCEDURAL_CUBE_SPHERE,
+    PROCEDURAL_ANNULUS
+};
+
+// generation parameters
+struct ProceduralParams
+{
+    ProceduralShape shape = PROCEDURAL_ICOSPHERE;
+    // icosphere: number of subdivisions of each edge of the icosahedron (the number of triangles is 20 * subdivisions^2)
+    // cube-sphere: number of subdivisions of each edge of the cube (the number of triangles is 12 * subdivisions^2)
+    // annulus: number of segments around the ring
+    GLuint subdivisions = 16;
+    // radii of the annulus (the spheres have radius 1)
+    GLfloat innerRadius = 0.5f;
+    GLfloat outerRadius = 1.0f;
+};
+
+// number of vertices of the base solid faces over which the faces are generated in parallel
+const GLuint PROCEDURAL_PARALLEL_THRESHOLD = 8192;
+
+//////////////////////////////////////////
+// we merge the vertices with the same position (the ones on the edges shared by the faces of the base solid).
+// The points on the shared edges are computed in the same way by the adjacent faces, so they are bit-wise identical
+inline void WeldPositions(const vector<vector<glm::vec3>>& facePositions, const vector<vector<GLuint>>& faceTriangles,
+                          vector<glm::vec3>& positions, vector<GLuint>& triangles)
+{
+    vector<glm::vec3> all;
+    vector<GLuint> allTriangles;
+    for (size_t f = 0; f < facePositions.size(); f++)
+    {
+        GLuint base = (GLuint)all.size();
+        all.insert(all.end(), facePositions[f].begin(), facePositions[f].end());
+        for (GLuint idx : faceTriangles[f])
+            allTriangles.push_back(base + idx);
+    }
+
+    // we reuse the vertex welding of the simplification
+    vector<Vertex> temp(all.size());
+    for (size_t i = 0; i < all.size(); i++)
+        temp[i].Position = all[i];
+    vector<GLuint> positionId;
+    ComputePositionRemap(temp, positionId);
+
+    vector<GLuint> compact(all.size(), (GLuint)-1);
+    positions.clear();
+    for (size_t i = 0; i < all.size(); i++)
+        if (positionId[i] == i)
+        {
+            compact[i] = (GLuint)positions.size();
+            positions.push_back(all[i]);
+        }
+    triangles.resize(allTriangles.size());
+    for (size_t i = 0; i < allTriangles.size(); i++)
+        triangles[i] = compact[positionId[allTriangles[i]]];
+}
+
+//////////////////////////////////////////
+// from the points on the unit sphere, we create the vertices with normals, equirectangular UVs, tangents and bitangents
+inline MeshData FinalizeSphere(const vector<glm::vec3>& positions, const vector<GLuint>& triangles)
+{
+    const GLfloat PI = 3.14159265359f;
+    MeshData data;
+    data.vertices.resize(positions.size());
+
+    auto longitude = [&](const glm::vec3& d) { return atan2(-d.z, d.x) / (2.0f * PI) + 0.5f; };
+    auto isPole = [&](const glm::vec3& d) { return d.x * d.x + d.z * d.z < 1e-12f; };
+
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        glm::vec3 d = glm::normalize(positions[i]);
+        data.vertices[i].Position = d;
+        data.vertices[i].Normal = d;
+        data.vertices[i].TexCoords = glm::vec2(longitude(d), acos(glm::clamp(d.y, -1.0f, 1.0f)) / PI);
+    }
+
+    // UV seam and poles: the triangles crossing the seam use copies of the vertices with u + 1,
+    // and each triangle touching a pole uses its own copy of the pole vertex, with the mean longitude of the other two vertices
+    vector<GLuint> seamCopy(positions.size(), (GLuint)-1);
+    data.indices.resize(triangles.size());
+    for (size_t t = 0; t < triangles.size(); t += 3)
+    {
+        GLuint idx[3] = { triangles[t], triangles[t + 1], triangles[t + 2] };
+        GLfloat minU = 1.0f, maxU = 0.0f;
+        for (int k = 0; k < 3; k++)
+            if (!isPole(data.vertices[idx[k]].Position))
+            {
+                minU = min(minU, data.vertices[idx[k]].TexCoords.x);
+                maxU = max(maxU, data.vertices[idx[k]].TexCoords.x);
+            }
+        if (maxU - minU > 0.5f)
+            for (int k = 0; k < 3; k++)
+                if (!isPole(data.vertices[idx[k]].Position) && data.vertices[idx[k]].TexCoords.x < 0.5f)
+                {
+                    if (seamCopy[idx[k]] == (GLuint)-1)
+                    {
+                        Vertex copy = data.vertices[idx[k]];
+                        copy.TexCoords.x += 1.0f;
+                        seamCopy[idx[k]] = (GLuint)data.vertices.size();
+                        data.vertices.push_back(copy);
+                    }
+                    idx[k] = seamCopy[idx[k]];
+                }
+        for (int k = 0; k < 3; k++)
+            if (isPole(data.vertices[idx[k]].Position))
+            {
+                Vertex copy = data.vertices[idx[k]];
+                copy.TexCoords.x = 0.5f * (data.vertices[idx[(k + 1) % 3]].TexCoords.x + data.vertices[idx[(k + 2) % 3]].TexCoords.x);
+                idx[k] = (GLuint)data.vertices.size();
+                data.vertices.push_back(copy);
+            }
+        data.indices[t] = idx[0];
+        data.indices[t + 1] = idx[1];
+        data.indices[t + 2] = idx[2];
+    }
+
+    // tangent = derivative of the position with respect to u, bitangent = derivative with respect to v
+    for (Vertex& v : data.vertices)
+    {
+        GLfloat phi = 2.0f * PI * (v.TexCoords.x - 0.5f);
+        GLfloat theta = PI * v.TexCoords.y;
+        v.Tangent = glm::vec3(-sin(phi), 0.0f, -cos(phi));
+        v.Bitangent = glm::vec3(cos(phi) * cos(theta), -sin(theta), -sin(phi) * cos(theta));
+    }
+    return data;
+}
+
+//////////////////////////////////////////
+// we execute the generation of each face (face = 0..numFaces-1), in parallel if the mesh is big enough
+template<class F>
+void GenerateFaces(GLuint numFaces, GLuint verticesPerFace, F generateFace)
+{
+    if (numFaces * verticesPerFace < PROCEDURAL_PARALLEL_THRESHOLD)
+    {
+        for (GLuint f = 0; f < numFaces; f++)
+            generateFace(f);
+        return;
+    }
+    JobSystem::Instance().ParallelFor(numFaces, [&generateFace](size_t first, size_t last)
+    {
+        for (size_t f = first; f < last; f++)
+            generateFace((GLuint)f);
+    });
+}
+
+//////////////////////////////////////////
+// icosphere: each of the 20 faces of the icosahedron is subdivided in a triangular grid with n subdivisions per edge
+inline MeshData GenerateIcosphere(GLuint n)
+{
+    n = max(n, 1u);
+    const GLfloat t = (1.0f + sqrt(5.0f)) * 0.5f;
+    const glm::vec3 corners[12] = {
+        glm::normalize(glm::vec3(-1, t, 0)), glm::normalize(glm::vec3(1, t, 0)), glm::normalize(glm::vec3(-1, -t, 0)), glm::normalize(glm::vec3(1, -t, 0)),
+        glm::normalize(glm::vec3(0, -1, t)), glm::normalize(glm::vec3(0, 1, t)), glm::normalize(glm::vec3(0, -1, -t)), glm::normalize(glm::vec3(0, 1, -t)),
+        glm::normalize(glm::vec3(t, 0, -1)), glm::normalize(glm::vec3(t, 0, 1)), glm::normalize(glm::vec3(-t, 0, -1)), glm::normalize(glm::vec3(-t, 0, 1))
+    };
+    // faces of the icosahedron, counter-clockwise when seen from outside
+    const GLuint faces[20][3] = {
+        {0,11,5}, {0,5,1}, {0,1,7}, {0,7,10}, {0,10,11}, {1,5,9}, {5,11,4}, {11,10,2}, {10,7,6}, {7,1,8},
+        {3,9,4}, {3,4,2}, {3,2,6}, {3,6,8}, {3,8,9}, {4,9,5}, {2,4,11}, {6,2,10}, {8,6,7}, {9,8,1}
+    };
+
+    vector<vector<glm::vec3>> facePositions(20);
+    vector<vector<GLuint>> faceTriangles(20);
+    const GLuint verticesPerFace = (n + 1) * (n + 2) / 2;
+
+    GenerateFaces(20, verticesPerFace, [&](GLuint f) {
+        vector<glm::vec3>& positions = facePositions[f];
+        vector<GLuint>& tris = faceTriangles[f];
+        positions.reserve(verticesPerFace);
+        tris.reserve(n * n * 3);
+
+        // index of the grid point (i, j), with i + j <= n
+        vector<GLuint> rowStart(n + 2);
+        for (GLuint i = 0, start = 0; i <= n + 1; i++)
+        {
+            rowStart[i] = start;
+            start += n + 1 - i;
+        }
+        for (GLuint i = 0; i <= n; i++)
+            for (GLuint j = 0; i + j <= n; j++)
+            {
+                // barycentric weights (integers), summed always in order of corner index:
+                // in this way, the points on an edge are computed in the same way by the two faces sharing the edge
+                GLuint w[3] = { n - i - j, i, j };
+                GLuint c[3] = { faces[f][0], faces[f][1], faces[f][2] };
+                for (int a = 0; a < 2; a++)
+                    for (int b = 0; b < 2 - a; b++)
+                        if (c[b] > c[b + 1])
+                        {
+                            swap(c[b], c[b + 1]);
+                            swap(w[b], w[b + 1]);
+                        }
+                glm::vec3 p(0.0f);
+                for (int k = 0; k < 3; k++)
+                    if (w[k] > 0)
+                        p += corners[c[k]] * (GLfloat)w[k];
+                positions.push_back(glm::normalize(p / (GLfloat)n));
+            }
+        for (GLuint i = 0; i < n; i++)
+            for (GLuint j = 0; i + j < n; j++)
+            {
+                GLuint p00 = rowStart[i] + j, p10 = rowStart[i + 1] + j, p01 = rowStart[i] + j + 1;
+                tris.insert(tris.end(), { p00, p10, p01 });
+                if (i + j + 1 < n)
+                {
+                    GLuint p11 = rowStart[i + 1] + j + 1;
+                    tris.insert(tris.end(), { p10, p11, p01 });
+                }
+            }
+    });
+
+    vector<glm::vec3> positions;
+    vector<GLuint> triangles;
+    WeldPositions(facePositions, faceTriangles, positions, triangles);
+    return FinalizeSphere(positions, triangles);
+}
+
+//////////////////////////////////////////
+// cube-sphere: each of the 6 faces of the cube is subdivided in a n x n grid
+inline MeshData GenerateCubeSphere(GLuint n)
+{
+    n = max(n, 1u);
+    // normal, U and V axes of the faces (U x V = normal, so the triangles are counter-clockwise when seen from outside)
+    const glm::ivec3 axes[6][3] = {
+        { { 1, 0, 0}, { 0, 0,-1}, {0, 1, 0} },
+        { {-1, 0, 0}, { 0, 0, 1}, {0, 1, 0} },
+        { { 0, 1, 0}, { 1, 0, 0}, {0, 0,-1} },
+        { { 0,-1, 0}, { 1, 0, 0}, {0, 0, 1} },
+        { { 0, 0, 1}, { 1, 0, 0}, {0, 1, 0} },
+        { { 0, 0,-1}, {-1, 0, 0}, {0, 1, 0} }
+    };
+
+    vector<vector<glm::vec3>> facePositions(6);
+    vector<vector<GLuint>> faceTriangles(6);
+    const GLuint verticesPerFace = (n + 1) * (n + 1);
+
+    GenerateFaces(6, verticesPerFace, [&](GLuint f) {
+        vector<glm::vec3>& positions = facePositions[f];
+        vector<GLuint>& tris = faceTriangles[f];
+        positions.reserve(verticesPerFace);
+        tris.reserve(n * n * 6);
+        for (GLuint j = 0; j <= n; j++)
+            for (GLuint i = 0; i <= n; i++)
+            {
+                // integer coordinates on the cube (in [-n, n]), divided by n: points on the shared edges are bit-wise identical
+                glm::ivec3 q = axes[f][0] * (GLint)n + axes[f][1] * ((GLint)(2 * i) - (GLint)n) + axes[f][2] * ((GLint)(2 * j) - (GLint)n);
+                glm::vec3 p = glm::vec3(q) / (GLfloat)n;
+                glm::vec3 p2 = p * p;
+                positions.push_back(glm::vec3(
+                    p.x * sqrt(max(0.0f, 1.0f - p2.y * 0.5f - p2.z * 0.5f + p2.y * p2.z / 3.0f)),
+                    p.y * sqrt(max(0.0f, 1.0f - p2.z * 0.5f - p2.x * 0.5f + p2.z * p2.x / 3.0f)),
+                    p.z * sqrt(max(0.0f, 1.0f - p2.x * 0.5f - p2.y * 0.5f + p2.x * p2.y / 3.0f))));
+            }
+        for (GLuint j = 0; j < n; j++)
+            for (GLuint i = 0; i < n; i++)
+            {
+                GLuint p00 = j * (n + 1) + i, p10 = p00 + 1, p01 = p00 + n + 1, p11 = p01 + 1;
+                tris.insert(tris.end(), { p00, p10, p11, p00, p11, p01 });
+            }
+    });
+
+    vector<glm::vec3> positions;
+    vector<GLuint> triangles;
+    WeldPositions(facePositions, faceTriangles, positions, triangles);
+    return FinalizeSphere(positions, triangles);
+}
+
+//////////////////////////////////////////
+// annulus on the XZ plane, facing +Y. The number of rings along the radius is proportional to the number of segments,
+// in order to have triangles of similar size
+inline MeshData GenerateAnnulus(GLuint segments, GLfloat innerRadius, GLfloat outerRadius)
+{
+    const GLfloat PI = 3.14159265359f;
+    segments = max(segments, 3u);
+    GLfloat width = outerRadius - innerRadius;
+    GLuint rings = max(1u, (GLuint)ceil(segments * width / (2.0f * PI * outerRadius)));
+
+    MeshData data;
+    data.vertices.reserve((rings + 1) * (segments + 1));
+    data.indices.reserve(rings * segments * 6);
+    // the first and last columns have the same positions, but different v (the seam of the ring)
+    for (GLuint s = 0; s <= segments; s++)
+    {
+        GLfloat phi = 2.0f * PI * s / segments;
+        glm::vec3 radial(cos(phi), 0.0f, -sin(phi));
+        for (GLuint r = 0; r <= rings; r++)
+        {
+            Vertex v;
+            GLfloat u = (GLfloat)r / rings;
+            v.Position = radial * (innerRadius + u * width);
+            v.Normal = glm::vec3(0.0f, 1.0f, 0.0f);
+            v.TexCoords = glm::vec2(u, (GLfloat)s / segments);
+            v.Tangent = radial;
+            v.Bitangent = glm::vec3(-sin(phi), 0.0f, -cos(phi));
+            data.vertices.push_back(v);
+        }
+    }
+    for (GLuint s = 0; s < segments; s++)
+        for (GLuint r = 0; r < rings; r++)
+        {
+            GLuint p00 = s * (rings + 1) + r, p10 = p00 + 1, p01 = p00 + rings + 1, p11 = p01 + 1;
+            data.indices.insert(data.indices.end(), { p00, p10, p01, p10, p11, p01 });
+        }
+    return data;
+}
+
+//////////////////////////////////////////
+// generation of a procedural mesh, with its LODs.
+// Results are cached using the parameters as key: a copy of the cached data is returned
+inline MeshData GenerateProceduralMesh(const ProceduralParams& params, const SimplifySettings& simplifySettings = SimplifySettings())
+{
+    typedef tuple<int, GLuint, GLfloat, GLfloat, uint64_t> CacheKey;
+    static map<CacheKey, MeshData> cache;
+    static mutex cacheMutex;
+
+    CacheKey key(params.shape, params.subdivisions,
+                 params.shape == PROCEDURAL_ANNULUS ? params.innerRadius : 0.0f,
+                 params.shape == PROCEDURAL_ANNULUS ? params.outerRadius : 0.0f,
+                 HashSimplifySettings(simplifySettings));
+    {
+        lock_guard<mutex> lock(cacheMutex);
+        auto cached = cache.find(key);
+        if (cached != cache.end())
+            return cached->second;
+    }
+
+    MeshData data;
+    if (params.shape == PROCEDURAL_ICOSPHERE)
+        data = GenerateIcosphere(params.subdivisions);
+    else if (params.shape == PROCEDURAL_CUBE_SPHERE)
+        data = GenerateCubeSphere(params.subdivisions);
+    else
+        data = GenerateAnnulus(params.subdivisions, params.innerRadius, params.outerRadius);
+    BuildLODChain(data, simplifySettings);
+
+    lock_guard<mutex> lock(cacheMutex);
+    cache[key] = data;
+    return data;
+}
@@ -0,0 +1,313 @@
+/*
+Program cache
+- persistent cache of the linked Shader Programs (see shader.h): after the linking, the binary of the program is retrieved
+  with glGetProgramBinary and saved in a file of the cache folder. At the next run, the binary is loaded with glProgramBinary,
+  skipping the compilation and the linking of the shaders
+- each file is identified by a key: the hash of the source code of the shaders (with the injected #define directives)
+  and of the vendor, renderer and version strings of the driver
+- if the driver supports GL_KHR_parallel_shader_compile (or GL_ARB_parallel_shader_compile), the compilation and the linking
+  of the programs not found in the cache are performed in parallel by the driver: the state of a program can be checked
+  without blocking with GL_COMPLETION_STATUS_KHR (see Shader::Ready)
+- the cache counts the programs loaded from the cache and the programs compiled, to report the warm-up time of the shaders
+- CompactionTask removes the invalid files and the files not used for a long time, one file at each step (see N.B. 4)
+- each saved binary is loaded back in a temporary program, through the same Load used at the next run: if the driver refuses it,
+  the file is removed, and the program will be compiled again (see N.B. 5)
+
+N.B. 1)
+The binaries are specific of the GPU and of the driver: if the driver is updated, the key changes and the programs are compiled again.
+The driver can refuse a binary also with the same key (e.g., after a change of settings): in this case the link status of the
+program is false after glProgramBinary, and the program is compiled from the source code (see Shader::finish).
+
+N.B. 2)
+If the driver does not support any binary format (GL_NUM_PROGRAM_BINARY_FORMATS is 0), the cache is disabled.
+The files are a local cache: they are not portable, and they can be deleted at any time.
+
+N.B. 3)
+glad does not include GL_KHR_parallel_shader_compile: we check the extension in the extension strings, and we use only
+the GL_COMPLETION_STATUS_KHR query. The number of compiler threads is left to the default of the driver
+(GL_MAX_SHADER_COMPILER_THREADS_KHR is "implementation-dependent maximum" by default).
+
+N.B. 4)
+The old binaries (e.g., of a previous driver, or of a modified shader) are never loaded again: without a compaction, the folder grows
+at each change. The time of the last use of a file is its modification time, updated when the file is loaded: the files not used for
+PROGRAM_CACHE_MAX_AGE_DAYS days are removed. The compaction is not urgent, and it reads the headers of all the files: it is executed
+in small steps by the FrameScheduler (see frame_scheduler.h), so it does not cause a spike in the frame time.
+
+N.B. 5)
+The binary can be retrieved only if GL_PROGRAM_BINARY_RETRIEVABLE_HINT is set before the linking (see Shader::compile): otherwise,
+some drivers return a binary of length 0, or a binary they refuse at the next run. A cache which is written but never hit only
+adds the cost of the saving, so Save checks the binary with Load before keeping the file, and it reports the binaries of length 0.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+#include <utils/hash.h>
+#include <utils/logger.h>
+
+// query of GL_KHR_parallel_shader_compile (not included in glad, see N.B. 3)
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// identifier and version of the cache file format
+const uint32_t PROGRAM_CACHE_MAGIC = 0x43475250; // "PRGC"
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+// the files not used for this number of days are removed by the compaction (see N.B. 4)
+const int PROGRAM_CACHE_MAX_AGE_DAYS = 30;
+
+// header of a cache file
+struct ProgramCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    // format of the binary (returned by glGetProgramBinary)
+    uint32_t binaryFormat;
+    uint32_t size;
+};
+
+/////////////////// PROGRAM CACHE class ///////////////////////
+class ProgramCache
+{
+public:
+    // the cache is shared by all the Shader Programs of the application
+    static ProgramCache& Instance()
+    {
+        static ProgramCache cache;
+        return cache;
+    }
+
+    ProgramCache(const ProgramCache&) = delete;
+    ProgramCache& operator=(const ProgramCache&) = delete;
+
+    // folder of the cache files (it is created at the first save)
+    void SetFolder(const string& path) { this->folder = path; }
+
+    // the cache can be disabled (e.g., to measure the compilation time)
+    void SetEnabled(bool enable) { this->enabled = enable; }
+
+    //////////////////////////////////////////
+
+    // key of a program: hash of the source code of the shaders and of the driver
+    uint64_t Key(const string& vertexCode, const string& fragmentCode)
+    {
+        this->init();
+        uint64_t h = HashString(this->driver);
+        h = HashString(vertexCode, h);
+        return HashString(fragmentCode, h);
+    }
+
+    // we load the binary of a program from the cache. It returns false if the binary is not in the cache.
+    // If it returns true, the link status of the program must be checked (the driver can refuse the binary, see N.B. 1)
+    bool Load(uint64_t key, GLuint program)
+    {
+        this->init();
+        if (!this->Enabled())
+            return false;
+        ifstream file(this->path(key), ios::binary);
+        if (!file)
+            return false;
+        ProgramCacheHeader header;
+        if (!file.read((char*)&header, sizeof(header)) || header.magic != PROGRAM_CACHE_MAGIC ||
+            header.version != PROGRAM_CACHE_VERSION || header.key != key)
+            return false;
+        vector<char> binary(header.size);
+        if (!file.read(binary.data(), header.size))
+            return false;
+        glProgramBinary(program, header.binaryFormat, binary.data(), (GLsizei)header.size);
+        // the modification time is the time of the last use (see N.B. 4)
+        file.close();
+        error_code error;
+        filesystem::last_write_time(this->path(key), filesystem::file_time_type::clock::now(), error);
+        return true;
+    }
+
+    // we save the binary of a linked program in the cache. The file is kept only if the binary is accepted by Load (see N.B. 5).
+    // It returns true if the program will be loaded from the cache at the next run
+    bool Save(uint64_t key, GLuint program)
+    {
+        if (!this->Enabled())
+            return false;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        vector<char> binary(max(length, 0));
+        GLenum binaryFormat = 0;
+        if (length > 0)
+            glGetProgramBinary(program, length, &length, &binaryFormat, binary.data());
+        if (length <= 0)
+        {
+            LOG_WARNING("PROGRAM_CACHE", "the driver returns an empty binary for the program " << this->fileName(key) << ": it is not cached");
+            return false;
+        }
+
+        ProgramCacheHeader header = { PROGRAM_CACHE_MAGIC, PROGRAM_CACHE_VERSION, key, binaryFormat, (uint32_t)length };
+        error_code error;
+        filesystem::create_directories(this->folder, error);
+        ofstream file(this->path(key), ios::binary | ios::trunc);
+        if (!file)
+        {
+            LOG_WARNING("PROGRAM_CACHE", "impossible to write the cache file " << this->path(key));
+            return false;
+        }
+        file.write((const char*)&header, sizeof(header));
+        file.write(binary.data(), length);
+        file.close();
+
+        // we load the file in a temporary program, like at the next run: if the driver refuses the binary, the file is useless
+        GLuint check = glCreateProgram();
+        GLint linked = GL_FALSE;
+        if (this->Load(key, check))
+            glGetProgramiv(check, GL_LINK_STATUS, &linked);
+        glDeleteProgram(check);
+        if (!linked)
+        {
+            LOG_WARNING("PROGRAM_CACHE", "the binary of the program " << this->fileName(key) << " is refused by the driver: it is not cached");
+            filesystem::remove(this->path(key), error);
+            return false;
+        }
+        return true;
+    }
+
+    // resumable task removing the invalid files and the files not used for PROGRAM_CACHE_MAX_AGE_DAYS days, one file at each call.
+    // It returns true when all the files have been checked (see N.B. 4)
+    function<bool()> CompactionTask()
+    {
+        struct Compaction
+        {
+            filesystem::directory_iterator file;
+            GLuint checked = 0, removed = 0;
+            uintmax_t removedBytes = 0;
+        };
+        shared_ptr<Compaction> state = make_shared<Compaction>();
+        error_code error;
+        state->file = filesystem::directory_iterator(this->folder, error);
+        return [this, state]()
+        {
+            error_code error;
+            if (state->file == filesystem::directory_iterator())
+            {
+                if (state->removed > 0)
+                    LOG_INFO("PROGRAM_CACHE", "compaction: " << state->removed << " of " << state->checked << " files removed, "
+                        << state->removedBytes / 1024 << " KB");
+                return true;
+            }
+            const filesystem::path path = state->file->path();
+            state->file.increment(error);
+            if (error)
+                state->file = filesystem::directory_iterator();
+            if (path.extension() != ".bin")
+                return false;
+            state->checked++;
+
+            // the header must be valid, and the key must be the name of the file
+            ProgramCacheHeader header;
+            bool valid = false;
+            {
+                ifstream file(path, ios::binary);
+                valid = file.read((char*)&header, sizeof(header)) && header.magic == PROGRAM_CACHE_MAGIC && header.version == PROGRAM_CACHE_VERSION &&
+                        path.stem().string() == this->fileName(header.key) &&
+                        filesystem::file_size(path, error) == sizeof(header) + header.size;
+            }
+            const filesystem::file_time_type lastUse = filesystem::last_write_time(path, error);
+            const bool old = !error && filesystem::file_time_type::clock::now() - lastUse > chrono::hours(24 * PROGRAM_CACHE_MAX_AGE_DAYS);
+            if (!valid || old)
+            {
+                const uintmax_t size = filesystem::file_size(path, error);
+                if (filesystem::remove(path, error))
+                {
+                    state->removed++;
+                    state->removedBytes += error ? 0 : size;
+                }
+            }
+            return false;
+        };
+    }
+
+    //////////////////////////////////////////
+
+    // the cache is used only if the driver supports at least a binary format (see N.B. 2)
+    bool Enabled()
+    {
+        this->init();
+        return this->enabled && this->binaryFormats > 0;
+    }
+
+    // true if the driver compiles and links the programs in parallel (see N.B. 3)
+    bool ParallelCompile()
+    {
+        this->init();
+        return this->parallel;
+    }
+
+    // we count the programs loaded from the cache, and the programs compiled from the source code
+    void CountHit() { this->hits++; }
+    void CountMiss() { this->misses++; }
+    GLuint Hits() const { return this->hits; }
+    GLuint Misses() const { return this->misses; }
+
+private:
+    ProgramCache() {}
+
+    string folder = "shader_cache";
+    bool enabled = true;
+    bool initialized = false;
+    // identification of the driver
+    string driver;
+    GLint binaryFormats = 0;
+    bool parallel = false;
+    GLuint hits = 0;
+    GLuint misses = 0;
+
+    // the properties of the driver are read at the first use (the OpenGL context must be current)
+    void init()
+    {
+        if (this->initialized)
+            return;
+        this->initialized = true;
+        const char* strings[] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER),
+                                  (const char*)glGetString(GL_VERSION) };
+        for (const char* s : strings)
+            this->driver += string(s ? s : "") + "|";
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &this->binaryFormats);
+
+        GLint numExtensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+        for (GLint i = 0; i < numExtensions; i++)
+        {
+            string extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if (extension == "GL_KHR_parallel_shader_compile" || extension == "GL_ARB_parallel_shader_compile")
+                this->parallel = true;
+        }
+    }
+
+    // name of the cache file of a program (without extension), and its path
+    string fileName(uint64_t key) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+        return name;
+    }
+
+    string path(uint64_t key) const
+    {
+        return (filesystem::path(this->folder) / (this->fileName(key) + ".bin")).string();
+    }
+};
@@ -0,0 +1,814 @@
+/*
+RenderGraph class
+- description of the frame as a graph of passes: each pass declares the resources it reads and writes (textures and buffers,
+  with their usage: attachment, sampled texture, storage image or buffer, ...), and a function recording its OpenGL commands.
+  The graph is built again at each frame, so the passes can change with the options of the application
+- the resources are "virtual": a transient texture is only a description (size and format) until the graph is compiled;
+  the textures and buffers created outside the graph (e.g., the default framebuffer, the textures of the models) are imported
+- Compile() computes, at each frame:
+  - the passes to execute: the passes whose outputs are not read by any other pass are culled (and then, recursively, the passes
+    writing only resources read by culled passes). The passes writing an imported resource, or marked with SideEffect(), are always executed
+  - the order of execution: the order of declaration of the passes (see N.B. 1)
+  - the lifetime of each transient texture (from the first to the last pass using it), and its physical texture: the transient textures
+    with the same description and non-overlapping lifetimes share the same physical texture (see N.B. 2)
+  - the memory barriers needed between the passes (see N.B. 3)
+- Execute() binds the framebuffer of each pass (created from its attachments, and cached), clears the attachments declared with
+  RG_LOAD_CLEAR, and calls the function of the pass
+
+N.B. 1)
+A pass can read only the resources created or written by the passes declared before it: the order of declaration is a valid
+order of execution, and the graph does not need a topological sort. Reading a transient texture not yet written is an error
+(its content is undefined, because its physical texture can be shared with other resources).
+
+N.B. 2)
+OpenGL does not allow to place more textures in the same memory (like the aliasing of memory in Vulkan and Direct3D 12):
+the transient textures with non-overlapping lifetimes share the texture objects of a pool, if they have the same description.
+The pool is kept between the frames (the textures are not created at each frame), and a texture not used for RG_POOL_FRAMES
+frames is deleted. Since the content of a shared texture is undefined at the beginning of the lifetime of a resource, the first
+pass writing a transient texture should clear it (RG_LOAD_CLEAR), or write all its texels.
+
+N.B. 3)
+In OpenGL, the writes in the attachments and the copies are visible to the following commands without explicit synchronization:
+a barrier (glMemoryBarrier, OpenGL 4.2) is needed only after the writes with image store or in shader storage buffers, before the
+following accesses to the same resource. The bits of the barrier depend on the following usage (e.g., GL_TEXTURE_FETCH_BARRIER_BIT
+for a sampled texture), and the barriers needed by a pass are combined in a single glMemoryBarrier call before it.
+
+N.B. 4)
+Release() deletes the textures of the pool and the framebuffers: it must be called while the OpenGL context is current
+(e.g., by the render thread, before releasing the context).
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+#include <climits>
+
+#include <glm/glm.hpp>
+
+#include <utils/gl_backend.h>
+#include <utils/resource_registry.h>
+#include <utils/logger.h>
+
+// frames after which an unused texture of the pool is deleted (see N.B. 2)
+const GLuint RG_POOL_FRAMES = 60;
+
+// usage of a resource in a pass
+enum RGUsage
+{
+    RG_COLOR_ATTACHMENT, RG_DEPTH_ATTACHMENT, RG_SAMPLED, RG_STORAGE_IMAGE,
+    RG_STORAGE_BUFFER, RG_UNIFORM_BUFFER, RG_INDIRECT_BUFFER, RG_VERTEX_BUFFER
+};
+
+// content of an attachment at the beginning of a pass writing it
+enum RGLoad { RG_LOAD_KEEP, RG_LOAD_CLEAR };
+
+// description of a texture of the graph
+struct RGTextureDesc
+{
+    GLuint width = 0;
+    GLuint height = 0;
+    GLenum format = GL_RGBA8;
+
+    bool operator==(const RGTextureDesc& other) const
+    {
+        return this->width == other.width && this->height == other.height && this->format == other.format;
+    }
+};
+
+// handle of a resource of the graph (valid only in the frame where it has been created or imported)
+struct RGResource
+{
+    GLuint index = UINT_MAX;
+
+    bool Valid() const { return this->index != UINT_MAX; }
+};
+
+class RenderGraph;
+
+/////////////////// RENDERGRAPHBUILDER class ///////////////////////
+// passed to the setup function of a pass, to declare its resources
+class RenderGraphBuilder
+{
+public:
+    // we create a transient texture
+    RGResource Create(const string& name, const RGTextureDesc& desc);
+    // the pass reads the resource
+    RGResource Read(RGResource resource, RGUsage usage = RG_SAMPLED);
+    // the pass writes the resource (an attachment can be cleared at the beginning of the pass)
+    RGResource Write(RGResource resource, RGUsage usage = RG_COLOR_ATTACHMENT, RGLoad load = RG_LOAD_KEEP);
+    // values of the attachments written with RG_LOAD_CLEAR
+    void SetClearColor(const glm::vec4& color);
+    void SetClearDepth(GLfloat depth);
+    // the pass is never culled (e.g., it reads back the results on the CPU)
+    void SideEffect();
+
+private:
+    friend class RenderGraph;
+
+    RenderGraph& graph;
+    GLuint pass;
+
+    RenderGraphBuilder(RenderGraph& graph, GLuint pass) : graph(graph), pass(pass) {}
+};
+
+/////////////////// RENDERGRAPHCONTEXT class ///////////////////////
+// passed to the execution function of a pass, to access the OpenGL objects of its resources
+class RenderGraphContext
+{
+public:
+    // texture (for the default framebuffer: 0) and buffer of a resource
+    GLuint Texture(RGResource resource) const;
+    GLuint Buffer(RGResource resource) const;
+    // size of a texture
+    GLuint Width(RGResource resource) const;
+    GLuint Height(RGResource resource) const;
+
+private:
+    friend class RenderGraph;
+
+    const RenderGraph& graph;
+
+    RenderGraphContext(const RenderGraph& graph) : graph(graph) {}
+};
+
+/////////////////// RENDERGRAPH class ///////////////////////
+class RenderGraph
+{
+public:
+    // We want RenderGraph to be non-copyable (the pool owns OpenGL objects)
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    RenderGraph() {}
+
+    //////////////////////////////////////////
+
+    // we remove the passes and the resources of the previous frame (the pool of textures is kept)
+    void Reset()
+    {
+        this->passes.clear();
+        this->resources.clear();
+        this->compiled = false;
+    }
+
+    // we import the default framebuffer (color and depth): the passes use it as attachment
+    RGResource ImportBackbuffer(const string& name, GLuint width, GLuint height)
+    {
+        Resource resource;
+        resource.name = name;
+        resource.desc = { width, height, 0 };
+        resource.imported = resource.backbuffer = true;
+        return this->add(std::move(resource));
+    }
+
+    // we import a texture created outside the graph
+    RGResource ImportTexture(const string& name, GLuint texture, const RGTextureDesc& desc)
+    {
+        Resource resource;
+        resource.name = name;
+        resource.desc = desc;
+        resource.imported = true;
+        resource.object = texture;
+        return this->add(std::move(resource));
+    }
+
+    // we import a buffer created outside the graph
+    RGResource ImportBuffer(const string& name, GLuint buffer)
+    {
+        Resource resource;
+        resource.name = name;
+        resource.imported = resource.buffer = true;
+        resource.object = buffer;
+        return this->add(std::move(resource));
+    }
+
+    // we add a pass: setup declares its resources (it is called immediately), execute records its commands (it is called by Execute)
+    void AddPass(const string& name, const function<void(RenderGraphBuilder&)>& setup, function<void(RenderGraphContext&)> execute)
+    {
+        Pass pass;
+        pass.name = name;
+        pass.execute = std::move(execute);
+        this->passes.push_back(std::move(pass));
+        this->compiled = false;
+        RenderGraphBuilder builder(*this, (GLuint)this->passes.size() - 1);
+        setup(builder);
+    }
+
+    //////////////////////////////////////////
+
+    // we cull the unused passes, and we compute the physical textures and the barriers of the passes (see the description above)
+    void Compile()
+    {
+        this->frame++;
+        for (Resource& resource : this->resources)
+        {
+            resource.refCount = 0;
+            resource.first = UINT_MAX;
+            resource.last = 0;
+            resource.physical = UINT_MAX;
+        }
+        this->cull();
+
+        // lifetimes of the transient textures, in the passes executed
+        vector<bool> written(this->resources.size(), false);
+        for (GLuint p = 0; p < this->passes.size(); p++)
+        {
+            if (this->passes[p].culled)
+                continue;
+            for (const Access& access : this->passes[p].accesses)
+            {
+                Resource& resource = this->resources[access.resource];
+                if (!access.write && !resource.imported && !written[access.resource] &&
+                    none_of(this->passes[p].accesses.begin(), this->passes[p].accesses.end(), [&access](const Access& other) { return other.write && other.resource == access.resource; }))
+                    LOG_ERROR("RENDER_GRAPH", "the pass " << this->passes[p].name << " reads " << resource.name << " before any write (see N.B. 1)");
+                resource.first = min(resource.first, p);
+                resource.last = max(resource.last, p);
+            }
+            for (const Access& access : this->passes[p].accesses)
+                written[access.resource] = written[access.resource] || access.write;
+        }
+
+        // physical textures: a texture of the pool is free after the last pass using its resource (see N.B. 2)
+        for (PooledTexture& texture : this->pool)
+            texture.used = false;
+        this->virtualBytes = this->physicalBytes = 0;
+        this->numTransient = this->numPhysical = 0;
+        for (GLuint p = 0; p < this->passes.size(); p++)
+        {
+            if (this->passes[p].culled)
+                continue;
+            for (const Access& access : this->passes[p].accesses)
+            {
+                Resource& resource = this->resources[access.resource];
+                if (resource.imported || resource.physical != UINT_MAX)
+                    continue;
+                resource.physical = this->acquire(resource.desc);
+                resource.object = this->pool[resource.physical].texture;
+                this->numTransient++;
+                this->virtualBytes += TextureBytes(resource.desc);
+            }
+            for (const Access& access : this->passes[p].accesses)
+            {
+                const Resource& resource = this->resources[access.resource];
+                if (!resource.imported && resource.last == p)
+                    this->pool[resource.physical].used = false;
+            }
+        }
+        for (const PooledTexture& texture : this->pool)
+            if (texture.lastFrame == this->frame)
+            {
+                this->numPhysical++;
+                this->physicalBytes += TextureBytes(texture.desc);
+            }
+
+        this->insertBarriers();
+        this->trimPool();
+        this->compiled = true;
+    }
+
+    // we execute the passes not culled (the graph is compiled, if needed). At the end, the default framebuffer is bound
+    void Execute()
+    {
+        if (!this->compiled)
+            this->Compile();
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        RenderGraphContext context(*this);
+        for (Pass& pass : this->passes)
+        {
+            if (pass.culled)
+                continue;
+            if (pass.barriers && glMemoryBarrier)
+                glMemoryBarrier(pass.barriers);
+            this->bindTargets(pass);
+            pass.execute(context);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+
+    //////////////////////////////////////////
+
+    // statistics of the last compilation
+    GLuint CulledPasses() const
+    {
+        return (GLuint)count_if(this->passes.begin(), this->passes.end(), [](const Pass& pass) { return pass.culled; });
+    }
+    GLuint TransientTextures() const { return this->numTransient; }
+    GLuint PhysicalTextures() const { return this->numPhysical; }
+    GLuint Barriers() const { return this->numBarriers; }
+    GLuint PooledTextures() const { return (GLuint)this->pool.size(); }
+
+    // we print on console the passes of the last compilation, with their resources, and the memory of the transient textures
+    void PrintStats() const
+    {
+        std::cout << "Render graph: " << this->passes.size() << " passes (" << this->CulledPasses() << " culled), " << this->numTransient
+                  << " transient textures in " << this->numPhysical << " physical textures (" << this->physicalBytes / 1024 << " KB, "
+                  << this->virtualBytes / 1024 << " KB without aliasing), " << this->numBarriers << " barriers, "
+                  << this->pool.size() << " textures in the pool" << std::endl;
+        for (const Pass& pass : this->passes)
+        {
+            std::cout << "  " << pass.name << (pass.culled ? " (culled)" : "") << ":";
+            for (const Access& access : pass.accesses)
+                std::cout << " " << (access.write ? "writes " : "reads ") << this->resources[access.resource].name;
+            std::cout << std::endl;
+        }
+    }
+
+    //////////////////////////////////////////
+
+    // we delete the textures of the pool and the framebuffers (see N.B. 4)
+    void Release()
+    {
+        for (const pair<const vector<GLuint>, GLuint>& framebuffer : this->framebuffers)
+            glDeleteFramebuffers(1, &framebuffer.second);
+        this->framebuffers.clear();
+        for (const PooledTexture& texture : this->pool)
+        {
+            ResourceRegistry::Instance().Release(RESOURCE_TEXTURE, texture.texture);
+            glDeleteTextures(1, &texture.texture);
+        }
+        this->pool.clear();
+        this->Reset();
+    }
+
+    //////////////////////////////////////////
+
+    // size in bytes of a texture
+    static size_t TextureBytes(const RGTextureDesc& desc)
+    {
+        GLenum external, type;
+        return (size_t)desc.width * desc.height * FormatInfo(desc.format, external, type);
+    }
+
+    // true if an internal format has unsigned integer texels (the attachments are cleared with glClearBufferuiv)
+    static bool IntegerFormat(GLenum format)
+    {
+        return format == GL_R32UI || format == GL_RGBA8UI || format == GL_RGBA16UI;
+    }
+
+    // bytes per texel of an internal format, and the format and the type of its data (for glTexImage2D)
+    static GLuint FormatInfo(GLenum format, GLenum& external, GLenum& type)
+    {
+        external = GL_RGBA;
+        type = GL_UNSIGNED_BYTE;
+        switch (format)
+        {
+            case GL_R8: external = GL_RED; return 1;
+            case GL_RG8: external = GL_RG; return 2;
+            case GL_RGBA8: return 4;
+            case GL_R32UI: external = GL_RED_INTEGER; type = GL_UNSIGNED_INT; return 4;
+            case GL_RGBA8UI: external = GL_RGBA_INTEGER; return 4;
+            case GL_RGBA16UI: external = GL_RGBA_INTEGER; type = GL_UNSIGNED_SHORT; return 8;
+            case GL_R16F: external = GL_RED; type = GL_FLOAT; return 2;
+            case GL_RG16F: external = GL_RG; type = GL_FLOAT; return 4;
+            case GL_R32F: external = GL_RED; type = GL_FLOAT; return 4;
+            case GL_R11F_G11F_B10F: external = GL_RGB; type = GL_FLOAT; return 4;
+            case GL_RGBA16F: type = GL_FLOAT; return 8;
+            case GL_RGBA32F: type = GL_FLOAT; return 16;
+            case GL_DEPTH_COMPONENT16: external = GL_DEPTH_COMPONENT; type = GL_FLOAT; return 2;
+            case GL_DEPTH_COMPONENT24: external = GL_DEPTH_COMPONENT; type = GL_FLOAT; return 4;
+            case GL_DEPTH_COMPONENT32F: external = GL_DEPTH_COMPONENT; type = GL_FLOAT; return 4;
+            case GL_DEPTH24_STENCIL8: external = GL_DEPTH_STENCIL; type = GL_UNSIGNED_INT_24_8; return 4;
+        }
+        return 4;
+    }
+
+private:
+    friend class RenderGraphBuilder;
+    friend class RenderGraphContext;
+
+    struct Access
+    {
+        GLuint resource;
+        RGUsage usage;
+        bool write;
+        RGLoad load;
+    };
+
+    struct Pass
+    {
+        string name;
+        function<void(RenderGraphContext&)> execute;
+        vector<Access> accesses;
+        bool sideEffect = false;
+        bool culled = false;
+        GLuint refCount = 0;
+        glm::vec4 clearColor = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        GLfloat clearDepth = 1.0f;
+        GLbitfield barriers = 0;
+    };
+
+    // state of the writes in storage (image store or shader storage buffer) of a resource, for the barriers (see N.B. 3)
+    struct StorageState
+    {
+        bool written = false;
+        // bits of the barriers already executed after the last write
+        GLbitfield synchronized = 0;
+    };
+
+    struct Resource
+    {
+        string name;
+        RGTextureDesc desc;
+        bool imported = false;
+        bool backbuffer = false;
+        bool buffer = false;
+        // texture or buffer (for the transient textures, the physical texture after the compilation)
+        GLuint object = 0;
+        // passes writing the resource, and number of passes reading it (for the culling)
+        vector<GLuint> producers;
+        GLuint refCount = 0;
+        // lifetime, and index of the physical texture in the pool
+        GLuint first = UINT_MAX, last = 0;
+        GLuint physical = UINT_MAX;
+        StorageState storage;
+    };
+
+    struct PooledTexture
+    {
+        RGTextureDesc desc;
+        GLuint texture = 0;
+        bool used = false;
+        GLuint64 lastFrame = 0;
+        StorageState storage;
+    };
+
+    vector<Pass> passes;
+    vector<Resource> resources;
+    vector<PooledTexture> pool;
+    // framebuffers, by their attachments (colors, then depth)
+    map<vector<GLuint>, GLuint> framebuffers;
+    bool compiled = false;
+    GLuint64 frame = 0;
+    // statistics of the last compilation
+    GLuint numTransient = 0, numPhysical = 0, numBarriers = 0;
+    size_t virtualBytes = 0, physicalBytes = 0;
+
+    RGResource add(Resource&& resource)
+    {
+        this->resources.push_back(std::move(resource));
+        this->compiled = false;
+        return { (GLuint)this->resources.size() - 1 };
+    }
+
+    bool valid(RGResource resource) const
+    {
+        if (resource.index < this->resources.size())
+            return true;
+        LOG_ERROR("RENDER_GRAPH", "invalid resource handle");
+        return false;
+    }
+
+    //////////////////////////////////////////
+
+    // culling of the passes whose outputs are not used (reference counting: a resource without readers releases its producers).
+    // The reference count of a pass is the number of different resources it writes, and the reference count of a resource is the number
+    // of passes reading it: a resource declared more times by a pass (e.g., as color attachment and as storage image) is counted once
+    void cull()
+    {
+        for (Pass& pass : this->passes)
+        {
+            pass.culled = false;
+            pass.refCount = 0;
+            for (size_t a = 0; a < pass.accesses.size(); a++)
+            {
+                const Access& access = pass.accesses[a];
+                // the writes of the imported resources are visible outside the graph
+                if (access.write && this->resources[access.resource].imported)
+                    pass.sideEffect = true;
+                if (repeated(pass, a))
+                    continue;
+                if (access.write)
+                    pass.refCount++;
+                else
+                    this->resources[access.resource].refCount++;
+            }
+        }
+        vector<GLuint> unused;
+        for (GLuint r = 0; r < this->resources.size(); r++)
+            if (this->resources[r].refCount == 0 && !this->resources[r].imported)
+                unused.push_back(r);
+        while (!unused.empty())
+        {
+            const GLuint r = unused.back();
+            unused.pop_back();
+            for (GLuint p : this->resources[r].producers)
+            {
+                Pass& pass = this->passes[p];
+                if (pass.sideEffect || pass.culled || --pass.refCount > 0)
+                    continue;
+                pass.culled = true;
+                for (size_t a = 0; a < pass.accesses.size(); a++)
+                {
+                    const GLuint read = pass.accesses[a].resource;
+                    if (!pass.accesses[a].write && !repeated(pass, a) && --this->resources[read].refCount == 0 && !this->resources[read].imported)
+                        unused.push_back(read);
+                }
+            }
+        }
+    }
+
+    // true if the resource of an access is already declared, in the same direction (read or write), by a previous access of the pass
+    static bool repeated(const Pass& pass, size_t a)
+    {
+        const Access& access = pass.accesses[a];
+        return any_of(pass.accesses.begin(), pass.accesses.begin() + a,
+                      [&access](const Access& other) { return other.resource == access.resource && other.write == access.write; });
+    }
+
+    // a free texture of the pool with the description, or a new one
+    GLuint acquire(const RGTextureDesc& desc)
+    {
+        for (GLuint i = 0; i < this->pool.size(); i++)
+            if (!this->pool[i].used && this->pool[i].desc == desc)
+            {
+                this->pool[i].used = true;
+                this->pool[i].lastFrame = this->frame;
+                return i;
+            }
+        PooledTexture texture;
+        texture.desc = desc;
+        texture.used = true;
+        texture.lastFrame = this->frame;
+        GLenum external, type;
+        FormatInfo(desc.format, external, type);
+        if (GLBackend::Instance().DSA())
+        {
+            glCreateTextures(GL_TEXTURE_2D, 1, &texture.texture);
+            glTextureStorage2D(texture.texture, 1, desc.format, desc.width, desc.height);
+            glTextureParameteri(texture.texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTextureParameteri(texture.texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTextureParameteri(texture.texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTextureParameteri(texture.texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        else
+        {
+            GLint bound = 0;
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+            glGenTextures(1, &texture.texture);
+            glBindTexture(GL_TEXTURE_2D, texture.texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, external, type, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindTexture(GL_TEXTURE_2D, bound);
+        }
+        ResourceRegistry::Instance().Register(RESOURCE_TEXTURE, texture.texture, TextureBytes(desc), desc.format, "RenderGraph pool");
+        this->pool.push_back(texture);
+        return (GLuint)this->pool.size() - 1;
+    }
+
+    // we delete the textures of the pool not used for RG_POOL_FRAMES frames, and their framebuffers
+    void trimPool()
+    {
+        for (size_t i = 0; i < this->pool.size();)
+        {
+            if (this->frame - this->pool[i].lastFrame < RG_POOL_FRAMES)
+            {
+                i++;
+                continue;
+            }
+            const GLuint texture = this->pool[i].texture;
+            for (auto framebuffer = this->framebuffers.begin(); framebuffer != this->framebuffers.end();)
+            {
+                if (find(framebuffer->first.begin(), framebuffer->first.end(), texture) != framebuffer->first.end())
+                {
+                    glDeleteFramebuffers(1, &framebuffer->second);
+                    framebuffer = this->framebuffers.erase(framebuffer);
+                }
+                else
+                    ++framebuffer;
+            }
+            ResourceRegistry::Instance().Release(RESOURCE_TEXTURE, texture);
+            glDeleteTextures(1, &texture);
+            // the indices of the following textures change: they are used only during the compilation
+            this->pool.erase(this->pool.begin() + i);
+        }
+    }
+
+    // bit of the barrier needed before an usage of a resource written in storage (see N.B. 3)
+    static GLbitfield barrierBit(RGUsage usage)
+    {
+        switch (usage)
+        {
+            case RG_COLOR_ATTACHMENT:
+            case RG_DEPTH_ATTACHMENT: return GL_FRAMEBUFFER_BARRIER_BIT;
+            case RG_SAMPLED: return GL_TEXTURE_FETCH_BARRIER_BIT;
+            case RG_STORAGE_IMAGE: return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+            case RG_STORAGE_BUFFER: return GL_SHADER_STORAGE_BARRIER_BIT;
+            case RG_UNIFORM_BUFFER: return GL_UNIFORM_BARRIER_BIT;
+            case RG_INDIRECT_BUFFER: return GL_COMMAND_BARRIER_BIT;
+            case RG_VERTEX_BUFFER: return GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT;
+        }
+        return GL_ALL_BARRIER_BITS;
+    }
+
+    // we compute the barriers of the passes, following the writes in storage of the resources (the state of the physical textures
+    // is kept between the frames, since they are shared by different resources)
+    void insertBarriers()
+    {
+        this->numBarriers = 0;
+        for (Pass& pass : this->passes)
+        {
+            pass.barriers = 0;
+            if (pass.culled)
+                continue;
+            for (const Access& access : pass.accesses)
+            {
+                StorageState& state = this->storageState(access.resource);
+                const GLbitfield bit = barrierBit(access.usage);
+                if (state.written && !(state.synchronized & bit))
+                {
+                    pass.barriers |= bit;
+                    state.synchronized |= bit;
+                }
+            }
+            for (const Access& access : pass.accesses)
+                if (access.write)
+                {
+                    StorageState& state = this->storageState(access.resource);
+                    state.written = (access.usage == RG_STORAGE_IMAGE || access.usage == RG_STORAGE_BUFFER);
+                    state.synchronized = 0;
+                }
+            this->numBarriers += (pass.barriers != 0) ? 1 : 0;
+        }
+    }
+
+    StorageState& storageState(GLuint resource)
+    {
+        Resource& r = this->resources[resource];
+        return r.imported ? r.storage : this->pool[r.physical].storage;
+    }
+
+    //////////////////////////////////////////
+
+    // we bind the framebuffer with the attachments of the pass, and we clear them (the passes without attachments bind their own targets)
+    void bindTargets(const Pass& pass)
+    {
+        vector<const Access*> colors;
+        const Access* depth = nullptr;
+        bool backbuffer = false;
+        for (const Access& access : pass.accesses)
+        {
+            if (access.usage != RG_COLOR_ATTACHMENT && access.usage != RG_DEPTH_ATTACHMENT)
+                continue;
+            backbuffer = backbuffer || this->resources[access.resource].backbuffer;
+            // the same attachment can be declared both as read and written: we keep the write (with its load operation)
+            const Access** slot = nullptr;
+            if (access.usage == RG_DEPTH_ATTACHMENT)
+                slot = &depth;
+            else
+                for (const Access*& color : colors)
+                    if (color->resource == access.resource)
+                        slot = &color;
+            if (!slot)
+            {
+                colors.push_back(&access);
+                continue;
+            }
+            if (!*slot || access.write)
+                *slot = &access;
+        }
+        if (colors.empty() && !depth)
+            return;
+
+        const Resource& first = this->resources[colors.empty() ? depth->resource : colors[0]->resource];
+        if (backbuffer)
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        else
+        {
+            vector<GLuint> key;
+            for (const Access* color : colors)
+                key.push_back(this->resources[color->resource].object);
+            key.push_back(depth ? this->resources[depth->resource].object : 0);
+            GLuint& framebuffer = this->framebuffers[key];
+            if (!framebuffer)
+            {
+                glGenFramebuffers(1, &framebuffer);
+                glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+                vector<GLenum> drawBuffers;
+                for (GLuint i = 0; i < colors.size(); i++)
+                {
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, key[i], 0);
+                    drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+                }
+                if (depth)
+                {
+                    const GLenum attachment = (this->resources[depth->resource].desc.format == GL_DEPTH24_STENCIL8) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, key.back(), 0);
+                }
+                if (drawBuffers.empty())
+                    glDrawBuffer(GL_NONE);
+                else
+                    glDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
+                if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                    LOG_ERROR("RENDER_GRAPH", "incomplete framebuffer in the pass " << pass.name);
+            }
+            else
+                glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        }
+        glViewport(0, 0, first.desc.width, first.desc.height);
+
+        for (GLuint i = 0; i < colors.size(); i++)
+            if (colors[i]->write && colors[i]->load == RG_LOAD_CLEAR)
+            {
+                // the integer attachments are cleared with integer values (the clear color is converted)
+                if (IntegerFormat(this->resources[colors[i]->resource].desc.format))
+                {
+                    const glm::uvec4 color = glm::uvec4(pass.clearColor);
+                    glClearBufferuiv(GL_COLOR, i, &color[0]);
+                }
+                else
+                    glClearBufferfv(GL_COLOR, i, &pass.clearColor[0]);
+            }
+        if (depth && depth->write && depth->load == RG_LOAD_CLEAR)
+        {
+            // the depth buffer is cleared only if its writes are enabled
+            GLboolean depthMask;
+            glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+            glDepthMask(GL_TRUE);
+            glClearBufferfv(GL_DEPTH, 0, &pass.clearDepth);
+            glDepthMask(depthMask);
+        }
+    }
+};
+
+//////////////////////////////////////////
+// RenderGraphBuilder and RenderGraphContext use the internals of RenderGraph
+
+inline RGResource RenderGraphBuilder::Create(const string& name, const RGTextureDesc& desc)
+{
+    RenderGraph::Resource resource;
+    resource.name = name;
+    resource.desc = desc;
+    return this->graph.add(std::move(resource));
+}
+
+inline RGResource RenderGraphBuilder::Read(RGResource resource, RGUsage usage)
+{
+    if (this->graph.valid(resource))
+        this->graph.passes[this->pass].accesses.push_back({ resource.index, usage, false, RG_LOAD_KEEP });
+    return resource;
+}
+
+inline RGResource RenderGraphBuilder::Write(RGResource resource, RGUsage usage, RGLoad load)
+{
+    if (this->graph.valid(resource))
+    {
+        this->graph.passes[this->pass].accesses.push_back({ resource.index, usage, true, load });
+        vector<GLuint>& producers = this->graph.resources[resource.index].producers;
+        if (find(producers.begin(), producers.end(), this->pass) == producers.end())
+            producers.push_back(this->pass);
+    }
+    return resource;
+}
+
+inline void RenderGraphBuilder::SetClearColor(const glm::vec4& color)
+{
+    this->graph.passes[this->pass].clearColor = color;
+}
+
+inline void RenderGraphBuilder::SetClearDepth(GLfloat depth)
+{
+    this->graph.passes[this->pass].clearDepth = depth;
+}
+
+inline void RenderGraphBuilder::SideEffect()
+{
+    this->graph.passes[this->pass].sideEffect = true;
+}
+
+inline GLuint RenderGraphContext::Texture(RGResource resource) const
+{
+    return this->graph.valid(resource) && !this->graph.resources[resource.index].buffer ? this->graph.resources[resource.index].object : 0;
+}
+
+inline GLuint RenderGraphContext::Buffer(RGResource resource) const
+{
+    return this->graph.valid(resource) && this->graph.resources[resource.index].buffer ? this->graph.resources[resource.index].object : 0;
+}
+
+inline GLuint RenderGraphContext::Width(RGResource resource) const
+{
+    return this->graph.valid(resource) ? this->graph.resources[resource.index].desc.width : 0;
+}
+
+inline GLuint RenderGraphContext::Height(RGResource resource) const
+{
+    return this->graph.valid(resource) ? this->graph.resources[resource.index].desc.height : 0;
+}
@@ -0,0 +1,385 @@
+/*
+ResourceRegistry class
+- accounting of the memory used by the application: each allocation of an OpenGL buffer, texture or renderbuffer
+  (and the biggest CPU-side copies of the assets) is recorded with its size, format, owner and creation site
+- the classes allocating resources (Mesh, TextureLoader, MipStreamer, VirtualTextureSystem, ...) call Register() after each
+  (re)allocation, and Release() when the resource is deleted: the registry keeps the totals for each kind of resource
+- PrintReport() prints the totals and the biggest resources (top-N, sorted by size), DumpJSON() saves all the records in a JSON file
+- budgets of GPU and CPU memory can be set: when a total exceeds its budget, a warning is printed (once, until the total goes
+  back under the budget), with the owner and the creation site of the allocation which exceeded it
+
+The owner of a resource is passed to Register(), or it is taken from the ResourceOwner active in the calling thread:
+e.g., "ResourceOwner owner(path);" before the creation of a Model assigns to all its buffers the path of the model.
+The creation site is the file and line of the call to Register() (using std::source_location, C++20).
+
+N.B. 1)
+The sizes are the ones requested to OpenGL (e.g., width * height * bytes per texel, for each level): the driver can allocate more memory
+(alignment, padding, internal copies), so the totals are a lower bound of the VRAM actually used.
+
+N.B. 2)
+The names of the OpenGL objects are unique only among the objects of the same kind, so the records are identified by kind and name.
+For the CPU-side data, the identifier is chosen by the owner (e.g., the address of the object keeping the data).
+Textures and buffers created by the loader thread of the TextureLoader are in a context sharing the objects with the main one:
+their names are in the same namespace. The registry can be used by all the threads.
+
+N.B. 3) the registry is shared by the whole application (Instance()), like the AssetSystem and the ThreadPool
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
+#include <source_location>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+
+// messages on the console (see logger.h)
+#include <utils/logger.h>
+
+// the S3TC formats are not in the GLAD loader (see texture_baker.h)
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// kinds of the recorded resources
+enum ResourceKind {
+    RESOURCE_BUFFER,
+    RESOURCE_TEXTURE,
+    RESOURCE_RENDERBUFFER,
+    // CPU-side data (e.g., decoded images, or mesh data kept after the creation of the buffers)
+    RESOURCE_CPU,
+    RESOURCE_KINDS
+};
+
+// a recorded resource
+struct ResourceRecord
+{
+    ResourceKind kind;
+    uint64_t id;
+    size_t bytes;
+    // internal format (textures and renderbuffers), or binding target (buffers). 0 if not relevant
+    GLenum format;
+    string owner;
+    // file and line of the registration
+    string site;
+};
+
+//////////////////////////////////////////
+// names of the kinds of resources
+inline const char* ResourceKindName(ResourceKind kind)
+{
+    switch (kind)
+    {
+        case RESOURCE_BUFFER: return "buffer";
+        case RESOURCE_TEXTURE: return "texture";
+        case RESOURCE_RENDERBUFFER: return "renderbuffer";
+        default: return "cpu";
+    }
+}
+
+//////////////////////////////////////////
+// names of the formats and targets used by the application (the others are printed in hexadecimal)
+inline string ResourceFormatName(GLenum format)
+{
+    switch (format)
+    {
+        case 0: return "-";
+        case GL_ARRAY_BUFFER: return "ARRAY_BUFFER";
+        case GL_ELEMENT_ARRAY_BUFFER: return "ELEMENT_ARRAY_BUFFER";
+        case GL_PIXEL_UNPACK_BUFFER: return "PIXEL_UNPACK_BUFFER";
+        case GL_PIXEL_PACK_BUFFER: return "PIXEL_PACK_BUFFER";
+        case GL_UNIFORM_BUFFER: return "UNIFORM_BUFFER";
+        case GL_RGB8: return "RGB8";
+        case GL_RGBA8: return "RGBA8";
+        case GL_RGBA8UI: return "RGBA8UI";
+        case GL_RGBA16UI: return "RGBA16UI";
+        case GL_DEPTH_COMPONENT24: return "DEPTH24";
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return "BC1";
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return "BC3";
+        case GL_COMPRESSED_RG_RGTC2: return "BC5";
+        case GL_COMPRESSED_RGBA_BPTC_UNORM: return "BC7";
+    }
+    stringstream name;
+    name << "0x" << hex << format;
+    return name.str();
+}
+
+/////////////////// RESOURCEOWNER class ///////////////////////
+// the resources registered by the current thread without an explicit owner, while an instance is alive, are assigned to its owner
+// (the instances can be nested: the previous owner is restored by the destructor)
+class ResourceOwner
+{
+public:
+
+    ResourceOwner(const ResourceOwner& copy) = delete;
+    ResourceOwner& operator=(const ResourceOwner&) = delete;
+
+    ResourceOwner(const string& owner) : previous(Current())
+    {
+        Current() = owner;
+    }
+
+    ~ResourceOwner()
+    {
+        Current() = this->previous;
+    }
+
+    // owner of the current thread
+    static string& Current()
+    {
+        thread_local string owner;
+        return owner;
+    }
+
+private:
+
+    string previous;
+};
+
+/////////////////// RESOURCEREGISTRY class ///////////////////////
+class ResourceRegistry
+{
+public:
+
+    // We want ResourceRegistry to be neither copied nor moved
+    ResourceRegistry(const ResourceRegistry& copy) = delete;
+    ResourceRegistry& operator=(const ResourceRegistry&) = delete;
+
+    //////////////////////////////////////////
+
+    // registry shared by the whole application
+    static ResourceRegistry& Instance()
+    {
+        static ResourceRegistry registry;
+        return registry;
+    }
+
+    //////////////////////////////////////////
+
+    // we record the allocation of a resource. If the resource is already recorded (e.g., a texture with a level added), its size and
+    // format are updated: the creation site is kept, and also the owner if owner is empty.
+    // Without explicit owner, the owner is the one of the current thread (see ResourceOwner)
+    void Register(ResourceKind kind, uint64_t id, size_t bytes, GLenum format = 0, const string& owner = string(),
+                  const source_location site = source_location::current())
+    {
+        lock_guard<mutex> lock(this->registryMutex);
+        auto found = this->records[kind].find(id);
+        if (found != this->records[kind].end())
+        {
+            ResourceRecord& record = found->second;
+            this->totals[kind] += bytes - record.bytes;
+            record.bytes = bytes;
+            record.format = format;
+            if (!owner.empty())
+                record.owner = owner;
+            this->checkBudgets(record);
+            return;
+        }
+
+        ResourceRecord record;
+        record.kind = kind;
+        record.id = id;
+        record.bytes = bytes;
+        record.format = format;
+        record.owner = !owner.empty() ? owner : !ResourceOwner::Current().empty() ? ResourceOwner::Current() : "(unknown)";
+        record.site = filesystem::path(site.file_name()).filename().string() + ":" + to_string(site.line());
+        this->totals[kind] += bytes;
+        this->checkBudgets(this->records[kind].emplace(id, std::move(record)).first->second);
+    }
+
+    // we remove the record of a deleted resource (if it is not recorded, nothing happens)
+    void Release(ResourceKind kind, uint64_t id)
+    {
+        lock_guard<mutex> lock(this->registryMutex);
+        auto found = this->records[kind].find(id);
+        if (found == this->records[kind].end())
+            return;
+        this->totals[kind] -= found->second.bytes;
+        this->records[kind].erase(found);
+        // the warnings are enabled again when the totals go back under the budgets
+        if (this->totalGPU() <= this->budgetGPU)
+            this->warnedGPU = false;
+        if (this->totals[RESOURCE_CPU] <= this->budgetCPU)
+            this->warnedCPU = false;
+    }
+
+    //////////////////////////////////////////
+
+    // budgets of GPU memory (buffers, textures and renderbuffers) and of CPU memory, in bytes (0 = no budget)
+    void SetBudgets(size_t gpuBytes, size_t cpuBytes)
+    {
+        lock_guard<mutex> lock(this->registryMutex);
+        this->budgetGPU = gpuBytes ? gpuBytes : SIZE_MAX;
+        this->budgetCPU = cpuBytes ? cpuBytes : SIZE_MAX;
+        this->warnedGPU = this->warnedCPU = false;
+    }
+
+    // total bytes of a kind of resources
+    size_t Total(ResourceKind kind) const
+    {
+        lock_guard<mutex> lock(this->registryMutex);
+        return this->totals[kind];
+    }
+
+    // total bytes of the GPU resources
+    size_t TotalGPU() const
+    {
+        lock_guard<mutex> lock(this->registryMutex);
+        return this->totalGPU();
+    }
+
+    //////////////////////////////////////////
+
+    // we print on console the totals, and the topN biggest resources
+    void PrintReport(size_t topN = 10) const
+    {
+        vector<ResourceRecord> sorted = this->sortedRecords();
+        lock_guard<mutex> lock(this->registryMutex);
+        std::cout << "Resources: GPU " << this->totalGPU() / 1024 << " KB (peak " << this->peakGPU / 1024 << " KB";
+        if (this->budgetGPU != SIZE_MAX)
+            std::cout << ", budget " << this->budgetGPU / 1024 << " KB";
+        std::cout << ") - CPU " << this->totals[RESOURCE_CPU] / 1024 << " KB (peak " << this->peakCPU / 1024 << " KB";
+        if (this->budgetCPU != SIZE_MAX)
+            std::cout << ", budget " << this->budgetCPU / 1024 << " KB";
+        std::cout << ")" << std::endl;
+        for (int kind = 0; kind < RESOURCE_KINDS; kind++)
+            std::cout << "  " << left << setw(13) << ResourceKindName((ResourceKind)kind) << right << setw(6) << this->records[kind].size()
+                      << " resources, " << this->totals[kind] / 1024 << " KB" << std::endl;
+
+        std::cout << "  the " << min(topN, sorted.size()) << " biggest resources:" << std::endl;
+        for (size_t i = 0; i < min(topN, sorted.size()); i++)
+        {
+            const ResourceRecord& record = sorted[i];
+            std::cout << "  " << setw(8) << record.bytes / 1024 << " KB  " << left << setw(13) << ResourceKindName(record.kind)
+                      << setw(21) << ResourceFormatName(record.format) << right << record.owner << " (" << record.site << ")" << std::endl;
+        }
+    }
+
+    // we save all the records, sorted by size, in a JSON file. It returns false in case of errors
+    bool DumpJSON(const string& path) const
+    {
+        vector<ResourceRecord> sorted = this->sortedRecords();
+        ofstream file(path, ios::trunc);
+        if (!file)
+        {
+            LOG_ERROR("RESOURCE_REGISTRY", "impossible to write " << path);
+            return false;
+        }
+
+        // strings with quotes, backslashes (e.g., Windows paths) and control characters escaped
+        auto quoted = [](const string& value)
+        {
+            stringstream out;
+            out << '"';
+            for (unsigned char c : value)
+            {
+                if (c == '"' || c == '\\')
+                    out << '\\' << c;
+                else if (c < 0x20)
+                    out << "\\u" << hex << setw(4) << setfill('0') << (int)c << dec << setfill(' ');
+                else
+                    out << c;
+            }
+            out << '"';
+            return out.str();
+        };
+
+        {
+            lock_guard<mutex> lock(this->registryMutex);
+            file << "{\n  \"totals\": {";
+            for (int kind = 0; kind < RESOURCE_KINDS; kind++)
+                file << (kind ? ", " : " ") << quoted(ResourceKindName((ResourceKind)kind)) << ": " << this->totals[kind];
+            file << ", \"gpu\": " << this->totalGPU() << " },\n";
+            file << "  \"peaks\": { \"gpu\": " << this->peakGPU << ", \"cpu\": " << this->peakCPU << " },\n";
+            file << "  \"budgets\": { \"gpu\": " << (this->budgetGPU != SIZE_MAX ? to_string(this->budgetGPU) : "null")
+                 << ", \"cpu\": " << (this->budgetCPU != SIZE_MAX ? to_string(this->budgetCPU) : "null") << " },\n";
+        }
+        file << "  \"resources\": [";
+        for (size_t i = 0; i < sorted.size(); i++)
+        {
+            const ResourceRecord& record = sorted[i];
+            file << (i ? ",\n" : "\n") << "    { \"kind\": " << quoted(ResourceKindName(record.kind)) << ", \"id\": " << record.id
+                 << ", \"bytes\": " << record.bytes << ", \"format\": " << quoted(ResourceFormatName(record.format))
+                 << ", \"owner\": " << quoted(record.owner) << ", \"site\": " << quoted(record.site) << " }";
+        }
+        file << "\n  ]\n}\n";
+        return (bool)file;
+    }
+
+private:
+
+    // records of each kind, by name (or identifier, for the CPU-side data)
+    unordered_map<uint64_t, ResourceRecord> records[RESOURCE_KINDS];
+    size_t totals[RESOURCE_KINDS] = {};
+    size_t peakGPU = 0, peakCPU = 0;
+    size_t budgetGPU = SIZE_MAX, budgetCPU = SIZE_MAX;
+    // true if the warning has already been printed (until the total goes back under the budget)
+    bool warnedGPU = false, warnedCPU = false;
+    mutable mutex registryMutex;
+
+    ResourceRegistry() = default;
+
+    //////////////////////////////////////////
+    // total of the GPU resources (the mutex must be locked)
+    size_t totalGPU() const
+    {
+        return this->totals[RESOURCE_BUFFER] + this->totals[RESOURCE_TEXTURE] + this->totals[RESOURCE_RENDERBUFFER];
+    }
+
+    //////////////////////////////////////////
+    // after an allocation, we update the peaks, and we check the budgets (the mutex must be locked)
+    void checkBudgets(const ResourceRecord& record)
+    {
+        const size_t gpu = this->totalGPU(), cpu = this->totals[RESOURCE_CPU];
+        this->peakGPU = max(this->peakGPU, gpu);
+        this->peakCPU = max(this->peakCPU, cpu);
+        if (gpu > this->budgetGPU && !this->warnedGPU)
+        {
+            LOG_WARNING("RESOURCE_REGISTRY", "GPU memory " << gpu / 1024 << " KB exceeds the budget of " << this->budgetGPU / 1024
+                        << " KB, at the allocation of " << record.owner << " (" << record.site << ")");
+            this->warnedGPU = true;
+        }
+        else if (gpu <= this->budgetGPU)
+            this->warnedGPU = false;
+        if (cpu > this->budgetCPU && !this->warnedCPU)
+        {
+            LOG_WARNING("RESOURCE_REGISTRY", "CPU memory " << cpu / 1024 << " KB exceeds the budget of " << this->budgetCPU / 1024
+                        << " KB, at the allocation of " << record.owner << " (" << record.site << ")");
+            this->warnedCPU = true;
+        }
+        else if (cpu <= this->budgetCPU)
+            this->warnedCPU = false;
+    }
+
+    //////////////////////////////////////////
+    // copy of all the records, sorted by decreasing size
+    vector<ResourceRecord> sortedRecords() const
+    {
+        vector<ResourceRecord> sorted;
+        {
+            lock_guard<mutex> lock(this->registryMutex);
+            for (int kind = 0; kind < RESOURCE_KINDS; kind++)
+                for (const auto& record : this->records[kind])
+                    sorted.push_back(record.second);
+        }
+        sort(sorted.begin(), sorted.end(), [](const ResourceRecord& a, const ResourceRecord& b) { return a.bytes > b.bytes; });
+        return sorted;
+    }
+};
@@ -1,8 +1,42 @@
 /*
 Shader class
 - loading Shader source code, Shader Program creation
+- a list of #define directives can be injected in the source code, after the #version directive
+- the source code is preprocessed: the directives #include "file" (with the path relative to the including file) are replaced
+  by the content of the file, and #line directives are added, so the errors refer to the lines of the original files
+  (the compilation errors are reported with the names of the files, see N.B. 4)
+- ShaderVariants class: a set of specialized Shader Programs compiled from the same source code with different #define directives.
+  Each variant is identified by a bitmask (the "key"): groups of bits of the key (ShaderOption) are passed to the shaders
+  as "#define NAME value", so the shaders select the code to use with #if directives, without branches or subroutines at runtime.
+  The variants are compiled on demand (or in advance with Precompile), and cached
+- the creation of a Shader Program is asynchronous: the constructor issues the compilation and the linking (or the loading of
+  the binary from the program cache, see program_cache.h), without waiting for the results. Ready() checks without blocking
+  if the program has been linked, Wait() blocks until then. The errors are checked, and the binary is saved in the cache,
+  when the program is ready
 
-N.B. ) adaptation of https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/shader.h
+N.B. 1) adaptation of https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/shader.h
+
+N.B. 2)
+Each variant is a different Shader Program, with its own uniforms: after the selection of a variant, all the uniforms must be set
+(the uniforms which do not change, e.g. the texture units of the samplers, can be set by the setup function of ShaderVariants,
+called once after the creation of each variant). The locations of the uniforms can be different in each variant.
+
+N.B. 3)
+The driver can compile in parallel only the programs whose results have not been requested yet: to exploit the parallel compilation,
+all the programs must be created before waiting for the first one (e.g., Precompile creates all the variants, and then waits for them).
+Use() waits for the program, so it can be called also on a program which is not ready.
+A Shader owns the compilation in progress: it is movable, but not copyable.
+
+N.B. 4)
+GLSL 4.1 does not support file names in the #line directives, only the number of the "source string": each file of a shader
+is a source string (0 is the main file, the others are numbered in order of inclusion), and the numbers are replaced by the names
+of the files in the compilation errors. The error format is different for each vendor ("0(12) : error" for NVIDIA,
+"0:12(3): error" for Mesa, "ERROR: 0:12:" for AMD): we replace the first "number(number" or "number:number" in each line.
+Each file is included once per shader (like with #pragma once), so recursive inclusions are ignored.
+
+N.B. 5)
+A Shader created from files can be reloaded (see shader_watcher.h): the new program is created asynchronously, and it replaces the
+current one when it is ready. If the new program has errors, the current one is kept.
 
 author: Davide Gadia
 
@@ -20,6 +54,27 @@ using namespace std;
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <filesystem>
+#include <algorithm>
+#include <regex>
+
+// messages on the console (see logger.h)
+#include <utils/logger.h>
+// persistent cache of the linked programs
+#include <utils/program_cache.h>
+
+//////////////////////////////////////////
+// source code of a shader after the preprocessing
+struct ShaderSource
+{
+    string code;
+    // the files of the source code: the file i is the source string i of the #line directives (see N.B. 4)
+    vector<string> files;
+};
 
 /////////////////// SHADER class ///////////////////////
 class Shader
@@ -30,85 +85,356 @@ public:
     //////////////////////////////////////////
 
     //constructor
-    Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
+    // the defines (e.g., "#define NR_LIGHTS 3\n") are injected in both the shaders
+    Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const string& defines = "")
+        : Program(0), vertexPath(vertexPath), fragmentPath(fragmentPath), defines(defines)
     {
         // Step 1: we retrieve shaders source code from provided filepaths
-        string vertexCode;
-        string fragmentCode;
-        ifstream vShaderFile;
-        ifstream fShaderFile;
+        // Steps 2-4: compilation and linking
+        this->build(ReadSource(vertexPath), ReadSource(fragmentPath), defines);
+    }
+
+    // creation of a Shader Program from the source code of the shaders
+    static Shader FromSource(const ShaderSource& vertexSource, const ShaderSource& fragmentSource, const string& defines = "")
+    {
+        Shader shader;
+        shader.build(vertexSource, fragmentSource, defines);
+        return shader;
+    }
+
+    //////////////////////////////////////////
 
+    // we read the source code of a shader, and we replace the #include directives with the content of the files
+    static ShaderSource ReadSource(const string& path)
+    {
+        ShaderSource source;
+        source.code = preprocess(path, source.files);
+        return source;
+    }
+
+    // we read the content of a file
+    static string ReadFile(const string& path)
+    {
+        string code;
+        ifstream shaderFile;
         // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (ifstream::failbit | ifstream::badbit);
-        fShaderFile.exceptions (ifstream::failbit | ifstream::badbit);
+        shaderFile.exceptions (ifstream::failbit | ifstream::badbit);
         try
         {
-            // Open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            stringstream vShaderStream, fShaderStream;
-            // Read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
+            // Open file, and read file's buffer contents into a stream
+            shaderFile.open(path);
+            stringstream shaderStream;
+            shaderStream << shaderFile.rdbuf();
+            shaderFile.close();
             // Convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
+            code = shaderStream.str();
+        }
+        catch (ifstream::failure& e)
+        {
+            LOG_ERROR("SHADER", "FILE_NOT_SUCCESFULLY_READ " << path);
+        }
+        return code;
+    }
+
+    // we insert the defines in the source code, after the #version directive (which must be the first directive of the shader)
+    static string InjectDefines(const string& code, const string& defines)
+    {
+        if (defines.empty())
+            return code;
+        // the directive is searched at the beginning of a line (the comments before it can contain the word)
+        size_t version = (code.compare(0, 8, "#version") == 0) ? 0 : code.find("\n#version");
+        if (version == string::npos)
+            return defines + "#line 1 0\n" + code;
+        if (version > 0)
+            version++;
+        size_t lineEnd = code.find('\n', version);
+        if (lineEnd == string::npos)
+            return code + "\n" + defines;
+        // after the defines, the numbering of the lines restarts from the line after the #version directive
+        size_t nextLine = count(code.begin(), code.begin() + lineEnd, '\n') + 2;
+        return code.substr(0, lineEnd + 1) + defines + "#line " + to_string(nextLine) + " 0\n" + code.substr(lineEnd + 1);
+    }
+
+    //////////////////////////////////////////
+
+    // all the files of the source code of the program (including the included files)
+    vector<string> Files() const
+    {
+        vector<string> files = this->vertexFiles;
+        for (const string& file : this->fragmentFiles)
+            if (find(files.begin(), files.end(), file) == files.end())
+                files.push_back(file);
+        return files;
+    }
+
+    // true if the program has been created from files, so it can be reloaded (a program created with FromSource cannot)
+    bool Reloadable() const { return !this->vertexPath.empty(); }
+
+    // we create again the program from its files (see N.B. 5). Only a Shader created from files can be reloaded
+    void Reload()
+    {
+        if (this->vertexPath.empty())
+            return;
+        if (this->reloaded)
+            this->reloaded->Delete();
+        this->reloaded = make_unique<Shader>(this->vertexPath.c_str(), this->fragmentPath.c_str(), this->defines);
+    }
+
+    // if the reloaded program is ready, it replaces the current one. It returns 1 if the program has been replaced,
+    // -1 if the reloaded program has errors (the current one is kept), 0 if the reloaded program is not ready (or there is none)
+    GLint SwapReloaded()
+    {
+        if (!this->reloaded || !this->reloaded->Ready())
+            return 0;
+        GLint result = -1;
+        if (this->reloaded->linked)
+        {
+            glDeleteProgram(this->Program);
+            this->Program = this->reloaded->Program;
+            this->vertexFiles = std::move(this->reloaded->vertexFiles);
+            this->fragmentFiles = std::move(this->reloaded->fragmentFiles);
+            result = 1;
+        }
+        else
+            this->reloaded->Delete();
+        this->reloaded.reset();
+        return result;
+    }
+
+    // true if the program has been linked without errors (it waits for the program)
+    bool Linked()
+    {
+        this->Wait();
+        return this->linked;
+    }
+
+    //////////////////////////////////////////
+
+    // true if the program has been linked. If the driver does not support the parallel compilation, it waits for the program
+    bool Ready()
+    {
+        if (!this->pending)
+            return true;
+        if (ProgramCache::Instance().ParallelCompile())
+        {
+            GLint completed = GL_FALSE;
+            glGetProgramiv(this->Program, GL_COMPLETION_STATUS_KHR, &completed);
+            if (!completed)
+                return false;
         }
-        catch (ifstream::failure e)
+        this->finish();
+        return true;
+    }
+
+    // we wait for the end of the linking of the program
+    void Wait()
+    {
+        if (this->pending)
+            this->finish();
+    }
+
+    // We activate the Shader Program as part of the current rendering process
+    void Use()
+    {
+        this->Wait();
+        glUseProgram(this->Program);
+    }
+
+    // We delete the Shader Program when application closes
+    void Delete()
+    {
+        // a program still in creation has its shaders (0 is ignored by glDeleteShader)
+        if (this->pending)
         {
-            cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
+            glDeleteShader(this->pending->vertex);
+            glDeleteShader(this->pending->fragment);
+            this->pending.reset();
         }
+        glDeleteProgram(this->Program);
+    }
+
+private:
+    // used by FromSource
+    Shader() : Program(0) {}
+
+    // the files and the defines used to create the program (empty for a program created with FromSource)
+    string vertexPath;
+    string fragmentPath;
+    string defines;
+    // the files of the source code of each shader (see N.B. 4)
+    vector<string> vertexFiles;
+    vector<string> fragmentFiles;
+    bool linked = false;
+    // the program created by Reload, until it replaces the current one
+    unique_ptr<Shader> reloaded;
+
+    // a program in creation: the source code is kept until the program is ready, in case the binary from the cache is refused
+    struct PendingBuild
+    {
+        string vertexCode;
+        string fragmentCode;
+        uint64_t key = 0;
+        bool fromCache = false;
+        GLuint vertex = 0;
+        GLuint fragment = 0;
+    };
+    unique_ptr<PendingBuild> pending;
+
+    //////////////////////////////////////////
 
+    // creation of the Shader Program: the binary is loaded from the cache, or the shaders are compiled (without waiting for the results)
+    void build(const ShaderSource& vertexSource, const ShaderSource& fragmentSource, const string& defines)
+    {
+        this->vertexFiles = vertexSource.files;
+        this->fragmentFiles = fragmentSource.files;
+        this->pending = make_unique<PendingBuild>();
+        this->pending->vertexCode = InjectDefines(vertexSource.code, defines);
+        this->pending->fragmentCode = InjectDefines(fragmentSource.code, defines);
+
+        this->Program = glCreateProgram();
+        this->pending->key = ProgramCache::Instance().Key(this->pending->vertexCode, this->pending->fragmentCode);
+        this->pending->fromCache = ProgramCache::Instance().Load(this->pending->key, this->Program);
+        if (!this->pending->fromCache)
+            this->compile();
+    }
+
+    // compilation of the shaders, and linking of the Shader Program. The errors are checked by finish
+    void compile()
+    {
         // Convert strings to char pointers
-        const GLchar* vShaderCode = vertexCode.c_str();
-        const GLchar * fShaderCode = fragmentCode.c_str();
+        const GLchar* vShaderCode = this->pending->vertexCode.c_str();
+        const GLchar * fShaderCode = this->pending->fragmentCode.c_str();
 
         // Step 2: we compile the shaders
-        GLuint vertex, fragment;
-
         // Vertex Shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        // check compilation errors
-        checkCompileErrors(vertex, "VERTEX");
+        this->pending->vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(this->pending->vertex, 1, &vShaderCode, NULL);
+        glCompileShader(this->pending->vertex);
 
         // Fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        // check compilation errors
-        checkCompileErrors(fragment, "FRAGMENT");
+        this->pending->fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(this->pending->fragment, 1, &fShaderCode, NULL);
+        glCompileShader(this->pending->fragment);
 
-        // Step 3: Shader Program creation
-        this->Program = glCreateProgram();
-        glAttachShader(this->Program, vertex);
-        glAttachShader(this->Program, fragment);
+        // Step 3: Shader Program creation. The binary of the program must be retrievable, to save it in the cache:
+        // the hint is effective only if it is set before the linking (see N.B. 5 in program_cache.h)
+        glAttachShader(this->Program, this->pending->vertex);
+        glAttachShader(this->Program, this->pending->fragment);
+        glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(this->Program);
-        // check linking errors
-        checkCompileErrors(this->Program, "PROGRAM");
+    }
+
+    // the program is ready: we check the errors, and we save the binary in the cache
+    void finish()
+    {
+        ProgramCache& cache = ProgramCache::Instance();
+        if (this->pending->fromCache)
+        {
+            GLint success;
+            glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
+            if (success)
+            {
+                cache.CountHit();
+                this->linked = true;
+                this->pending.reset();
+                return;
+            }
+            // the driver has refused the binary (see N.B. 1 in program_cache.h): we compile the shaders
+            this->pending->fromCache = false;
+            this->compile();
+        }
+        cache.CountMiss();
+        // check compilation and linking errors
+        checkCompileErrors(this->pending->vertex, "VERTEX");
+        checkCompileErrors(this->pending->fragment, "FRAGMENT");
+        this->linked = checkCompileErrors(this->Program, "PROGRAM");
+        if (this->linked)
+            cache.Save(this->pending->key, this->Program);
 
         // Step 4: we delete the shaders because they are linked to the Shader Program, and we do not need them anymore
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+        glDetachShader(this->Program, this->pending->vertex);
+        glDetachShader(this->Program, this->pending->fragment);
+        glDeleteShader(this->pending->vertex);
+        glDeleteShader(this->pending->fragment);
+        this->pending.reset();
     }
 
     //////////////////////////////////////////
 
-    // We activate the Shader Program as part of the current rendering process
-    void Use() { glUseProgram(this->Program); }
+    // we replace the #include directives of a file with the content of the included files, adding the #line directives (see N.B. 4)
+    static string preprocess(const string& path, vector<string>& files)
+    {
+        string text = ReadFile(path);
+        string index = to_string(files.size());
+        files.push_back(path);
+        filesystem::path folder = filesystem::path(path).parent_path();
 
-    // We delete the Shader Program when application closes
-    void Delete() { glDeleteProgram(this->Program); }
+        string code;
+        istringstream lines(text);
+        string line;
+        GLuint number = 0;
+        while (getline(lines, line))
+        {
+            number++;
+            string name;
+            if (!parseInclude(line, name))
+            {
+                code += line + "\n";
+                continue;
+            }
+            string includePath = (folder / name).generic_string();
+            // each file is included once (the empty line keeps the numbering of the lines)
+            if (find(files.begin(), files.end(), includePath) != files.end())
+            {
+                code += "\n";
+                continue;
+            }
+            code += "#line 1 " + to_string(files.size()) + "\n";
+            code += preprocess(includePath, files);
+            code += "#line " + to_string(number + 1) + " " + index + "\n";
+        }
+        return code;
+    }
+
+    // if the line is an #include directive, we return the name of the file
+    static bool parseInclude(const string& line, string& name)
+    {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == string::npos || line.compare(start, 8, "#include") != 0)
+            return false;
+        size_t open = line.find('"', start + 8);
+        size_t close = (open == string::npos) ? string::npos : line.find('"', open + 1);
+        if (close == string::npos)
+            return false;
+        name = line.substr(open + 1, close - open - 1);
+        return true;
+    }
+
+    // we replace the numbers of the source strings with the names of the files, in the log of the compiler (see N.B. 4)
+    static string translateLog(const string& log, const vector<string>& files)
+    {
+        static const regex location("(\\d+)[:(]\\d+");
+        string result;
+        istringstream lines(log);
+        string line;
+        while (getline(lines, line))
+        {
+            smatch match;
+            if (regex_search(line, match, location))
+            {
+                size_t file = stoul(match[1].str());
+                if (file < files.size())
+                    line.replace(match.position(1), match.length(1), files[file]);
+            }
+            result += line + "\n";
+        }
+        return result;
+    }
 
-private:
     //////////////////////////////////////////
 
-    // Check compilation and linking errors
-    void checkCompileErrors(GLuint shader, string type)
+    // Check compilation and linking errors. It returns false in case of errors
+    bool checkCompileErrors(GLuint shader, string type)
 	{
 		GLint success;
 		GLchar infoLog[1024];
@@ -118,7 +444,8 @@ private:
 			if(!success)
 			{
 				glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-                cout << "| ERROR::::SHADER-COMPILATION-ERROR of type: " << type << "|\n" << infoLog << "\n| -- --------------------------------------------------- -- |" << endl;
+                string log = translateLog(infoLog, (type == "VERTEX") ? this->vertexFiles : this->fragmentFiles);
+                LOG_ERROR("SHADER", "COMPILATION-ERROR of type: " << type << "\n" << log << "\n| -- --------------------------------------------------- -- |");
 			}
 		}
 		else
@@ -127,8 +454,210 @@ private:
 			if(!success)
 			{
 				glGetProgramInfoLog(shader, 1024, NULL, infoLog);
-                cout << "| ERROR::::PROGRAM-LINKING-ERROR of type: " << type << "|\n" << infoLog << "\n| -- --------------------------------------------------- -- |" << endl;
+                LOG_ERROR("SHADER", "PROGRAM-LINKING-ERROR of type: " << type << "\n" << infoLog << "\n| -- --------------------------------------------------- -- |");
 			}
 		}
+		return success;
 	}
 };
+
+//////////////////////////////////////////
+// an option of the variants of a shader: the bits [shift, shift + bits) of the key of a variant
+// are passed to the shaders as "#define name value"
+struct ShaderOption
+{
+    string name;
+    GLuint shift;
+    GLuint bits = 1;
+};
+
+/////////////////// SHADER VARIANTS class ///////////////////////
+class ShaderVariants
+{
+public:
+    // the source code is read once. The common defines are injected in all the variants (e.g., "#define NR_LIGHTS 3\n"),
+    // the setup function is called after the creation of each variant, with the variant active (see N.B. 2)
+    ShaderVariants(const GLchar* vertexPath, const GLchar* fragmentPath, const vector<ShaderOption>& options,
+                   const string& commonDefines = "", function<void(GLuint)> setup = nullptr)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath), vertexSource(Shader::ReadSource(vertexPath)),
+          fragmentSource(Shader::ReadSource(fragmentPath)), options(options), commonDefines(commonDefines), setup(setup) {}
+
+    // the variants are Shader Programs: ShaderVariants is non-copyable
+    ShaderVariants(const ShaderVariants&) = delete;
+    ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+    //////////////////////////////////////////
+
+    // we return the variant with the given key: if it does not exist, it is compiled now (and cached).
+    // If the variant is still in creation, we wait for it
+    Shader& Get(GLuint key)
+    {
+        Variant& variant = this->create(key);
+        if (!variant.initialized)
+        {
+            variant.shader.Use();
+            if (this->setup)
+                this->setup(variant.shader.Program);
+            variant.initialized = true;
+        }
+        return variant.shader;
+    }
+
+    // we compile in advance a set of variants (e.g., at loading time, to avoid compilations during the rendering).
+    // The creation of the variants is started without waiting for them, so the driver can compile them in parallel (see N.B. 3):
+    // Ready and Wait check the end of the compilations
+    void Precompile(const vector<GLuint>& keys)
+    {
+        for (GLuint key : keys)
+            this->create(key);
+    }
+
+    // true if all the created variants are ready (it does not block, if the driver supports the parallel compilation)
+    bool Ready()
+    {
+        bool ready = true;
+        for (auto& variant : this->variants)
+            ready = variant.second.shader.Ready() && ready;
+        return ready;
+    }
+
+    // we wait for all the created variants, and we set them up
+    void Wait()
+    {
+        for (auto& variant : this->variants)
+            this->Get(variant.first);
+    }
+
+    // all the keys obtained combining all the values of the options
+    vector<GLuint> AllKeys() const
+    {
+        GLuint bits = 0;
+        for (const ShaderOption& option : this->options)
+            bits |= ((1u << option.bits) - 1u) << option.shift;
+        // we enumerate all the subsets of the bits
+        vector<GLuint> keys;
+        GLuint key = 0;
+        do
+        {
+            keys.push_back(key);
+            key = (key - bits) & bits;
+        } while (key != 0);
+        return keys;
+    }
+
+    // the #define directives of a variant
+    string Defines(GLuint key) const
+    {
+        string defines = this->commonDefines;
+        for (const ShaderOption& option : this->options)
+            defines += "#define " + option.name + " " + to_string((key >> option.shift) & ((1u << option.bits) - 1u)) + "\n";
+        return defines;
+    }
+
+    // number of compiled variants
+    size_t Size() const { return this->variants.size(); }
+
+    //////////////////////////////////////////
+
+    // all the files of the source code of the variants (including the included files)
+    vector<string> Files() const
+    {
+        vector<string> files = this->vertexSource.files;
+        for (const string& file : this->fragmentSource.files)
+            if (find(files.begin(), files.end(), file) == files.end())
+                files.push_back(file);
+        return files;
+    }
+
+    // we read again the source code, and we create again all the compiled variants (see N.B. 5)
+    void Reload()
+    {
+        this->reloadedVertex = Shader::ReadSource(this->vertexPath);
+        this->reloadedFragment = Shader::ReadSource(this->fragmentPath);
+        this->deleteReloaded();
+        this->reloading = true;
+        for (auto& variant : this->variants)
+            this->reloaded.emplace(variant.first, Shader::FromSource(this->reloadedVertex, this->reloadedFragment, this->Defines(variant.first)));
+    }
+
+    // if all the reloaded variants are ready, they replace the current ones (as Shader::SwapReloaded):
+    // if a variant has errors, all the current variants are kept
+    GLint SwapReloaded()
+    {
+        if (!this->reloading)
+            return 0;
+        bool linked = true;
+        for (auto& shader : this->reloaded)
+        {
+            if (!shader.second.Ready())
+                return 0;
+            linked = linked && shader.second.Linked();
+        }
+        if (!linked)
+        {
+            this->deleteReloaded();
+            this->reloading = false;
+            return -1;
+        }
+        // the new variants must be set up again (see N.B. 2)
+        for (auto& shader : this->reloaded)
+        {
+            Variant& variant = this->variants.at(shader.first);
+            variant.shader.Delete();
+            variant = Variant{ std::move(shader.second) };
+        }
+        this->reloaded.clear();
+        // the new variants will be created from the new source code
+        this->vertexSource = std::move(this->reloadedVertex);
+        this->fragmentSource = std::move(this->reloadedFragment);
+        this->reloading = false;
+        return 1;
+    }
+
+    // We delete all the Shader Programs when application closes
+    void Delete()
+    {
+        for (auto& variant : this->variants)
+            variant.second.shader.Delete();
+        this->variants.clear();
+        this->deleteReloaded();
+    }
+
+private:
+    string vertexPath;
+    string fragmentPath;
+    ShaderSource vertexSource;
+    ShaderSource fragmentSource;
+    vector<ShaderOption> options;
+    string commonDefines;
+    function<void(GLuint)> setup;
+    // a variant, and if it has been set up by the setup function
+    struct Variant
+    {
+        Shader shader;
+        bool initialized = false;
+    };
+    // compiled variants, with their keys
+    unordered_map<GLuint, Variant> variants;
+    // the source code and the variants created by Reload, until they replace the current ones
+    ShaderSource reloadedVertex;
+    ShaderSource reloadedFragment;
+    unordered_map<GLuint, Shader> reloaded;
+    bool reloading = false;
+
+    void deleteReloaded()
+    {
+        for (auto& shader : this->reloaded)
+            shader.second.Delete();
+        this->reloaded.clear();
+    }
+
+    // we start the creation of a variant (if it does not exist)
+    Variant& create(GLuint key)
+    {
+        auto variant = this->variants.find(key);
+        if (variant != this->variants.end())
+            return variant->second;
+        return this->variants.emplace(key, Variant{ Shader::FromSource(this->vertexSource, this->fragmentSource, this->Defines(key)) }).first->second;
+    }
+};
@@ -0,0 +1,206 @@
+/*
+ShaderWatcher class
+- hot reload of the Shader Programs (see shader.h): a thread checks periodically the last modification time of all the files
+  of the watched programs (including the files included with #include). When a file changes, the programs using it are created
+  again, asynchronously (the driver compiles them in parallel, while the application renders with the current programs)
+- Update() must be called at the beginning of each frame (by the thread of the OpenGL context): it starts the reload of the programs
+  whose files have changed, and it replaces the programs whose reload is completed. So the programs are swapped only at the
+  frame boundary, never during the rendering of a frame
+- the reload time (from the change of the file to the swap of the program) is logged. If the new program has errors,
+  the errors are logged with the names of the files (see N.B. 4 in shader.h), and the current program is kept
+
+N.B. 1)
+The thread checks the files with std::filesystem::last_write_time, instead of the notifications of the operating system
+(inotify on Linux, ReadDirectoryChangesW on Windows): the code is portable, and a few files are checked with a negligible cost.
+A file saved by an editor can change more times: each change after the start of a reload starts a new reload.
+
+N.B. 2)
+The watched programs (and the ShaderWatcher) must be alive until the watcher is destroyed.
+After a reload, all the uniforms of the new program must be set again, and their locations can be different: Update returns true
+when some reloads are completed, so the locations cached by the application are read again. The setup function of ShaderVariants
+is called on the new variants.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <filesystem>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include <utils/shader.h>
+#include <utils/logger.h>
+
+// interval between the checks of the files (in milliseconds)
+const GLuint SHADER_WATCH_INTERVAL = 250;
+
+/////////////////// SHADER WATCHER class ///////////////////////
+class ShaderWatcher
+{
+public:
+    ShaderWatcher() : watcher(&ShaderWatcher::watch, this) {}
+
+    // ShaderWatcher is not copyable (the thread uses its data)
+    ShaderWatcher(const ShaderWatcher&) = delete;
+    ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+    ~ShaderWatcher()
+    {
+        {
+            lock_guard<mutex> lock(this->filesMutex);
+            this->stop = true;
+        }
+        this->wakeup.notify_one();
+        this->watcher.join();
+    }
+
+    //////////////////////////////////////////
+
+    // we watch the files of a Shader Program. A program created with FromSource has no files to read again: it is not watched
+    // (otherwise its reload would never complete)
+    void Watch(Shader& shader)
+    {
+        if (!shader.Reloadable())
+        {
+            LOG_WARNING("SHADER", "a program created from source cannot be reloaded: it is not watched");
+            return;
+        }
+        this->add([&shader]() { return shader.Files(); }, [&shader]() { shader.Reload(); }, [&shader]() { return shader.SwapReloaded(); });
+    }
+
+    // we watch the files of a set of variants
+    void Watch(ShaderVariants& variants)
+    {
+        this->add([&variants]() { return variants.Files(); }, [&variants]() { variants.Reload(); }, [&variants]() { return variants.SwapReloaded(); });
+    }
+
+    // at the frame boundary, we start the reload of the changed programs, and we swap the reloaded programs.
+    // It returns true if the reload of some programs is completed (the programs without errors have been replaced, see N.B. 2)
+    bool Update()
+    {
+        vector<string> changedFiles;
+        {
+            lock_guard<mutex> lock(this->filesMutex);
+            changedFiles.swap(this->changed);
+        }
+        bool swapped = false;
+        for (Entry& entry : this->entries)
+        {
+            if (!changedFiles.empty())
+            {
+                vector<string> files = entry.files();
+                for (const string& file : changedFiles)
+                {
+                    if (find(files.begin(), files.end(), file) == files.end())
+                        continue;
+                    LOG_INFO("SHADER", "reloading " << files[0] << " (" << file << " changed)");
+                    if (!entry.reloading)
+                        entry.start = chrono::steady_clock::now();
+                    entry.reloading = true;
+                    entry.reload();
+                    break;
+                }
+            }
+            if (!entry.reloading)
+                continue;
+            GLint result = entry.swap();
+            if (result == 0)
+                continue;
+            entry.reloading = false;
+            swapped = true;
+            double milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - entry.start).count();
+            if (result > 0)
+                LOG_INFO("SHADER", "reloaded " << entry.files()[0] << " in " << milliseconds << " ms");
+            else
+                LOG_WARNING("SHADER", "errors in " << entry.files()[0] << ", the previous program is kept (" << milliseconds << " ms)");
+        }
+        // the files of the reloaded programs can be changed (e.g., a new #include)
+        if (swapped)
+            this->refresh();
+        return swapped;
+    }
+
+private:
+    // a watched program: the functions to retrieve its files, and to reload and swap it
+    struct Entry
+    {
+        function<vector<string>()> files;
+        function<void()> reload;
+        function<GLint()> swap;
+        bool reloading = false;
+        chrono::steady_clock::time_point start;
+    };
+    vector<Entry> entries;
+
+    // the watched files, with their last modification time, and the files changed since the last Update
+    mutex filesMutex;
+    condition_variable wakeup;
+    unordered_map<string, filesystem::file_time_type> times;
+    vector<string> changed;
+    bool stop = false;
+    // N.B.) the thread must be declared after the data it uses
+    thread watcher;
+
+    void add(function<vector<string>()> files, function<void()> reload, function<GLint()> swap)
+    {
+        this->entries.push_back({ files, reload, swap, false, {} });
+        this->refresh();
+    }
+
+    // we update the list of the watched files
+    void refresh()
+    {
+        vector<string> files;
+        for (const Entry& entry : this->entries)
+            for (const string& file : entry.files())
+                files.push_back(file);
+
+        lock_guard<mutex> lock(this->filesMutex);
+        for (const string& file : files)
+        {
+            if (this->times.count(file) > 0)
+                continue;
+            error_code error;
+            this->times[file] = filesystem::last_write_time(file, error);
+        }
+    }
+
+    // the thread checks the files periodically (see N.B. 1)
+    void watch()
+    {
+        unique_lock<mutex> lock(this->filesMutex);
+        while (!this->wakeup.wait_for(lock, chrono::milliseconds(SHADER_WATCH_INTERVAL), [this]() { return this->stop; }))
+        {
+            // the files are checked without holding the lock, so Update never waits for the file system
+            vector<pair<string, filesystem::file_time_type>> files(this->times.begin(), this->times.end());
+            lock.unlock();
+            vector<pair<string, filesystem::file_time_type>> modified;
+            for (const auto& file : files)
+            {
+                error_code error;
+                filesystem::file_time_type time = filesystem::last_write_time(file.first, error);
+                if (!error && time != file.second)
+                    modified.push_back({ file.first, time });
+            }
+            lock.lock();
+            for (const auto& file : modified)
+            {
+                this->times[file.first] = file.second;
+                this->changed.push_back(file.first);
+            }
+        }
+    }
+};
@@ -0,0 +1,748 @@
+/*
+Texture baking
+- offline conversion of images (JPG, PNG, ...) to block-compressed textures, with a precomputed chain of mipmaps
+- the baked textures are saved in KTX (version 1) files, next to the source images (e.g., "mars.jpg" -> "mars.jpg.ktx")
+- at runtime, a baked texture is read and uploaded as it is (glCompressedTexImage2D): no image decoding, and no glGenerateMipmap
+
+Supported formats (4x4 pixel blocks):
+- BC1 (DXT1): RGB, 8 bytes per block (6:1 with respect to RGB8)
+- BC3 (DXT5): RGBA, 16 bytes per block: BC1 color block + BC4 alpha block
+- BC5 (RGTC2): two channels (e.g., XY of normal maps), 16 bytes per block: two BC4 blocks
+- BC7 (BPTC): RGBA, 16 bytes per block, higher quality than BC1/BC3.
+  The encoder uses only mode 6 (one subset, 7-bit endpoints + p-bit, 4-bit indices): it is fast,
+  and for smooth images (like the planets textures) the quality is close to the one of a full BC7 encoder
+
+N.B. 1)
+The encoder works on a block at a time: the endpoints are chosen along the principal axis of the colors of the block,
+then the indices are selected and the endpoints are refined with a least squares fit.
+The selection of the nearest palette entry for the 16 pixels of a block uses SSE2 (4 pixels at a time), if available.
+The rows of blocks of each mip level are divided among the threads of the job system (see job_system.h): the calling thread
+encodes blocks too while it waits, so BakeTexture can be called also inside a job of the thread pool.
+
+N.B. 2)
+In the key/value data of the KTX file, we store size and last modification time of the source images:
+if the sources have been modified, the baked texture is not valid anymore, and the texture must be baked again.
+
+N.B. 3)
+BC1 and BC3 require the EXT_texture_compression_s3tc extension, BC7 requires OpenGL 4.2 or the ARB_texture_compression_bptc extension,
+BC5 is core since OpenGL 3.0. The S3TC formats are not in the GLAD loader (core profile only), so we define their constants here.
+
+N.B. 4) source images and baked textures are read through the AssetSystem (see asset_system.h): they can be read also from an asset pack
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define TEXTURE_BAKER_SSE2
+    #include <emmintrin.h>
+#endif
+
+#include <stb_image/stb_image.h>
+
+#include <utils/job_system.h>
+#include <utils/asset_system.h>
+#include <utils/logger.h>
+
+// S3TC formats (EXT_texture_compression_s3tc)
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// block-compressed formats of the baked textures
+enum BakeFormat {
+    BAKE_BC1,
+    BAKE_BC3,
+    BAKE_BC5,
+    BAKE_BC7
+};
+
+// a KTX texture in CPU memory: the whole file is kept in memory (or mapped, if it is read from an asset pack),
+// and the images are addressed by offset
+struct KTXTexture
+{
+    GLenum internalFormat = 0;
+    GLuint width = 0, height = 0;
+    GLuint numFaces = 1, numLevels = 1;
+    AssetData file;
+    // offset in data of the image of each (level, face), at index level * numFaces + face
+    vector<size_t> imageOffsets;
+    // size of the image of a face, for each level
+    vector<GLsizei> imageSizes;
+};
+
+// identifier of the KTX 1.1 files
+const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+// key of the key/value pair with the information about the source images
+const char KTX_SOURCE_KEY[] = "RTGPbakedFrom";
+
+// header of a KTX file (after the identifier)
+struct KTXHeader
+{
+    uint32_t endianness;
+    uint32_t glType;
+    uint32_t glTypeSize;
+    uint32_t glFormat;
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+//////////////////////////////////////////
+// OpenGL internal format, and size of a block, of a bake format
+inline GLenum BakeFormatGL(BakeFormat format)
+{
+    switch (format)
+    {
+        case BAKE_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BAKE_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BAKE_BC5: return GL_COMPRESSED_RG_RGTC2;
+        default: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+}
+
+inline GLuint BakeFormatBlockSize(BakeFormat format)
+{
+    return (format == BAKE_BC1) ? 8 : 16;
+}
+
+//////////////////////////////////////////
+// path of the baked texture of a set of source images (1 image for 2D textures, 6 for cube maps)
+inline string BakedTexturePath(const vector<string>& sources)
+{
+    return sources[0] + ((sources.size() == 6) ? ".cube.ktx" : ".ktx");
+}
+
+//////////////////////////////////////////
+// size and last modification time of the source images, as stored in the KTX file
+inline bool GetBakeSourcesInfo(const vector<string>& sources, vector<int64_t>& info)
+{
+    info.clear();
+    for (const string& source : sources)
+    {
+        uint64_t size;
+        int64_t time;
+        if (!AssetSystem::Instance().GetFileInfo(source, size, time))
+            return false;
+        info.push_back((int64_t)size);
+        info.push_back(time);
+    }
+    return true;
+}
+
+//////////////////////////////////////////
+// for each of the 16 pixels of a block (channels in SoA layout), we select the nearest entry of the palette
+// (squared distance on the first numChannels channels). It returns the total squared error
+inline float SelectBlockIndices(const float pixels[4][16], const float palette[][4], int paletteSize, int numChannels, uint8_t indices[16])
+{
+    float error = 0.0f;
+#ifdef TEXTURE_BAKER_SSE2
+    for (int group = 0; group < 16; group += 4)
+    {
+        __m128 best = _mm_set1_ps(FLT_MAX);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int e = 0; e < paletteSize; e++)
+        {
+            __m128 distance = _mm_setzero_ps();
+            for (int c = 0; c < numChannels; c++)
+            {
+                __m128 diff = _mm_sub_ps(_mm_loadu_ps(&pixels[c][group]), _mm_set1_ps(palette[e][c]));
+                distance = _mm_add_ps(distance, _mm_mul_ps(diff, diff));
+            }
+            // where the distance is lower, we replace the best index
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(e)), _mm_andnot_si128(closer, bestIndex));
+            best = _mm_min_ps(distance, best);
+        }
+        alignas(16) int32_t selected[4];
+        alignas(16) float distances[4];
+        _mm_store_si128((__m128i*)selected, bestIndex);
+        _mm_store_ps(distances, best);
+        for (int i = 0; i < 4; i++)
+        {
+            indices[group + i] = (uint8_t)selected[i];
+            error += distances[i];
+        }
+    }
+#else
+    for (int i = 0; i < 16; i++)
+    {
+        float best = FLT_MAX;
+        for (int e = 0; e < paletteSize; e++)
+        {
+            float distance = 0.0f;
+            for (int c = 0; c < numChannels; c++)
+                distance += (pixels[c][i] - palette[e][c]) * (pixels[c][i] - palette[e][c]);
+            if (distance < best)
+            {
+                best = distance;
+                indices[i] = (uint8_t)e;
+            }
+        }
+        error += best;
+    }
+#endif
+    return error;
+}
+
+//////////////////////////////////////////
+// we compute the endpoints of a block along the principal axis of its colors (first numChannels channels)
+inline void PrincipalAxisEndpoints(const float pixels[4][16], int numChannels, float endpoint0[4], float endpoint1[4])
+{
+    float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int c = 0; c < numChannels; c++)
+    {
+        for (int i = 0; i < 16; i++)
+            mean[c] += pixels[c][i];
+        mean[c] /= 16.0f;
+    }
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; i++)
+        for (int a = 0; a < numChannels; a++)
+            for (int b = 0; b < numChannels; b++)
+                covariance[a][b] += (pixels[a][i] - mean[a]) * (pixels[b][i] - mean[b]);
+
+    // power iteration, starting from the diagonal
+    float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        float length = 0.0f;
+        for (int a = 0; a < numChannels; a++)
+        {
+            for (int b = 0; b < numChannels; b++)
+                next[a] += covariance[a][b] * axis[b];
+            length = max(length, fabsf(next[a]));
+        }
+        if (length < 1e-6f)
+            break;
+        for (int a = 0; a < numChannels; a++)
+            axis[a] = next[a] / length;
+    }
+
+    // projection of the pixels on the axis: the endpoints are the extremes
+    float minT = FLT_MAX, maxT = -FLT_MAX, axisLength2 = 0.0f;
+    for (int c = 0; c < numChannels; c++)
+        axisLength2 += axis[c] * axis[c];
+    for (int i = 0; i < 16; i++)
+    {
+        float t = 0.0f;
+        for (int c = 0; c < numChannels; c++)
+            t += (pixels[c][i] - mean[c]) * axis[c];
+        minT = min(minT, t);
+        maxT = max(maxT, t);
+    }
+    for (int c = 0; c < 4; c++)
+    {
+        endpoint0[c] = (c < numChannels) ? min(max(mean[c] + axis[c] * maxT / axisLength2, 0.0f), 255.0f) : 255.0f;
+        endpoint1[c] = (c < numChannels) ? min(max(mean[c] + axis[c] * minT / axisLength2, 0.0f), 255.0f) : 255.0f;
+    }
+}
+
+//////////////////////////////////////////
+// least squares fit of the endpoints, given the interpolation weights of the pixels (weight of endpoint1, in [0,1])
+// It returns false if the system is singular (e.g., all the pixels use the same weight)
+inline bool FitEndpoints(const float pixels[4][16], const float weights[16], int numChannels, float endpoint0[4], float endpoint1[4])
+{
+    float a = 0.0f, b = 0.0f, c = 0.0f, x0[4] = {}, x1[4] = {};
+    for (int i = 0; i < 16; i++)
+    {
+        float t = weights[i], s = 1.0f - t;
+        a += s * s;
+        b += s * t;
+        c += t * t;
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            x0[ch] += s * pixels[ch][i];
+            x1[ch] += t * pixels[ch][i];
+        }
+    }
+    float det = a * c - b * b;
+    if (fabsf(det) < 1e-6f)
+        return false;
+    for (int ch = 0; ch < numChannels; ch++)
+    {
+        endpoint0[ch] = min(max((c * x0[ch] - b * x1[ch]) / det, 0.0f), 255.0f);
+        endpoint1[ch] = min(max((a * x1[ch] - b * x0[ch]) / det, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+//////////////////////////////////////////
+// BC1 color block
+// The decoder uses 4 colors only if color0 > color1 (as 16 bit values): c2 = (2*c0 + c1)/3, c3 = (c0 + 2*c1)/3
+inline uint16_t PackRGB565(const float color[4])
+{
+    uint32_t r = (uint32_t)(color[0] * 31.0f / 255.0f + 0.5f), g = (uint32_t)(color[1] * 63.0f / 255.0f + 0.5f), b = (uint32_t)(color[2] * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void UnpackRGB565(uint16_t packed, float color[4])
+{
+    uint32_t r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (float)((r << 3) | (r >> 2));
+    color[1] = (float)((g << 2) | (g >> 4));
+    color[2] = (float)((b << 3) | (b >> 2));
+    color[3] = 255.0f;
+}
+
+// we quantize the endpoints, we select the indices, and we return the error
+inline float QuantizeBC1(const float pixels[4][16], const float endpoint0[4], const float endpoint1[4], uint16_t& color0, uint16_t& color1, uint8_t indices[16])
+{
+    color0 = PackRGB565(endpoint0);
+    color1 = PackRGB565(endpoint1);
+    if (color0 < color1)
+        swap(color0, color1);
+    float palette[4][4];
+    UnpackRGB565(color0, palette[0]);
+    UnpackRGB565(color1, palette[1]);
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+    // if the colors are equal, the block would be decoded in 3 colors mode: we use only the first color
+    return SelectBlockIndices(pixels, palette, (color0 == color1) ? 1 : 4, 3, indices);
+}
+
+inline void EncodeBlockBC1(const float pixels[4][16], uint8_t* block)
+{
+    float endpoint0[4], endpoint1[4];
+    PrincipalAxisEndpoints(pixels, 3, endpoint0, endpoint1);
+    uint16_t color0, color1;
+    uint8_t indices[16];
+    float error = QuantizeBC1(pixels, endpoint0, endpoint1, color0, color1, indices);
+
+    // refinement of the endpoints: if the error is lower, we keep the new ones
+    const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+    float pixelWeights[16];
+    for (int i = 0; i < 16; i++)
+        pixelWeights[i] = weights[indices[i]];
+    if (FitEndpoints(pixels, pixelWeights, 3, endpoint0, endpoint1))
+    {
+        uint16_t refined0, refined1;
+        uint8_t refinedIndices[16];
+        if (QuantizeBC1(pixels, endpoint0, endpoint1, refined0, refined1, refinedIndices) < error)
+        {
+            color0 = refined0;
+            color1 = refined1;
+            memcpy(indices, refinedIndices, 16);
+        }
+    }
+
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; i++)
+        bits |= (uint32_t)indices[i] << (2 * i);
+    memcpy(block, &color0, 2);
+    memcpy(block + 2, &color1, 2);
+    memcpy(block + 4, &bits, 4);
+}
+
+//////////////////////////////////////////
+// BC4 block (single channel): with value0 > value1, the decoder uses 8 values, interpolated in integer arithmetic
+inline void EncodeBlockBC4(const float values[16], uint8_t* block)
+{
+    float pixels[4][16];
+    memcpy(pixels[0], values, sizeof(float) * 16);
+    float minV = 255.0f, maxV = 0.0f;
+    for (int i = 0; i < 16; i++)
+    {
+        minV = min(minV, values[i]);
+        maxV = max(maxV, values[i]);
+    }
+    uint32_t value0 = (uint32_t)(maxV + 0.5f), value1 = (uint32_t)(minV + 0.5f);
+    float palette[8][4];
+    palette[0][0] = (float)value0;
+    palette[1][0] = (float)value1;
+    for (int i = 2; i < 8; i++)
+        palette[i][0] = (float)(((8 - i) * value0 + (i - 1) * value1) / 7);
+    uint8_t indices[16];
+    // if the values are equal, the block would be decoded in 6 values mode: we use only the first value
+    SelectBlockIndices(pixels, palette, (value0 == value1) ? 1 : 8, 1, indices);
+
+    uint64_t bits = 0;
+    for (int i = 0; i < 16; i++)
+        bits |= (uint64_t)indices[i] << (3 * i);
+    block[0] = (uint8_t)value0;
+    block[1] = (uint8_t)value1;
+    for (int i = 0; i < 6; i++)
+        block[2 + i] = (uint8_t)(bits >> (8 * i));
+}
+
+//////////////////////////////////////////
+// BC7 mode 6 block
+// endpoints are 7 bit per channel, plus a "p-bit" shared by the channels of each endpoint (8 bit values = (value << 1) | pbit)
+const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// we quantize an endpoint, choosing the p-bit with the lower error
+inline void QuantizeBC7Endpoint(const float endpoint[4], uint32_t quantized[4], uint32_t& pbit)
+{
+    float bestError = FLT_MAX;
+    for (uint32_t p = 0; p < 2; p++)
+    {
+        uint32_t q[4];
+        float error = 0.0f;
+        for (int c = 0; c < 4; c++)
+        {
+            q[c] = (uint32_t)min(max((endpoint[c] - (float)p) * 0.5f + 0.5f, 0.0f), 127.0f);
+            float value = (float)((q[c] << 1) | p);
+            error += (value - endpoint[c]) * (value - endpoint[c]);
+        }
+        if (error < bestError)
+        {
+            bestError = error;
+            pbit = p;
+            memcpy(quantized, q, sizeof(q));
+        }
+    }
+}
+
+inline float QuantizeBC7(const float pixels[4][16], const float endpoint0[4], const float endpoint1[4], uint32_t q0[4], uint32_t q1[4], uint32_t& p0, uint32_t& p1, uint8_t indices[16])
+{
+    QuantizeBC7Endpoint(endpoint0, q0, p0);
+    QuantizeBC7Endpoint(endpoint1, q1, p1);
+    float palette[16][4];
+    for (int e = 0; e < 16; e++)
+        for (int c = 0; c < 4; c++)
+        {
+            int e0 = (int)((q0[c] << 1) | p0), e1 = (int)((q1[c] << 1) | p1);
+            palette[e][c] = (float)(((64 - BC7_WEIGHTS4[e]) * e0 + BC7_WEIGHTS4[e] * e1 + 32) >> 6);
+        }
+    return SelectBlockIndices(pixels, palette, 16, 4, indices);
+}
+
+// bits are written from the least significant bit of the first byte
+struct BlockBitWriter
+{
+    uint8_t* block;
+    int position = 0;
+
+    void Write(uint32_t value, int numBits)
+    {
+        for (int i = 0; i < numBits; i++, position++)
+            if (value & (1u << i))
+                block[position >> 3] |= (uint8_t)(1u << (position & 7));
+    }
+};
+
+inline void EncodeBlockBC7(const float pixels[4][16], uint8_t* block)
+{
+    float endpoint0[4], endpoint1[4];
+    PrincipalAxisEndpoints(pixels, 4, endpoint0, endpoint1);
+    uint32_t q0[4], q1[4], p0, p1;
+    uint8_t indices[16];
+    float error = QuantizeBC7(pixels, endpoint0, endpoint1, q0, q1, p0, p1, indices);
+
+    // refinement of the endpoints
+    float pixelWeights[16];
+    for (int i = 0; i < 16; i++)
+        pixelWeights[i] = BC7_WEIGHTS4[indices[i]] / 64.0f;
+    if (FitEndpoints(pixels, pixelWeights, 4, endpoint0, endpoint1))
+    {
+        uint32_t r0[4], r1[4], rp0, rp1;
+        uint8_t refinedIndices[16];
+        if (QuantizeBC7(pixels, endpoint0, endpoint1, r0, r1, rp0, rp1, refinedIndices) < error)
+        {
+            memcpy(q0, r0, sizeof(r0));
+            memcpy(q1, r1, sizeof(r1));
+            p0 = rp0;
+            p1 = rp1;
+            memcpy(indices, refinedIndices, 16);
+        }
+    }
+
+    // the most significant bit of the first index is implicitly 0 ("anchor" index): if it is 1, we swap the endpoints
+    // (the weights are symmetric, so index i with swapped endpoints is equal to index 15-i)
+    if (indices[0] & 8)
+    {
+        for (int c = 0; c < 4; c++)
+            swap(q0[c], q1[c]);
+        swap(p0, p1);
+        for (int i = 0; i < 16; i++)
+            indices[i] = 15 - indices[i];
+    }
+
+    memset(block, 0, 16);
+    BlockBitWriter writer = { block };
+    // mode 6: 6 zero bits followed by a 1
+    writer.Write(1 << 6, 7);
+    for (int c = 0; c < 4; c++)
+    {
+        writer.Write(q0[c], 7);
+        writer.Write(q1[c], 7);
+    }
+    writer.Write(p0, 1);
+    writer.Write(p1, 1);
+    writer.Write(indices[0], 3);
+    for (int i = 1; i < 16; i++)
+        writer.Write(indices[i], 4);
+}
+
+//////////////////////////////////////////
+// we encode a block of 4x4 pixels (channels in SoA layout) in the given format
+inline void EncodeBlock(const float pixels[4][16], uint8_t* block, BakeFormat format)
+{
+    switch (format)
+    {
+        case BAKE_BC1:
+            EncodeBlockBC1(pixels, block);
+            break;
+        case BAKE_BC3:
+            EncodeBlockBC4(pixels[3], block);
+            EncodeBlockBC1(pixels, block + 8);
+            break;
+        case BAKE_BC5:
+            EncodeBlockBC4(pixels[0], block);
+            EncodeBlockBC4(pixels[1], block + 8);
+            break;
+        default:
+            EncodeBlockBC7(pixels, block);
+            break;
+    }
+}
+
+//////////////////////////////////////////
+// we encode a RGBA8 image. Rows of blocks are divided among the worker threads
+inline vector<unsigned char> EncodeImage(const unsigned char* rgba, GLuint width, GLuint height, BakeFormat format)
+{
+    const GLuint blocksX = (width + 3) / 4, blocksY = (height + 3) / 4, blockSize = BakeFormatBlockSize(format);
+    vector<unsigned char> result((size_t)blocksX * blocksY * blockSize);
+
+    auto encodeRows = [&](GLuint firstRow, GLuint lastRow)
+    {
+        for (GLuint by = firstRow; by < lastRow; by++)
+            for (GLuint bx = 0; bx < blocksX; bx++)
+            {
+                // pixels of the block (in SoA layout). At the borders of images smaller than a block, we repeat the last pixel
+                float pixels[4][16];
+                for (GLuint y = 0; y < 4; y++)
+                    for (GLuint x = 0; x < 4; x++)
+                    {
+                        const unsigned char* p = rgba + 4 * ((size_t)min(by * 4 + y, height - 1) * width + min(bx * 4 + x, width - 1));
+                        for (int c = 0; c < 4; c++)
+                            pixels[c][y * 4 + x] = (float)p[c];
+                    }
+                EncodeBlock(pixels, &result[((size_t)by * blocksX + bx) * blockSize], format);
+            }
+    };
+
+    JobSystem::Instance().ParallelFor(blocksY, [&encodeRows](size_t first, size_t last) { encodeRows((GLuint)first, (GLuint)last); });
+    return result;
+}
+
+//////////////////////////////////////////
+// next level of the mipmaps chain of a RGBA8 image (2x2 box filter)
+inline vector<unsigned char> DownsampleImage(const vector<unsigned char>& rgba, GLuint width, GLuint height, GLuint& nextWidth, GLuint& nextHeight)
+{
+    nextWidth = max(width / 2, 1u);
+    nextHeight = max(height / 2, 1u);
+    vector<unsigned char> result((size_t)nextWidth * nextHeight * 4);
+    for (GLuint y = 0; y < nextHeight; y++)
+        for (GLuint x = 0; x < nextWidth; x++)
+            for (int c = 0; c < 4; c++)
+            {
+                GLuint x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1), y0 = min(2 * y, height - 1), y1 = min(2 * y + 1, height - 1);
+                GLuint sum = rgba[4 * ((size_t)y0 * width + x0) + c] + rgba[4 * ((size_t)y0 * width + x1) + c] +
+                             rgba[4 * ((size_t)y1 * width + x0) + c] + rgba[4 * ((size_t)y1 * width + x1) + c];
+                result[4 * ((size_t)y * nextWidth + x) + c] = (unsigned char)((sum + 2) / 4);
+            }
+    return result;
+}
+
+//////////////////////////////////////////
+// we encode the images of the faces (RGBA8, all with the same size) and we save them in a KTX file, with the information about the sources.
+// If mipmaps is true, the full chain of mipmaps is generated (the images of the faces are modified). It returns false in case of errors
+inline bool WriteBakedTexture(const string& path, vector<vector<unsigned char>>& faces, GLuint width, GLuint height, BakeFormat format,
+                              bool mipmaps, const vector<int64_t>& sourcesInfo)
+{
+    GLuint numLevels = 1;
+    if (mipmaps)
+        while ((max(width, height) >> numLevels) > 0)
+            numLevels++;
+
+    // compressed levels: for each level, the images of all the faces
+    vector<vector<unsigned char>> levels(numLevels);
+    for (vector<unsigned char>& face : faces)
+    {
+        GLuint w = width, h = height;
+        for (GLuint level = 0; level < numLevels; level++)
+        {
+            vector<unsigned char> compressed = EncodeImage(face.data(), w, h, format);
+            levels[level].insert(levels[level].end(), compressed.begin(), compressed.end());
+            if (level + 1 < numLevels)
+                face = DownsampleImage(face, w, h, w, h);
+        }
+    }
+
+    // key/value data: key and value, with the size of the pair before them, and padding to 4 bytes
+    vector<unsigned char> keyValue(sizeof(KTX_SOURCE_KEY) + sourcesInfo.size() * sizeof(int64_t));
+    memcpy(keyValue.data(), KTX_SOURCE_KEY, sizeof(KTX_SOURCE_KEY));
+    memcpy(keyValue.data() + sizeof(KTX_SOURCE_KEY), sourcesInfo.data(), sourcesInfo.size() * sizeof(int64_t));
+    uint32_t keyValueSize = (uint32_t)keyValue.size();
+    keyValue.resize((keyValue.size() + 3) & ~(size_t)3, 0);
+
+    KTXHeader header = {};
+    header.endianness = 0x04030201;
+    header.glTypeSize = 1;
+    header.glInternalFormat = BakeFormatGL(format);
+    header.glBaseInternalFormat = (format == BAKE_BC1) ? GL_RGB : (format == BAKE_BC5) ? GL_RG : GL_RGBA;
+    header.pixelWidth = (uint32_t)width;
+    header.pixelHeight = (uint32_t)height;
+    header.numberOfFaces = (uint32_t)faces.size();
+    header.numberOfMipmapLevels = numLevels;
+    header.bytesOfKeyValueData = (uint32_t)(sizeof(uint32_t) + keyValue.size());
+
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file)
+    {
+        LOG_ERROR("TEXTURE_BAKER", "impossible to write " << path);
+        return false;
+    }
+    file.write((const char*)KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)&keyValueSize, sizeof(keyValueSize));
+    file.write((const char*)keyValue.data(), keyValue.size());
+    // for each level, the size of the image of a face, then the images
+    // (compressed images are multiple of 8 bytes, so no padding is needed)
+    for (const vector<unsigned char>& level : levels)
+    {
+        uint32_t imageSize = (uint32_t)(level.size() / faces.size());
+        file.write((const char*)&imageSize, sizeof(imageSize));
+        file.write((const char*)level.data(), level.size());
+    }
+    return (bool)file;
+}
+
+//////////////////////////////////////////
+// we bake a texture (1 source image for a 2D texture, 6 for a cube map in the order +X, -X, +Y, -Y, +Z, -Z) in a KTX file
+// If mipmaps is true, the full chain of mipmaps is generated. It returns false in case of errors
+inline bool BakeTexture(const vector<string>& sources, BakeFormat format, bool mipmaps)
+{
+    vector<int64_t> sourcesInfo;
+    if (!GetBakeSourcesInfo(sources, sourcesInfo))
+    {
+        LOG_ERROR("TEXTURE_BAKER", "missing source image for " << BakedTexturePath(sources));
+        return false;
+    }
+
+    // images of the faces, decoded as RGBA
+    vector<vector<unsigned char>> faces(sources.size());
+    int width = 0, height = 0;
+    for (size_t f = 0; f < sources.size(); f++)
+    {
+        int w, h, channels;
+        AssetData source;
+        unsigned char* image = nullptr;
+        if (AssetSystem::Instance().Read(sources[f], source))
+            image = stbi_load_from_memory(source.data, (int)source.size, &w, &h, &channels, STBI_rgb_alpha);
+        if (!image || (f > 0 && (w != width || h != height)))
+        {
+            LOG_ERROR("TEXTURE_BAKER", "impossible to load " << sources[f]);
+            stbi_image_free(image);
+            return false;
+        }
+        width = w;
+        height = h;
+        faces[f].assign(image, image + (size_t)w * h * 4);
+        stbi_image_free(image);
+    }
+
+    return WriteBakedTexture(BakedTexturePath(sources), faces, (GLuint)width, (GLuint)height, format, mipmaps, sourcesInfo);
+}
+
+//////////////////////////////////////////
+// we read a KTX file with the given number of faces, baked from the sources with the given information (see GetBakeSourcesInfo)
+inline bool ReadBakedTexture(const string& path, const vector<int64_t>& sourcesInfo, GLuint numFaces, KTXTexture& texture)
+{
+    if (!AssetSystem::Instance().Read(path, texture.file))
+        return false;
+    const unsigned char* data = texture.file.data;
+    const size_t dataSize = texture.file.size;
+
+    const size_t headerEnd = sizeof(KTX_IDENTIFIER) + sizeof(KTXHeader);
+    if (dataSize < headerEnd || memcmp(data, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0)
+        return false;
+    KTXHeader header;
+    memcpy(&header, data + sizeof(KTX_IDENTIFIER), sizeof(header));
+    if (header.endianness != 0x04030201 || header.numberOfFaces != numFaces || header.numberOfMipmapLevels == 0)
+        return false;
+
+    // we check the information about the source images
+    size_t offset = headerEnd;
+    const size_t keyValueEnd = headerEnd + header.bytesOfKeyValueData;
+    bool sourcesMatch = false;
+    while (offset + sizeof(uint32_t) <= keyValueEnd && keyValueEnd <= dataSize)
+    {
+        uint32_t size;
+        memcpy(&size, data + offset, sizeof(size));
+        const unsigned char* pair = data + offset + sizeof(uint32_t);
+        if (size == sizeof(KTX_SOURCE_KEY) + sourcesInfo.size() * sizeof(int64_t) && memcmp(pair, KTX_SOURCE_KEY, sizeof(KTX_SOURCE_KEY)) == 0)
+            sourcesMatch = memcmp(pair + sizeof(KTX_SOURCE_KEY), sourcesInfo.data(), sourcesInfo.size() * sizeof(int64_t)) == 0;
+        offset += sizeof(uint32_t) + ((size + 3) & ~3u);
+    }
+    if (!sourcesMatch)
+        return false;
+
+    texture.internalFormat = header.glInternalFormat;
+    texture.width = header.pixelWidth;
+    texture.height = header.pixelHeight;
+    texture.numFaces = header.numberOfFaces;
+    texture.numLevels = header.numberOfMipmapLevels;
+    texture.imageOffsets.clear();
+    texture.imageSizes.clear();
+    offset = keyValueEnd;
+    for (GLuint level = 0; level < texture.numLevels; level++)
+    {
+        uint32_t imageSize;
+        if (offset + sizeof(imageSize) > dataSize)
+            return false;
+        memcpy(&imageSize, data + offset, sizeof(imageSize));
+        offset += sizeof(imageSize);
+        texture.imageSizes.push_back((GLsizei)imageSize);
+        for (GLuint face = 0; face < texture.numFaces; face++)
+        {
+            texture.imageOffsets.push_back(offset);
+            offset += (imageSize + 3) & ~3u;
+        }
+        if (offset > dataSize)
+            return false;
+    }
+    return true;
+}
+
+//////////////////////////////////////////
+// we read the baked texture of a set of source images. It returns false if the baked texture does not exist,
+// or if it is not valid (e.g., the source images have been modified after the baking)
+inline bool LoadBakedTexture(const vector<string>& sources, KTXTexture& texture)
+{
+    vector<int64_t> sourcesInfo;
+    if (!GetBakeSourcesInfo(sources, sourcesInfo))
+        return false;
+    return ReadBakedTexture(BakedTexturePath(sources), sourcesInfo, (GLuint)sources.size(), texture);
+}
@@ -0,0 +1,741 @@
+/*
+TextureLoader class
+- asynchronous loading of 2D textures and cube maps
+- images are decoded in parallel by the worker threads (see thread_pool.h)
+- decoded images are uploaded to the GPU by a dedicated loader thread, with its own OpenGL context shared with the main one
+
+The loading of a texture follows these steps:
+1) the main thread creates a request (Load2D or LoadCube), and it submits a decoding job for each image to the worker threads
+2) when all the images of a request have been decoded, the request is passed to the loader thread
+3) the loader thread copies the images in a Pixel Buffer Object (PBO), creates the texture from the PBO,
+   and inserts a fence sync object in its command stream
+4) the main thread checks the fence (Poll or WaitAll): when it is signaled, the texture is complete and it can be used
+
+In this way, the loading time is bound by the slowest image, and not by the sum of the decoding times of all the images.
+Moreover, the main thread can load models and compile shaders while the textures are decoded.
+
+If a valid baked texture (block-compressed, with precomputed mipmaps, see texture_baker.h) exists for the source images,
+and its format is supported by the OpenGL implementation, the worker thread just reads the KTX file in memory,
+and the loader thread uploads its levels with glCompressedTexImage2D. Otherwise, the source images are decoded.
+
+Cube-sphere textures (LoadCubeSphere, see cube_reprojection.h) are cube maps created from a single equirectangular image:
+the baked cube map is used if available, otherwise the image is decoded, and each face is reprojected by a different worker thread.
+
+N.B. 1)
+The loader context is created using a hidden GLFW window. GLFW requires that windows are created and destroyed in the main thread:
+the constructor and Shutdown() must be called by the main thread. If the shared context cannot be created,
+the uploads are executed by the main thread inside Poll() and WaitAll().
+
+N.B. 2)
+Texture names are shared between the two contexts, but the changes to a texture made in the loader context are guaranteed
+to be visible in the main context only after the fence has been signaled, and the texture is bound again.
+This is why Texture() returns 0 until the request is complete.
+
+N.B. 3)
+The created textures and the PBO are recorded in the ResourceRegistry (see resource_registry.h), with the path of the images as owner.
+The textures are owned by the application: when it deletes a texture, it must release its record.
+
+N.B. 4)
+With the DSA backend (see gl_backend.h), the textures are created with immutable storage (glTextureStorage2D) and the images are
+copied with glTextureSubImage2D / glCompressedTextureSubImage2D (for the cube maps, the 3D versions, with a face for each layer),
+without binding the textures. The storage must be allocated before the copy of the first image, so a request with images
+of different sizes (e.g., when an image has not been loaded, and it is replaced by a white pixel) uses the mutable storage.
+
+N.B. 5) the class is "non-copyable" and "non-movable": worker threads and loader thread keep pointers to the instance
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include <glfw/glfw3.h>
+#include <stb_image/stb_image.h>
+
+#include <utils/thread_pool.h>
+#include <utils/texture_baker.h>
+#include <utils/cube_reprojection.h>
+#include <utils/resource_registry.h>
+#include <utils/gl_backend.h>
+#include <utils/logger.h>
+
+// an image decoded in CPU memory
+struct DecodedImage
+{
+    string path;
+    unsigned char* pixels = nullptr;
+    int width = 0, height = 0, components = 0;
+    // if not empty, pixels points to storage (the image has not been decoded by stb_image, e.g. a reprojected face)
+    vector<unsigned char> storage;
+    // decoding start and end (in milliseconds from the creation of the loader)
+    double decodeStart = 0.0, decodeEnd = 0.0;
+};
+
+// a texture loading request: a single image for a 2D texture, 6 images for a cube map
+struct TextureRequest
+{
+    GLenum target;
+    vector<DecodedImage> images;
+    // cube map reprojected from an equirectangular image (see cube_reprojection.h): the 6 images have the path of the source
+    GLboolean cubeSphere = GL_FALSE;
+    // number of images still to decode
+    atomic<unsigned int> remaining;
+    // baked texture (if isBaked is true, images are not decoded)
+    KTXTexture baked;
+    GLboolean isBaked = GL_FALSE;
+    // OpenGL texture, and fence signaled when the upload is complete
+    GLuint texture = 0;
+    // size of the uploaded data (including mipmaps)
+    size_t textureBytes = 0;
+    GLsync fence = 0;
+    GLboolean ready = GL_FALSE;
+    // timeline of the request (in milliseconds from the creation of the loader)
+    double submitted = 0.0, uploadStart = 0.0, uploadEnd = 0.0, completed = 0.0;
+};
+
+//////////////////////////////////////////
+// compressed formats of the baked textures (see texture_baker.h) supported by the OpenGL implementation
+// It must be called by a thread where an OpenGL context is current
+inline vector<GLenum> QueryCompressedFormats()
+{
+    vector<GLenum> formats;
+    GLint major, minor, numExtensions;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    formats.push_back(GL_COMPRESSED_RG_RGTC2);
+    if (major > 4 || (major == 4 && minor >= 2))
+        formats.push_back(GL_COMPRESSED_RGBA_BPTC_UNORM);
+    for (GLint i = 0; i < numExtensions; i++)
+    {
+        string extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension == "GL_EXT_texture_compression_s3tc")
+        {
+            formats.push_back(GL_COMPRESSED_RGB_S3TC_DXT1_EXT);
+            formats.push_back(GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);
+        }
+        else if (extension == "GL_ARB_texture_compression_bptc")
+            formats.push_back(GL_COMPRESSED_RGBA_BPTC_UNORM);
+    }
+    return formats;
+}
+
+/////////////////// TEXTURELOADER class ///////////////////////
+class TextureLoader
+{
+public:
+
+    // We want TextureLoader to be neither copied nor moved
+    TextureLoader(const TextureLoader& copy) = delete;
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    //////////////////////////////////////////
+
+    // constructor: mainWindow is the window with the OpenGL context used for rendering
+    // the window hints used for the main window (OpenGL version and profile) must still be set
+    TextureLoader(GLFWwindow* mainWindow)
+    {
+        this->startTime = chrono::steady_clock::now();
+
+        // compressed formats of the baked textures supported by the OpenGL implementation (the main context is current)
+        this->compressedFormats = QueryCompressedFormats();
+
+        // we create a hidden window, with a context sharing objects with the main one
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        this->loaderWindow = glfwCreateWindow(1, 1, "texture loader", nullptr, mainWindow);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+        if (this->loaderWindow)
+            this->loaderThread = thread([this] { this->loaderLoop(); });
+        else
+            LOG_WARNING("TEXTURE_LOADER", "impossible to create the shared context, textures will be uploaded by the main thread");
+    }
+
+    //////////////////////////////////////////
+
+    // destructor
+    ~TextureLoader()
+    {
+        this->Shutdown();
+    }
+
+    //////////////////////////////////////////
+
+    // we stop the loader thread, and we destroy its context. It must be called by the main thread, before glfwTerminate
+    // N.B.) the requests not yet uploaded are discarded, the textures already created are not deleted
+    void Shutdown()
+    {
+        // the decoding jobs still running access the requests: we wait for them
+        {
+            unique_lock<mutex> lock(this->queueMutex);
+            this->completedCondition.wait(lock, [this] { return this->pendingDecodes == 0; });
+        }
+        if (this->loaderThread.joinable())
+        {
+            {
+                lock_guard<mutex> lock(this->queueMutex);
+                this->stopping = true;
+            }
+            this->uploadCondition.notify_all();
+            this->loaderThread.join();
+        }
+        if (this->loaderWindow)
+        {
+            glfwDestroyWindow(this->loaderWindow);
+            this->loaderWindow = nullptr;
+        }
+    }
+
+    //////////////////////////////////////////
+
+    // we request the loading of a 2D texture (with mipmaps). It returns the index of the request
+    GLuint Load2D(const string& path)
+    {
+        return this->submit(GL_TEXTURE_2D, { path });
+    }
+
+    // we request the loading of a cube map: the 6 images must be in the order +X, -X, +Y, -Y, +Z, -Z
+    // It returns the index of the request
+    GLuint LoadCube(const string& folder, const vector<string>& faces)
+    {
+        vector<string> paths;
+        for (const string& face : faces)
+            paths.push_back(folder + face);
+        return this->submit(GL_TEXTURE_CUBE_MAP, paths);
+    }
+
+    // we request the loading of a cube-sphere texture (a cube map with mipmaps) from an equirectangular image
+    // It returns the index of the request
+    GLuint LoadCubeSphere(const string& path)
+    {
+        return this->submit(GL_TEXTURE_CUBE_MAP, vector<string>(6, path), GL_TRUE);
+    }
+
+    //////////////////////////////////////////
+
+    // we check the completed uploads without blocking. It returns true if all the requests are complete
+    GLboolean Poll()
+    {
+        return this->processCompleted(false);
+    }
+
+    // we wait for the completion of all the requests
+    void WaitAll()
+    {
+        while (!this->processCompleted(true))
+            ;
+    }
+
+    //////////////////////////////////////////
+
+    // texture created by a request (0 if the request is not complete yet)
+    GLuint Texture(GLuint request) const
+    {
+        const TextureRequest& r = *this->requests[request];
+        return r.ready ? r.texture : 0;
+    }
+
+    //////////////////////////////////////////
+
+    // we print on console the timeline of the completed requests
+    void PrintTimeline() const
+    {
+        double decodeSum = 0.0, slowestDecode = 0.0, end = 0.0;
+        size_t textureBytes = 0;
+        cout << "Texture loading timeline (ms from the creation of the loader):" << endl;
+        cout << fixed << setprecision(1);
+        for (const unique_ptr<TextureRequest>& r : this->requests)
+        {
+            if (!r->ready)
+                continue;
+            // for baked textures, the read time of the KTX file is stored in the first image
+            for (size_t i = 0; i < (r->isBaked ? 1 : r->images.size()); i++)
+            {
+                const DecodedImage& image = r->images[i];
+                if (r->isBaked)
+                    cout << "  " << (r->cubeSphere ? CubeSphereTexturePath(image.path) : BakedTexturePath({ image.path })) << ": read ";
+                else
+                    cout << "  " << image.path << (r->cubeSphere ? ": reproject face " + to_string(i) + " " : ": decode ");
+                cout << image.decodeStart << " - " << image.decodeEnd << " (" << image.decodeEnd - image.decodeStart << ")" << endl;
+                decodeSum += image.decodeEnd - image.decodeStart;
+                slowestDecode = max(slowestDecode, image.decodeEnd - image.decodeStart);
+            }
+            cout << "    submitted " << r->submitted << " - upload " << r->uploadStart << " - " << r->uploadEnd << " - ready " << r->completed;
+            cout << " - " << r->textureBytes / 1024 << " KB" << endl;
+            end = max(end, r->completed);
+            textureBytes += r->textureBytes;
+        }
+        cout << "  all textures ready at " << end << " - sum of decoding times " << decodeSum << " - slowest image " << slowestDecode;
+        cout << " - texture memory " << textureBytes / 1024 << " KB" << endl;
+        cout << defaultfloat << setprecision(6);
+    }
+
+private:
+
+    vector<unique_ptr<TextureRequest>> requests;
+    // requests with all the images decoded, waiting for the upload
+    deque<TextureRequest*> uploadQueue;
+    // requests uploaded, waiting for the fence
+    deque<TextureRequest*> completedQueue;
+    mutex queueMutex;
+    condition_variable uploadCondition;
+    condition_variable completedCondition;
+    bool stopping = false;
+    // number of jobs (reading of baked textures and decoding of images) still running
+    unsigned int pendingDecodes = 0;
+
+    GLFWwindow* loaderWindow = nullptr;
+    thread loaderThread;
+    // Pixel Buffer Object used for the uploads (it belongs to the context which executes the uploads)
+    GLuint PBO = 0;
+    // compressed formats supported by the OpenGL implementation
+    vector<GLenum> compressedFormats;
+
+    chrono::steady_clock::time_point startTime;
+
+    //////////////////////////////////////////
+    // milliseconds from the creation of the loader
+    double now() const
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - this->startTime).count();
+    }
+
+    //////////////////////////////////////////
+    // we create a request, and we submit a job to read its baked texture
+    GLuint submit(GLenum target, const vector<string>& paths, GLboolean cubeSphere = GL_FALSE)
+    {
+        this->requests.push_back(make_unique<TextureRequest>());
+        TextureRequest* request = this->requests.back().get();
+        request->target = target;
+        request->cubeSphere = cubeSphere;
+        request->images.resize(paths.size());
+        for (size_t i = 0; i < paths.size(); i++)
+            request->images[i].path = paths[i];
+        request->remaining = (unsigned int)paths.size();
+        request->submitted = this->now();
+        {
+            lock_guard<mutex> lock(this->queueMutex);
+            this->pendingDecodes++;
+        }
+
+        ThreadPool::Instance().Submit([this, request] { this->readBaked(request); });
+        return (GLuint)this->requests.size() - 1;
+    }
+
+    //////////////////////////////////////////
+    // job reading the baked texture (executed by a worker thread)
+    // if the baked texture is not available, or its format is not supported, we submit a decoding job for each image
+    void readBaked(TextureRequest* request)
+    {
+        vector<string> sources;
+        for (const DecodedImage& image : request->images)
+            sources.push_back(image.path);
+
+        request->images[0].decodeStart = this->now();
+        GLboolean loaded = request->cubeSphere ? LoadCubeSphereTexture(sources[0], request->baked) : LoadBakedTexture(sources, request->baked);
+        if (loaded &&
+            find(this->compressedFormats.begin(), this->compressedFormats.end(), request->baked.internalFormat) != this->compressedFormats.end())
+        {
+            request->isBaked = GL_TRUE;
+            request->images[0].decodeEnd = this->now();
+            this->jobCompleted(request, true);
+            return;
+        }
+
+        request->baked = KTXTexture();
+        if (request->cubeSphere)
+        {
+            this->decodeCubeSphere(request);
+            return;
+        }
+        {
+            lock_guard<mutex> lock(this->queueMutex);
+            this->pendingDecodes += (unsigned int)request->images.size();
+        }
+        for (DecodedImage& image : request->images)
+        {
+            DecodedImage* decoded = &image;
+            ThreadPool::Instance().Submit([this, request, decoded] { this->decode(request, *decoded); });
+        }
+        this->jobCompleted(request, false);
+    }
+
+    //////////////////////////////////////////
+    // decoding job (executed by a worker thread)
+    void decode(TextureRequest* request, DecodedImage& image)
+    {
+        image.decodeStart = this->now();
+        int channels = 0;
+        // the image file is read through the AssetSystem (from an asset archive, or from disk), and decoded from memory
+        AssetData file;
+        // images with alpha channel are loaded as RGBA, all the others as RGB
+        if (AssetSystem::Instance().Read(image.path, file) && stbi_info_from_memory(file.data, (int)file.size, &image.width, &image.height, &channels))
+        {
+            image.components = (channels == 4) ? STBI_rgb_alpha : STBI_rgb;
+            image.pixels = stbi_load_from_memory(file.data, (int)file.size, &image.width, &image.height, &channels, image.components);
+        }
+        if (image.pixels == nullptr)
+            LOG_ERROR("TEXTURE_LOADER", "failed to load texture " << image.path);
+        image.decodeEnd = this->now();
+
+        // the last decoded image of the request moves the request to the upload queue
+        this->jobCompleted(request, --request->remaining == 0);
+    }
+
+    //////////////////////////////////////////
+    // we decode the equirectangular image of a cube-sphere texture (in the job reading the baked texture),
+    // and we submit a job reprojecting each face. The last face releases the image
+    void decodeCubeSphere(TextureRequest* request)
+    {
+        AssetData file;
+        int width = 0, height = 0, channels;
+        unsigned char* source = nullptr;
+        if (AssetSystem::Instance().Read(request->images[0].path, file))
+            source = stbi_load_from_memory(file.data, (int)file.size, &width, &height, &channels, STBI_rgb_alpha);
+        if (source == nullptr)
+        {
+            // all the faces will use a white pixel
+            LOG_ERROR("TEXTURE_LOADER", "failed to load texture " << request->images[0].path);
+            request->images[0].decodeEnd = this->now();
+            this->jobCompleted(request, true);
+            return;
+        }
+
+        const GLuint faceSize = CubeFaceSize(width);
+        {
+            lock_guard<mutex> lock(this->queueMutex);
+            this->pendingDecodes += 6;
+        }
+        for (GLuint face = 0; face < 6; face++)
+        {
+            ThreadPool::Instance().Submit([this, request, source, width, height, channels, face, faceSize]
+            {
+                DecodedImage& image = request->images[face];
+                image.decodeStart = this->now();
+                const size_t numTexels = (size_t)faceSize * faceSize;
+                image.storage.resize(numTexels * 4);
+                ReprojectFace(source, width, height, face, faceSize, 0, faceSize, image.storage.data());
+                // like the other images, the faces of a source without alpha channel are uploaded as RGB
+                image.components = (channels == 4) ? STBI_rgb_alpha : STBI_rgb;
+                if (image.components == STBI_rgb)
+                {
+                    for (size_t i = 0; i < numTexels; i++)
+                        memmove(&image.storage[i * 3], &image.storage[i * 4], 3);
+                    image.storage.resize(numTexels * 3);
+                }
+                image.pixels = image.storage.data();
+                image.width = image.height = (int)faceSize;
+                image.decodeEnd = this->now();
+
+                const bool last = --request->remaining == 0;
+                if (last)
+                    stbi_image_free(source);
+                this->jobCompleted(request, last);
+            });
+        }
+        this->jobCompleted(request, false);
+    }
+
+    //////////////////////////////////////////
+    // end of a job of a request: if last is true, the request is ready for the upload
+    void jobCompleted(TextureRequest* request, bool last)
+    {
+        {
+            lock_guard<mutex> lock(this->queueMutex);
+            if (last)
+                this->uploadQueue.push_back(request);
+            this->pendingDecodes--;
+        }
+        // without the loader thread, the uploads are executed by the main thread (waiting on completedCondition)
+        if (last && this->loaderWindow)
+            this->uploadCondition.notify_one();
+        this->completedCondition.notify_all();
+    }
+
+    //////////////////////////////////////////
+    // the loader thread makes its context current, and it uploads the decoded requests until Shutdown
+    void loaderLoop()
+    {
+        glfwMakeContextCurrent(this->loaderWindow);
+        for (;;)
+        {
+            TextureRequest* request;
+            {
+                unique_lock<mutex> lock(this->queueMutex);
+                this->uploadCondition.wait(lock, [this] { return this->stopping || !this->uploadQueue.empty(); });
+                if (this->stopping)
+                    break;
+                request = this->uploadQueue.front();
+                this->uploadQueue.pop_front();
+            }
+            this->upload(*request);
+            {
+                lock_guard<mutex> lock(this->queueMutex);
+                this->completedQueue.push_back(request);
+            }
+            this->completedCondition.notify_all();
+        }
+        if (this->PBO)
+        {
+            ResourceRegistry::Instance().Release(RESOURCE_BUFFER, this->PBO);
+            glDeleteBuffers(1, &this->PBO);
+        }
+        glfwMakeContextCurrent(nullptr);
+    }
+
+    //////////////////////////////////////////
+    // we create the texture of a request, copying the images through the PBO, and we insert the fence
+    void upload(TextureRequest& request)
+    {
+        request.uploadStart = this->now();
+
+        if (!this->PBO)
+            glGenBuffers(1, &this->PBO);
+        // RGB rows are not always aligned to 4 bytes
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        // with the DSA backend, the texture has immutable storage, and it is never bound (see N.B. 4)
+        GLboolean immutable = GLBackend::Instance().DSA() && this->uniformSize(request);
+        if (immutable)
+            glCreateTextures(request.target, 1, &request.texture);
+        else
+        {
+            glGenTextures(1, &request.texture);
+            glBindTexture(request.target, request.texture);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->PBO);
+        if (request.isBaked)
+            this->uploadBaked(request, immutable);
+        else
+            this->uploadDecoded(request, immutable);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        // filtering: the cube map of the skybox has no mipmaps, 2D textures and cube-sphere textures have the complete chain
+        GLboolean mipmaps = this->hasMipmaps(request) && (!request.isBaked || request.baked.numLevels > 1);
+        auto parameter = [&request, immutable](GLenum name, GLint value)
+        {
+            if (immutable)
+                glTextureParameteri(request.texture, name, value);
+            else
+                glTexParameteri(request.target, name, value);
+        };
+        if (mipmaps && !request.isBaked)
+        {
+            if (immutable)
+                glGenerateTextureMipmap(request.texture);
+            else
+                glGenerateMipmap(request.target);
+        }
+        parameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        parameter(GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        if (request.target == GL_TEXTURE_CUBE_MAP)
+        {
+            parameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            parameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            parameter(GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        }
+        else
+        {
+            parameter(GL_TEXTURE_WRAP_S, GL_REPEAT);
+            parameter(GL_TEXTURE_WRAP_T, GL_REPEAT);
+        }
+        if (!immutable)
+            glBindTexture(request.target, 0);
+
+        // the owner is the source image (the folder of the images, for the cube maps with an image for each face)
+        GLenum format = request.isBaked ? request.baked.internalFormat : (request.images[0].components == STBI_rgb_alpha) ? GL_RGBA8 : GL_RGB8;
+        string owner = request.images[0].path;
+        if (request.cubeSphere)
+            owner += " (cube sphere)";
+        else if (request.target == GL_TEXTURE_CUBE_MAP)
+            owner = filesystem::path(owner).parent_path().string() + "/";
+        ResourceRegistry::Instance().Register(RESOURCE_TEXTURE, request.texture, request.textureBytes, format, owner);
+
+        // the fence is signaled when the GPU has executed all the previous commands.
+        // We must flush the commands, otherwise the fence could never reach the GPU, and the main thread would wait forever
+        request.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+        request.uploadEnd = this->now();
+    }
+
+    //////////////////////////////////////////
+    // 2D textures and cube-sphere textures have the complete mipmap chain, the cube map of the skybox has only the first level
+    GLboolean hasMipmaps(const TextureRequest& request) const
+    {
+        return request.target == GL_TEXTURE_2D || request.cubeSphere;
+    }
+
+    // the immutable storage can be used if all the images have the same size (see N.B. 4)
+    GLboolean uniformSize(const TextureRequest& request) const
+    {
+        if (request.isBaked)
+            return true;
+        for (const DecodedImage& image : request.images)
+            if (!image.pixels || image.width != request.images[0].width || image.height != request.images[0].height)
+                return false;
+        return true;
+    }
+
+    // we copy in the PBO all the levels of a baked texture, and we create each level with glCompressedTexImage2D
+    // (or we copy it in the immutable storage, allocated for all the levels)
+    void uploadBaked(TextureRequest& request, GLboolean immutable)
+    {
+        KTXTexture& baked = request.baked;
+        // the images are contiguous in the file (with the size of each level between them): we copy them with a single memcpy
+        const size_t first = baked.imageOffsets.front(), size = baked.file.size - first;
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        ResourceRegistry::Instance().Register(RESOURCE_BUFFER, this->PBO, size, GL_PIXEL_UNPACK_BUFFER, "TextureLoader PBO");
+        void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        memcpy(dst, baked.file.data + first, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        if (immutable)
+            glTextureStorage2D(request.texture, baked.numLevels, baked.internalFormat, baked.width, baked.height);
+        for (GLuint level = 0; level < baked.numLevels; level++)
+        {
+            GLsizei width = max(baked.width >> level, 1u), height = max(baked.height >> level, 1u);
+            for (GLuint face = 0; face < baked.numFaces; face++)
+            {
+                GLenum target = (request.target == GL_TEXTURE_CUBE_MAP) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : GL_TEXTURE_2D;
+                size_t offset = baked.imageOffsets[level * baked.numFaces + face] - first;
+                if (!immutable)
+                    glCompressedTexImage2D(target, level, baked.internalFormat, width, height, 0, baked.imageSizes[level], (GLvoid*)offset);
+                else if (request.target == GL_TEXTURE_CUBE_MAP)
+                    glCompressedTextureSubImage3D(request.texture, level, 0, 0, face, width, height, 1, baked.internalFormat, baked.imageSizes[level], (GLvoid*)offset);
+                else
+                    glCompressedTextureSubImage2D(request.texture, level, 0, 0, width, height, baked.internalFormat, baked.imageSizes[level], (GLvoid*)offset);
+                request.textureBytes += baked.imageSizes[level];
+            }
+        }
+        // (the immutable storage has exactly the baked levels)
+        if (!immutable)
+            glTexParameteri(request.target, GL_TEXTURE_MAX_LEVEL, baked.numLevels - 1);
+        // the data are now in the texture: we release the CPU copy
+        request.baked.file = AssetData();
+    }
+
+    //////////////////////////////////////////
+    // we copy in the PBO each decoded image, and we create the texture with glTexImage2D
+    // (or we copy it in the first level of the immutable storage, allocated for all the levels)
+    void uploadDecoded(TextureRequest& request, GLboolean immutable)
+    {
+        if (immutable)
+        {
+            const DecodedImage& first = request.images[0];
+            GLsizei levels = this->hasMipmaps(request) ? MipmapLevels(first.width, first.height) : 1;
+            glTextureStorage2D(request.texture, levels, (first.components == STBI_rgb_alpha) ? GL_RGBA8 : GL_RGB8, first.width, first.height);
+        }
+        for (size_t i = 0; i < request.images.size(); i++)
+        {
+            DecodedImage& image = request.images[i];
+            // if the image has not been loaded, we use a white pixel
+            static const unsigned char white[4] = { 255, 255, 255, 255 };
+            const unsigned char* pixels = image.pixels ? image.pixels : white;
+            if (!image.pixels)
+            {
+                image.width = image.height = 1;
+                image.components = STBI_rgb_alpha;
+            }
+            GLsizeiptr size = (GLsizeiptr)image.width * image.height * image.components;
+
+            // we allocate new storage for the PBO at each upload ("orphaning"), so we do not wait for the previous upload to complete
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            ResourceRegistry::Instance().Register(RESOURCE_BUFFER, this->PBO, size, GL_PIXEL_UNPACK_BUFFER, "TextureLoader PBO");
+            void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            memcpy(dst, pixels, size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+            // with a PBO bound, the last parameter is an offset in the buffer
+            GLenum target = (request.target == GL_TEXTURE_CUBE_MAP) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)i : GL_TEXTURE_2D;
+            GLenum format = (image.components == STBI_rgb_alpha) ? GL_RGBA : GL_RGB;
+            if (!immutable)
+                glTexImage2D(target, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, (GLvoid*)0);
+            else if (request.target == GL_TEXTURE_CUBE_MAP)
+                glTextureSubImage3D(request.texture, 0, 0, 0, (GLint)i, image.width, image.height, 1, format, GL_UNSIGNED_BYTE, (GLvoid*)0);
+            else
+                glTextureSubImage2D(request.texture, 0, 0, 0, image.width, image.height, format, GL_UNSIGNED_BYTE, (GLvoid*)0);
+            // (the mipmaps of 2D textures and cube-sphere textures add 1/3 of the size of the first level)
+            request.textureBytes += this->hasMipmaps(request) ? size * 4 / 3 : size;
+
+            if (image.storage.empty())
+                stbi_image_free(image.pixels);
+            image.storage = vector<unsigned char>();
+            image.pixels = nullptr;
+        }
+    }
+
+    //////////////////////////////////////////
+    // main thread: we check the fences of the uploaded requests (and, without the loader thread, we execute the uploads)
+    // If block is true, we wait until at least one request is completed. It returns true if all the requests are complete
+    GLboolean processCompleted(bool block)
+    {
+        vector<TextureRequest*> toUpload, toCheck;
+        {
+            unique_lock<mutex> lock(this->queueMutex);
+            auto pending = [this] { return !this->completedQueue.empty() || (!this->loaderWindow && !this->uploadQueue.empty()); };
+            if (block && !this->allReady())
+                this->completedCondition.wait(lock, pending);
+            if (!this->loaderWindow)
+            {
+                toUpload.assign(this->uploadQueue.begin(), this->uploadQueue.end());
+                this->uploadQueue.clear();
+            }
+            toCheck.assign(this->completedQueue.begin(), this->completedQueue.end());
+            this->completedQueue.clear();
+        }
+
+        for (TextureRequest* request : toUpload)
+        {
+            this->upload(*request);
+            toCheck.push_back(request);
+        }
+
+        vector<TextureRequest*> notSignaled;
+        for (TextureRequest* request : toCheck)
+        {
+            // if block is true, we wait for the fence (timeout in nanoseconds), otherwise we just check it
+            GLenum status = glClientWaitSync(request->fence, 0, block ? 1000000000 : 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            {
+                glDeleteSync(request->fence);
+                request->fence = 0;
+                request->ready = GL_TRUE;
+                request->completed = this->now();
+            }
+            else
+                notSignaled.push_back(request);
+        }
+
+        lock_guard<mutex> lock(this->queueMutex);
+        this->completedQueue.insert(this->completedQueue.begin(), notSignaled.begin(), notSignaled.end());
+        return this->allReady();
+    }
+
+    //////////////////////////////////////////
+    // true if all the requests are complete
+    bool allReady() const
+    {
+        for (const unique_ptr<TextureRequest>& r : this->requests)
+            if (!r->ready)
+                return false;
+        return true;
+    }
+};
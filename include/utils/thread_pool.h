@@ -0,0 +1,135 @@
+/*
+ThreadPool class
+- a fixed set of worker threads, consuming a FIFO queue of jobs
+- it is used to move CPU-heavy work (e.g., mesh simplification during models loading) out of the main thread
+
+N.B. 1)
+OpenGL calls MUST NOT be executed inside the jobs: the OpenGL context is current only in the main thread.
+Jobs must work only on CPU-side data, and the main thread uses their results to create the GPU resources.
+
+N.B. 2)
+Submit() returns a std::future: the caller can wait for the result using get().
+If the job throws an exception, it is stored in the future, and it is re-thrown by get().
+
+N.B. 3) the class is "non-copyable" and "non-movable": the worker threads keep a pointer to the instance
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+/////////////////// THREADPOOL class ///////////////////////
+class ThreadPool
+{
+public:
+
+    // We want ThreadPool to be neither copied nor moved
+    ThreadPool(const ThreadPool& copy) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    //////////////////////////////////////////
+
+    // constructor
+    // if numThreads is 0, we use all the available hardware threads except one (which is left to the main thread)
+    explicit ThreadPool(unsigned int numThreads = 0)
+    {
+        if (numThreads == 0)
+        {
+            unsigned int hw = thread::hardware_concurrency();
+            numThreads = (hw > 1) ? hw - 1 : 1;
+        }
+
+        for (unsigned int i = 0; i < numThreads; i++)
+            this->workers.emplace_back([this] { this->workerLoop(); });
+    }
+
+    //////////////////////////////////////////
+
+    // destructor: the jobs still in the queue are completed, then the workers are joined
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(this->queueMutex);
+            this->stopping = true;
+        }
+        this->queueCondition.notify_all();
+        for (thread& worker : this->workers)
+            worker.join();
+    }
+
+    //////////////////////////////////////////
+
+    // we add a job to the queue, and we return a future to retrieve its result
+    template<class F>
+    auto Submit(F&& job) -> future<decltype(job())>
+    {
+        using R = decltype(job());
+
+        // packaged_task is move-only, while std::function requires a copyable callable:
+        // we keep the task in a shared_ptr, and the lambda in the queue copies only the pointer
+        auto task = make_shared<packaged_task<R()>>(std::forward<F>(job));
+        future<R> result = task->get_future();
+        {
+            lock_guard<mutex> lock(this->queueMutex);
+            this->jobs.emplace([task] { (*task)(); });
+        }
+        this->queueCondition.notify_one();
+        return result;
+    }
+
+    //////////////////////////////////////////
+
+    // number of worker threads
+    unsigned int Size() const { return (unsigned int)this->workers.size(); }
+
+    //////////////////////////////////////////
+
+    // pool shared by the whole application, created at the first use
+    static ThreadPool& Instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+
+    vector<thread> workers;
+    queue<function<void()>> jobs;
+    mutex queueMutex;
+    condition_variable queueCondition;
+    bool stopping = false;
+
+    //////////////////////////////////////////
+
+    // each worker waits for a job, executes it, and starts again, until the pool is destroyed
+    void workerLoop()
+    {
+        for (;;)
+        {
+            function<void()> job;
+            {
+                unique_lock<mutex> lock(this->queueMutex);
+                this->queueCondition.wait(lock, [this] { return this->stopping || !this->jobs.empty(); });
+                if (this->stopping && this->jobs.empty())
+                    return;
+                job = std::move(this->jobs.front());
+                this->jobs.pop();
+            }
+            job();
+        }
+    }
+};
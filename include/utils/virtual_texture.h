@@ -0,0 +1,837 @@
+/*
+Virtual texturing
+- textures much larger than the VRAM available (e.g., 32k-64k equirectangular images of the planets): the texture is
+  divided in pages, and only the pages actually visible in the frame, at the level of detail needed, are resident
+- offline, BakeVirtualTexture divides the chain of mipmaps of the source image in pages of VT_PAGE_SIZE x VT_PAGE_SIZE texels,
+  with a border of VT_PAGE_BORDER texels taken from the neighbouring pages (so bilinear filtering works across the pages).
+  The pages are block-compressed (see texture_baker.h), and saved in a file next to the source image (e.g., "mars.jpg" -> "mars.jpg.vt")
+- at runtime, the VirtualTextureSystem class manages:
+  - a page cache: a single texture shared by all the virtual textures, where the resident pages are placed in slots of a grid
+  - for each virtual texture, a page table (indirection table): a texture with a texel for each page of each level
+    (a mipmap level of the page table for each level of the virtual texture), with the coordinates of the page in the cache
+  - a feedback pass: the objects using virtual textures are rendered in a small framebuffer, where each pixel stores the page
+    (texture, level, x, y) needed by the fragment. The framebuffer is read back asynchronously (Pixel Buffer Object + fence),
+    and a few frames later the pages not resident are requested (with all their ancestors, the coarser pages containing them).
+    The framebuffer is provided by the application (see N.B. 7): the class owns only the Pixel Buffer Objects of the read back
+  - the loading of the pages, executed by the worker threads (see thread_pool.h), and their upload in the cache by the main thread,
+    with a limit of pages per frame. When the cache is full, the Least Recently Used pages not visible in the last feedback are replaced
+- the memory used is bounded by the size of the cache (and of the page tables), and not by the size of the textures
+
+In the shader, the level of detail is calculated from the derivatives of the texture coordinates, and the page table is read
+at that level: if the page is not resident, the coarser levels are read, until a resident page is found (the page of the coarsest
+level is always resident). The two nearest levels are blended, like in trilinear filtering.
+
+N.B. 1)
+The number of pages of the level 0 is a power of two along each axis (the source image is resampled to the nearest sizes
+multiple of the page content), so the levels of the page table match the mipmap chain of the page table texture.
+The last level has a single page.
+
+N.B. 2)
+The baker does not keep the level 0 in memory: its rows are resampled from the source image one row of pages at a time,
+and they are used to generate the next level. The source image must fit in memory (~8 GB for a 64k x 32k image).
+
+N.B. 3)
+The files of the virtual textures are memory-mapped directly (see asset_pack.h), and not read through the AssetSystem, which would
+read the whole file in memory: they should not be added to the asset pack. The pages are copied from the mapping by the worker
+threads, so the main thread never waits for the disk.
+If the source image is available, its size and modification time are checked, like for the baked textures.
+The source image is not needed at runtime: the virtual texture can be distributed alone.
+
+N.B. 4)
+Update(), Add(), Bind(), and the feedback pass must be called by the main thread (where the OpenGL context is current).
+The Shader Programs using virtual textures must declare the uniforms used in Bind() (see illumination_models_ML.frag and vt_feedback.frag).
+
+N.B. 5) cache, page tables and feedback buffers are recorded in the ResourceRegistry (see resource_registry.h)
+
+N.B. 6) the class is "non-copyable" and "non-movable": the loading jobs keep pointers to the virtual textures
+
+N.B. 7)
+The feedback framebuffer is needed only between the feedback pass and the read back, so it does not need a dedicated texture:
+the application creates it as a transient texture of the render graph (see render_graph.h), with the size given by FeedbackSize,
+a VT_FEEDBACK_FORMAT color attachment cleared to 0, and a depth attachment. The physical textures are taken from the pool
+of the graph, and they are shared with the other transient textures of the frame with the same description.
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include <stb_image/stb_image.h>
+
+#include <utils/thread_pool.h>
+#include <utils/job_system.h>
+#include <utils/asset_system.h>
+#include <utils/texture_baker.h>
+#include <utils/texture_loader.h>
+#include <utils/resource_registry.h>
+#include <utils/logger.h>
+
+// size of a page (border included), and size of the border, in texels
+const GLuint VT_PAGE_SIZE = 128;
+const GLuint VT_PAGE_BORDER = 4;
+// texture units of the page table and of the page cache (unit 0 is used by the usual textures)
+const GLuint VT_PAGE_TABLE_UNIT = 1;
+const GLuint VT_PAGE_CACHE_UNIT = 2;
+// number of Pixel Buffer Objects used for the asynchronous read back of the feedback
+const GLuint VT_FEEDBACK_BUFFERS = 3;
+// formats of the color attachment of the feedback framebuffer (the page of each pixel), and of its depth attachment (see N.B. 7)
+const GLenum VT_FEEDBACK_FORMAT = GL_RGBA16UI;
+const GLenum VT_FEEDBACK_DEPTH_FORMAT = GL_DEPTH_COMPONENT24;
+
+// identifier and version of the files of the virtual textures
+const char VT_MAGIC[8] = { 'R', 'T', 'G', 'P', 'V', 'T', 'E', 'X' };
+const uint32_t VT_VERSION = 1;
+
+// header of a virtual texture file. It is followed by the pages, level by level, in row-major order inside each level
+struct VirtualTextureHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t internalFormat;
+    // pages of the level 0 (powers of two)
+    uint32_t pagesX, pagesY;
+    uint32_t numLevels;
+    uint32_t pageSize;
+    uint32_t border;
+    // size of a compressed page
+    uint32_t pageBytes;
+    // size and last modification time of the source image
+    int64_t sourceSize;
+    int64_t sourceTime;
+};
+
+//////////////////////////////////////////
+// path of the virtual texture of a source image
+inline string VirtualTexturePath(const string& source)
+{
+    return source + ".vt";
+}
+
+//////////////////////////////////////////
+// we bake the virtual texture of a source image (see N.B. 1 and 2). It returns false in case of errors
+inline bool BakeVirtualTexture(const string& source, BakeFormat format)
+{
+    vector<int64_t> sourceInfo;
+    AssetData file;
+    int sourceWidth, sourceHeight, channels;
+    unsigned char* pixels = nullptr;
+    if (GetBakeSourcesInfo({ source }, sourceInfo) && AssetSystem::Instance().Read(source, file))
+        pixels = stbi_load_from_memory(file.data, (int)file.size, &sourceWidth, &sourceHeight, &channels, STBI_rgb_alpha);
+    if (!pixels)
+    {
+        LOG_ERROR("VIRTUAL_TEXTURE", "impossible to load " << source);
+        return false;
+    }
+    // the encoded image is not needed anymore
+    file = AssetData();
+
+    // number of pages of the level 0: the nearest power of two (see N.B. 1)
+    const GLuint content = VT_PAGE_SIZE - 2 * VT_PAGE_BORDER;
+    auto pagesCount = [content](int size)
+    {
+        return 1u << (GLuint)max((int)round(log2((double)size / content)), 0);
+    };
+    VirtualTextureHeader header = {};
+    memcpy(header.magic, VT_MAGIC, sizeof(VT_MAGIC));
+    header.version = VT_VERSION;
+    header.internalFormat = BakeFormatGL(format);
+    header.pagesX = pagesCount(sourceWidth);
+    header.pagesY = pagesCount(sourceHeight);
+    header.numLevels = 1;
+    while ((max(header.pagesX, header.pagesY) >> header.numLevels) > 0)
+        header.numLevels++;
+    header.pageSize = VT_PAGE_SIZE;
+    header.border = VT_PAGE_BORDER;
+    header.pageBytes = (VT_PAGE_SIZE / 4) * (VT_PAGE_SIZE / 4) * BakeFormatBlockSize(format);
+    header.sourceSize = sourceInfo[0];
+    header.sourceTime = sourceInfo[1];
+
+    const string path = VirtualTexturePath(source);
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out)
+    {
+        LOG_ERROR("VIRTUAL_TEXTURE", "impossible to write " << path);
+        stbi_image_free(pixels);
+        return false;
+    }
+    out.write((const char*)&header, sizeof(header));
+
+    // we divide [0, count) among the threads of the job system (see job_system.h), and we wait for the results
+    auto parallelFor = [](GLuint count, const function<void(GLuint, GLuint)>& body)
+    {
+        JobSystem::Instance().ParallelFor(count, [&body](size_t first, size_t last) { body((GLuint)first, (GLuint)last); });
+    };
+
+    // image of the current level (empty for the level 0, whose rows are resampled from the source when needed)
+    vector<unsigned char> image;
+    GLuint width = header.pagesX * content, height = header.pagesY * content;
+    vector<unsigned char> strip, pages;
+    for (GLuint level = 0; level < header.numLevels; level++)
+    {
+        const GLuint pagesX = max(header.pagesX >> level, 1u), pagesY = max(header.pagesY >> level, 1u);
+        // the next level halves the size only along the axes with more than one page
+        const GLuint scaleX = (pagesX > 1) ? 2 : 1, scaleY = (pagesY > 1) ? 2 : 1;
+        const GLuint nextWidth = width / scaleX, nextHeight = height / scaleY;
+        vector<unsigned char> next;
+        if (level + 1 < header.numLevels)
+            next.resize((size_t)nextWidth * nextHeight * 4);
+
+        // a row of the level: the equirectangular image wraps horizontally, and it is clamped vertically
+        auto readRow = [&](GLint y, unsigned char* row)
+        {
+            y = min(max(y, 0), (GLint)height - 1);
+            if (level > 0)
+            {
+                memcpy(row, &image[(size_t)y * width * 4], (size_t)width * 4);
+                return;
+            }
+            // bilinear resampling of the source image
+            GLfloat sy = min(max((y + 0.5f) * sourceHeight / height - 0.5f, 0.0f), (GLfloat)(sourceHeight - 1));
+            GLint y0 = (GLint)sy, y1 = min(y0 + 1, sourceHeight - 1);
+            GLfloat fy = sy - y0;
+            for (GLuint x = 0; x < width; x++)
+            {
+                GLfloat sx = (x + 0.5f) * sourceWidth / width - 0.5f;
+                GLint x0 = (GLint)floor(sx);
+                GLfloat fx = sx - x0;
+                GLint x1 = (x0 + 1) % sourceWidth;
+                x0 = (x0 + sourceWidth) % sourceWidth;
+                const unsigned char* p00 = pixels + 4 * ((size_t)y0 * sourceWidth + x0);
+                const unsigned char* p01 = pixels + 4 * ((size_t)y0 * sourceWidth + x1);
+                const unsigned char* p10 = pixels + 4 * ((size_t)y1 * sourceWidth + x0);
+                const unsigned char* p11 = pixels + 4 * ((size_t)y1 * sourceWidth + x1);
+                for (int c = 0; c < 4; c++)
+                {
+                    GLfloat value = (p00[c] * (1.0f - fx) + p01[c] * fx) * (1.0f - fy) + (p10[c] * (1.0f - fx) + p11[c] * fx) * fy;
+                    row[4 * x + c] = (unsigned char)(value + 0.5f);
+                }
+            }
+        };
+
+        strip.resize((size_t)width * VT_PAGE_SIZE * 4);
+        pages.resize((size_t)pagesX * header.pageBytes);
+        for (GLuint py = 0; py < pagesY; py++)
+        {
+            // the rows of a row of pages, borders included
+            parallelFor(VT_PAGE_SIZE, [&](GLuint first, GLuint last)
+            {
+                for (GLuint r = first; r < last; r++)
+                    readRow((GLint)(py * content + r) - (GLint)VT_PAGE_BORDER, &strip[(size_t)r * width * 4]);
+            });
+
+            // we encode the pages of the row
+            parallelFor(pagesX, [&](GLuint first, GLuint last)
+            {
+                const GLuint blocks = VT_PAGE_SIZE / 4, blockSize = BakeFormatBlockSize(format);
+                for (GLuint px = first; px < last; px++)
+                    for (GLuint by = 0; by < blocks; by++)
+                        for (GLuint bx = 0; bx < blocks; bx++)
+                        {
+                            float block[4][16];
+                            for (GLuint y = 0; y < 4; y++)
+                                for (GLuint x = 0; x < 4; x++)
+                                {
+                                    GLint column = (GLint)(px * content + bx * 4 + x) - (GLint)VT_PAGE_BORDER;
+                                    column = (column + (GLint)width) % (GLint)width;
+                                    const unsigned char* p = &strip[4 * ((size_t)(by * 4 + y) * width + column)];
+                                    for (int c = 0; c < 4; c++)
+                                        block[c][y * 4 + x] = (float)p[c];
+                                }
+                            EncodeBlock(block, &pages[(size_t)px * header.pageBytes + ((size_t)by * blocks + bx) * blockSize], format);
+                        }
+            });
+            out.write((const char*)pages.data(), pages.size());
+
+            // the rows of the next level covered by the row of pages (2x2, 2x1 or 1x2 box filter)
+            if (!next.empty())
+                parallelFor(content / scaleY, [&](GLuint first, GLuint last)
+                {
+                    for (GLuint r = first; r < last; r++)
+                        for (GLuint x = 0; x < nextWidth; x++)
+                            for (int c = 0; c < 4; c++)
+                            {
+                                GLuint sum = 0;
+                                for (GLuint dy = 0; dy < scaleY; dy++)
+                                    for (GLuint dx = 0; dx < scaleX; dx++)
+                                        sum += strip[4 * ((size_t)(VT_PAGE_BORDER + r * scaleY + dy) * width + x * scaleX + dx) + c];
+                                const GLuint count = scaleX * scaleY;
+                                next[4 * ((size_t)(py * content / scaleY + r) * nextWidth + x) + c] = (unsigned char)((sum + count / 2) / count);
+                            }
+                });
+        }
+        image = std::move(next);
+        width = nextWidth;
+        height = nextHeight;
+    }
+    stbi_image_free(pixels);
+    return (bool)out;
+}
+
+/////////////////// VIRTUALTEXTURESYSTEM class ///////////////////////
+class VirtualTextureSystem
+{
+public:
+
+    // We want VirtualTextureSystem to be neither copied nor moved
+    VirtualTextureSystem(const VirtualTextureSystem& copy) = delete;
+    VirtualTextureSystem& operator=(const VirtualTextureSystem&) = delete;
+
+    //////////////////////////////////////////
+
+    // constructor: format of the pages (all the virtual textures must use it), size of the cache (in pages along each side),
+    // ratio between the size of the viewport and of the feedback framebuffer, maximum number of pages uploaded per frame,
+    // and maximum number of pages loaded at the same time by the worker threads.
+    // It must be called by the main thread. If the format is not supported, no virtual texture can be added
+    VirtualTextureSystem(BakeFormat format, GLuint cachePages = 32, GLuint feedbackScale = 8, GLuint uploadsPerFrame = 32, GLuint maxLoads = 64)
+        : format(BakeFormatGL(format)), cachePages(min(cachePages, 256u)), feedbackScale(max(feedbackScale, 1u)),
+          uploadsPerFrame(uploadsPerFrame), maxLoads(maxLoads)
+    {
+        vector<GLenum> supported = QueryCompressedFormats();
+        if (find(supported.begin(), supported.end(), this->format) == supported.end())
+        {
+            LOG_ERROR("VIRTUAL_TEXTURE", "format of the pages not supported, virtual texturing disabled");
+            return;
+        }
+
+        // the page cache: the content of the slots is undefined until a page is uploaded
+        const GLuint size = this->cachePages * VT_PAGE_SIZE;
+        this->cacheBytes = (size_t)(size / 4) * (size / 4) * BakeFormatBlockSize(format);
+        glGenTextures(1, &this->cacheTexture);
+        glBindTexture(GL_TEXTURE_2D, this->cacheTexture);
+        glCompressedTexImage2D(GL_TEXTURE_2D, 0, this->format, size, size, 0, (GLsizei)this->cacheBytes, nullptr);
+        ResourceRegistry::Instance().Register(RESOURCE_TEXTURE, this->cacheTexture, this->cacheBytes, this->format, "VirtualTextureSystem page cache");
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        this->slots.resize((size_t)this->cachePages * this->cachePages);
+        for (GLint slot = (GLint)this->slots.size() - 1; slot >= 0; slot--)
+            this->freeSlots.push_back((GLuint)slot);
+    }
+
+    ~VirtualTextureSystem()
+    {
+        this->waitLoading();
+    }
+
+    //////////////////////////////////////////
+
+    // we add the virtual texture of a source image (it must have been baked with BakeVirtualTexture).
+    // It returns the id of the virtual texture, or -1 if it is not available
+    GLint Add(const string& source)
+    {
+        if (!this->cacheTexture || this->textures.size() >= 255)
+            return -1;
+        unique_ptr<VirtualTexture> texture = make_unique<VirtualTexture>();
+        texture->path = VirtualTexturePath(source);
+        // the virtual texture has not been baked
+        if (!texture->file.Open(texture->path))
+            return -1;
+
+        VirtualTextureHeader& header = texture->header;
+        if (texture->file.Size() >= sizeof(header))
+            memcpy(&header, texture->file.Data(), sizeof(header));
+        size_t numPages = 0;
+        bool valid = texture->file.Size() >= sizeof(header) && memcmp(header.magic, VT_MAGIC, sizeof(VT_MAGIC)) == 0 && header.version == VT_VERSION &&
+                     header.pageSize == VT_PAGE_SIZE && header.border == VT_PAGE_BORDER && header.numLevels > 0 && header.numLevels <= 24;
+        if (valid)
+            for (GLuint level = 0; level < header.numLevels; level++)
+            {
+                texture->firstPage.push_back(numPages);
+                numPages += (size_t)max(header.pagesX >> level, 1u) * max(header.pagesY >> level, 1u);
+            }
+        if (!valid || texture->file.Size() != sizeof(header) + numPages * header.pageBytes)
+        {
+            LOG_ERROR("VIRTUAL_TEXTURE", "invalid file " << texture->path);
+            return -1;
+        }
+        if (header.internalFormat != this->format)
+        {
+            LOG_ERROR("VIRTUAL_TEXTURE", "the format of " << texture->path << " is different from the format of the cache");
+            return -1;
+        }
+        // if the source image is available, we check that it has not been modified
+        vector<int64_t> sourceInfo;
+        if (GetBakeSourcesInfo({ source }, sourceInfo) && (sourceInfo[0] != header.sourceSize || sourceInfo[1] != header.sourceTime))
+        {
+            LOG_ERROR("VIRTUAL_TEXTURE", texture->path << " is older than its source image, it must be baked again");
+            return -1;
+        }
+
+        // the page table: all the pages are not resident (alpha = 0)
+        glGenTextures(1, &texture->pageTable);
+        glBindTexture(GL_TEXTURE_2D, texture->pageTable);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        vector<unsigned char> entries((size_t)header.pagesX * header.pagesY * 4, 0);
+        for (GLuint level = 0; level < header.numLevels; level++)
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8UI, max(header.pagesX >> level, 1u), max(header.pagesY >> level, 1u), 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entries.data());
+        // integer textures cannot be filtered (with linear filtering the texture would be incomplete)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.numLevels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        this->pageTableBytes += numPages * 4;
+        ResourceRegistry::Instance().Register(RESOURCE_TEXTURE, texture->pageTable, numPages * 4, GL_RGBA8UI, texture->path + " (page table)");
+
+        const GLuint id = (GLuint)this->textures.size();
+        this->textures.push_back(std::move(texture));
+        // the page of the coarsest level is always resident: until it is uploaded, the virtual texture cannot be used
+        this->startLoad(pageKey(id, this->textures[id]->header.numLevels - 1, 0, 0));
+        return (GLint)id;
+    }
+
+    //////////////////////////////////////////
+
+    // the virtual texture can be used (the page of its coarsest level is resident)
+    GLboolean Ready(GLint id) const
+    {
+        return id >= 0 && id < (GLint)this->textures.size() && this->textures[id]->ready;
+    }
+
+    //////////////////////////////////////////
+
+    // at least one of the virtual textures can be used (e.g., to select the Shader Program variant with virtual texturing)
+    GLboolean AnyReady() const
+    {
+        for (const auto& texture : this->textures)
+            if (texture->ready)
+                return GL_TRUE;
+        return GL_FALSE;
+    }
+
+    //////////////////////////////////////////
+
+    // we assign the texture units of the page table and of the cache in a Shader Program using virtual textures.
+    // It must be called once, before the draw calls (two samplers of different types cannot use the same texture unit)
+    void SetupProgram(GLuint program) const
+    {
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "vtPageTable"), VT_PAGE_TABLE_UNIT);
+        glUniform1i(glGetUniformLocation(program, "vtPageCache"), VT_PAGE_CACHE_UNIT);
+        glUniform1i(glGetUniformLocation(program, "virtualTexturing"), GL_FALSE);
+    }
+
+    //////////////////////////////////////////
+
+    // we bind the page table and the cache, and we set the uniforms of a virtual texture in the current Shader Program.
+    // If the virtual texture is not ready (or id is -1), the "virtualTexturing" uniform is set to false. It returns the value of the uniform
+    GLboolean Bind(GLint id, GLuint program) const
+    {
+        const GLboolean active = this->Ready(id);
+        glUniform1i(glGetUniformLocation(program, "virtualTexturing"), active);
+        if (!active)
+            return GL_FALSE;
+        const VirtualTexture& texture = *this->textures[id];
+        glActiveTexture(GL_TEXTURE0 + VT_PAGE_TABLE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, texture.pageTable);
+        glActiveTexture(GL_TEXTURE0 + VT_PAGE_CACHE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, this->cacheTexture);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform3i(glGetUniformLocation(program, "vtPages"), texture.header.pagesX, texture.header.pagesY, texture.header.numLevels);
+        glUniform3f(glGetUniformLocation(program, "vtPageLayout"), (GLfloat)VT_PAGE_SIZE, (GLfloat)VT_PAGE_BORDER, (GLfloat)this->cachePages);
+        glUniform1ui(glGetUniformLocation(program, "vtId"), (GLuint)id);
+        return GL_TRUE;
+    }
+
+    // the next draw calls use the usual texture
+    void Unbind(GLuint program) const
+    {
+        glUniform1i(glGetUniformLocation(program, "virtualTexturing"), GL_FALSE);
+    }
+
+    //////////////////////////////////////////
+
+    // size of the feedback framebuffer for a viewport (feedbackScale times smaller, see N.B. 7)
+    void FeedbackSize(GLuint viewportWidth, GLuint viewportHeight, GLuint& width, GLuint& height) const
+    {
+        width = max((viewportWidth + this->feedbackScale - 1) / this->feedbackScale, 1u);
+        height = max((viewportHeight + this->feedbackScale - 1) / this->feedbackScale, 1u);
+    }
+
+    // we start the feedback pass: the feedback framebuffer is bound and cleared by the application (see N.B. 7), and the Shader Program
+    // of the feedback is activated. Then, the application draws the objects using virtual textures (after calling Bind for each of them),
+    // and it calls ReadBackFeedback
+    void BeginFeedback(GLuint program)
+    {
+        glUseProgram(program);
+        // the derivatives of the texture coordinates are feedbackScale times larger than in the viewport
+        glUniform1f(glGetUniformLocation(program, "lodBias"), -log2((GLfloat)this->feedbackScale));
+    }
+
+    //////////////////////////////////////////
+
+    // we start the read back of the feedback: the color attachment 0 of the bound framebuffer (of the given size) is copied in a Pixel Buffer Object
+    void ReadBackFeedback(GLuint width, GLuint height)
+    {
+        if (width != this->feedbackWidth || height != this->feedbackHeight)
+            this->createFeedbackBuffers(width, height);
+        FeedbackBuffer& buffer = this->feedback[this->feedbackWrite];
+        // if the GPU has not completed the oldest read back yet, we skip the feedback of this frame
+        if (!buffer.fence)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.pbo);
+            glReadPixels(0, 0, this->feedbackWidth, this->feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            this->feedbackWrite = (this->feedbackWrite + 1) % VT_FEEDBACK_BUFFERS;
+        }
+    }
+
+    //////////////////////////////////////////
+
+    // called by the main thread at each frame: we read the completed feedbacks, we start the loading of the pages requested,
+    // and we upload the loaded pages in the cache
+    void Update()
+    {
+        // the read backs completed by the GPU, from the oldest
+        for (GLuint i = 0; i < VT_FEEDBACK_BUFFERS; i++)
+        {
+            FeedbackBuffer& buffer = this->feedback[(this->feedbackWrite + i) % VT_FEEDBACK_BUFFERS];
+            if (!buffer.fence)
+                continue;
+            GLenum status = glClientWaitSync(buffer.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                continue;
+            glDeleteSync(buffer.fence);
+            buffer.fence = nullptr;
+            const size_t count = (size_t)this->feedbackWidth * this->feedbackHeight;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.pbo);
+            const uint16_t* pixels = (const uint16_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, count * 4 * sizeof(uint16_t), GL_MAP_READ_BIT);
+            if (pixels)
+            {
+                this->processFeedback(pixels, count);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
+        // we start the loading of the requested pages (the coarsest first)
+        size_t started = 0;
+        while (started < this->requests.size() && this->loads.size() < this->maxLoads)
+            this->startLoad(this->requests[started++]);
+        this->requests.erase(this->requests.begin(), this->requests.begin() + started);
+
+        // we upload the loaded pages
+        GLuint uploaded = 0;
+        for (auto load = this->loads.begin(); load != this->loads.end() && uploaded < this->uploadsPerFrame;)
+        {
+            if (load->data.wait_for(chrono::seconds(0)) != future_status::ready)
+            {
+                ++load;
+                continue;
+            }
+            const uint64_t key = load->key;
+            vector<unsigned char> data = load->data.get();
+            load = this->loads.erase(load);
+            this->loading.erase(key);
+            if (this->uploadPage(key, data))
+                uploaded++;
+        }
+    }
+
+    //////////////////////////////////////////
+
+    // we print on console the state of the cache, and of each virtual texture
+    void PrintStats() const
+    {
+        const GLuint size = this->cachePages * VT_PAGE_SIZE;
+        std::cout << "Virtual texturing (cache " << size << "x" << size << ", " << this->cacheBytes / 1024 << " KB, page tables "
+                  << this->pageTableBytes / 1024 << " KB): " << this->resident.size() << "/" << this->slots.size() << " pages resident, "
+                  << this->visiblePages << " visible, " << this->numUploads << " uploaded, " << this->numEvictions << " evicted, "
+                  << this->numDropped << " dropped (cache full)" << std::endl;
+        for (size_t id = 0; id < this->textures.size(); id++)
+        {
+            const VirtualTexture& texture = *this->textures[id];
+            size_t pages = 0;
+            for (const pair<const uint64_t, GLuint>& page : this->resident)
+                pages += (pageTexture(page.first) == id) ? 1 : 0;
+            const GLuint content = VT_PAGE_SIZE - 2 * VT_PAGE_BORDER;
+            std::cout << "  " << texture.path << ": " << texture.header.pagesX * content << "x" << texture.header.pagesY * content << " ("
+                      << texture.header.numLevels << " levels), " << texture.file.Size() / 1024 << " KB on disk, " << pages << " pages resident" << std::endl;
+        }
+    }
+
+    //////////////////////////////////////////
+
+    // we wait for the loading jobs, and we delete the OpenGL objects (the OpenGL context must still be current)
+    void Shutdown()
+    {
+        this->waitLoading();
+        this->loads.clear();
+        this->loading.clear();
+        this->requests.clear();
+        for (unique_ptr<VirtualTexture>& texture : this->textures)
+        {
+            ResourceRegistry::Instance().Release(RESOURCE_TEXTURE, texture->pageTable);
+            glDeleteTextures(1, &texture->pageTable);
+        }
+        this->textures.clear();
+        this->resident.clear();
+        this->deleteFeedbackBuffers();
+        if (this->cacheTexture)
+        {
+            ResourceRegistry::Instance().Release(RESOURCE_TEXTURE, this->cacheTexture);
+            glDeleteTextures(1, &this->cacheTexture);
+        }
+        this->cacheTexture = 0;
+    }
+
+private:
+
+    // a virtual texture
+    struct VirtualTexture
+    {
+        string path;
+        MappedFile file;
+        VirtualTextureHeader header;
+        // index of the first page of each level in the file
+        vector<size_t> firstPage;
+        GLuint pageTable = 0;
+        // the page of the coarsest level is resident
+        GLboolean ready = GL_FALSE;
+    };
+
+    // a slot of the cache
+    struct CacheSlot
+    {
+        uint64_t key = 0;
+        // last feedback where the page was visible
+        uint64_t lastUsed = 0;
+        // the pages of the coarsest levels are never replaced
+        GLboolean pinned = GL_FALSE;
+    };
+
+    // a page loaded by a worker thread
+    struct PageLoad
+    {
+        uint64_t key;
+        future<vector<unsigned char>> data;
+    };
+
+    // a Pixel Buffer Object for the read back of the feedback, with the fence signaled when the read back is complete
+    struct FeedbackBuffer
+    {
+        GLuint pbo = 0;
+        GLsync fence = nullptr;
+    };
+
+    GLenum format;
+    GLuint cachePages;
+    GLuint feedbackScale;
+    GLuint uploadsPerFrame;
+    GLuint maxLoads;
+
+    vector<unique_ptr<VirtualTexture>> textures;
+
+    GLuint cacheTexture = 0;
+    size_t cacheBytes = 0;
+    size_t pageTableBytes = 0;
+    vector<CacheSlot> slots;
+    vector<GLuint> freeSlots;
+    // resident pages (key -> slot), pages being loaded, and pages requested by the last feedback and not loaded yet
+    unordered_map<uint64_t, GLuint> resident;
+    unordered_set<uint64_t> loading;
+    vector<PageLoad> loads;
+    vector<uint64_t> requests;
+
+    // size of the feedback framebuffer, and Pixel Buffer Objects for the read back
+    GLuint feedbackWidth = 0, feedbackHeight = 0;
+    FeedbackBuffer feedback[VT_FEEDBACK_BUFFERS];
+    GLuint feedbackWrite = 0;
+    // number of feedbacks processed (the pages visible in the last one are not replaced)
+    uint64_t generation = 0;
+
+    // statistics
+    size_t visiblePages = 0;
+    size_t numUploads = 0, numEvictions = 0, numDropped = 0;
+
+    //////////////////////////////////////////
+    // a page is identified by texture (8 bits), level (8 bits), and coordinates (24 bits each)
+    static uint64_t pageKey(GLuint id, GLuint level, GLuint x, GLuint y)
+    {
+        return ((uint64_t)id << 56) | ((uint64_t)level << 48) | ((uint64_t)y << 24) | x;
+    }
+    static GLuint pageTexture(uint64_t key) { return (GLuint)(key >> 56); }
+    static GLuint pageLevel(uint64_t key) { return (GLuint)(key >> 48) & 0xFF; }
+    static GLuint pageY(uint64_t key) { return (GLuint)(key >> 24) & 0xFFFFFF; }
+    static GLuint pageX(uint64_t key) { return (GLuint)key & 0xFFFFFF; }
+
+    //////////////////////////////////////////
+    // we collect the pages of the feedback (with their ancestors): the resident ones are marked as used, the others are requested
+    void processFeedback(const uint16_t* pixels, size_t count)
+    {
+        this->generation++;
+        unordered_set<uint64_t> visible;
+        for (size_t i = 0; i < count; i++)
+        {
+            const uint16_t* pixel = pixels + 4 * i;
+            // alpha = 0: no object with virtual texture in the pixel
+            if (pixel[3] == 0 || pixel[3] > this->textures.size())
+                continue;
+            const GLuint id = pixel[3] - 1u;
+            const VirtualTextureHeader& header = this->textures[id]->header;
+            GLuint x = pixel[0], y = pixel[1];
+            // the ancestors are used until the page is resident, and for the blending between levels.
+            // If a page is already in the set, also its ancestors are
+            for (GLuint level = min((GLuint)pixel[2], header.numLevels - 1); level < header.numLevels; level++, x >>= 1, y >>= 1)
+                if (!visible.insert(pageKey(id, level, x, y)).second)
+                    break;
+        }
+
+        this->visiblePages = visible.size();
+        this->requests.clear();
+        for (uint64_t key : visible)
+        {
+            auto page = this->resident.find(key);
+            if (page != this->resident.end())
+                this->slots[page->second].lastUsed = this->generation;
+            else if (this->loading.find(key) == this->loading.end())
+                this->requests.push_back(key);
+        }
+        // the coarsest pages first: they replace the largest areas of missing pages
+        sort(this->requests.begin(), this->requests.end(), [](uint64_t a, uint64_t b) { return pageLevel(a) > pageLevel(b); });
+    }
+
+    //////////////////////////////////////////
+    // a worker thread copies the page from the mapped file: the reading from disk happens in the worker thread
+    void startLoad(uint64_t key)
+    {
+        if (this->resident.count(key) || !this->loading.insert(key).second)
+            return;
+        const VirtualTexture* texture = this->textures[pageTexture(key)].get();
+        const GLuint level = pageLevel(key);
+        const size_t index = texture->firstPage[level] + (size_t)pageY(key) * max(texture->header.pagesX >> level, 1u) + pageX(key);
+        const size_t offset = sizeof(VirtualTextureHeader) + index * texture->header.pageBytes;
+        this->loads.push_back({ key, ThreadPool::Instance().Submit([texture, offset]
+        {
+            const unsigned char* page = texture->file.Data() + offset;
+            return vector<unsigned char>(page, page + texture->header.pageBytes);
+        }) });
+    }
+
+    //////////////////////////////////////////
+    // we upload a page in a free slot of the cache (or in the slot of the LRU page not visible), and we update the page table.
+    // It returns false if all the slots are used by visible pages
+    bool uploadPage(uint64_t key, const vector<unsigned char>& data)
+    {
+        GLint slot = -1;
+        if (!this->freeSlots.empty())
+        {
+            slot = (GLint)this->freeSlots.back();
+            this->freeSlots.pop_back();
+        }
+        else
+        {
+            for (GLuint i = 0; i < this->slots.size(); i++)
+                if (!this->slots[i].pinned && this->slots[i].lastUsed < this->generation && (slot < 0 || this->slots[i].lastUsed < this->slots[slot].lastUsed))
+                    slot = (GLint)i;
+            if (slot < 0)
+            {
+                this->numDropped++;
+                return false;
+            }
+            // the replaced page is not resident anymore
+            this->setPageTableEntry(this->slots[slot].key, 0, 0, 0);
+            this->resident.erase(this->slots[slot].key);
+            this->numEvictions++;
+        }
+
+        VirtualTexture& texture = *this->textures[pageTexture(key)];
+        CacheSlot& cacheSlot = this->slots[slot];
+        cacheSlot.key = key;
+        cacheSlot.lastUsed = this->generation;
+        cacheSlot.pinned = pageLevel(key) == texture.header.numLevels - 1;
+
+        const GLuint x = (GLuint)slot % this->cachePages, y = (GLuint)slot / this->cachePages;
+        glBindTexture(GL_TEXTURE_2D, this->cacheTexture);
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x * VT_PAGE_SIZE, y * VT_PAGE_SIZE, VT_PAGE_SIZE, VT_PAGE_SIZE, this->format, (GLsizei)data.size(), data.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        this->setPageTableEntry(key, x, y, 255);
+        this->resident[key] = (GLuint)slot;
+        if (cacheSlot.pinned)
+            texture.ready = GL_TRUE;
+        this->numUploads++;
+        return true;
+    }
+
+    //////////////////////////////////////////
+    // we write the entry of a page in the page table: coordinates of the slot in the cache, and alpha = 255 if the page is resident
+    void setPageTableEntry(uint64_t key, GLuint slotX, GLuint slotY, GLuint alpha)
+    {
+        const unsigned char entry[4] = { (unsigned char)slotX, (unsigned char)slotY, 0, (unsigned char)alpha };
+        glBindTexture(GL_TEXTURE_2D, this->textures[pageTexture(key)]->pageTable);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, pageLevel(key), pageX(key), pageY(key), 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entry);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    //////////////////////////////////////////
+    // we (re)create the Pixel Buffer Objects for the read back of a feedback framebuffer of the given size
+    void createFeedbackBuffers(GLuint width, GLuint height)
+    {
+        this->deleteFeedbackBuffers();
+        this->feedbackWidth = width;
+        this->feedbackHeight = height;
+
+        for (FeedbackBuffer& buffer : this->feedback)
+        {
+            glGenBuffers(1, &buffer.pbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4 * sizeof(uint16_t), nullptr, GL_STREAM_READ);
+            ResourceRegistry::Instance().Register(RESOURCE_BUFFER, buffer.pbo, (size_t)width * height * 4 * sizeof(uint16_t), GL_PIXEL_PACK_BUFFER,
+                                                  "VirtualTextureSystem feedback");
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        this->feedbackWrite = 0;
+    }
+
+    //////////////////////////////////////////
+    // the pending read backs are discarded
+    void deleteFeedbackBuffers()
+    {
+        for (FeedbackBuffer& buffer : this->feedback)
+        {
+            if (buffer.fence)
+                glDeleteSync(buffer.fence);
+            if (buffer.pbo)
+            {
+                ResourceRegistry::Instance().Release(RESOURCE_BUFFER, buffer.pbo);
+                glDeleteBuffers(1, &buffer.pbo);
+            }
+            buffer = FeedbackBuffer();
+        }
+        this->feedbackWidth = this->feedbackHeight = 0;
+    }
+
+    //////////////////////////////////////////
+    // we wait for the loading jobs still running (they access the mapped files)
+    void waitLoading()
+    {
+        for (PageLoad& load : this->loads)
+            if (load.data.valid())
+                load.data.wait();
+    }
+};
@@ -0,0 +1,118 @@
+/*
+Stress test of the queue of the frame packets (see frame_queue.h)
+- a producer thread sends many packets to a consumer thread, like the main thread and the render thread of the application,
+  and the consumer checks that it receives all the packets, in order, with their contents (also the vector of the lights,
+  exchanged with the slots)
+- in the first half of the test the consumer is slower (the queue is often full), in the second half the producer is slower
+  (the queue is often empty), so both threads wait on the index of the other thread
+- like the main loop of the application, the producer overwrites the old packets received from the queue: after the first packets,
+  their vectors are large enough, and they are not allocated again
+
+N.B.) the test does not use OpenGL, so it can be run with ThreadSanitizer ("make tsan", see Makefile and N.B. 4 in frame_queue.h)
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <cstdint>
+
+#include <utils/frame_queue.h>
+#include <utils/logger.h>
+
+// number of packets sent by the producer
+const uint64_t NUM_PACKETS = 200000;
+// number of slots of the queue (the same of the application)
+const size_t FRAME_QUEUE_SIZE = 2;
+
+// a light of the packet (the application sends the point lights, see clustered_lights.h)
+struct TestLight
+{
+    float position[3];
+};
+
+// a packet with the same structure of the FramePacket of the application: some plain values, and a vector reused by the producer
+struct TestPacket
+{
+    bool quit = false;
+    uint64_t index = 0;
+    vector<TestLight> lights;
+};
+
+// the contents of a packet depend only on its index
+size_t LightsCount(uint64_t index)
+{
+    return (size_t)(index % 7);
+}
+
+bool SameLight(const TestLight& light, uint64_t index, size_t number)
+{
+    return light.position[0] == (float)(index % 1000) && light.position[1] == (float)number && light.position[2] == 1.0f;
+}
+
+/////////////////// MAIN function ///////////////////////
+int main()
+{
+    FrameQueue<TestPacket, FRAME_QUEUE_SIZE> queue;
+    uint64_t received = 0, errors = 0;
+    double consumerWait = 0.0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    thread consumer([&]()
+    {
+        TestPacket packet;
+        while (true)
+        {
+            consumerWait += queue.Pop(packet);
+            if (packet.quit)
+                break;
+            bool valid = (packet.index == received) && (packet.lights.size() == LightsCount(received));
+            for (size_t i = 0; valid && i < packet.lights.size(); i++)
+                valid = SameLight(packet.lights[i], received, i);
+            if (!valid)
+                errors++;
+            received++;
+            if (received < NUM_PACKETS / 2 && received % 64 == 0)
+                this_thread::yield();
+        }
+    });
+
+    double producerWait = 0.0;
+    TestPacket packet;
+    uint64_t allocations = 0;
+    for (uint64_t i = 0; i < NUM_PACKETS; i++)
+    {
+        packet.index = i;
+        if (i >= 1000 && packet.lights.capacity() < LightsCount(i))
+            allocations++;
+        packet.lights.resize(LightsCount(i));
+        for (size_t l = 0; l < packet.lights.size(); l++)
+            packet.lights[l] = { { (float)(i % 1000), (float)l, 1.0f } };
+        if (i >= NUM_PACKETS / 2 && i % 64 == 0)
+            this_thread::yield();
+        producerWait += queue.Push(packet);
+    }
+    // the queue has no "close" operation: the last packet tells the consumer to exit (see N.B. 2 in frame_queue.h)
+    TestPacket last;
+    last.quit = true;
+    queue.Push(last);
+    consumer.join();
+    double milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    std::cout << NUM_PACKETS << " packets in " << milliseconds << " ms, waited " << producerWait << " ms (producer) and "
+              << consumerWait << " ms (consumer)" << std::endl;
+    int result = 0;
+    if (received != NUM_PACKETS || errors > 0 || queue.Size() != 0 || allocations > 0)
+    {
+        LOG_ERROR("FRAME_QUEUE", "received " << received << " packets of " << NUM_PACKETS << ", " << errors << " wrong, "
+                  << allocations << " packets allocated again");
+        result = -1;
+    }
+    LOG_INFO("FRAME_QUEUE", (result == 0 ? "test passed" : "test failed"));
+    return result;
+}
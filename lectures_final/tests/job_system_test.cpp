@@ -0,0 +1,139 @@
+/*
+Stress test of the job system (see job_system.h)
+- the job system is used from two threads at the same time (like the main thread and the render thread of the application), with:
+  - many small jobs started by the calling thread, executed by the workers stealing them, and jobs waiting for their own sub-jobs
+  - chains of stages started with RunAfter: each stage updates the values written by the previous one, without atomics, so the
+    dependency counters must order the accesses (some stages are added when their dependency is already completed)
+  - nested ParallelFor, checking that each index is visited exactly once
+
+N.B.) the data of the jobs are plain values, and the test does not use OpenGL: it is meant to be run also with ThreadSanitizer
+("make tsan", see Makefile and N.B. 5 in job_system.h)
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <iostream>
+#include <cstdint>
+
+#include <utils/job_system.h>
+#include <utils/logger.h>
+
+// number of workers of the job system, and rounds of each thread
+const unsigned int NUM_WORKERS = 4;
+const int NUM_ROUNDS = 20;
+// small jobs, and sub-jobs of each job
+const size_t NUM_JOBS = 2000;
+const size_t NUM_SUBJOBS = 8;
+// stages of the chains, and values updated by each stage
+const size_t NUM_STAGES = 16;
+const size_t NUM_VALUES = 4096;
+// iterations of the outer and of the inner parallel loops
+const size_t NUM_ROWS = 64;
+const size_t NUM_COLUMNS = 1000;
+
+/////////////////// MAIN function ///////////////////////
+int main()
+{
+    // a system with more workers than the hardware threads, so the threads are also preempted while they own or steal jobs
+    JobSystem jobs(NUM_WORKERS);
+    atomic<uint64_t> errors{ 0 };
+    atomic<uint64_t> stolen{ 0 };
+    auto check = [&errors](bool condition) { if (!condition) errors.fetch_add(1, memory_order_relaxed); };
+
+    auto stress = [&]()
+    {
+        const thread::id caller = this_thread::get_id();
+        for (int round = 0; round < NUM_ROUNDS; round++)
+        {
+            // small jobs, each one with sub-jobs: the sub-jobs are in the queue of the thread executing the job, and they are waited there
+            vector<uint32_t> executed(NUM_JOBS * NUM_SUBJOBS, 0);
+            JobCounter counter;
+            for (size_t i = 0; i < NUM_JOBS; i++)
+                jobs.Run(counter, [&, i]()
+                {
+                    if (this_thread::get_id() != caller)
+                        stolen.fetch_add(1, memory_order_relaxed);
+                    JobCounter subjobs;
+                    for (size_t j = 0; j < NUM_SUBJOBS; j++)
+                        jobs.Run(subjobs, [&executed, i, j]() { executed[i * NUM_SUBJOBS + j]++; });
+                    jobs.Wait(subjobs);
+                });
+            jobs.Wait(counter);
+            check(all_of(executed.begin(), executed.end(), [](uint32_t count) { return count == 1; }));
+
+            // a chain of stages: the jobs of a stage start when all the jobs of the previous stage are completed. Each stage reads the
+            // values written by the previous stage in a buffer (also the values written by the other jobs), and it writes the other buffer
+            vector<uint32_t> values[2] = { vector<uint32_t>(NUM_VALUES, 0), vector<uint32_t>(NUM_VALUES, 0) };
+            vector<unique_ptr<JobCounter>> stages;
+            const size_t parts = 8, size = NUM_VALUES / parts;
+            for (size_t stage = 0; stage < NUM_STAGES; stage++)
+            {
+                stages.push_back(make_unique<JobCounter>());
+                for (size_t part = 0; part < parts; part++)
+                {
+                    auto body = [&values, &check, stage, part, size]()
+                    {
+                        const vector<uint32_t>& source = values[stage % 2];
+                        vector<uint32_t>& destination = values[(stage + 1) % 2];
+                        for (size_t v = part * size; v < (part + 1) * size; v++)
+                        {
+                            check(source[v] == stage && source[(v + size) % NUM_VALUES] == stage);
+                            destination[v] = source[v] + 1;
+                        }
+                    };
+                    if (stage == 0)
+                        jobs.Run(*stages[stage], body);
+                    else
+                        jobs.RunAfter(*stages[stage - 1], *stages[stage], body);
+                }
+                // half of the times, the next stage is added when this stage may already be completed
+                if (round % 2 == 1)
+                    this_thread::yield();
+            }
+            jobs.Wait(*stages.back());
+            check(all_of(values[NUM_STAGES % 2].begin(), values[NUM_STAGES % 2].end(), [](uint32_t value) { return value == NUM_STAGES; }));
+            // the jobs of the last stage started after the previous stages: all the counters are completed
+            check(all_of(stages.begin(), stages.end(), [](const unique_ptr<JobCounter>& stage) { return stage->Done(); }));
+
+            // nested parallel loops: each cell is written by a single iteration
+            vector<uint32_t> cells(NUM_ROWS * NUM_COLUMNS, 0);
+            jobs.ParallelFor(NUM_ROWS, [&](size_t begin, size_t end)
+            {
+                for (size_t row = begin; row < end; row++)
+                    jobs.ParallelFor(NUM_COLUMNS, [&cells, row](size_t first, size_t last)
+                    {
+                        for (size_t column = first; column < last; column++)
+                            cells[row * NUM_COLUMNS + column]++;
+                    }, 16);
+            });
+            check(all_of(cells.begin(), cells.end(), [](uint32_t count) { return count == 1; }));
+        }
+    };
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    thread other(stress);
+    stress();
+    other.join();
+    double milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    std::cout << "2 threads x " << NUM_ROUNDS << " rounds in " << milliseconds << " ms, " << NUM_WORKERS << " workers, "
+              << stolen.load() << " of " << 2 * NUM_ROUNDS * NUM_JOBS << " jobs executed by other threads" << std::endl;
+    int result = 0;
+    if (errors.load() > 0)
+    {
+        LOG_ERROR("JOBS", errors.load() << " wrong values");
+        result = -1;
+    }
+    LOG_INFO("JOBS", (result == 0 ? "test passed" : "test failed"));
+    return result;
+}
@@ -5,12 +5,30 @@ N.B. 1)  "13_illumination_models_ML_TX.vert" must be used as vertex shader
 
 N.B. 2) In this example, we consider point lights only. For different kind of lights, the computation must be changed (for example, a directional light is defined by the direction of incident light, so the lightDir is passed as uniform and not calculated in the shader like in this case with a point light).
 
-N.B. 3)  the different illumination models are implemented using Shaders Subroutines
+N.B. 3)  the different illumination models are selected at compile time: the main application compiles a variant of the shader
+for each combination of the options (see ShaderVariants in shader.h), injecting the #define directives after the version directive:
+- LIGHTING_MODEL: 0 = Lambert, 1 = Phong, 2 = Blinn-Phong, 3 = GGX
+- VIRTUAL_TEXTURING: 1 if the code of the virtual textures is included (see N.B. 6)
+- CUBE_SPHERE: 1 if the code of the cube-sphere textures is included (see N.B. 7)
+- NR_LIGHTS: number of lights
+- CLUSTERED_LIGHTING: 1 if the point lights are read from the shader storage buffers of the clusters (see N.B. 8)
+so there are no subroutines and no branches on the options at runtime. Without the directives, the default values are used
 
-N.B. 4)  only Blinn-Phong and GGX illumination models are considered in this shader
+N.B. 4)  the Lambert, Phong, Blinn-Phong and GGX illumination models are considered in this shader
 
 N.B. 5) see note 2 in the vertex shader for considerations on multiple lights management
 
+N.B. 6) if virtualTexturing is true, the surface color is sampled from a virtual texture (see virtual_texture.h in the main application),
+instead of the "tex" texture
+
+N.B. 7) if cubeSphere is true, the surface color is sampled from a cube-sphere texture (see cube_reprojection.h in the main application),
+using the direction of the fragment in object space instead of the UV coordinates. The virtual texture has the priority
+
+N.B. 8) besides the NR_LIGHTS lights (the sun), the scene has many point lights with a limited radius: they are shaded by cluster
+(see clustered_lights.h in the main application). Each fragment finds its cluster (the tile of the window, and the slice of its depth),
+and it shades only the lights in the list of the cluster, read from shader storage buffers. The buffers are core in GLSL 4.30, so they
+are enabled with an extension. Without them (CLUSTERED_LIGHTING 0), the nearest point lights are passed as uniform arrays
+
 author: Davide Gadia
 
 Real-Time Graphics Programming - a.a. 2023/2024
@@ -21,8 +39,20 @@ Universita' degli Studi di Milano
 
 #version 410 core
 
-// number of lights in the scene
-#define NR_LIGHTS 1
+// default values of the options (see N.B. 3)
+#include "lights.glsl"
+#ifndef LIGHTING_MODEL
+#define LIGHTING_MODEL 2
+#endif
+#ifndef VIRTUAL_TEXTURING
+#define VIRTUAL_TEXTURING 1
+#endif
+#ifndef CUBE_SPHERE
+#define CUBE_SPHERE 1
+#endif
+#if CLUSTERED_LIGHTING
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
 
 const float PI = 3.14159265359;
 
@@ -39,6 +69,8 @@ in vec3 vViewPosition;
 
 // interpolated texture coordinates
 in vec2 interp_UV;
+// interpolated position in object space (on the unit sphere, for the planets)
+in vec3 interp_Direction;
 
 // texture repetitions
 uniform float repeat;
@@ -58,61 +90,219 @@ uniform float Ks;
 // shininess coefficients (passed from the application)
 uniform float shininess;
 
+// roughness and Fresnel reflectance at 0 degrees of the GGX model (passed from the application)
+uniform float alpha;
+uniform float F0;
+
+// transition between two Levels of Detail (see lod_dither.glsl)
+uniform float lodFade;
+#include "lod_dither.glsl"
+
+
+#if VIRTUAL_TEXTURING
+// virtual texturing (see virtual_texture.h in the main application)
+uniform bool virtualTexturing;
+// page table: for each page of each level (mipmap level of the page table), coordinates of the page in the cache, and alpha = 255 if resident
+uniform usampler2D vtPageTable;
+// cache of the resident pages
+uniform sampler2D vtPageCache;
+// number of pages of the level 0 (x, y), and number of levels (z)
+uniform ivec3 vtPages;
+// size of a page, border included (x), size of the border (y), size of the cache in pages (z)
+uniform vec3 vtPageLayout;
+#endif
+
+#if CUBE_SPHERE
+// cube-sphere texture, sampled with the direction in object space (see cube_reprojection.h in the main application)
+uniform bool cubeSphere;
+uniform samplerCube cubeTex;
+#endif
+
+// point lights (see N.B. 8): position in view coordinates and radius, color multiplied by the intensity
+#if CLUSTERED_LIGHTING
+struct PointLight
+{
+    vec4 positionRadius;
+    vec4 color;
+};
+layout (std430) readonly buffer PointLights { PointLight pointLights[]; };
+// offset and number of lights of each cluster, in the indices of the lights
+layout (std430) readonly buffer LightClusters { uvec2 clusters[]; };
+layout (std430) readonly buffer LightIndices { uint lightIndices[]; };
+// tiles per pixel (x, y), and scale and bias of the logarithm of the depth for the slices
+uniform vec2 clusterScale;
+uniform vec2 clusterDepth;
+#else
+uniform int numPointLights;
+uniform vec4 pointLightPositions[CLUSTER_FALLBACK_LIGHTS];
+uniform vec4 pointLightColors[CLUSTER_FALLBACK_LIGHTS];
+#endif
 
 ////////////////////////////////////////////////////////////////////
 
-// the "type" of the Subroutine
-subroutine vec4 ill_model();
+#if VIRTUAL_TEXTURING
+// we sample a level of the virtual texture: if the page is not resident, we use the coarser levels
+// (the page of the coarsest level is always resident)
+vec4 SampleVirtualLevel(vec2 uv, int level)
+{
+    uvec4 entry = uvec4(0u);
+    vec2 pageCoords = vec2(0.0);
+    for (; level < vtPages.z; level++)
+    {
+        pageCoords = uv * vec2(max(vtPages.xy >> level, ivec2(1)));
+        entry = texelFetch(vtPageTable, ivec2(pageCoords), level);
+        if (entry.a != 0u)
+            break;
+    }
+    // position in the cache: we skip the border of the page
+    float content = vtPageLayout.x - 2.0 * vtPageLayout.y;
+    vec2 texel = vec2(entry.xy) * vtPageLayout.x + vtPageLayout.y + fract(pageCoords) * content;
+    return textureLod(vtPageCache, texel / (vtPageLayout.x * vtPageLayout.z), 0.0);
+}
 
-// Subroutine Uniform (it is conceptually similar to a C pointer function)
-subroutine uniform ill_model Illumination_Model_ML_TX;
+// we sample the virtual texture: the level of detail is calculated from the derivatives of the coordinates (in texels of the level 0),
+// and the two nearest levels are blended
+vec4 SampleVirtual(vec2 uv)
+{
+    vec2 texels = uv * vec2(vtPages.xy) * (vtPageLayout.x - 2.0 * vtPageLayout.y);
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float lod = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), 0.0, float(vtPages.z - 1));
+    // the equirectangular texture wraps horizontally
+    uv = vec2(fract(uv.x), clamp(uv.y, 0.0, 0.99999));
+    int level = int(lod);
+    return mix(SampleVirtualLevel(uv, level), SampleVirtualLevel(uv, min(level + 1, vtPages.z - 1)), fract(lod));
+}
 
+#endif
 
+////////////////////////////////////////////////////////////////////
 
-//////////////////////////////////////////
-// a subroutine for the Blinn-Phong model for multiple lights and texturing
-subroutine(ill_model)
-vec4 BlinnPhong_ML_TX() // this name is the one which is detected by the SetupShaders() function in the main application, and the one used to swap subroutines
+// color of the surface: the virtual texture has the priority, then the cube-sphere texture, and the 2D texture
+vec4 SurfaceColor()
 {
+    // (the derivatives of the virtual texture coordinates are calculated before the repetition, to avoid discontinuities)
+#if VIRTUAL_TEXTURING
+    if (virtualTexturing)
+        return SampleVirtual(interp_UV*repeat);
+#endif
+#if CUBE_SPHERE
+    if (cubeSphere)
+        return texture(cubeTex, interp_Direction);
+#endif
     // we repeat the UVs and we sample the texture
     vec2 repeated_UV = mod(interp_UV*repeat, 1.0);
-    vec4 surfaceColor = texture(tex, repeated_UV);
+    return texture(tex, repeated_UV);
+}
+
+#if LIGHTING_MODEL == 3
+// Schlick-GGX approximation of the geometric attenuation of a direction (used by the Smith model)
+float G1(float NdotX, float k)
+{
+    return NdotX / (NdotX * (1.0 - k) + k);
+}
+#endif
+
+//////////////////////////////////////////
+// contribution of a light with incidence direction L, for the illumination model selected by LIGHTING_MODEL
+vec3 Shade(vec3 L, vec3 N, vec3 V, vec3 surfaceColor)
+{
+    // Lambert coefficient
+    float lambertian = max(dot(L,N), 0.0);
+
+#if LIGHTING_MODEL == 0
+    // Lambert: only the diffusive component
+    return Kd * lambertian * surfaceColor;
+#else
+    // if the lambert coefficient is positive, then I can calculate the specular component
+    if(lambertian > 0.0)
+    {
+#if LIGHTING_MODEL == 1
+        // in the Phong model we use the reflection vector of the incidence direction
+        vec3 R = reflect(-L, N);
+        float specAngle = max(dot(R, V), 0.0);
+        float specular = pow(specAngle, shininess);
+        return Kd * lambertian * surfaceColor + Ks * specular * specularColor;
+#elif LIGHTING_MODEL == 2
+        // in the Blinn-Phong model we do not use the reflection vector, but the half vector
+        vec3 H = normalize(L + V);
+
+        // we use H to calculate the specular component
+        float specAngle = max(dot(H, N), 0.0);
+        // shininess application to the specular component
+        float specular = pow(specAngle, shininess);
+
+        // We add diffusive (= color sampled from texture) and specular components to the final color
+        // N.B. ): in this implementation, the sum of the components can be different than 1
+        return Kd * lambertian * surfaceColor + Ks * specular * specularColor;
+#else
+        // GGX: microfacets distribution (D), Smith geometric attenuation (G2), and Fresnel-Schlick (F)
+        vec3 H = normalize(L + V);
+        float NdotH = max(dot(N, H), 0.0);
+        float NdotV = max(dot(N, V), 1e-4);
+        float VdotH = max(dot(V, H), 0.0);
+        float alphaSquared = alpha * alpha;
+        float denominator = NdotH * NdotH * (alphaSquared - 1.0) + 1.0;
+        float D = alphaSquared / (PI * denominator * denominator);
+        float k = (alpha + 1.0) * (alpha + 1.0) / 8.0;
+        float G2 = G1(lambertian, k) * G1(NdotV, k);
+        float F = F0 + (1.0 - F0) * pow(1.0 - VdotH, 5.0);
+        float specular = (D * G2 * F) / (4.0 * NdotV * lambertian);
+        return Kd * lambertian * surfaceColor + Ks * specular * lambertian * specularColor;
+#endif
+    }
+    return vec3(0.0);
+#endif
+}
+
+// contribution of a point light (position in view coordinates and radius): the attenuation is the inverse of the squared distance,
+// multiplied by a window reaching 0 at the radius (so the light does not contribute outside its clusters)
+vec3 PointLightColor(vec4 positionRadius, vec3 lightColor, vec3 N, vec3 V, vec3 surfaceColor)
+{
+    vec3 direction = positionRadius.xyz + vViewPosition;
+    float lightDistance = length(direction);
+    float window = clamp(1.0 - pow(lightDistance / positionRadius.w, 4.0), 0.0, 1.0);
+    float attenuation = window * window / (lightDistance * lightDistance + 1.0);
+    if (attenuation <= 0.0)
+        return vec3(0.0);
+    return attenuation * lightColor * Shade(direction / lightDistance, N, V, surfaceColor);
+}
+
+//////////////////////////////////////////
+// the illumination model selected by LIGHTING_MODEL, for multiple lights and texturing
+vec4 Illumination()
+{
+    vec3 surfaceColor = SurfaceColor().rgb;
 
     // ambient component can be calculated at the beginning
-    vec4 color = vec4(Ka*ambientColor,1.0);
+    vec3 color = Ka*ambientColor;
 
     // normalization of the per-fragment normal
     vec3 N = normalize(vNormal);
+    // the view vector has been calculated in the vertex shader, already negated to have direction from the mesh to the camera
+    vec3 V = normalize( vViewPosition );
 
     //for all the lights in the scene
     for(int i = 0; i < NR_LIGHTS; i++)
-    {
         // normalization of the per-fragment light incidence direction
-        vec3 L = normalize(lightDirs[i]);
-
-        // Lambert coefficient
-        float lambertian = max(dot(L,N), 0.0);
-
-        // if the lambert coefficient is positive, then I can calculate the specular component
-        if(lambertian > 0.0)
-        {
-            // the view vector has been calculated in the vertex shader, already negated to have direction from the mesh to the camera
-            vec3 V = normalize( vViewPosition );
-
-            // in the Blinn-Phong model we do not use the reflection vector, but the half vector
-            vec3 H = normalize(L + V);
-
-            // we use H to calculate the specular component
-            float specAngle = max(dot(H, N), 0.0);
-            // shininess application to the specular component
-            float specular = pow(specAngle, shininess);
-
-            // We add diffusive (= color sampled from texture) and specular components to the final color
-            // N.B. ): in this implementation, the sum of the components can be different than 1
-            color += Kd * lambertian * surfaceColor + vec4(Ks * specular * specularColor,1.0);
-        }
+        color += Shade(normalize(lightDirs[i]), N, V, surfaceColor);
+
+    // the point lights near to the fragment (see N.B. 8)
+#if CLUSTERED_LIGHTING
+    // cluster of the fragment: tile of the window, and slice of the depth (exponential, see clustered_lights.h)
+    ivec2 tile = min(ivec2(gl_FragCoord.xy * clusterScale), ivec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+    int slice = clamp(int(floor(log(max(vViewPosition.z, 1e-4)) * clusterDepth.x + clusterDepth.y)), 0, CLUSTER_Z - 1);
+    uvec2 cluster = clusters[(slice * CLUSTER_Y + tile.y) * CLUSTER_X + tile.x];
+    for (uint i = 0u; i < cluster.y; i++)
+    {
+        PointLight light = pointLights[lightIndices[cluster.x + i]];
+        color += PointLightColor(light.positionRadius, light.color.rgb, N, V, surfaceColor);
     }
-    return color;
+#else
+    for (int i = 0; i < numPointLights; i++)
+        color += PointLightColor(pointLightPositions[i], pointLightColors[i].rgb, N, V, surfaceColor);
+#endif
+    return vec4(color, 1.0);
 }
 
 
@@ -121,7 +311,9 @@ vec4 BlinnPhong_ML_TX() // this name is the one which is detected by the SetupSh
 // main
 void main(void)
 {
-    // we call the pointer function Illumination_Model_ML_TX():
-    // the subroutine selected in the main application will be called and executed
-    colorFrag = Illumination_Model_ML_TX();
+    // dithered transition between two LODs: the two LODs use complementary sets of pixels
+    lodDitherDiscard(lodFade);
+
+    // the illumination model is selected at compile time (see N.B. 3)
+    colorFrag = Illumination();
 }
@@ -20,8 +20,8 @@ Universita' degli Studi di Milano
 
 #version 410 core
 
-// number of lights in the scene
-#define NR_LIGHTS 1
+// number of lights in the scene (injected by the main application, see ShaderVariants in shader.h)
+#include "lights.glsl"
 
 // vertex position in world coordinates
 layout (location = 0) in vec3 position;
@@ -58,6 +58,8 @@ out vec3 vViewPosition;
 
 // the output variable for UV coordinates
 out vec2 interp_UV;
+// the position in object space (the direction used to sample the cube-sphere textures of the planets)
+out vec3 interp_Direction;
 
 
 void main(){
@@ -81,6 +83,7 @@ void main(){
 
   // I assign the values to a variable with "out" qualifier so to use the per-fragment interpolated values in the Fragment shader
   interp_UV = UV;
+  interp_Direction = position;
 
   // we apply the projection transformation
   gl_Position = projectionMatrix * mvPosition;
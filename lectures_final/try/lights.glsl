@@ -0,0 +1,37 @@
+/*
+lights.glsl: definitions shared by the vertex and fragment shaders of the illumination models,
+included with #include "lights.glsl" (see the preprocessing in shader.h)
+
+N.B.) NR_LIGHTS and the options of the clusters are injected by the main application (see ShaderVariants in shader.h),
+so they are defined only in the application: the default values are used only if the shaders are compiled without them
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+
+*/
+
+// number of lights in the scene
+#ifndef NR_LIGHTS
+#define NR_LIGHTS 1
+#endif
+
+// point lights shaded by cluster (see clustered_lights.h in the main application): 1 if the lists of the clusters are
+// in shader storage buffers, 0 if the nearest point lights are passed as uniform arrays
+#ifndef CLUSTERED_LIGHTING
+#define CLUSTERED_LIGHTING 0
+#endif
+// size of the grid of the clusters: tiles of the window, and slices of depth
+#ifndef CLUSTER_X
+#define CLUSTER_X 16
+#endif
+#ifndef CLUSTER_Y
+#define CLUSTER_Y 9
+#endif
+#ifndef CLUSTER_Z
+#define CLUSTER_Z 24
+#endif
+// maximum number of point lights passed as uniform arrays
+#ifndef CLUSTER_FALLBACK_LIGHTS
+#define CLUSTER_FALLBACK_LIGHTS 16
+#endif
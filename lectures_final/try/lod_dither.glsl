@@ -0,0 +1,28 @@
+/*
+lod_dither.glsl: dithered transition between two Levels of Detail (see lod.h in the main application), shared by the fragment
+shaders of the objects drawn with LODs, included with #include "lod_dither.glsl" (see the preprocessing in shader.h)
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+
+*/
+
+// 4x4 Bayer matrix for ordered dithering: each pixel of a 4x4 block has a different threshold in [0,1)
+const float bayerMatrix[16] = float[16](
+     0.0/16.0,  8.0/16.0,  2.0/16.0, 10.0/16.0,
+    12.0/16.0,  4.0/16.0, 14.0/16.0,  6.0/16.0,
+     3.0/16.0, 11.0/16.0,  1.0/16.0,  9.0/16.0,
+    15.0/16.0,  7.0/16.0, 13.0/16.0,  5.0/16.0);
+
+// we discard the fragment if it does not belong to the LOD, during a transition (the two LODs use complementary sets of pixels):
+// = 0 -> all the fragments are drawn
+// > 0 -> only the fragments with dithering threshold < fade are drawn (LOD "fading in")
+// < 0 -> only the fragments with dithering threshold >= -fade are drawn (LOD "fading out")
+void lodDitherDiscard(float fade)
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy) % 4;
+    float threshold = bayerMatrix[pixel.y * 4 + pixel.x];
+    if ((fade > 0.0 && threshold >= fade) || (fade < 0.0 && threshold < -fade))
+        discard;
+}
@@ -3,7 +3,8 @@
 
 N.B. 1)  "15_reflect_refract.vert" must be used as vertex shader
 
-N.B. 2)  the different effects are implemented using Shaders Subroutines
+N.B. 2)  the different effects are selected at compile time, with the REFLECTION_MODEL option (0 = reflection, 1 = Fresnel):
+the main application compiles a variant of the shader for each value (see ShaderVariants in shader.h)
 
 author: Davide Gadia
 
@@ -15,6 +16,11 @@ Universita' degli Studi di Milano
 
 #version 410 core
 
+// default value of the option (see N.B. 2)
+#ifndef REFLECTION_MODEL
+#define REFLECTION_MODEL 0
+#endif
+
 const float PI = 3.14159265359;
 
 // output shader variable
@@ -41,18 +47,10 @@ uniform float mFresnelPower;
 
 ////////////////////////////////////////////////////////////////////
 
-// the "type" of the Subroutine
-subroutine vec4 refl_refra();
-
-// Subroutine Uniform (it is conceptually similar to a C pointer function)
-subroutine uniform refl_refra Reflection_Refraction;
-
-////////////////////////////////////////////////////////////////////
-
+#if REFLECTION_MODEL == 0
 //////////////////////////////////////////
-// a subroutine for the reflection using an environment map
-subroutine(refl_refra)
-vec4 Reflection() // this name is the one which is detected by the SetupShaders() function in the main application, and the one used to swap subroutines
+// reflection using an environment map
+vec4 Reflection_Refraction()
 {
     // vector from vertex to camera in world coordinates
     vec3 V = normalize(worldPosition.xyz - cameraPosition);
@@ -65,10 +63,10 @@ vec4 Reflection() // this name is the one which is detected by the SetupShaders(
 }
 //////////////////////////////////////////
 
+#else
 //////////////////////////////////////////
-// a subroutine for refraction using Fresnel
-subroutine(refl_refra)
-vec4 Fresnel() // this name is the one which is detected by the SetupShaders() function in the main application, and the one used to swap subroutines
+// refraction using Fresnel
+vec4 Reflection_Refraction()
 {
     vec3 N = normalize(worldNormal);
 
@@ -110,12 +108,12 @@ vec4 Fresnel() // this name is the one which is detected by the SetupShaders() f
     // we merge the 2 colors, using the ratio calculated with the Fresnel equation
     return mix( refractedColor, reflectedColor, clamp( Ratio, 0.0, 1.0 ));
 }
+#endif
 //////////////////////////////////////////
 
 // main
 void main(void)
 {
-    // we call the pointer function Reflection_Refraction():
-    // the subroutine selected in the main application will be called and executed
+    // the effect is selected at compile time (see N.B. 2)
     colorFrag = Reflection_Refraction();
 }
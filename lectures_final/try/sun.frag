@@ -12,9 +12,16 @@ uniform float repeat;
 // texture sampler
 uniform sampler2D tex;
 
+// transition between two Levels of Detail (see lod_dither.glsl)
+uniform float lodFade;
+#include "lod_dither.glsl"
+
 // main function
 void main(void)
 {
+    // dithered transition between two LODs: the two LODs use complementary sets of pixels
+    lodDitherDiscard(lodFade);
+
     // we repeat the UVs and we sample the texture
     vec2 repeated_UV = mod(interp_UV * repeat, 1.0);
     vec4 surfaceColor = texture(tex, repeated_UV);
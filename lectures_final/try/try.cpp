@@ -17,6 +17,10 @@ positive Z axis points "outside" the screen
 
 // Std. Includes
 #include <string>
+#include <array>
+#include <thread>
+#include <atomic>
+#include <random>
 
 // Loader estensioni OpenGL
 // http://glad.dav1d.de/
@@ -41,7 +45,42 @@ positive Z axis points "outside" the screen
 // classes developed during lab lectures to manage shaders, to load models, and for FPS camera
 #include <utils/shader.h>
 #include <utils/model.h>
+// creation of buffers and textures with Direct State Access (OpenGL 4.5) or with the OpenGL 4.1 functions
+#include <utils/gl_backend.h>
+// hot reload of the shaders when their files change
+#include <utils/shader_watcher.h>
+// pool of worker threads (see BenchJobs)
+#include <utils/thread_pool.h>
+// work-stealing job system, for the parallel loops (see BenchJobs)
+#include <utils/job_system.h>
+// queue of the frames between the main thread and the render thread
+#include <utils/frame_queue.h>
+// description of the frame as a graph of passes
+#include <utils/render_graph.h>
+// clustered shading of the point lights
+#include <utils/clustered_lights.h>
+// time-sliced execution of the background tasks, and histogram of the frame times
+#include <utils/frame_scheduler.h>
+#include <utils/frame_histogram.h>
 #include <utils/camera.h>
+// Levels of Detail selection at draw time
+#include <utils/lod.h>
+// procedural generation of the spheres used for the planets
+#include <utils/procedural_mesh.h>
+// asynchronous loading of the textures (parallel decoding, and upload using a shared OpenGL context)
+#include <utils/texture_loader.h>
+// streaming of models and textures using coroutines, with placeholders until the assets are resident
+#include <utils/asset_streamer.h>
+// streaming of the mipmap levels of the planet textures, inside a VRAM budget
+#include <utils/mip_streamer.h>
+// virtual texturing of the planets with very high resolution textures (only the visible pages are resident)
+#include <utils/virtual_texture.h>
+// cube-sphere textures of the planets, reprojected from the equirectangular images (no oversampling and aliasing at the poles)
+#include <utils/cube_reprojection.h>
+// accounting of the GPU and CPU memory used by the resources, with budgets and per-resource reports
+#include <utils/resource_registry.h>
+// asynchronous logging (the loaders and the frame loop never wait for the console)
+#include <utils/logger.h>
 
 // we load the GLM classes used in the application
 #include <glm/glm.hpp>
@@ -65,24 +104,43 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 // if one of the WASD keys is pressed, we call the corresponding method of the Camera class
 void apply_camera_movements();
 
-// index of the current shader subroutine (= 0 in the beginning)
-GLuint current_subroutine = 0;
-// a vector for all the shader subroutines names used and swapped in the application
-vector<std::string> shaders;
+// names of the lighting models of the illumination shader (= values of the LIGHTING_MODEL option, see illumination_models_ML.frag),
+// selected with the number keys
+vector<std::string> lightingModels = { "Lambert", "Phong", "BlinnPhong", "GGX" };
+// index of the current lighting model (= Blinn-Phong in the beginning)
+GLuint current_model = 2;
 
-// the name of the subroutines are searched in the shaders, and placed in the shaders vector (to allow shaders swapping)
-void SetupShader(int shader_program);
+// options of the variants of the illumination shader: bits of the key of a variant (see ShaderVariants in shader.h)
+const GLuint LIGHTING_MODEL_SHIFT = 0;
+const GLuint VIRTUAL_TEXTURING_BIT = 1u << 2;
+const GLuint CUBE_SPHERE_BIT = 1u << 3;
 
+// print on console the name of current lighting model
+void PrintCurrentShader(int model);
 
+// print on console the CPU and GPU memory used by the models
+void PrintMemoryReport(const vector<pair<string, const Model*>>& models);
 
-// print on console the name of current shader subroutine
-void PrintCurrentShader(int subroutine);
+// bake the textures of the application in block-compressed formats (the application is started with the "--bake" argument)
+int BakeTextures();
 
-// load the 6 images from disk and create an OpenGL cubemap
-GLint LoadTextureCube(string path);
+// bake the compressed meshes of the models loaded from file (the application is started with the "--bake" argument)
+int BakeModels();
 
-// load image from disk and create an OpenGL texture
-GLint LoadTexture(const char* path);
+// pack the assets of the application in a single asset pack (the application is started with the "--pack" argument)
+int PackAssets();
+
+// compare size on disk and loading time of the models in the different formats (the application is started with the "--bench-models" argument)
+int BenchModels();
+
+// measure the overhead of the jobs and the scaling of the job system (the application is started with the "--bench-jobs" argument)
+int BenchJobs();
+
+// check the culling, the aliasing of the transient textures and the barriers of the render graph (the application is started with the "--render-graph-test" argument)
+int RenderGraphTest();
+
+// measure the building of the lists of the clustered lights, and check them (the application is started with the "--bench-lights" argument)
+int BenchLights();
 
 // we initialize an array of booleans for each keyboard key
 bool keys[1024];
@@ -134,6 +192,16 @@ GLboolean spinning = GL_TRUE;
 // boolean to activate/deactivate wireframe rendering
 GLboolean wireframe = GL_FALSE;
 
+// boolean to activate/deactivate the cube-sphere textures of the planets (if deactivated, the equirectangular textures are used)
+GLboolean cubeSphereTextures = GL_TRUE;
+
+// if true, the memory report of the models is printed on console at the next frame
+GLboolean memoryReportRequested = GL_FALSE;
+// number of resources in the memory report (the biggest ones), and file where all the resources are saved pressing J
+const size_t resourceReportSize = 15;
+const string resourceDumpPath = "resources.json";
+GLboolean resourceDumpRequested = GL_FALSE;
+
 // we create a camera. We pass the initial position as a paramenter to the constructor. The last boolean tells if we want a camera "anchored" to the ground
 Camera camera(glm::vec3(0.0f, 0.0f, 7.0f), GL_TRUE);
 
@@ -147,6 +215,9 @@ GLfloat Ks = 0.5f;
 GLfloat Ka = 0.01f;
 // shininess coefficient for Blinn-Phong shader
 GLfloat shininess = 25.0f;
+// roughness and Fresnel reflectance at 0 degrees for the GGX model
+GLfloat alpha = 0.2f;
+GLfloat F0 = 0.9f;
 
 // ratio between refraction indices (Fresnel shader) of air (1.00) and glass (1.52)
 GLfloat Eta = 1.0f/1.52f;
@@ -155,30 +226,176 @@ GLfloat Eta = 1.0f/1.52f;
 // < 5 -> technically not physically correct, but it gives more "artistic" results
 GLfloat mFresnelPower = 5.0f;
 
-// texture unit for the cube map
-GLuint textureCube;
+// texture unit for the cube map (streamed: a placeholder is used until the cube map is resident)
+StreamedTexture textureCube;
 GLuint textureSun;
 
-// vector for the textures IDs
-vector<GLint> textureID;
+// vector for the textures IDs (streamed: a placeholder is used until each texture is resident)
+vector<StreamedTexture> textureID;
+// cube-sphere textures of the planets (same order of the textureID vector): until they are resident, the 2D textures are used
+vector<StreamedTexture> planetCubes;
+
+// folder and images of the cube map, in the order +X, -X, +Y, -Y, +Z, -Z
+const string cubeMapFolder = "../../textures/cube/ProjectCubeMap/";
+const vector<string> cubeMapFaces = { "nx.png", "ny.png", "nz.png", "px.png", "pz.png", "py.png" };
+// textures of the sun and of the planets (same order of the textureID vector), with the format used to bake them
+// (BC7 for the Earth, which has the finest details, BC1 for the others)
+const vector<pair<string, BakeFormat>> planetTextures = {
+    { "../../textures/sun/suns.jpg", BAKE_BC1 },
+    { "../../textures/mercury/mercury.jpg", BAKE_BC1 },
+    { "../../textures/venus/venus.jpg", BAKE_BC1 },
+    { "../../textures/earth/earth1.jpg", BAKE_BC7 },
+    { "../../textures/mars.jpg", BAKE_BC1 },
+    { "../../textures/jupiter.jpg", BAKE_BC1 },
+    { "../../textures/saturn.jpg", BAKE_BC1 },
+    { "../../textures/uranus1.jpg", BAKE_BC1 },
+    { "../../textures/neptune.jpg", BAKE_BC1 } };
+
+// models loaded from file (the other models are procedural): their compressed meshes are baked with the "--bake" argument,
+// and they are loaded instead of the models (see mesh_compression.h)
+const string cubeModelPath = "../../models/cube.obj";
+const string saturnModelPath = "../../models/saturn.obj";
+
+// planets using cube-sphere textures (index in the textureID vector): not the sun, which uses its own shader,
+// and not Saturn, whose model has the UVs of the rings
+const vector<GLuint> cubeSpherePlanets = { 1, 2, 3, 4, 5, 7, 8 };
 
 // UV repetitions
 GLfloat repeat = 1.0f;
 
+// planets using virtual textures (index in the textureID vector), with their source images. The virtual textures are baked
+// with the "--bake" argument, and until they are ready the planets use the streamed textures.
+// For close views, the sources can be replaced with 32k-64k images: the memory used depends only on the visible pages
+const vector<pair<GLuint, string>> virtualTextureSources = {
+    { 3, "../../textures/earth/earth1.jpg" },
+    { 4, "../../textures/mars.jpg" } };
+// size of the cache of the virtual textures, in pages along each side (32 -> 4096x4096 texels, 8 MB with BC1)
+const GLuint virtualCachePages = 32;
+
+// VRAM budget for the planet textures, in MB (it can be changed with the "--texture-budget <MB>" argument)
+GLuint textureBudgetMB = 64;
+
+// time budget of the background tasks at each frame, in milliseconds (it can be changed with the "--task-budget <ms>" argument)
+GLfloat taskBudgetMs = 2.0f;
+// if true, the histogram of the frame times and the statistics of the background tasks are printed on console at the next frame
+GLboolean frameReportRequested = GL_FALSE;
+
+// number of point lights orbiting around the sun, shaded by cluster (it can be changed with the "--lights <number>" argument)
+GLuint numPointLights = 1024;
+
+// parameters of the LOD selection (pressing O, LOD selection is activated/deactivated)
+LODSettings lodSettings;
+// LOD state of the sun and of the planets (same order of the textureID vector)
+LODState lodStates[9];
+// number of triangles submitted to the GPU in the current frame (shown in the window title, together with the frame rate)
+GLuint trianglesSubmitted = 0;
+
+// locations of the uniforms used to draw the sun and the planets, read once for each Shader Program: each variant of the
+// illumination shader has its own locations (see N.B. 2 in shader.h). The uniforms not declared by a program have location -1
+struct PlanetUniforms
+{
+    GLint projectionMatrix, viewMatrix, modelMatrix, normalMatrix;
+    GLint tex, repeat, Ka, Kd, Ks, alpha, F0, lights, lodFade, cubeSphere;
+
+    explicit PlanetUniforms(GLuint program)
+        : projectionMatrix(glGetUniformLocation(program, "projectionMatrix")), viewMatrix(glGetUniformLocation(program, "viewMatrix")),
+          modelMatrix(glGetUniformLocation(program, "modelMatrix")), normalMatrix(glGetUniformLocation(program, "normalMatrix")),
+          tex(glGetUniformLocation(program, "tex")), repeat(glGetUniformLocation(program, "repeat")),
+          Ka(glGetUniformLocation(program, "Ka")), Kd(glGetUniformLocation(program, "Kd")), Ks(glGetUniformLocation(program, "Ks")),
+          alpha(glGetUniformLocation(program, "alpha")), F0(glGetUniformLocation(program, "F0")), lights(glGetUniformLocation(program, "lights")),
+          lodFade(glGetUniformLocation(program, "lodFade")), cubeSphere(glGetUniformLocation(program, "cubeSphere")) {}
+};
+
+// a frame prepared by the main thread, and rendered by the render thread (see frame_queue.h): only values, so the main thread
+// can prepare the next frame while the render thread reads this one
+struct FramePacket
+{
+    // the last packet: the render thread exits
+    GLboolean quit = GL_FALSE;
+    GLfloat deltaTime = 0.0f;
+    glm::mat4 view = glm::mat4(1.0f);
+    // model and normal matrices of the sun and of the planets (same order of the textureID vector)
+    array<glm::mat4, 9> modelMatrices;
+    array<glm::mat3, 9> normalMatrices;
+    // options of the frame, changed by the key callback
+    GLuint lightingModel = 0;
+    GLboolean wireframe = GL_FALSE;
+    GLboolean cubeSphereTextures = GL_TRUE;
+    LODSettings lodSettings;
+    GLboolean memoryReport = GL_FALSE;
+    GLboolean resourceDump = GL_FALSE;
+    GLboolean frameReport = GL_FALSE;
+    // point lights, in world coordinates (see clustered_lights.h)
+    vector<PointLight> pointLights;
+};
+// number of frames the main thread can prepare ahead of the render thread
+const size_t FRAME_QUEUE_SIZE = 2;
+
 
 
 /////////////////// MAIN function ///////////////////////
-int main()
+int main(int argc, char* argv[])
 {
+  // with the "--bake" argument, we only bake the textures and the models, and we close the application
+  if (argc > 1 && string(argv[1]) == "--bake")
+  {
+    int texturesResult = BakeTextures();
+    int modelsResult = BakeModels();
+    return (texturesResult == 0 && modelsResult == 0) ? 0 : -1;
+  }
+  // with the "--pack" argument, we only build the asset pack, and we close the application
+  if (argc > 1 && string(argv[1]) == "--pack")
+    return PackAssets();
+  // with the "--bench-models" argument, we only compare the model formats, and we close the application
+  if (argc > 1 && string(argv[1]) == "--bench-models")
+    return BenchModels();
+  // with the "--bench-jobs" argument, we only measure the job system
+  if (argc > 1 && string(argv[1]) == "--bench-jobs")
+    return BenchJobs();
+  // with the "--render-graph-test" argument, we only test the render graph
+  if (argc > 1 && string(argv[1]) == "--render-graph-test")
+    return RenderGraphTest();
+  // with the "--bench-lights" argument, we only measure the clustered lights
+  if (argc > 1 && string(argv[1]) == "--bench-lights")
+    return BenchLights();
+
+  // VRAM budget for the streamed textures, and budgets of the GPU and CPU memory of all the resources (see resource_registry.h)
+  size_t gpuBudgetMB = 0, cpuBudgetMB = 0;
+  // with the "--gl41" argument, we use the OpenGL 4.1 context and the "bind-to-edit" backend also if OpenGL 4.5 is supported
+  bool allowDSA = true;
+  for (int i = 1; i < argc; i++)
+    if (string(argv[i]) == "--gl41")
+      allowDSA = false;
+  for (int i = 1; i + 1 < argc; i++)
+  {
+    if (string(argv[i]) == "--texture-budget")
+      textureBudgetMB = (GLuint)max(atoi(argv[i + 1]), 1);
+    else if (string(argv[i]) == "--gpu-budget")
+      gpuBudgetMB = (size_t)max(atoi(argv[i + 1]), 0);
+    else if (string(argv[i]) == "--cpu-budget")
+      cpuBudgetMB = (size_t)max(atoi(argv[i + 1]), 0);
+    else if (string(argv[i]) == "--task-budget")
+      taskBudgetMs = max((GLfloat)atof(argv[i + 1]), 0.1f);
+    else if (string(argv[i]) == "--lights")
+      numPointLights = (GLuint)max(atoi(argv[i + 1]), 0);
+  }
+  ResourceRegistry::Instance().SetBudgets(gpuBudgetMB * 1024 * 1024, cpuBudgetMB * 1024 * 1024);
+
+  // we mount the asset archives: the asset pack (if it has been built, see PackAssets), and the zip archive of the models.
+  // The assets not found in the archives are read from disk
+  if (AssetSystem::Instance().MountPack("../../assets.pack", "../../"))
+    LOG_INFO("", "Mounted asset pack ../../assets.pack");
+  AssetSystem::Instance().MountZip("../../models/models.zip", "../../");
+
   // Initialization of OpenGL context using GLFW
   glfwInit();
   // We set OpenGL specifications required for this application
-  // In this case: 4.1 Core
-  // If not supported by your graphics HW, the context will not be created and the application will close
+  // In this case: 4.5 Core, for the Direct State Access backend (see gl_backend.h), or 4.1 Core if 4.5 is not supported
+  // If 4.1 is not supported by your graphics HW, the context will not be created and the application will close
   // N.B.) creating GLAD code to load extensions, try to take into account the specifications and any extensions you want to use,
   // in relation also to the values indicated in these GLFW commands
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, allowDSA ? 5 : 1);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
   // we set if the window is resizable
@@ -186,9 +403,15 @@ int main()
 
   // we create the application's window
     GLFWwindow* window = glfwCreateWindow(screenWidth, screenHeight, "try", nullptr, nullptr);
+    // we fall back to the 4.1 context (the hint is used also by the shared context of the TextureLoader)
+    if (!window && allowDSA)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+        window = glfwCreateWindow(screenWidth, screenHeight, "try", nullptr, nullptr);
+    }
     if (!window)
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
+        LOG_ERROR("GLFW", "failed to create the window");
         glfwTerminate();
         return -1;
     }
@@ -204,9 +427,12 @@ int main()
     // GLAD tries to load the context set by GLFW
     if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress))
     {
-        std::cout << "Failed to initialize OpenGL context" << std::endl;
+        LOG_ERROR("GLAD", "failed to initialize the OpenGL context");
         return -1;
     }
+    // the buffers and the textures are created with Direct State Access if the context supports it
+    GLBackend::Instance().Init(allowDSA);
+    LOG_INFO("", "Backend: " << GLBackend::Instance().Name() << " (" << glGetString(GL_VERSION) << ")");
 
     // we define the viewport dimensions
     int width, height;
@@ -215,55 +441,139 @@ int main()
 
     // we enable Z test
     glEnable(GL_DEPTH_TEST);
+    // filtering across the edges of the faces of the cube maps (for the cube-sphere textures)
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
     //the "clear" color for the frame buffer
     glClearColor(0.0f, 0.0f, 1.0f, 1.0f);
 
+    // we start the streaming of the textures: the images are decoded in parallel by the worker threads, and they are uploaded
+    // by the TextureLoader while the application is already rendering. Until then, 1x1 placeholder textures are used
+    TextureLoader textureLoader(window);
+    AssetStreamer streamer(textureLoader);
+    // if the textures have been baked (see BakeTextures), the compressed textures are used
+    textureCube.placeholder = streamer.PlaceholderCubeMap();
+    streamer.Stream(textureCube, cubeMapFolder, cubeMapFaces);
+    // the mipmap levels of the planet textures are streamed according to the projected size of the planets:
+    // until the coarsest levels are resident, the placeholder is used
+    MipStreamer mipStreamer((size_t)textureBudgetMB * 1024 * 1024);
+    vector<GLuint> planetMips;
+    textureID.resize(planetTextures.size());
+    for (size_t i = 0; i < planetTextures.size(); i++)
+    {
+        textureID[i].placeholder = streamer.PlaceholderTexture2D();
+        planetMips.push_back(mipStreamer.Add(planetTextures[i].first));
+    }
+    // the cube-sphere textures are baked with the "--bake" argument, otherwise they are reprojected at load time
+    planetCubes.resize(planetTextures.size());
+    for (GLuint planet : cubeSpherePlanets)
+        streamer.StreamCubeSphere(planetCubes[planet], planetTextures[planet].first);
+    // the pages of the virtual textures are in BC1 (S3TC is supported also by the OpenGL 4.1 implementations without BPTC)
+    VirtualTextureSystem virtualTextures(BAKE_BC1, virtualCachePages);
+    vector<GLint> virtualTextureIDs(planetTextures.size(), -1);
+    for (const pair<GLuint, string>& source : virtualTextureSources)
+        virtualTextureIDs[source.first] = virtualTextures.Add(source.second);
+
+    // the point lights are shaded by cluster, with the lists in shader storage buffers if the context supports them (see clustered_lights.h)
+    ClusteredLights clusteredLights(ClusteredLights::Supported());
+    LOG_INFO("", "Point lights: " << numPointLights << (clusteredLights.Storage() ? ", clustered shading" : ", the nearest " + to_string(CLUSTER_FALLBACK_LIGHTS) + " shaded without clusters"));
+
+    // the Shader Programs are created asynchronously: the binaries are loaded from the program cache (see program_cache.h),
+    // or they are compiled in parallel by the driver. We wait for all of them at the end, measuring the warm-up time
+    double shadersStart = glfwGetTime();
     // we create the Shader Program used for the environment map
     Shader skybox_shader("skybox.vert", "skybox.frag");
     Shader sun_shader("sun.vert","sun.frag");
-    // we create the Shader Program used for objects (which presents different subroutines we can switch)
-    Shader illumination_shader = Shader("illumination_models_ML.vert", "illumination_models_ML.frag");   
-    // we parse the Shader Program to search for the number and names of the subroutines.
-    // the names are placed in the shaders vector
-    SetupShader(illumination_shader.Program);
-   // we print on console the name of the first subroutine used
-    PrintCurrentShader(current_subroutine);
+    // we create the variants of the Shader Program used for objects: one for each lighting model, with and without
+    // the code of the virtual textures and of the cube-sphere textures. The samplers units are set when a variant is created
+    ShaderVariants illumination_variants("illumination_models_ML.vert", "illumination_models_ML.frag",
+        { { "LIGHTING_MODEL", LIGHTING_MODEL_SHIFT, 2 }, { "VIRTUAL_TEXTURING", 2 }, { "CUBE_SPHERE", 3 } },
+        "#define NR_LIGHTS " + to_string(NR_LIGHTS) + "\n" + clusteredLights.ShaderDefines(),
+        [&virtualTextures, &clusteredLights](GLuint program)
+        {
+            virtualTextures.SetupProgram(program);
+            clusteredLights.SetupProgram(program);
+            glUniform1i(glGetUniformLocation(program, "cubeTex"), CUBE_SPHERE_TEXTURE_UNIT);
+        });
+    // all the variants are compiled now, so the switch of lighting model does not compile shaders during the rendering
+    illumination_variants.Precompile(illumination_variants.AllKeys());
+    // the Shader Program of the feedback pass of the virtual textures
+    Shader feedback_shader("vt_feedback.vert", "vt_feedback.frag");
+    skybox_shader.Wait();
+    sun_shader.Wait();
+    feedback_shader.Wait();
+    illumination_variants.Wait();
+    // "cold" start: all the programs are compiled; "warm" start: all the programs are loaded from the cache
+    ProgramCache& programCache = ProgramCache::Instance();
+    LOG_INFO("", "Shader warm-up (" << (programCache.Misses() == 0 ? "warm" : programCache.Hits() == 0 ? "cold" : "partial")
+        << "): " << programCache.Hits() << " programs from the cache, " << programCache.Misses() << " compiled"
+        << (programCache.ParallelCompile() ? " in parallel" : "") << ", " << (glfwGetTime() - shadersStart) * 1000.0 << " ms");
+    // the shaders are reloaded when their files (or the included files) change, without restarting the application
+    ShaderWatcher shaderWatcher;
+    shaderWatcher.Watch(skybox_shader);
+    shaderWatcher.Watch(sun_shader);
+    shaderWatcher.Watch(feedback_shader);
+    shaderWatcher.Watch(illumination_variants);
+   // we print on console the name of the first lighting model used
+    PrintCurrentShader(current_model);
     
    
-    // we load the cube map (we pass the path to the folder containing the 6 views)
-    textureCube = LoadTextureCube("../../textures/cube/ProjectCubeMap/");
-
-
-    // we load the model(s)
-    Model cubeModel("../../models/cube.obj"); // used for the environment map
-    Model sunModel("../../models/sun.obj");
-    Model mercuryModel("../../models/mercury.obj");
-    Model venusModel("../../models/venus.obj");
-    Model earthModel("../../models/sphere.obj");
-    Model marsModel("../../models/sphere.obj");
-    Model jupiterModel("../../models/sphere.obj");
-    Model saturnModel("../../models/saturn.obj");
-    Model uranusModel("../../models/sphere.obj");
-    Model neptuneModel("../../models/sphere.obj");
-
-    textureID.push_back(LoadTexture("../../textures/sun/suns.jpg"));
-    textureID.push_back(LoadTexture("../../textures/mercury/mercury.jpg"));
-    textureID.push_back(LoadTexture("../../textures/venus/venus.jpg"));
-    textureID.push_back(LoadTexture("../../textures/earth/earth1.jpg"));
-    textureID.push_back(LoadTexture("../../textures/mars.jpg"));
-    textureID.push_back(LoadTexture("../../textures/jupiter.jpg"));
-    textureID.push_back(LoadTexture("../../textures/saturn.jpg"));
-    textureID.push_back(LoadTexture("../../textures/uranus1.jpg"));
-    textureID.push_back(LoadTexture("../../textures/neptune.jpg"));
+
+    // the buffers of the procedural models are recorded with the name of the model as owner (see resource_registry.h)
+    auto proceduralModel = [](const string& name, MeshData&& data)
+    {
+        ResourceOwner owner(name);
+        return Model(std::move(data));
+    };
+
+    // we start the streaming of the model(s): until they are resident, low-resolution spheres are drawn
+    ProceduralParams placeholderSphere;
+    placeholderSphere.shape = PROCEDURAL_ICOSPHERE;
+    placeholderSphere.subdivisions = 4;
+    Model cubePlaceholder = proceduralModel("cube placeholder", GenerateProceduralMesh(placeholderSphere));
+    // the placeholder of Saturn has the size of the body of the planet in the model (radius ~250 units)
+    MeshData saturnSphere = GenerateProceduralMesh(placeholderSphere);
+    for (Vertex& vertex : saturnSphere.vertices)
+        vertex.Position *= 250.0f;
+    for (MeshLOD& lod : saturnSphere.lods)
+        lod.error *= 250.0f;
+    Model saturnPlaceholder = proceduralModel("saturn placeholder", std::move(saturnSphere));
+
+    StreamedModel cubeModel; // used for the environment map
+    cubeModel.placeholder = &cubePlaceholder;
+    streamer.Stream(cubeModel, cubeModelPath);
+    StreamedModel saturnModel;
+    saturnModel.placeholder = &saturnPlaceholder;
+    streamer.Stream(saturnModel, saturnModelPath);
+
+    // the sun and the other planets are procedural icospheres (with radius 1, like the sphere.obj model used before)
+    // the sphere is generated only once, and then it is taken from the cache of the procedural meshes
+    ProceduralParams planetSphere;
+    planetSphere.shape = PROCEDURAL_ICOSPHERE;
+    planetSphere.subdivisions = 16;
+    Model sunModel = proceduralModel("sun", GenerateProceduralMesh(planetSphere));
+    Model mercuryModel = proceduralModel("mercury", GenerateProceduralMesh(planetSphere));
+    Model venusModel = proceduralModel("venus", GenerateProceduralMesh(planetSphere));
+    Model earthModel = proceduralModel("earth", GenerateProceduralMesh(planetSphere));
+    Model marsModel = proceduralModel("mars", GenerateProceduralMesh(planetSphere));
+    Model jupiterModel = proceduralModel("jupiter", GenerateProceduralMesh(planetSphere));
+    Model uranusModel = proceduralModel("uranus", GenerateProceduralMesh(planetSphere));
+    Model neptuneModel = proceduralModel("neptune", GenerateProceduralMesh(planetSphere));
+    // the model of each planet (same index of the textureID vector), for the passes drawing the planets in a loop.
+    // Saturn is streamed: its model changes when the loading is completed
+    const vector<Model*> planetModels = { &sunModel, &mercuryModel, &venusModel, &earthModel, &marsModel,
+                                          &jupiterModel, nullptr, &uranusModel, &neptuneModel };
+    auto planetModel = [&planetModels, &saturnModel](GLuint planet) -> Model& { return planetModels[planet] ? *planetModels[planet] : saturnModel.Get(); };
+
+    // when the streaming is completed, we print the time of the first frame and of the completion of the streaming,
+    // when each image has been decoded and uploaded, and the memory report
+    GLboolean streamingCompleted = GL_FALSE;
+    GLboolean firstFrame = GL_TRUE;
 
 
     // Projection matrix: FOV angle, aspect ratio, near and far planes
     glm::mat4 projection = glm::perspective(45.0f, (float)screenWidth/(float)screenHeight, 0.1f, 10000.0f);
 
-    // View matrix: the camera moves, so we just set to indentity now
-    glm::mat4 view = glm::mat4(1.0f);
-
     // Model and Normal transformation matrices for the object in the scene: we set to identity
     glm::mat4 sunModelMatrix = glm::mat4(1.0f);
     glm::mat3 sunNormalMatrix = glm::mat3(1.0f);
@@ -299,7 +609,346 @@ int main()
    // Assuming the sun is at origin
     glm::vec3 viewPos = camera.Position;  // Use your camera's position
 
-   // Rendering loop: this code is executed at each frame
+    // the point lights: lights of stations and spacecrafts orbiting around the sun, between the orbits of Mercury and Neptune,
+    // with random colors and radii (the same at each execution). The speed of their orbits decreases with the distance from the sun
+    vector<PointLight> stationLights(numPointLights);
+    vector<GLfloat> stationSpeeds(numPointLights);
+    mt19937 lightsRandom(42);
+    uniform_real_distribution<GLfloat> unit(0.0f, 1.0f);
+    for (GLuint i = 0; i < numPointLights; i++)
+    {
+        GLfloat orbit = orbitRadiusMercury + (orbitRadiusNeptune - orbitRadiusMercury) * unit(lightsRandom);
+        GLfloat angle = glm::two_pi<GLfloat>() * unit(lightsRandom);
+        stationLights[i].position = glm::vec3(orbit * cos(angle), 1.5f * (unit(lightsRandom) - 0.5f), orbit * sin(angle));
+        stationLights[i].radius = 0.5f + 1.5f * unit(lightsRandom);
+        stationLights[i].color = glm::normalize(glm::vec3(unit(lightsRandom), unit(lightsRandom), unit(lightsRandom)) + 0.1f);
+        stationLights[i].intensity = 2.0f;
+        stationSpeeds[i] = (0.5f + unit(lightsRandom)) / sqrt(orbit);
+    }
+    // time of the animation of the lights (it is stopped with the planets, pressing P)
+    GLfloat lightsTime = 0.0f;
+
+    // statistics of the render thread (frames, triangles and submit time), shown in the window title every half second
+    atomic<GLuint> renderedFrames{ 0 };
+    atomic<GLuint64> renderedTriangles{ 0 };
+    atomic<GLuint64> submitMicroseconds{ 0 };
+    GLfloat lastStatsTime = 0.0f;
+    GLuint lastStatsFrames = 0;
+    GLuint64 lastStatsTriangles = 0, lastStatsSubmit = 0;
+    double prepareSinceStats = 0.0;
+    GLuint framesSinceStats = 0;
+
+    // the frames are prepared by this thread (input, camera, animations and matrices), and rendered by the render thread,
+    // which owns the OpenGL context: while the render thread submits the frame N, this thread prepares the frame N+1
+    // (see frame_queue.h). The Update of the streamers and of the shader watcher is called by the render thread, where the context is current
+    FrameQueue<FramePacket, FRAME_QUEUE_SIZE> frameQueue;
+    glfwMakeContextCurrent(nullptr);
+    thread renderThread([&]()
+    {
+        glfwMakeContextCurrent(window);
+        // the loading coroutines create the GPU resources in the render thread
+        streamer.SetMainThread();
+        // the background tasks are executed in the render thread, within the time budget of each frame (see frame_scheduler.h),
+        // and the histogram counts the time between the beginning of two consecutive frames (see frame_histogram.h)
+        FrameScheduler scheduler(taskBudgetMs);
+        FrameHistogram frameHistogram;
+        // the passes of the frame (see render_graph.h): the graph is built again at each frame, and its pool of textures is kept
+        RenderGraph renderGraph;
+        // the locations of the uniforms of the programs drawing the planets, cached for each program (they are read again after
+        // the reload of a program, see N.B. 2 in shader_watcher.h)
+        unordered_map<GLuint, PlanetUniforms> uniformsCache;
+        auto planetUniforms = [&uniformsCache](GLuint program) -> const PlanetUniforms&
+        {
+            return uniformsCache.try_emplace(program, program).first->second;
+        };
+        double lastFrameStart = 0.0;
+        FramePacket frame;
+        while (true)
+        {
+            frameQueue.Pop(frame);
+            if (frame.quit)
+                break;
+            double submitStart = glfwGetTime();
+            if (lastFrameStart > 0.0)
+                frameHistogram.Add((submitStart - lastFrameStart) * 1000.0);
+            lastFrameStart = submitStart;
+            glm::mat4 view = frame.view;
+            // the memory report is requested by the M key, or by the end of the streaming
+            GLboolean memoryReport = frame.memoryReport;
+
+            // the reloaded shaders replace the current ones at the beginning of the frame
+            if (shaderWatcher.Update())
+                uniformsCache.clear();
+
+            // we resume the loading coroutines waiting for the main thread (e.g., to create the GPU buffers of a model)
+            streamer.Update();
+            if (!streamingCompleted && streamer.Pending() == 0)
+            {
+                streamingCompleted = GL_TRUE;
+                LOG_INFO("", "Streaming completed after " << glfwGetTime() << " s");
+                // the reports are written directly on the console: we wait for the messages sent before them
+                Logger::Instance().Flush();
+                textureLoader.PrintTimeline();
+                memoryReport = GL_TRUE;
+                // after the loading, the old files of the program cache are removed in the background (see N.B. 4 in program_cache.h)
+                scheduler.Submit("program cache compaction", programCache.CompactionTask(), TASK_PRIORITY_LOW);
+            }
+
+            // the mipmap levels of the planet textures are selected using the projected size of the planets in the previous frame
+            // (when the virtual texture or the cube-sphere texture of a planet is used, only the tail of its texture is needed)
+            for (size_t i = 0; i < planetMips.size(); i++)
+            {
+                GLboolean replaced = virtualTextures.Ready(virtualTextureIDs[i]) || (frame.cubeSphereTextures && planetCubes[i].Resident());
+                mipStreamer.Request(planetMips[i], replaced ? 0.0f : lodStates[i].pixelSize);
+            }
+            mipStreamer.Update();
+            for (size_t i = 0; i < planetMips.size(); i++)
+                textureID[i].texture = mipStreamer.Texture(planetMips[i]);
+            // the pages requested by the feedback of the previous frames are loaded and uploaded
+            virtualTextures.Update();
+            // we execute the steps of the background tasks, until the time budget of the frame is spent
+            scheduler.Update();
+            // the lists of the point lights of the clusters are built (in parallel, by the job system) and uploaded
+            clusteredLights.Build(frame.pointLights, view, projection);
+            clusteredLights.Upload();
+
+            // the memory report is printed when the streaming is completed, and then every time the M key is pressed
+            if (memoryReport)
+            {
+                Logger::Instance().Flush();
+                PrintMemoryReport({
+                    { "cube", &cubeModel.Get() }, { "sun", &sunModel }, { "mercury", &mercuryModel }, { "venus", &venusModel },
+                    { "earth", &earthModel }, { "mars", &marsModel }, { "jupiter", &jupiterModel }, { "saturn", &saturnModel.Get() },
+                    { "uranus", &uranusModel }, { "neptune", &neptuneModel } });
+                mipStreamer.PrintStats();
+                virtualTextures.PrintStats();
+                ImportLog::Instance().PrintReport();
+                ResourceRegistry::Instance().PrintReport(resourceReportSize);
+            }
+            // the histogram of the frame times (since the last report) is printed when the H key is pressed
+            if (frame.frameReport)
+            {
+                Logger::Instance().Flush();
+                frameHistogram.Print("Frame times");
+                scheduler.PrintStats();
+                renderGraph.PrintStats();
+                clusteredLights.PrintStats();
+                frameHistogram.Reset();
+            }
+            // the records of all the resources are saved in a JSON file when the J key is pressed
+            if (frame.resourceDump)
+            {
+                if (ResourceRegistry::Instance().DumpJSON(resourceDumpPath))
+                    LOG_INFO("", "Resources saved in " << resourceDumpPath);
+            }
+
+            trianglesSubmitted = 0;
+
+            // we set the rendering mode
+            if (frame.wireframe)
+                // Draw in wireframe
+                glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+            else
+                glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+            // the frame is a render graph (see render_graph.h) with four passes: the scene, the feedback of the virtual textures and its read back, and the skybox.
+            // The default framebuffer is imported in the graph: the scene pass clears the frame and z buffer
+            renderGraph.Reset();
+            RGResource backbuffer = renderGraph.ImportBackbuffer("backbuffer", (GLuint)width, (GLuint)height);
+            // the buffers of the clustered lights are read by the scene pass (they are written by the CPU, without barriers)
+            vector<RGResource> lightBuffers;
+            if (clusteredLights.Storage())
+            {
+                lightBuffers.push_back(renderGraph.ImportBuffer("point lights", clusteredLights.Buffer(CLUSTER_LIGHTS_BINDING)));
+                lightBuffers.push_back(renderGraph.ImportBuffer("light clusters", clusteredLights.Buffer(CLUSTER_GRID_BINDING)));
+                lightBuffers.push_back(renderGraph.ImportBuffer("light indices", clusteredLights.Buffer(CLUSTER_INDICES_BINDING)));
+            }
+
+            /////////////////// SCENE ////////////////////////////////////////////////
+            renderGraph.AddPass("scene", [&](RenderGraphBuilder& builder)
+            {
+                builder.Write(backbuffer, RG_COLOR_ATTACHMENT, RG_LOAD_CLEAR);
+                builder.Write(backbuffer, RG_DEPTH_ATTACHMENT, RG_LOAD_CLEAR);
+                builder.SetClearColor(glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+                for (RGResource buffer : lightBuffers)
+                    builder.Read(buffer, RG_STORAGE_BUFFER);
+            }, [&](RenderGraphContext&)
+            {
+            // we select the variant of the illumination shader: the current lighting model, and the texturing code used in this frame
+            GLuint variantKey = frame.lightingModel << LIGHTING_MODEL_SHIFT;
+            if (virtualTextures.AnyReady())
+                variantKey |= VIRTUAL_TEXTURING_BIT;
+            if (frame.cubeSphereTextures)
+                variantKey |= CUBE_SPHERE_BIT;
+            Shader& illumination_shader = illumination_variants.Get(variantKey);
+            const PlanetUniforms& uniforms = planetUniforms(illumination_shader.Program);
+            const PlanetUniforms& sunUniforms = planetUniforms(sun_shader.Program);
+
+            // we bind the cube-sphere texture of a planet, if it is resident and activated (otherwise, the 2D texture is used)
+            auto bindCubeSphere = [&](GLuint planet)
+            {
+                GLboolean used = frame.cubeSphereTextures && planetCubes[planet].Resident();
+                glActiveTexture(GL_TEXTURE0 + CUBE_SPHERE_TEXTURE_UNIT);
+                glBindTexture(GL_TEXTURE_CUBE_MAP, used ? planetCubes[planet].Get() : 0);
+                glActiveTexture(GL_TEXTURE0);
+                glUniform1i(uniforms.cubeSphere, used);
+            };
+
+            //////////SUN///////////
+            sun_shader.Use();
+
+            // Bind the texture
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, textureID[0].Get());
+
+            // Set transformation matrices for the sun
+            glUniformMatrix4fv(sunUniforms.projectionMatrix, 1, GL_FALSE, glm::value_ptr(projection));
+            glUniformMatrix4fv(sunUniforms.viewMatrix, 1, GL_FALSE, glm::value_ptr(view));
+            glUniform1i(sunUniforms.tex, 0);
+            glUniform1f(sunUniforms.repeat, 1.0f);
+            glUniformMatrix4fv(sunUniforms.modelMatrix, 1, GL_FALSE, glm::value_ptr(frame.modelMatrices[0]));
+
+            UpdateLOD(lodStates[0], sunModel, frame.modelMatrices[0], view, projection, (GLfloat)height, frame.deltaTime, frame.lodSettings);
+            trianglesSubmitted += DrawModelLOD(sunModel, lodStates[0], sunUniforms.lodFade);
+
+            /////////////PLANETS////////////
+            illumination_shader.Use();
+
+            // the uniforms shared by all the planets
+            glUniformMatrix4fv(uniforms.projectionMatrix, 1, GL_FALSE, glm::value_ptr(projection));
+            glUniformMatrix4fv(uniforms.viewMatrix, 1, GL_FALSE, glm::value_ptr(view));
+            glUniform1f(uniforms.Ka, Ka);
+            glUniform1f(uniforms.Kd, Kd);
+            glUniform1f(uniforms.Ks, Ks);
+            glUniform1i(uniforms.tex, 0);
+            glUniform1f(uniforms.repeat, 1.0f);
+            // parameters of the GGX model
+            glUniform1f(uniforms.alpha, alpha);
+            glUniform1f(uniforms.F0, F0);
+            // the positions of the NR_LIGHTS lights (the sun), with a single call; the point lights are shaded by cluster (see clustered_lights.h)
+            glUniform3fv(uniforms.lights, NR_LIGHTS, glm::value_ptr(lightPositions[0]));
+            clusteredLights.Bind(illumination_shader.Program, (GLuint)width, (GLuint)height);
+
+            // the planets, with the same index of the textureID vector (model, LOD state, matrices and textures)
+            for (GLuint planet = 1; planet < planetModels.size(); planet++)
+            {
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, textureID[planet].Get());
+                bindCubeSphere(planet);
+
+                glUniformMatrix4fv(uniforms.modelMatrix, 1, GL_FALSE, glm::value_ptr(frame.modelMatrices[planet]));
+                glUniformMatrix3fv(uniforms.normalMatrix, 1, GL_FALSE, glm::value_ptr(frame.normalMatrices[planet]));
+
+                // the planets with a virtual texture use it, if it is ready
+                const GLboolean virtualTexture = (virtualTextureIDs[planet] >= 0);
+                if (virtualTexture)
+                    virtualTextures.Bind(virtualTextureIDs[planet], illumination_shader.Program);
+                Model& model = planetModel(planet);
+                UpdateLOD(lodStates[planet], model, frame.modelMatrices[planet], view, projection, (GLfloat)height, frame.deltaTime, frame.lodSettings);
+                trianglesSubmitted += DrawModelLOD(model, lodStates[planet], uniforms.lodFade);
+                if (virtualTexture)
+                    virtualTextures.Unbind(illumination_shader.Program);
+            }
+            });
+
+            /////////////////// VIRTUAL TEXTURES FEEDBACK ////////////////////////////
+            // the planets with virtual textures are drawn in the feedback framebuffer, to find the pages needed (read back in the next frames).
+            // The attachments of the feedback are transient textures of the graph (see N.B. 7 in virtual_texture.h): the color is read
+            // back by the next pass, while the depth is used only by this pass, so its physical texture is free after it
+            GLuint feedbackWidth, feedbackHeight;
+            virtualTextures.FeedbackSize((GLuint)width, (GLuint)height, feedbackWidth, feedbackHeight);
+            RGResource feedbackColor;
+            renderGraph.AddPass("virtual textures feedback", [&](RenderGraphBuilder& builder)
+            {
+                feedbackColor = builder.Create("feedback color", { feedbackWidth, feedbackHeight, VT_FEEDBACK_FORMAT });
+                RGResource feedbackDepth = builder.Create("feedback depth", { feedbackWidth, feedbackHeight, VT_FEEDBACK_DEPTH_FORMAT });
+                builder.Write(feedbackColor, RG_COLOR_ATTACHMENT, RG_LOAD_CLEAR);
+                builder.Write(feedbackDepth, RG_DEPTH_ATTACHMENT, RG_LOAD_CLEAR);
+                builder.SetClearColor(glm::vec4(0.0f));
+            }, [&](RenderGraphContext&)
+            {
+            virtualTextures.BeginFeedback(feedback_shader.Program);
+            glUniformMatrix4fv(glGetUniformLocation(feedback_shader.Program, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projection));
+            glUniformMatrix4fv(glGetUniformLocation(feedback_shader.Program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
+            for (const pair<GLuint, string>& source : virtualTextureSources)
+            {
+                const GLuint planet = source.first;
+                if (!virtualTextures.Bind(virtualTextureIDs[planet], feedback_shader.Program))
+                    continue;
+                glUniformMatrix4fv(glGetUniformLocation(feedback_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(frame.modelMatrices[planet]));
+                DrawModelLOD(planetModel(planet), lodStates[planet], -1);
+            }
+            });
+            // the read back of the feedback is used outside the graph (by the VirtualTextureSystem, in the next frames): the pass is never culled.
+            // The framebuffer of the pass has the feedback color as attachment, and glReadPixels reads it
+            renderGraph.AddPass("virtual textures read back", [&](RenderGraphBuilder& builder)
+            {
+                builder.Read(feedbackColor, RG_COLOR_ATTACHMENT);
+                builder.SideEffect();
+            }, [&](RenderGraphContext& context)
+            {
+            virtualTextures.ReadBackFeedback(context.Width(feedbackColor), context.Height(feedbackColor));
+            });
+
+            /////////////////// SKYBOX ////////////////////////////////////////////////
+            // the skybox pass uses the depth buffer of the scene, without writing it
+            renderGraph.AddPass("skybox", [&](RenderGraphBuilder& builder)
+            {
+                builder.Read(backbuffer, RG_DEPTH_ATTACHMENT);
+                builder.Write(backbuffer, RG_COLOR_ATTACHMENT);
+            }, [&](RenderGraphContext&)
+            {
+            // we use the cube to attach the 6 textures of the environment map.
+            // we render it after all the other objects, in order to avoid the depth tests as much as possible.
+            // we will set, in the vertex shader for the skybox, all the values to the maximum depth. Thus, the environment map is rendered only where there are no other objects in the image (so, only on the background).
+            //Thus, we set the depth test to GL_LEQUAL, in order to let the fragments of the background pass the depth test (because they have the maximum depth possible, and the default setting is GL_LESS)
+            glDepthFunc(GL_LEQUAL);
+            skybox_shader.Use();
+        
+             // we pass projection and view matrices to the Shader Program of the skybox
+            glUniformMatrix4fv(glGetUniformLocation(skybox_shader.Program, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projection));
+            // to have the background fixed during camera movements, we have to remove the translations from the view matrix
+            // thus, we consider only the top-left submatrix, and we create a new 4x4 matrix
+            view = glm::mat4(glm::mat3(view)); // Remove any translation component of the view matrix
+            glUniformMatrix4fv(glGetUniformLocation(skybox_shader.Program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
+
+            // we activate the cube map of the environment
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, textureCube.Get());
+            // we determine the position in the Shader Program of the uniform variables
+            GLint textureLocation = glGetUniformLocation(skybox_shader.Program, "tCube");
+            // we assign the value to the uniform variable
+            glUniform1i(textureLocation, 0);
+
+            // we render the cube with the environment map
+            trianglesSubmitted += cubeModel.Get().Draw();
+            // we set again the depth test to the default operation for the next frame
+            glDepthFunc(GL_LESS);
+            });
+
+            // we execute the passes of the frame
+            renderGraph.Execute();
+
+            // Swapping back and front buffers (the submit time does not include the wait of the swap)
+            submitMicroseconds += (GLuint64)((glfwGetTime() - submitStart) * 1000000.0);
+            glfwSwapBuffers(window);
+            renderedTriangles += trianglesSubmitted;
+            renderedFrames++;
+
+            if (firstFrame)
+            {
+                LOG_INFO("", "First frame after " << glfwGetTime() << " s");
+                firstFrame = GL_FALSE;
+            }
+        }
+        renderGraph.Release();
+        glfwMakeContextCurrent(nullptr);
+    });
+
+   // the packet of the frames is kept between the frames: Push gives back an old packet, so its vector of the lights is reused
+    // (see N.B. 1 in frame_queue.h)
+    FramePacket frame;
+   // Main loop: this code is executed at each frame, to prepare the frame rendered by the render thread
     while(!glfwWindowShouldClose(window))
     { 
         
@@ -311,20 +960,11 @@ int main()
 
         // Check is an I/O event is happening
         glfwPollEvents();
+
         // we apply FPS camera movements
         apply_camera_movements();
         // View matrix (=camera): position, view direction, camera "up" vector
-        view = camera.GetViewMatrix();
-
-        // we "clear" the frame and z buffer
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        // we set the rendering mode
-        if (wireframe)
-            // Draw in wireframe
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        else
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        glm::mat4 view = camera.GetViewMatrix();
 
         // if animated rotation is activated, than we increment the rotation angle using delta time and the rotation speed parameter
         if (spinning)
@@ -349,85 +989,11 @@ int main()
           angleNeptune = currentFrame * spin_speedNeptune;
 
 
-        illumination_shader.Use();
-          
-        /////////////////// PLANE ////////////////////////////////////////////////
-   
-
-    // We search inside the Shader Program the name of the subroutine, and we get the numerical index
-    GLuint index = glGetSubroutineIndex(illumination_shader.Program, GL_FRAGMENT_SHADER, "BlinnPhong_ML_TX");
-    // We activate the subroutine using the index (this is where shaders swapping happens)
-    glUniformSubroutinesuiv(GL_FRAGMENT_SHADER, 1, &index);
-
-    // We determine the position in the Shader Program of the uniform variables
-   
-    GLint textureLocation = glGetUniformLocation(illumination_shader.Program, "tex");
-    GLint textureLoc = glGetUniformLocation(sun_shader.Program, "tex");
-    GLint repeatLocation = glGetUniformLocation(illumination_shader.Program, "repeat");
-    GLint repeatLoc = glGetUniformLocation(sun_shader.Program, "repeat");
-    GLint matAmbientLocation = glGetUniformLocation(illumination_shader.Program, "ambientColor");
-    GLint matSpecularLocation = glGetUniformLocation(illumination_shader.Program, "specularColor");
-    GLint kaLocation = glGetUniformLocation(illumination_shader.Program, "Ka");
-    GLint kdLocation = glGetUniformLocation(illumination_shader.Program, "Kd");
-    GLint ksLocation = glGetUniformLocation(illumination_shader.Program, "Ks");
-    GLint shineLocation = glGetUniformLocation(illumination_shader.Program, "shininess");
-    //GLint alphaLocation = glGetUniformLocation(illumination_shader.Program, "alpha");
-
-
-    for (GLuint i = 0; i < NR_LIGHTS; i++)
-        {
-            string number = to_string(i);
-            glUniform3fv(glGetUniformLocation(illumination_shader.Program, ("lights[" + number + "]").c_str()), 1, glm::value_ptr(lightPositions[i]));
-        }
-       ////////////////// OBJECT ////////////////////////////////////////////////
-        // we activate the cube map
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureCube);
-
-
-        // we pass projection and view matrices to the Shader Program
-       glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projection));
-       glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
-
-
-    //////////SUN///////////
-        sun_shader.Use();
-       
-        
-        
-        // Bind the texture
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID[0]);
-
-        // Set transformation matrices for the sun
-        glUniformMatrix4fv(glGetUniformLocation(sun_shader.Program, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(sun_shader.Program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniform1i(textureLoc, 0);
-        glUniform1f(repeatLoc, 1.0f);
-
+        // transformations of the sun and of the planets
         sunModelMatrix = glm::mat4(1.0f);
         sunNormalMatrix = glm::mat3(1.0f);
-        
         sunModelMatrix = glm::rotate(sunModelMatrix, glm::radians(orientationYSun), glm::vec3(0.0f, 1.0f, 0.0f));
         sunModelMatrix = glm::scale(sunModelMatrix, glm::vec3(1.5f, 1.5f, 1.5f));
-        
-        glUniformMatrix4fv(glGetUniformLocation(sun_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(sunModelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(sun_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(sunNormalMatrix));
-   
-        sunModel.Draw();
-
-       /////////////MERCURY////////////
-        illumination_shader.Use();
-        // Activate the texture with id 1, and bind the id to our loaded texture data
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID[1]);
-
-        // Set uniform variables for the shader
-        glUniform1f(kaLocation, Ka);
-        glUniform1f(kdLocation, Kd);
-        glUniform1f(ksLocation, Ks);
-        glUniform1i(textureLocation, 0);
-        glUniform1f(repeatLocation, 1.0f);
 
         mercuryModelMatrix = glm::mat4(1.0f);
         mercuryNormalMatrix = glm::mat3(1.0f);
@@ -437,27 +1003,6 @@ int main()
         mercuryModelMatrix = glm::scale(mercuryModelMatrix, glm::vec3(0.1596f, 0.1596f, 0.1596f)); // Scale relative to the sun
         mercuryNormalMatrix = glm::inverseTranspose(glm::mat3(view * mercuryModelMatrix));
 
-        
-        // Set the transformation matrices for the shader
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(mercuryModelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(illumination_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(mercuryNormalMatrix));
-
-        // Draw the Mercury model
-        mercuryModel.Draw();
-
-       /////////////VENUS////////////
-        // Activate the texture with id 1, and bind the id to our loaded texture data
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID[2]);
-
-        // Set uniform variables for the shader
-        glUniform1f(kaLocation, Ka);
-        glUniform1f(kdLocation, Kd);
-        glUniform1f(ksLocation, Ks);
-        glUniform1i(textureLocation, 0);
-        glUniform1f(repeatLocation, 1.0f);
-
-        // Venus transformation
         venusModelMatrix = glm::mat4(1.0f);
         venusNormalMatrix = glm::mat3(1.0f);
         venusModelMatrix = glm::rotate(venusModelMatrix, glm::radians(orientationYVenus), glm::vec3(0.0f, 1.0f, 0.0f));//orient orbit
@@ -465,90 +1010,23 @@ int main()
         venusModelMatrix = glm::rotate(venusModelMatrix, angleVenus, glm::vec3(0.0f, 1.0f, 0.0f)); // Planet's own rotation
         venusModelMatrix = glm::scale(venusModelMatrix, glm::vec3(0.399f, 0.399f, 0.399f));
         venusNormalMatrix = glm::inverseTranspose(glm::mat3(view * venusModelMatrix));
-        
-        // Set the transformation matrices for the shader
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(venusModelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(illumination_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(venusNormalMatrix));
 
-        
-        // Draw the Venus model
-        venusModel.Draw();
-
-         /////////////EARTH////////////
-        // Activate the texture with id 1, and bind the id to our loaded texture data
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID[3]);
-
-        // Set uniform variables for the shader
-        glUniform1f(kaLocation, Ka);
-        glUniform1f(kdLocation, Kd);
-        glUniform1f(ksLocation, Ks);
-        glUniform1i(textureLocation, 0);
-        glUniform1f(repeatLocation, 1.0f);
-
-        // Earth transformation
         earthModelMatrix = glm::mat4(1.0f);
         earthNormalMatrix = glm::mat3(1.0f);
-        
         earthModelMatrix = glm::rotate(earthModelMatrix, glm::radians(orientationYEarth), glm::vec3(0.0f, 1.0f, 0.0f)); //orient orbit angle around the sun
         earthModelMatrix = glm::translate(earthModelMatrix, glm::vec3(orbitRadiusEarth, 0.0f, 0.0f)); //move earth to orbit of radius
-        earthModelMatrix = glm::rotate(earthModelMatrix, angleEarth, glm::vec3(0.0f, 1.0f, 0.0f)); // Rotate around itself       
+        earthModelMatrix = glm::rotate(earthModelMatrix, angleEarth, glm::vec3(0.0f, 1.0f, 0.0f)); // Rotate around itself
         earthModelMatrix = glm::scale(earthModelMatrix, glm::vec3(0.42f, 0.42f, 0.42f)); // Scale relative to the sun
         earthNormalMatrix = glm::inverseTranspose(glm::mat3(view * earthModelMatrix));
 
-        
-        // Set the transformation matrices for the shader
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(earthModelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(illumination_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(earthNormalMatrix));
-
-        
-        // Draw the Earth model
-        earthModel.Draw();
-
-
-        /////////////MARS////////////
-        // Activate the texture with id 1, and bind the id to our loaded texture data
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID[4]);
-
-        // Set uniform variables for the shader
-        glUniform1f(kaLocation, Ka);
-        glUniform1f(kdLocation, Kd);
-        glUniform1f(ksLocation, Ks);
-        glUniform1i(textureLocation, 0);
-        glUniform1f(repeatLocation, 1.0f);
-
-        // Mars transformation
         marsModelMatrix = glm::mat4(1.0f);
-        marsNormalMatrix = glm::mat3(1.0f); 
+        marsNormalMatrix = glm::mat3(1.0f);
         marsModelMatrix = glm::rotate(marsModelMatrix, glm::radians(orientationYMars), glm::vec3(0.0f, 1.0f, 0.0f));
         marsModelMatrix = glm::translate(marsModelMatrix, glm::vec3(orbitRadiusMars, 0.0f, 0.0f));
         marsModelMatrix = glm::rotate(marsModelMatrix, angleMars, glm::vec3(0.0f, 1.0f, 0.0f)); // Planet's own rotation
         marsModelMatrix = glm::scale(marsModelMatrix, glm::vec3(0.4446f, 0.4446f, 0.4446f)); // Scale relative to the sun
         marsNormalMatrix = glm::inverseTranspose(glm::mat3(view * marsModelMatrix));
 
-        
-        // Set the transformation matrices for the shader
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(marsModelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(illumination_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(marsNormalMatrix));
-
-        // Draw the Mars model
-        marsModel.Draw();
-
-
-        /////////////JUPITER////////////
-        // Activate the texture with id 1, and bind the id to our loaded texture data
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID[5]);
-
-        // Set uniform variables for the shader
-        glUniform1f(kaLocation, Ka);
-        glUniform1f(kdLocation, Kd);
-        glUniform1f(ksLocation, Ks);
-        glUniform1i(textureLocation, 0);
-        glUniform1f(repeatLocation, 1.0f);
-
-        // Jupiter transformation
         jupiterModelMatrix = glm::mat4(1.0f);
         jupiterNormalMatrix = glm::mat3(1.0f);
         jupiterModelMatrix = glm::rotate(jupiterModelMatrix, glm::radians(orientationYJupiter), glm::vec3(0.0f, 1.0f, 0.0f));
@@ -557,63 +1035,15 @@ int main()
         jupiterModelMatrix = glm::scale(jupiterModelMatrix, glm::vec3(0.90f, 0.9f, 0.9f)); // Scale relative to the sun
         jupiterNormalMatrix = glm::inverseTranspose(glm::mat3(view * jupiterModelMatrix));
 
-        
-        // Set the transformation matrices for the shader
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(jupiterModelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(illumination_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(jupiterNormalMatrix));
-
-        
-        // Draw the Jupiter model
-        jupiterModel.Draw();
-
-
-        /////////////SATURN///////////
-        // Activate the texture with id 1, and bind the id to our loaded texture data
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID[6]);
-
-        // Set uniform variables for the shader
-        glUniform1f(kaLocation, Ka);
-        glUniform1f(kdLocation, Kd);
-        glUniform1f(ksLocation, Ks);
-        glUniform1i(textureLocation, 0);
-        glUniform1f(repeatLocation, 1.0f);
-        // Saturn transformation
-        
         saturnModelMatrix = glm::mat4(1.0f);
         saturnNormalMatrix = glm::mat3(1.0f);
-       
-        saturnModelMatrix = glm::rotate(saturnModelMatrix,glm::radians(90.0f),glm::vec3(1.0f, 0.0f, 0.0f)); 
+        saturnModelMatrix = glm::rotate(saturnModelMatrix,glm::radians(90.0f),glm::vec3(1.0f, 0.0f, 0.0f));
         saturnModelMatrix = glm::rotate(saturnModelMatrix, glm::radians(orientationYSaturn), glm::vec3(0.0f, 0.0f, -1.0f)); //orient orbit angle around the sun
         saturnModelMatrix = glm::translate(saturnModelMatrix, glm::vec3(orbitRadiusSaturn, 0.0f, 0.0f)); //move planet to orbit radius
         saturnModelMatrix = glm::rotate(saturnModelMatrix, angleSaturn, glm::vec3(0.0f, 0.0f, 1.0f)); //rotate around itself
         saturnModelMatrix = glm::scale(saturnModelMatrix, glm::vec3(0.004f,0.004f,0.004f)); // Scale relative to the sun
         saturnNormalMatrix = glm::inverseTranspose(glm::mat3(view * saturnModelMatrix));
 
-        // Set the transformation matrices for the shader
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(saturnModelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(illumination_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(saturnNormalMatrix));
-        
-        
-        // Draw the Saturn model
-        saturnModel.Draw();
-
-
-
-
-         /////////////URANUS////////////
-        // Activate the texture with id 7, and bind the id to our loaded texture data
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID[7]);
-
-        // Set uniform variables for the shader
-        glUniform1f(kaLocation, Ka);
-        glUniform1f(kdLocation, Kd);
-        glUniform1f(ksLocation, Ks);
-        glUniform1i(textureLocation, 0);
-        glUniform1f(repeatLocation, 1.0f);
-
-        // Uranus transformation
         uranusModelMatrix = glm::mat4(1.0f);
         uranusNormalMatrix = glm::mat3(1.0f);
         uranusModelMatrix = glm::rotate(uranusModelMatrix, glm::radians(orientationYUranus), glm::vec3(0.0f, 1.0f, 0.0f));
@@ -622,26 +1052,6 @@ int main()
         uranusModelMatrix = glm::scale(uranusModelMatrix, glm::vec3(0.70f, 0.7f, 0.7f)); // Scale relative to the sun
         uranusNormalMatrix = glm::inverseTranspose(glm::mat3(view * uranusModelMatrix));
 
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(uranusModelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(illumination_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(uranusNormalMatrix));
-
-        // Draw the Uranus model
-        uranusModel.Draw();
-
-
-         /////////////NEPTUNE////////////
-        // Activate the texture with id 8, and bind the id to our loaded texture data
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID[8]);
-
-        // Set uniform variables for the shader
-        glUniform1f(kaLocation, Ka);
-        glUniform1f(kdLocation, Kd);
-        glUniform1f(ksLocation, Ks);
-        glUniform1i(textureLocation, 0);
-        glUniform1f(repeatLocation, 1.0f);
-
-        // Neptune transformation
         neptuneModelMatrix = glm::mat4(1.0f);
         neptuneNormalMatrix = glm::mat3(1.0f);
         neptuneModelMatrix = glm::rotate(neptuneModelMatrix, glm::radians(orientationYNeptune), glm::vec3(0.0f, 1.0f, 0.0f)); //orient orbit angle around the sun
@@ -650,210 +1060,585 @@ int main()
         neptuneModelMatrix = glm::scale(neptuneModelMatrix, glm::vec3(0.65f, 0.65f, 0.65f)); // Scale relative to the sun
         neptuneNormalMatrix = glm::inverseTranspose(glm::mat3(view * neptuneModelMatrix));
 
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(neptuneModelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(illumination_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(neptuneNormalMatrix));
-
-        // Activate or deactivate the texture
-        glUniform1i(glGetUniformLocation(illumination_shader.Program, "useTexture"), true);
-
-        // Draw the Neptune model
-        neptuneModel.Draw();
-
-
-        /////////////////// SKYBOX ////////////////////////////////////////////////
-        // we use the cube to attach the 6 textures of the environment map.
-        // we render it after all the other objects, in order to avoid the depth tests as much as possible.
-        // we will set, in the vertex shader for the skybox, all the values to the maximum depth. Thus, the environment map is rendered only where there are no other objects in the image (so, only on the background).
-        //Thus, we set the depth test to GL_LEQUAL, in order to let the fragments of the background pass the depth test (because they have the maximum depth possible, and the default setting is GL_LESS)
-        glDepthFunc(GL_LEQUAL);
-        skybox_shader.Use();
-        
-         // we pass projection and view matrices to the Shader Program of the skybox
-        glUniformMatrix4fv(glGetUniformLocation(skybox_shader.Program, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projection));
-        // to have the background fixed during camera movements, we have to remove the translations from the view matrix
-        // thus, we consider only the top-left submatrix, and we create a new 4x4 matrix
-        view = glm::mat4(glm::mat3(view)); // Remove any translation component of the view matrix
-        glUniformMatrix4fv(glGetUniformLocation(skybox_shader.Program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
-
-        // we determine the position in the Shader Program of the uniform variables
-        textureLocation = glGetUniformLocation(skybox_shader.Program, "tCube");
-        // we assign the value to the uniform variable
-        glUniform1i(textureLocation, 0);
-
-        // we render the cube with the environment map
-        cubeModel.Draw();
-        // we set again the depth test to the default operation for the next frame
-        glDepthFunc(GL_LESS);
-
-        // Swapping back and front buffers
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-
+        // we send the frame to the render thread, with the options of the frame (the globals changed by the key callback
+        // are copied: the render thread does not read them)
+        frame.deltaTime = deltaTime;
+        frame.view = view;
+        frame.modelMatrices = { sunModelMatrix, mercuryModelMatrix, venusModelMatrix, earthModelMatrix, marsModelMatrix,
+                                jupiterModelMatrix, saturnModelMatrix, uranusModelMatrix, neptuneModelMatrix };
+        frame.normalMatrices = { sunNormalMatrix, mercuryNormalMatrix, venusNormalMatrix, earthNormalMatrix, marsNormalMatrix,
+                                 jupiterNormalMatrix, saturnNormalMatrix, uranusNormalMatrix, neptuneNormalMatrix };
+        frame.lightingModel = current_model;
+        frame.wireframe = wireframe;
+        frame.cubeSphereTextures = cubeSphereTextures;
+        frame.lodSettings = lodSettings;
+        frame.memoryReport = memoryReportRequested;
+        frame.resourceDump = resourceDumpRequested;
+        frame.frameReport = frameReportRequested;
+        // the point lights orbit around the sun (around the Y axis), while the animation is active
+        if (spinning)
+            lightsTime += deltaTime;
+        // the lights are copied in the vector of the recycled packet: its memory is reused, so after the first frames there are no allocations
+        frame.pointLights.assign(stationLights.begin(), stationLights.end());
+        for (size_t i = 0; i < stationLights.size(); i++)
+        {
+            GLfloat angle = lightsTime * stationSpeeds[i];
+            const glm::vec3& position = stationLights[i].position;
+            frame.pointLights[i].position = glm::vec3(position.x * cos(angle) - position.z * sin(angle), position.y, position.x * sin(angle) + position.z * cos(angle));
+        }
+        memoryReportRequested = GL_FALSE;
+        resourceDumpRequested = GL_FALSE;
+        frameReportRequested = GL_FALSE;
+        prepareSinceStats += (glfwGetTime() - currentFrame) * 1000.0;
+        // if the render thread is FRAME_QUEUE_SIZE frames behind, we wait for it
+        frameQueue.Push(frame);
+        framesSinceStats++;
+
+        // we show the number of triangles submitted per frame, the frame rate, and the CPU time to prepare and to submit a frame in the window title
+        if (currentFrame - lastStatsTime >= 0.5f)
+        {
+            GLuint frames = renderedFrames.load();
+            GLuint64 triangles = renderedTriangles.load(), submit = submitMicroseconds.load();
+            GLuint rendered = max(frames - lastStatsFrames, 1u);
+            std::ostringstream title;
+            title << "try - " << (triangles - lastStatsTriangles) / rendered << " triangles/frame - "
+                  << (int)(rendered / (currentFrame - lastStatsTime)) << " fps - prepare " << std::fixed << std::setprecision(2)
+                  << prepareSinceStats / max(framesSinceStats, 1u) << " ms, submit " << (submit - lastStatsSubmit) / 1000.0 / rendered
+                  << " ms - LOD " << (lodSettings.enabled ? "on" : "off");
+            glfwSetWindowTitle(window, title.str().c_str());
+            lastStatsTime = currentFrame;
+            lastStatsFrames = frames;
+            lastStatsTriangles = triangles;
+            lastStatsSubmit = submit;
+            prepareSinceStats = 0.0;
+            framesSinceStats = 0;
+        }
     }
-    illumination_shader.Delete();
+    // the last packet stops the render thread, and the context is current again in this thread for the cleanup
+    FramePacket last;
+    last.quit = GL_TRUE;
+    frameQueue.Push(last);
+    renderThread.join();
+    glfwMakeContextCurrent(window);
+
+    clusteredLights.Release();
+    illumination_variants.Delete();
     sun_shader.Delete();
+    feedback_shader.Delete();
     // when I exit from the graphics loop, it is because the application is closing
     // we delete the Shader Program
     skybox_shader.Delete();
+    // we stop the streaming (the assets not yet loaded are discarded), the texture loader thread, and we delete its context
+    streamer.Shutdown();
+    mipStreamer.Shutdown();
+    virtualTextures.Shutdown();
+    textureLoader.Shutdown();
     // we close and delete the created context
     glfwTerminate();
     return 0;
 }
 
-///////////////////////////////////////////
-// load one side of the cubemap, passing the name of the file and the side of the corresponding OpenGL cubemap
-void LoadTextureCubeSide(string path, string side_image, GLuint side_name)
+//////////////////////////////////////////
+// we print on console the name of the currently used lighting model
+void PrintCurrentShader(int model)
 {
-    int w, h;
-    unsigned char* image;
-    string fullname;
-
-    // full name and path of the side of the cubemap
-    fullname = path + side_image;
-    // we load the image file
-    image = stbi_load(fullname.c_str(), &w, &h, 0, STBI_rgb);
-    if (image == nullptr)
-        std::cout << "Failed to load texture!" << std::endl;
-    // we set the image file as one of the side of the cubemap (passed as a parameter)
-    glTexImage2D(side_name, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-    // we free the memory once we have created an OpenGL texture
-    stbi_image_free(image);
+    LOG_INFO("", "Current lighting model: " << lightingModels[model]);
 }
 
+//////////////////////////////////////////
+// we bake the textures in block-compressed formats, with the chain of mipmaps (the cube map has no mipmaps)
+// The baked textures are saved next to the source images, and they are used by the TextureLoader in the next executions.
+// Then, we bake the cube-sphere textures (see cube_reprojection.h) and the virtual textures of the planets (see virtual_texture.h)
+int BakeTextures()
+{
+    GLboolean success = GL_TRUE;
+    vector<string> cubeMapPaths;
+    for (const string& face : cubeMapFaces)
+        cubeMapPaths.push_back(cubeMapFolder + face);
+    LOG_INFO("", "Baking " << BakedTexturePath(cubeMapPaths));
+    success &= BakeTexture(cubeMapPaths, BAKE_BC1, false);
+    for (const pair<string, BakeFormat>& texture : planetTextures)
+    {
+        LOG_INFO("", "Baking " << BakedTexturePath({ texture.first }));
+        success &= BakeTexture({ texture.first }, texture.second, true);
+    }
+    for (GLuint planet : cubeSpherePlanets)
+    {
+        LOG_INFO("", "Baking " << CubeSphereTexturePath(planetTextures[planet].first));
+        success &= BakeCubeSphereTexture(planetTextures[planet].first, planetTextures[planet].second);
+    }
+    for (const pair<GLuint, string>& source : virtualTextureSources)
+    {
+        LOG_INFO("", "Baking " << VirtualTexturePath(source.second));
+        success &= BakeVirtualTexture(source.second, BAKE_BC1);
+    }
+    return success ? 0 : -1;
+}
 
 //////////////////////////////////////////
-// we load the 6 images from disk and we create an OpenGL cube map
-GLint LoadTextureCube(string path)
+// we bake the compressed meshes (with their LODs) of the models loaded from file, with the simplification settings used to stream them.
+// The .cmesh files are saved next to the models, and they are loaded instead of the models in the next executions (see mesh_compression.h)
+int BakeModels()
 {
-    GLuint textureImage;
-
-    // we create and activate the OpenGL cubemap texture
-    glGenTextures(1, &textureImage);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureImage);
-
-    // we load and set the 6 images corresponding to the 6 views of the cubemap
-    // we use as convention that the names of the 6 images are "posx, negx, posy, negy, posz, negz", placed at the path passed as parameter
-    // we load the images individually and we assign them to the correct sides of the cube map
-    LoadTextureCubeSide(path, std::string("nx.png"), GL_TEXTURE_CUBE_MAP_POSITIVE_X);
-    LoadTextureCubeSide(path, std::string("ny.png"), GL_TEXTURE_CUBE_MAP_NEGATIVE_X);
-    LoadTextureCubeSide(path, std::string("nz.png"), GL_TEXTURE_CUBE_MAP_POSITIVE_Y);
-    LoadTextureCubeSide(path, std::string("px.png"), GL_TEXTURE_CUBE_MAP_NEGATIVE_Y);
-    LoadTextureCubeSide(path, std::string("pz.png"), GL_TEXTURE_CUBE_MAP_POSITIVE_Z);
-    LoadTextureCubeSide(path, std::string("py.png"), GL_TEXTURE_CUBE_MAP_NEGATIVE_Z);
-
-    // we set the filtering for minification and magnification
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    // we set how to consider the texture coordinates outside [0,1] range
-    // in this case we have a cube map, so
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-    // we set the binding to 0 once we have finished
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-
-    return textureImage;
+    GLboolean success = GL_TRUE;
+    const SimplifySettings settings;
+    for (const string& path : { cubeModelPath, saturnModelPath })
+    {
+        LOG_INFO("", "Baking " << CompressedMeshPath(path));
+        // the previous .cmesh file is removed, so the meshes are not quantized again: the LODs are read from the mesh cache, or they are generated
+        filesystem::remove(CompressedMeshPath(path));
+        vector<MeshData> meshes;
+        if (!Model::LoadMeshesData(path, settings, meshes) || !BakeCompressedMeshes(path, settings, meshes))
+            success = GL_FALSE;
+    }
+    return success ? 0 : -1;
+}
 
+//////////////////////////////////////////
+// we pack in a single file the assets used by the application: models, source images, and (if present) baked textures, mesh caches and compressed meshes.
+// Names in the pack are relative to the root folder of the repository, where the pack is mounted
+int PackAssets()
+{
+    const string root = "../../";
+    vector<string> candidates = { "models/cube.obj", "models/saturn.obj", "models/cube.obj.meshcache", "models/saturn.obj.meshcache",
+                                  "models/cube.obj.cmesh", "models/saturn.obj.cmesh" };
+    vector<string> texturePaths;
+    for (const string& face : cubeMapFaces)
+        texturePaths.push_back(cubeMapFolder + face);
+    texturePaths.push_back(BakedTexturePath(texturePaths));
+    for (const pair<string, BakeFormat>& texture : planetTextures)
+    {
+        texturePaths.push_back(texture.first);
+        texturePaths.push_back(BakedTexturePath({ texture.first }));
+        texturePaths.push_back(CubeSphereTexturePath(texture.first));
+    }
+    for (const string& path : texturePaths)
+        candidates.push_back(path.substr(root.size()));
+
+    // baked textures, mesh caches and compressed meshes are optional
+    vector<string> names;
+    for (const string& name : candidates)
+        if (filesystem::exists(root + name))
+            names.push_back(name);
+    return BuildAssetPack(root + "assets.pack", root, names) ? 0 : -1;
 }
 
-///////////////////////////////////////////
-// The function parses the content of the Shader Program, searches for the Subroutine type names,
-// the subroutines implemented for each type, print the names of the subroutines on the terminal, and add the names of
-// the subroutines to the shaders vector, which is used for the shaders swapping
-void SetupShader(int program)
+//////////////////////////////////////////
+// for each model, we compare bytes read from disk and loading time of: the OBJ file (loaded by Assimp), the mesh cache,
+// and the compressed mesh files (see mesh_compression.h) with two quantization settings. For the compressed files, we print also the
+// maximum position error, relative to the size of the bounding box.
+// The compressed files of the benchmark are temporary: the .cmesh files loaded by the application are baked with the "--bake" argument
+int BenchModels()
 {
-    int maxSub,maxSubU,countActiveSU;
-    GLchar name[256];
-    int len, numCompS;
-
-    // global parameters about the Subroutines parameters of the system
-    glGetIntegerv(GL_MAX_SUBROUTINES, &maxSub);
-    glGetIntegerv(GL_MAX_SUBROUTINE_UNIFORM_LOCATIONS, &maxSubU);
-    std::cout << "Max Subroutines:" << maxSub << " - Max Subroutine Uniforms:" << maxSubU << std::endl;
-
-    // get the number of Subroutine uniforms (only for the Fragment shader, due to the nature of the exercise)
-    // it is possible to add similar calls also for the Vertex shader
-    glGetProgramStageiv(program, GL_FRAGMENT_SHADER, GL_ACTIVE_SUBROUTINE_UNIFORMS, &countActiveSU);
-
-    // print info for every Subroutine uniform
-    for (int i = 0; i < countActiveSU; i++) {
-
-        // get the name of the Subroutine uniform (in this example, we have only one)
-        glGetActiveSubroutineUniformName(program, GL_FRAGMENT_SHADER, i, 256, &len, name);
-        // print index and name of the Subroutine uniform
-        std::cout << "Subroutine Uniform: " << i << " - name: " << name << std::endl;
-
-        // get the number of subroutines
-        glGetActiveSubroutineUniformiv(program, GL_FRAGMENT_SHADER, i, GL_NUM_COMPATIBLE_SUBROUTINES, &numCompS);
-
-        // get the indices of the active subroutines info and write into the array s
-        int *s =  new int[numCompS];
-        glGetActiveSubroutineUniformiv(program, GL_FRAGMENT_SHADER, i, GL_COMPATIBLE_SUBROUTINES, s);
-        std::cout << "Compatible Subroutines:" << std::endl;
-
-        // for each index, get the name of the subroutines, print info, and save the name in the shaders vector
-        for (int j=0; j < numCompS; ++j) {
-            glGetActiveSubroutineName(program, GL_FRAGMENT_SHADER, s[j], 256, &len, name);
-            std::cout << "\t" << s[j] << " - " << name << "\n";
-            shaders.push_back(name);
+    const vector<string> models = { "../../models/earth.obj", "../../models/saturn.obj" };
+    MeshQuantization lowQuantization;
+    lowQuantization.positionBits = 11;
+    lowQuantization.normalBits = 8;
+    lowQuantization.texCoordBits = 10;
+    lowQuantization.tangentBits = 6;
+    SimplifySettings settings;
+
+    auto elapsed = [](chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    };
+    auto fileSize = [](const string& path)
+    {
+        uint64_t size = 0;
+        int64_t time;
+        AssetSystem::Instance().GetFileInfo(path, size, time);
+        return size;
+    };
+    auto printRow = [](const string& format, uint64_t bytes, double ms, const string& notes)
+    {
+        std::cout << "  " << std::left << std::setw(12) << format << std::right << std::setw(10) << bytes / 1024 << " KB"
+                  << std::setw(10) << std::fixed << std::setprecision(2) << ms << " ms  " << notes << std::endl;
+    };
+
+    for (const string& path : models)
+    {
+        std::cout << path << std::endl;
+
+        // OBJ file, loaded by Assimp
+        vector<MeshData> meshes;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!Model::ImportMeshes(path, meshes))
+            return -1;
+        printRow("OBJ", fileSize(path), elapsed(start), "");
+
+        // mesh cache (the LODs are generated, and the cache is written if it is not valid)
+        vector<MeshData> cached;
+        if (!LoadMeshCache(path, settings, cached))
+        {
+            for (MeshData& mesh : meshes)
+                BuildLODChain(mesh, settings);
+            SaveMeshCache(path, settings, meshes);
+        }
+        else
+            meshes = cached;
+        start = chrono::steady_clock::now();
+        if (LoadMeshCache(path, settings, cached))
+            printRow("mesh cache", fileSize(MeshCachePath(path)), elapsed(start), "");
+
+        // compressed meshes, with the default and a lower quantization
+        const vector<pair<string, MeshQuantization>> variants = { { path + ".bench.cmesh", MeshQuantization() }, { path + ".bench.low.cmesh", lowQuantization } };
+        for (const pair<string, MeshQuantization>& variant : variants)
+        {
+            if (!SaveCompressedMeshes(variant.first, meshes, variant.second))
+                return -1;
+            vector<MeshData> decoded;
+            start = chrono::steady_clock::now();
+            if (!LoadCompressedMeshes(variant.first, decoded))
+                return -1;
+            double ms = elapsed(start);
+
+            // maximum position error, relative to the diagonal of the bounding box of each mesh
+            GLfloat maxError = 0.0f;
+            for (size_t m = 0; m < meshes.size(); m++)
+            {
+                glm::vec3 minP(FLT_MAX), maxP(-FLT_MAX);
+                for (const Vertex& v : meshes[m].vertices)
+                {
+                    minP = glm::min(minP, v.Position);
+                    maxP = glm::max(maxP, v.Position);
+                }
+                GLfloat diagonal = max(glm::length(maxP - minP), 1e-6f);
+                for (size_t i = 0; i < meshes[m].vertices.size(); i++)
+                    maxError = max(maxError, glm::length(decoded[m].vertices[i].Position - meshes[m].vertices[i].Position) / diagonal);
+            }
+            const MeshQuantization& q = variant.second;
+            std::ostringstream notes;
+            notes << "bits " << q.positionBits << "/" << q.normalBits << "/" << q.texCoordBits << "/" << q.tangentBits
+                  << ", max position error " << std::scientific << std::setprecision(2) << maxError;
+            printRow((&variant == &variants[0]) ? "CMESH" : "CMESH low", fileSize(variant.first), ms, notes.str());
+            filesystem::remove(variant.first);
         }
-        std::cout << std::endl;
+    }
+    return 0;
+}
 
-        delete[] s;
+//////////////////////////////////////////
+// we measure the cost of an empty job: in the job system (see job_system.h), with Run and with ParallelFor, and in the thread pool
+// (see thread_pool.h). Then, we measure the scaling of a CPU-bound loop (the update of the matrices of many objects, like the
+// planets of the scene) with 1, 2, 4, ... threads, up to the number of hardware threads
+int BenchJobs()
+{
+    const size_t NUM_JOBS = 100000;
+    const size_t NUM_OBJECTS = 1 << 20;
+    const int REPETITIONS = 5;
+    const unsigned int hw = max(thread::hardware_concurrency(), 1u);
+
+    auto elapsed = [](chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    };
+    auto printRow = [](const string& name, double ms, double ns, const string& unit)
+    {
+        std::cout << "  " << std::left << std::setw(24) << name << std::right << std::setw(10) << std::fixed << std::setprecision(2) << ms << " ms"
+                  << std::setw(10) << std::setprecision(1) << ns << " ns/" << unit << std::endl;
+    };
+
+    // empty jobs
+    JobSystem& jobs = JobSystem::Instance();
+    std::cout << "empty jobs: " << NUM_JOBS << ", " << jobs.Size() << " workers + the calling thread" << std::endl;
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        JobCounter counter;
+        for (size_t i = 0; i < NUM_JOBS; i++)
+            jobs.Run(counter, [] {});
+        jobs.Wait(counter);
+        double ms = elapsed(start);
+        printRow("JobSystem Run", ms, ms * 1e6 / NUM_JOBS, "job");
+    }
+    {
+        // the range is divided adaptively: the cost is per iteration, not per job
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        jobs.ParallelFor(NUM_JOBS, [](size_t, size_t) {});
+        double ms = elapsed(start);
+        printRow("JobSystem ParallelFor", ms, ms * 1e6 / NUM_JOBS, "iteration");
+    }
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<future<void>> futures;
+        futures.reserve(NUM_JOBS);
+        for (size_t i = 0; i < NUM_JOBS; i++)
+            futures.push_back(ThreadPool::Instance().Submit([] {}));
+        for (future<void>& f : futures)
+            f.get();
+        double ms = elapsed(start);
+        printRow("ThreadPool Submit", ms, ms * 1e6 / NUM_JOBS, "job");
     }
+
+    // update of the model and normal matrices of the objects
+    vector<glm::mat4> modelMatrices(NUM_OBJECTS);
+    vector<glm::mat3> normalMatrices(NUM_OBJECTS);
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 10.0f, 30.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    auto updateObjects = [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3((GLfloat)(i % 1024), 0.0f, (GLfloat)(i / 1024)));
+            model = glm::rotate(model, glm::radians((GLfloat)(i % 360)), glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::scale(model, glm::vec3(0.5f));
+            modelMatrices[i] = model;
+            normalMatrices[i] = glm::inverseTranspose(glm::mat3(view * model));
+        }
+    };
+
+    std::cout << "update of " << NUM_OBJECTS << " objects (best of " << REPETITIONS << "), " << hw << " hardware threads" << std::endl;
+    if (hw == 1)
+        LOG_WARNING("JOBS", "only one hardware thread: the scaling cannot be measured");
+    vector<unsigned int> threadCounts;
+    for (unsigned int threads = 1; threads < hw; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(hw);
+    double serial = 0.0;
+    for (unsigned int threads : threadCounts)
+    {
+        // with a single thread, the loop is executed without the job system
+        unique_ptr<JobSystem> system = (threads > 1) ? make_unique<JobSystem>(threads - 1) : nullptr;
+        double best = DBL_MAX;
+        for (int r = 0; r < REPETITIONS; r++)
+        {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            if (system)
+                system->ParallelFor(NUM_OBJECTS, updateObjects);
+            else
+                updateObjects(0, NUM_OBJECTS);
+            best = min(best, elapsed(start));
+        }
+        if (threads == 1)
+            serial = best;
+        const double speedup = serial / best;
+        std::cout << "  " << std::setw(3) << threads << " threads" << std::setw(10) << std::fixed << std::setprecision(2) << best << " ms"
+                  << "  speedup " << std::setprecision(2) << speedup << "x, efficiency " << std::setprecision(0) << 100.0 * speedup / threads << "%" << std::endl;
+    }
+    return 0;
 }
 
+//////////////////////////////////////////
+// we measure the building of the lists of the clusters (see clustered_lights.h) with an increasing number of lights, placed randomly
+// in front of the camera, and the number of lights shaded by each fragment compared to all the lights. Then we check that the lists
+// are conservative: for random points in the view frustum, all the lights reaching the point must be in the list of its cluster
+int BenchLights()
+{
+    const GLuint LIGHT_COUNTS[] = { 256, 1024, 4096, 16384 };
+    const int REPETITIONS = 20;
+    const GLuint NUM_POINTS = 100000;
+
+    const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 1000.0f);
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 5.0f, 40.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::mat4 inverseView = glm::inverse(view);
+    mt19937 random(42);
+    uniform_real_distribution<GLfloat> unit(0.0f, 1.0f);
+    int result = 0;
+    std::cout << "clusters " << CLUSTER_X << "x" << CLUSTER_Y << "x" << CLUSTER_Z << ", " << JobSystem::Instance().Size() << " workers + the calling thread" << std::endl;
+    for (GLuint count : LIGHT_COUNTS)
+    {
+        // the lights are in a box of 80 x 20 x 80 around the origin (like the orbits of the planets)
+        vector<PointLight> lights(count);
+        for (PointLight& light : lights)
+        {
+            light.position = glm::vec3(80.0f * unit(random) - 40.0f, 20.0f * unit(random) - 10.0f, 80.0f * unit(random) - 40.0f);
+            light.radius = 0.5f + 1.5f * unit(random);
+        }
+        ClusteredLights clusters(true);
+        double best = DBL_MAX;
+        for (int r = 0; r < REPETITIONS; r++)
+        {
+            clusters.Build(lights, view, projection);
+            best = min(best, clusters.BuildMs());
+        }
 
+        // we check the list of the cluster of random points in the view frustum (until 150 units from the camera)
+        GLuint missing = 0;
+        for (GLuint i = 0; i < NUM_POINTS; i++)
+        {
+            GLfloat depth = 0.1f + 150.0f * unit(random);
+            glm::vec3 position((2.0f * unit(random) - 1.0f) * depth / projection[0][0], (2.0f * unit(random) - 1.0f) * depth / projection[1][1], -depth);
+            vector<GLuint> cluster = clusters.LightsAt(position);
+            glm::vec3 world = glm::vec3(inverseView * glm::vec4(position, 1.0f));
+            for (GLuint light = 0; light < count; light++)
+                if (glm::length(lights[light].position - world) < lights[light].radius && find(cluster.begin(), cluster.end(), light) == cluster.end())
+                    missing++;
+        }
+        std::cout << "  " << std::setw(6) << count << " lights (" << std::setw(5) << clusters.VisibleLights() << " visible): build "
+                  << std::fixed << std::setprecision(3) << best << " ms, " << std::setw(6) << clusters.References() << " references, "
+                  << std::setprecision(2) << (double)clusters.References() / max(clusters.LitClusters(), 1u) << " lights per lit cluster (max "
+                  << clusters.MaxLightsPerCluster() << ")" << std::endl;
+        if (missing > 0)
+        {
+            LOG_ERROR("LIGHTS", missing << " lights missing from the clusters with " << count << " lights");
+            result = -1;
+        }
+    }
+    return result;
+}
 
-GLint LoadTexture(const char* path)
+//////////////////////////////////////////
+// we build a graph similar to a frame with shadows and bloom (see render_graph.h), with the passes recording only the clears of their
+// attachments, and we check: the culling of a pass whose output is never read (also if the pass declares more writes of it), the aliasing of the transient textures of the bloom,
+// the barriers after the writes in storage, the reuse of the pool in the next frame, and the color of the final image (the texture of
+// the last blur pass, which shares its physical texture with the first one, copied in the default framebuffer)
+const GLuint RG_TEST_SIZE = 64;
+
+int RenderGraphTest()
 {
-    GLuint textureImage;
-    int w, h, channels;
-    unsigned char* image;
-    image = stbi_load(path, &w, &h, &channels, STBI_rgb);
-
-    if (image == nullptr)
-        std::cout << "Failed to load texture!" << std::endl;
-
-    glGenTextures(1, &textureImage);
-    glBindTexture(GL_TEXTURE_2D, textureImage);
-    // 3 channels = RGB ; 4 channel = RGBA
-    if (channels==3)
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-    else if (channels==4)
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    // we set how to consider UVs outside [0,1] range
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // we set the filtering for minification and magnification
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST_MIPMAP_NEAREST);
-
-    // we free the memory once we have created an OpenGL texture
-    stbi_image_free(image);
-
-    // we set the binding to 0 once we have finished
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    return textureImage;
+    // a context 4.5 (4.1 if not available), with a hidden window
+    glfwInit();
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+    GLFWwindow* window = glfwCreateWindow(RG_TEST_SIZE, RG_TEST_SIZE, "render graph test", nullptr, nullptr);
+    if (!window)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+        window = glfwCreateWindow(RG_TEST_SIZE, RG_TEST_SIZE, "render graph test", nullptr, nullptr);
+    }
+    if (!window)
+    {
+        LOG_ERROR("RENDER_GRAPH", "Failed to create the OpenGL context");
+        glfwTerminate();
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        LOG_ERROR("RENDER_GRAPH", "Failed to initialize OpenGL context");
+        glfwTerminate();
+        return -1;
+    }
+    GLBackend::Instance().Init(true);
 
+    int result = 0;
+    auto check = [&result](bool condition, const string& message)
+    {
+        if (!condition)
+        {
+            LOG_ERROR("RENDER_GRAPH", message);
+            result = -1;
+        }
+    };
+    const RGTextureDesc full = { RG_TEST_SIZE, RG_TEST_SIZE, GL_RGBA16F }, half = { RG_TEST_SIZE / 2, RG_TEST_SIZE / 2, GL_RGBA16F };
+    const RGTextureDesc depthDesc = { RG_TEST_SIZE, RG_TEST_SIZE, GL_DEPTH_COMPONENT24 };
+    GLuint copyFramebuffer = 0;
+    glGenFramebuffers(1, &copyFramebuffer);
+    RenderGraph graph;
+    GLuint pooled = 0;
+    for (int frame = 0; frame < 2 && result == 0; frame++)
+    {
+        graph.Reset();
+        RGResource backbuffer = graph.ImportBackbuffer("backbuffer", RG_TEST_SIZE, RG_TEST_SIZE);
+        RGResource shadowMap, hdr, depth, bright, blurX, blurY, particles;
+        auto nothing = [](RenderGraphContext&) {};
+        graph.AddPass("shadow map", [&](RenderGraphBuilder& builder)
+        {
+            shadowMap = builder.Write(builder.Create("shadow map", depthDesc), RG_DEPTH_ATTACHMENT, RG_LOAD_CLEAR);
+        }, nothing);
+        graph.AddPass("scene", [&](RenderGraphBuilder& builder)
+        {
+            builder.Read(shadowMap);
+            hdr = builder.Write(builder.Create("hdr", full), RG_COLOR_ATTACHMENT, RG_LOAD_CLEAR);
+            depth = builder.Write(builder.Create("depth", depthDesc), RG_DEPTH_ATTACHMENT, RG_LOAD_CLEAR);
+            builder.SetClearColor(glm::vec4(0.25f, 0.5f, 0.75f, 1.0f));
+        }, nothing);
+        // its output is never read: the pass is culled. The output is written both as attachment and with image store,
+        // and it is counted once in the reference count of the pass
+        graph.AddPass("debug view", [&](RenderGraphBuilder& builder)
+        {
+            builder.Read(depth);
+            RGResource debugView = builder.Create("debug view", { RG_TEST_SIZE, RG_TEST_SIZE, GL_RGBA8 });
+            builder.Write(debugView, RG_COLOR_ATTACHMENT, RG_LOAD_CLEAR);
+            builder.Write(debugView, RG_STORAGE_IMAGE);
+        }, nothing);
+        // bloom: "blur y" can use the physical texture of "bright", which is not used after "blur x"
+        graph.AddPass("bright", [&](RenderGraphBuilder& builder)
+        {
+            builder.Read(hdr);
+            bright = builder.Write(builder.Create("bright", half), RG_COLOR_ATTACHMENT, RG_LOAD_CLEAR);
+            builder.SetClearColor(glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+        }, nothing);
+        graph.AddPass("blur x", [&](RenderGraphBuilder& builder)
+        {
+            builder.Read(bright);
+            blurX = builder.Write(builder.Create("blur x", half), RG_COLOR_ATTACHMENT, RG_LOAD_CLEAR);
+            builder.SetClearColor(glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
+        }, nothing);
+        graph.AddPass("blur y", [&](RenderGraphBuilder& builder)
+        {
+            builder.Read(blurX);
+            blurY = builder.Write(builder.Create("blur y", half), RG_COLOR_ATTACHMENT, RG_LOAD_CLEAR);
+            builder.SetClearColor(glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+        }, nothing);
+        // a write with image store (the pass does not execute it): the composite pass needs a barrier before sampling the texture
+        graph.AddPass("particles", [&](RenderGraphBuilder& builder)
+        {
+            particles = builder.Write(builder.Create("particles", { RG_TEST_SIZE, RG_TEST_SIZE, GL_RGBA8 }), RG_STORAGE_IMAGE);
+        }, nothing);
+        graph.AddPass("composite", [&](RenderGraphBuilder& builder)
+        {
+            builder.Read(hdr);
+            builder.Read(blurY);
+            builder.Read(particles);
+            builder.Write(backbuffer, RG_COLOR_ATTACHMENT, RG_LOAD_CLEAR);
+        }, [&](RenderGraphContext& context)
+        {
+            // we copy the result of the bloom in the default framebuffer (bound by the graph)
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, copyFramebuffer);
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, context.Texture(blurY), 0);
+            glBlitFramebuffer(0, 0, context.Width(blurY), context.Height(blurY), 0, 0, RG_TEST_SIZE, RG_TEST_SIZE, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        });
+
+        graph.Compile();
+        graph.Execute();
+        unsigned char center[4] = { 0, 0, 0, 0 };
+        glReadPixels(RG_TEST_SIZE / 2, RG_TEST_SIZE / 2, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, center);
+
+        // 7 transient textures in use (the one of the culled pass is not created), and "blur y" shares the texture of "bright"
+        check(graph.CulledPasses() == 1, "the debug view pass is not culled");
+        check(graph.TransientTextures() == 7, "wrong number of transient textures: " + to_string(graph.TransientTextures()));
+        check(graph.PhysicalTextures() == 6, "wrong number of physical textures: " + to_string(graph.PhysicalTextures()));
+        // in the next frame, "particles" also needs a barrier before writing again the texture written with image store in this frame
+        check(graph.Barriers() == ((frame == 0) ? 1u : 2u), "wrong number of barriers: " + to_string(graph.Barriers()));
+        check(center[0] == 0 && center[1] == 0 && center[2] == 255, "wrong color of the final image: " + to_string(center[0]) + " " + to_string(center[1]) + " " + to_string(center[2]));
+        check(frame == 0 || graph.PooledTextures() == pooled, "the textures of the pool are not reused in the next frame");
+        pooled = graph.PooledTextures();
+        const GLenum error = glGetError();
+        check(error == GL_NO_ERROR, "OpenGL error " + to_string(error));
+    }
+    graph.PrintStats();
+    graph.Release();
+    glDeleteFramebuffers(1, &copyFramebuffer);
+
+    LOG_INFO("RENDER_GRAPH", (result == 0 ? "test passed" : "test failed"));
+    glfwTerminate();
+    return result;
 }
 
 //////////////////////////////////////////
-// we print on console the name of the currently used shader subroutine
-void PrintCurrentShader(int subroutine)
+// we print on console the memory used by each model: CPU memory is the one still resident after the creation of the GPU buffers
+void PrintMemoryReport(const vector<pair<string, const Model*>>& models)
 {
-    std::cout << "Current shader subroutine: " << shaders[subroutine]  << std::endl;
+    size_t totalCPU = 0, totalGPU = 0;
+    std::cout << "Memory report (KB):" << std::endl;
+    for (const pair<string, const Model*>& model : models)
+    {
+        size_t cpu = model.second->CPUMemoryBytes(), gpu = model.second->GPUMemoryBytes();
+        std::cout << "  " << model.first << ": CPU " << cpu / 1024 << " - GPU " << gpu / 1024 << std::endl;
+        totalCPU += cpu;
+        totalGPU += gpu;
+    }
+    std::cout << "  total: CPU " << totalCPU / 1024 << " - GPU " << totalGPU / 1024 << std::endl;
 }
 
 //////////////////////////////////////////
 // callback for keyboard events
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode)
 {
-    GLuint new_subroutine;
+    GLuint new_model;
 
     // if ESC is pressed, we close the application
     if(key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
@@ -867,23 +1652,46 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     if(key == GLFW_KEY_L && action == GLFW_PRESS)
         wireframe=!wireframe;
 
-    // pressing a key number, we change the shader applied to the models
+    // if O is pressed, we activate/deactivate the LOD selection (if deactivated, the full resolution meshes are always used)
+    if(key == GLFW_KEY_O && action == GLFW_PRESS)
+        lodSettings.enabled=!lodSettings.enabled;
+
+    // if C is pressed, we activate/deactivate the cube-sphere textures of the planets
+    if(key == GLFW_KEY_C && action == GLFW_PRESS)
+    {
+        cubeSphereTextures=!cubeSphereTextures;
+        LOG_INFO("", "Cube-sphere textures: " << (cubeSphereTextures ? "on" : "off"));
+    }
+
+    // if M is pressed, we print the memory report of the models and of all the resources
+    if(key == GLFW_KEY_M && action == GLFW_PRESS)
+        memoryReportRequested=GL_TRUE;
+
+    // if J is pressed, we save the records of all the resources in a JSON file
+    if(key == GLFW_KEY_J && action == GLFW_PRESS)
+        resourceDumpRequested=GL_TRUE;
+
+    // if H is pressed, we print the histogram of the frame times and the statistics of the background tasks
+    if(key == GLFW_KEY_H && action == GLFW_PRESS)
+        frameReportRequested=GL_TRUE;
+
+    // pressing a key number, we change the lighting model applied to the models (= the variant of the shader)
     // if the key is between 1 and 9, we proceed and check if the pressed key corresponds to
-    // a valid subroutine
+    // a valid lighting model
     if((key >= GLFW_KEY_1 && key <= GLFW_KEY_9) && action == GLFW_PRESS)
     {
         // "1" to "9" -> ASCII codes from 49 to 59
         // we subtract 48 (= ASCII CODE of "0") to have integers from 1 to 9
         // we subtract 1 to have indices from 0 to 8
-        new_subroutine = (key-'0'-1);
-        // if the new index is valid ( = there is a subroutine with that index in the shaders vector),
-        // we change the value of the current_subroutine variable
-        // NB: we can just check if the new index is in the range between 0 and the size of the shaders vector,
+        new_model = (key-'0'-1);
+        // if the new index is valid ( = there is a lighting model with that index in the lightingModels vector),
+        // we change the value of the current_model variable (the variant is selected at the next frame)
+        // NB: we can just check if the new index is in the range between 0 and the size of the lightingModels vector,
         // avoiding to use the std::find function on the vector
-        if (new_subroutine<shaders.size())
+        if (new_model<lightingModels.size())
         {
-            current_subroutine = new_subroutine;
-            PrintCurrentShader(current_subroutine);
+            current_model = new_model;
+            PrintCurrentShader(current_model);
         }
     }
 
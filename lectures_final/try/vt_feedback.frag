@@ -0,0 +1,48 @@
+/*
+vt_feedback.frag: fragment shader of the feedback pass of virtual texturing (see virtual_texture.h in the main application)
+
+N.B. 1) "vt_feedback.vert" must be used as vertex shader
+
+N.B. 2) each fragment stores the page of the virtual texture needed to draw it: x and y of the page, level, and id of the virtual texture + 1
+(0 = no virtual texture in the pixel). The level of detail is calculated like in illumination_models_ML.frag, but the feedback framebuffer
+is smaller than the viewport, so the derivatives are larger: lodBias compensates for it
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+
+*/
+
+#version 410 core
+
+// output shader variable: the page needed by the fragment
+out uvec4 feedback;
+
+// interpolated texture coordinates
+in vec2 interp_UV;
+
+// texture repetitions
+uniform float repeat = 1.0;
+// number of pages of the level 0 (x, y), and number of levels (z)
+uniform ivec3 vtPages;
+// size of a page, border included (x), size of the border (y), size of the cache in pages (z)
+uniform vec3 vtPageLayout;
+// id of the virtual texture
+uniform uint vtId;
+// log2 of the ratio between the size of the viewport and of the feedback framebuffer (negated)
+uniform float lodBias;
+
+void main()
+{
+    vec2 uv = interp_UV * repeat;
+    vec2 texels = uv * vec2(vtPages.xy) * (vtPageLayout.x - 2.0 * vtPageLayout.y);
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float lod = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + lodBias, 0.0, float(vtPages.z - 1));
+    int level = int(lod);
+
+    // the page containing the fragment, in the level
+    uv = vec2(fract(uv.x), clamp(uv.y, 0.0, 0.99999));
+    ivec2 page = ivec2(uv * vec2(max(vtPages.xy >> level, ivec2(1))));
+    feedback = uvec4(page, level, vtId + 1u);
+}
@@ -0,0 +1,33 @@
+/*
+vt_feedback.vert: vertex shader of the feedback pass of virtual texturing (see virtual_texture.h in the main application)
+
+N.B. 1) "vt_feedback.frag" must be used as fragment shader
+
+Real-Time Graphics Programming - a.a. 2023/2024
+Master degree in Computer Science
+Universita' degli Studi di Milano
+
+*/
+
+#version 410 core
+
+// vertex position in world coordinates
+layout (location = 0) in vec3 position;
+// UV coordinates
+layout (location = 2) in vec2 UV;
+
+// model matrix
+uniform mat4 modelMatrix;
+// view matrix
+uniform mat4 viewMatrix;
+// Projection matrix
+uniform mat4 projectionMatrix;
+
+// texture coordinates (interpolated by rasterization)
+out vec2 interp_UV;
+
+void main()
+{
+    interp_UV = UV;
+    gl_Position = projectionMatrix * viewMatrix * modelMatrix * vec4(position, 1.0);
+}